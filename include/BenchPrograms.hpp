@@ -0,0 +1,49 @@
+#pragma once
+
+#include "CodeNodeNano.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// where the benchmarks look for the example programs by default
+#ifndef CNMCU_EXAMPLES_DIR
+#define CNMCU_EXAMPLES_DIR "examples"
+#endif
+
+// A ROM image for CodeNodeNano::ROM()
+struct BenchProgram
+{
+    std::string name;
+    std::vector<uint8_t> rom;
+};
+
+// Assembles the two example programs found in examplesDir and the
+// synthetic kernels shared by the benchmarks. Prints what went wrong to
+// stderr and returns false if any of them fails to assemble.
+bool loadBenchPrograms(const char* examplesDir, std::vector<BenchProgram>& programs);
+
+// Drives the input pins of node for the given tick on a fixed schedule,
+// so interrupt-driven programs have something to react to
+template <class Node>
+void driveBenchInputs(Node& node, uint64_t tick)
+{
+    uint8_t dir = *node.GPIO().dirData();
+    uint8_t levels[4] = {
+        0,
+        static_cast<uint8_t>((tick / 7) % 2 ? 15 : 0),
+        static_cast<uint8_t>((tick / 13) % 16),
+        static_cast<uint8_t>((tick / 11) % 2 ? 15 : 0),
+    };
+
+    for(int pin = 0; pin < 4; pin++)
+    {
+        if((dir & (1 << pin)) == 0)
+            node.GPIO().setPin(pin, levels[pin]);
+    }
+}
+
+// Prints sizeof(CodeNodeNano) and which cache lines each part of a node
+// spans, see CodeNodeNano::memoryLayout()
+void printNodeLayout(FILE* out);
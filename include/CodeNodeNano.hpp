@@ -1,20 +1,69 @@
 #pragma once
 
 #include <mos6502.h>
+#include <mos6502_jit.h>
 #include "GPIO.hpp"
 #include "RAM.hpp"
 #include "ROM.hpp"
 #include "Config.hpp"
 
-class CodeNodeNano
+#include <memory>
+#include <vector>
+
+// Which device answers each 256-byte page of a CodeNode's address space.
+// Built at compile time for each variant, see CodeNode::pageMap.
+template <size_t RAM_BYTES, size_t GPIO_PAGES, size_t ROM_BYTES>
+struct CodeNodePageMap
+{
+    enum Device : uint8_t
+    {
+        DEVICE_OPEN_BUS, // reads 0, ignores writes
+        DEVICE_RAM,
+        DEVICE_GPIO,
+        DEVICE_ROM,
+    };
+
+    Device device[256];
+
+    constexpr CodeNodePageMap() : device()
+    {
+        for(size_t page = 0; page < RAM_BYTES / 256; page++)
+            device[page] = DEVICE_RAM;
+        for(size_t page = 0x70; page < 0x70 + GPIO_PAGES; page++)
+            device[page] = DEVICE_GPIO;
+        for(size_t page = 256 - ROM_BYTES / 256; page < 256; page++)
+            device[page] = DEVICE_ROM;
+    }
+};
+
+// A Code Node MCU: PINS GPIO pins with their registers at $7000, RAM_BYTES
+// of RAM from $0000 and ROM_BYTES of ROM up to $FFFF, clocked at CLOCK_HZ.
+// Sizes are compile-time constants, so the memory map and the pin loops
+// are built for each variant. Member functions are defined in
+// CodeNodeNano.cpp, which instantiates the variants below; another one
+// needs its own instantiation there.
+//
+// Cache line aligned, see the member order below.
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+class alignas(64) CodeNode
 {
 public:
-    constexpr static size_t GPIO_NUM_PINS = 64; // Supports 64 pins, only 4 of which are used
-    constexpr static size_t RAM_SIZE = 512; // 512 bytes
-    constexpr static size_t ROM_SIZE = 8192; // 8 KB
-    constexpr static size_t CLOCK_FREQUENCY = GAME_TICK_RATE * 40; // 800 Hz
+    constexpr static size_t GPIO_NUM_PINS = PINS;
+    constexpr static size_t RAM_SIZE = RAM_BYTES;
+    constexpr static size_t ROM_SIZE = ROM_BYTES;
+    constexpr static size_t CLOCK_FREQUENCY = CLOCK_HZ;
+
+    static_assert(RAM_SIZE % 256 == 0 && ROM_SIZE % 256 == 0, "memories must fill whole pages");
+    static_assert(RAM_SIZE >= 0x200, "zero page and stack are handed to the CPU as RAM");
+    static_assert(RAM_SIZE <= 0x7000 &&
+        0x7000 + CNGPIO<PINS>::REGISTER_PAGES * 256 <= 0x10000 - ROM_SIZE,
+        "RAM, GPIO registers and ROM must not overlap");
+    static_assert(CLOCK_FREQUENCY % GAME_TICK_RATE == 0 && CLOCK_FREQUENCY > 0,
+        "the clock must run a whole number of cycles per game tick");
 
-    CodeNodeNano();
+    CodeNode();
+    CodeNode(CodeNode&& other);
+    CodeNode& operator=(CodeNode&& other);
 
     void tick();
     void cycle();
@@ -27,32 +76,188 @@ public:
     void resumeClock() { clockPaused = false; }
     bool isClockPaused() const { return clockPaused; }
     uint64_t numCycles() const { return cyclesCounter; }
+    // Runs ROM code as translated x86-64 where the host supports it, see
+    // mos6502_jit.h. Off by default, each node keeps its own code cache.
+    void setJitEnabled(bool enabled);
+    bool isJitEnabled() const { return jit != nullptr; }
 
+    // With tracing off, zero page and stack accesses skip the memory map
+    // and leave the bus latch below alone. On by default.
+    void setBusTracing(bool enabled) { busTracing = enabled; }
+    bool isBusTracing() const { return busTracing; }
     uint16_t busAddress() const { return m_busAddress; }
     uint8_t busData() const { return m_busData; }
     bool busRw() const { return m_busRw; }
 
+    // Everything that changes while the node runs, as plain bytes that
+    // can be copied, stored and compared as a whole: CPU state, RAM, GPIO
+    // registers and back buffer, cycle counters, bus latch and the power
+    // and clock flags. The ROM, JIT and bus tracing settings are not part
+    // of it, restore into a node running the same image. Fields are in
+    // host byte order.
+    constexpr static uint32_t SNAPSHOT_MAGIC = 0x4E4E4E43; // "CNNN"
+    constexpr static uint16_t SNAPSHOT_VERSION = 1;
+
+    // the fields every variant's Snapshot starts with
+    struct SnapshotHeader
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint8_t flags; // SNAPSHOT_* below
+        uint8_t busData;
+        uint64_t cyclesCounter;
+        uint64_t cyclesTarget;
+        uint16_t busAddress;
+        mos6502::State cpu;
+    };
+
+    // gpioBack is padded so a Snapshot never ends in padding bytes
+    constexpr static size_t SNAPSHOT_GPIO_OFFSET = sizeof(SnapshotHeader) + RAM_SIZE + CNGPIO<GPIO_NUM_PINS>::REGISTERS_SIZE;
+    constexpr static size_t SNAPSHOT_GPIO_BACK_SIZE = (SNAPSHOT_GPIO_OFFSET + GPIO_NUM_PINS + 7) / 8 * 8 - SNAPSHOT_GPIO_OFFSET;
+
+    struct Snapshot : SnapshotHeader
+    {
+        uint8_t ram[RAM_SIZE];
+        uint8_t gpioRegisters[CNGPIO<GPIO_NUM_PINS>::REGISTERS_SIZE];
+        uint8_t gpioBack[SNAPSHOT_GPIO_BACK_SIZE];
+    };
+    enum SnapshotFlags : uint8_t
+    {
+        SNAPSHOT_POWERED_ON = 0x01,
+        SNAPSHOT_CLOCK_PAUSED = 0x02,
+        SNAPSHOT_BUS_RW = 0x04,
+    };
+
+    void saveSnapshot(Snapshot& snapshot) const;
+    // false, leaving the node untouched, if the snapshot is not one
+    bool loadSnapshot(const Snapshot& snapshot);
+
+    // Delta snapshots hold the bytes of a Snapshot that changed since a
+    // base, as runs of new bytes between skipped unchanged ones, so a node
+    // that only touched a few zero page bytes costs a few dozen bytes.
+    // Each delta names the base it applies to by hash, deltas chain by
+    // applying them in order on top of a full snapshot.
+    constexpr static uint32_t DELTA_MAGIC = 0x444E4E43; // "CNND"
+    // dirty tracking granularity, 32 pages at most
+    constexpr static size_t RAM_PAGE_SIZE = RAM_SIZE / 32 > 32 ? RAM_SIZE / 32 : 32;
+    static void encodeDelta(const Snapshot& base, const Snapshot& current, std::vector<uint8_t>& delta);
+    // false, leaving snapshot untouched, if delta is malformed or made
+    // for another base
+    static bool applyDelta(Snapshot& snapshot, const uint8_t* delta, size_t size);
+
+    // The current state becomes the base of the next delta
+    void checkpoint();
+    bool hasCheckpoint() const { return lastCheckpoint != nullptr; }
+    // RAM pages (bit n covers RAM_PAGE_SIZE bytes from n * RAM_PAGE_SIZE)
+    // and GPIO registers changed since the last checkpoint, everything
+    // without one
+    uint32_t dirtyRamPages() const;
+    bool isGpioDirty() const;
+    // Appends the changes since the last checkpoint to delta and takes a
+    // new checkpoint. False without a checkpoint to start from.
+    bool saveDelta(std::vector<uint8_t>& delta);
+    // Leaves the checkpoint alone, call checkpoint() after restoring to
+    // keep saving deltas from the restored state
+    bool applyDelta(const uint8_t* delta, size_t size);
+
     mos6502& CPU();
     CNGPIO<GPIO_NUM_PINS>& GPIO();
     CNRAM<RAM_SIZE>& RAM();
+    // The ROM is predecoded on reset(), call it (or powerOn()) after
+    // loading a new image. ROM().load() shares the image with every other
+    // node running it, writing through ROM().data() gives this node its
+    // own copy, see CNROM.
     CNROM<ROM_SIZE>& ROM();
+    const CNROM<ROM_SIZE>& ROM() const { return rom; }
+
+    // Where the parts of a node sit inside it, for benchmarks and layout
+    // work. Offsets are from the start of the node.
+    struct LayoutEntry
+    {
+        const char* name;
+        size_t offset;
+        size_t size;
+    };
+    static std::vector<LayoutEntry> memoryLayout();
 private:
+    // Members are ordered by how often a running node touches them: the
+    // CPU and the clock, bus and power state every tick reads first, then
+    // the GPIO registers and RAM. What only reset, uploads and the tools
+    // use comes last, see memoryLayout().
     mos6502 cpu;
-    CNGPIO<GPIO_NUM_PINS> gpio;
-    CNRAM<RAM_SIZE> ram;
-    CNROM<ROM_SIZE> rom;
     uint64_t cyclesCounter;
     uint64_t cyclesTarget;
 
     uint16_t m_busAddress;
     uint8_t m_busData;
     bool m_busRw;
+    bool busTracing;
 
     bool poweredOn;
     bool clockPaused;
 
-    static CodeNodeNano* currentInstance;
-    static uint8_t read(uint16_t address);
-    static void write(uint16_t address, uint8_t value);
-    static void cycle(mos6502* cpu);
-};
\ No newline at end of file
+    // decodedROM's instructions, indexed by address - (0x10000 - ROM_SIZE)
+    const mos6502::DecodedInstr* decoded;
+
+    CNGPIO<GPIO_NUM_PINS> gpio;
+    CNRAM<RAM_SIZE> ram;
+
+    // cold from here on
+    CNROM<ROM_SIZE> rom;
+    // the image the JIT was bound to, it may move under ROM()
+    const uint8_t* mappedROM;
+
+    // ROM decoded once per image. Nodes running a shared image share its
+    // decoding too, a node with a private copy has its own.
+    std::shared_ptr<std::vector<mos6502::DecodedInstr>> decodedROM;
+    bool decodedShared;
+
+    std::unique_ptr<mos6502_jit> jit;
+
+    // base of the next delta, allocated by the first checkpoint()
+    std::unique_ptr<Snapshot> lastCheckpoint;
+
+    void syncROM();
+
+    // Memory map seen by the CPU, bound at compile time through
+    // mos6502::Run(bus, ...)
+    struct Bus
+    {
+        CodeNode& node;
+        uint8_t Read(uint16_t address) { return node.busRead(address); }
+        void Write(uint16_t address, uint8_t value) { node.busWrite(address, value); }
+        const mos6502::DecodedInstr* Decoded(uint16_t address) { return node.busDecoded(address); }
+        mos6502_jit* Jit() { return node.jit.get(); }
+        uint8_t* LowMemory() { return node.busTracing ? nullptr : node.ram.data(); }
+        // reads are free of side effects, polling loops may be skipped
+        const mos6502::DecodedInstr* Inspect(uint16_t address) { return node.decodedAt(address); }
+    };
+
+    // Memory map: RAM from 0, the GPIO register pages (zero past
+    // gpio.size()) from 0x7000 and the ROM at the top. Everything else
+    // reads 0 and ignores writes. One table per variant, shared by all
+    // its nodes, so an access is a single load and a switch.
+    typedef CodeNodePageMap<RAM_SIZE, CNGPIO<GPIO_NUM_PINS>::REGISTER_PAGES, ROM_SIZE> PageMap;
+    constexpr static PageMap pageMap = PageMap();
+    constexpr static uint16_t GPIO_BASE = 0x7000;
+    constexpr static uint16_t ROM_BASE = static_cast<uint16_t>(0x10000 - ROM_SIZE);
+    uint8_t busRead(uint16_t address);
+    void busWrite(uint16_t address, uint8_t value);
+    const mos6502::DecodedInstr* busDecoded(uint16_t address);
+    const mos6502::DecodedInstr* decodedAt(uint16_t address) const;
+
+    void predecodeROM();
+    void predecodeROM(size_t begin, size_t end);
+
+    static uint8_t read(void* context, uint16_t address);
+    static void write(void* context, uint16_t address, uint8_t value);
+    // GPIO writes from translated code, which stops while the line is up
+    static bool ioWrite(void* context, uint16_t address, uint8_t value);
+};
+
+// The node the mod ships: the 64-pin register file, 4 of them wired
+typedef CodeNode<64, 512, 8192, GAME_TICK_RATE * 40> CodeNodeNano;
+// Same memories with a 4-pin register file, packed into 8 bytes
+typedef CodeNode<4, 512, 8192, GAME_TICK_RATE * 40> CodeNodePico;
+// 8 KB of RAM, 16 KB of ROM and a 4 kHz clock for heavier logic
+typedef CodeNode<64, 0x2000, 0x4000, GAME_TICK_RATE * 200> CodeNodeMicro;
@@ -22,6 +22,14 @@ public:
         ANALOG_FALLING = 0x8,
         NO_CHANGE = 0x9
     };
+
+    // bytes of each register and of the register file: values, direction
+    // (a bit per pin), interrupt types (4 bits per pin) and flags (a bit
+    // per pin), partly used bytes rounded up
+    constexpr static size_t DIR_SIZE = (N + 7) / 8;
+    constexpr static size_t INT_SIZE = (N + 1) / 2;
+    constexpr static size_t IFL_SIZE = (N + 7) / 8;
+    constexpr static size_t REGISTERS_SIZE = N + DIR_SIZE + INT_SIZE + IFL_SIZE;
 private:
     constexpr static int GPIOPV = 0;
     constexpr static int GPIODIR = 1;
@@ -33,104 +41,180 @@ private:
         if(*address < N)
             return GPIOPV;// 0x0000
         *address -= N;
-        if(*address < N / 8) // 0x0040
+        if(*address < DIR_SIZE) // 0x0040
             return GPIODIR;
-        *address -= N / 8;
-        if(*address < N / 2) // 0x0048
+        *address -= DIR_SIZE;
+        if(*address < INT_SIZE) // 0x0048
             return GPIOINT;
-        *address -= N / 2;
-        if(*address < N / 8) // 0x0068
+        *address -= INT_SIZE;
+        if(*address < IFL_SIZE) // 0x0068
             return GPIOIFL;
-        *address -= N / 8;
+        *address -= IFL_SIZE;
         return -1;
     }
     
-    bool triggersInterrupt(IRQType type, uint8_t pv, uint8_t pvOld) const
+    // The register file in the order the CPU sees it, padded with zeros
+    // to whole 256-byte pages so a bus can read it as plain memory
+    struct Registers
+    {
+        uint8_t pvFront[N];
+        uint8_t dir[DIR_SIZE];
+        uint8_t interrupt[INT_SIZE];
+        uint8_t ifl[IFL_SIZE];
+        uint8_t padding[(REGISTERS_SIZE / 256 + 1) * 256 - REGISTERS_SIZE];
+    };
+
+    Registers registers;
+    uint8_t gpiopvBack[N];
+
+    // Pins by interrupt type, a bit per pin, rebuilt from the DIR and INT
+    // registers whenever they change. armedPins are the inputs with any
+    // interrupt type set, every other pin has its flag cleared each tick.
+    constexpr static size_t MASK_WORDS = (N + 63) / 64;
+    uint64_t pinsOfType[NO_CHANGE + 1][MASK_WORDS];
+    uint64_t armedPins[MASK_WORDS];
+    bool anyArmed;
+
+    // Pins whose front value may differ from the back one, only these are
+    // compared and copied. Every other pin holds the same value in both.
+    uint64_t dirtyPins[MASK_WORDS];
+    // Pins whose value changed from one swapBuffers() to the next
+    uint64_t changedPins[MASK_WORDS];
+    // Back values above 0, so unchanged pins need not be read
+    uint64_t highBackPins[MASK_WORDS];
+
+    // Bytes of a register as a word, byte 0 in the low bits on any host
+    static uint64_t loadWord(const uint8_t* bytes, size_t count)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes, count);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        return word;
+    }
+
+    static void storeWord(uint8_t* bytes, size_t count, uint64_t word)
     {
-        pv &= 0xF;
-        pvOld &= 0xF;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        memcpy(bytes, &word, count);
+    }
+
+    // The high bit of every byte gathered into the low 8 bits
+    static uint64_t gatherHighBits(uint64_t word)
+    {
+        return ((word & 0x8080808080808080ull) * 0x0002040810204081ull) >> 56;
+    }
+
+    // Eight pin values from pv on, their low nibbles in the bytes of a word
+    static uint64_t loadValues(const uint8_t* pv, size_t count)
+    {
+        return loadWord(pv, count) & 0x0F0F0F0F0F0F0F0Full;
+    }
+
+    // A bit for every byte of loadValues() above 0, values are below 0x10
+    // so no carry crosses a byte
+    static uint64_t nonZeroBytes(uint64_t values)
+    {
+        return gatherHighBits(values + 0x7F7F7F7F7F7F7F7Full);
+    }
 
-        switch(type)
+    void markDirty(size_t pin)
+    {
+        dirtyPins[pin / 64] |= 1ull << (pin % 64);
+    }
+
+    void updateInterruptMasks()
+    {
+        memset(pinsOfType, 0, sizeof(pinsOfType));
+        memset(armedPins, 0, sizeof(armedPins));
+        anyArmed = false;
+
+        for(size_t i = 0; i < N; i++)
         {
-            case LOW:
-                return pv == 0;
-            case HIGH:
-                return pv > 0;
-            case RISING:
-                return pv > 0 && pvOld == 0;
-            case FALLING:
-                return pv == 0 && pvOld > 0;
-            case CHANGE:
-                return pv > 0 != pvOld > 0;
-            case ANALOG_CHANGE:
-                return pv != pvOld;
-            case ANALOG_RISING:
-                return pv > pvOld;
-            case ANALOG_FALLING:
-                return pv < pvOld;
-            case NO_CHANGE:
-                return pv == pvOld;
-            default:
-                return false;
+            bool isInput = (registers.dir[i / 8] & (1 << (i % 8))) == 0;
+            uint8_t irqType = (registers.interrupt[i / 2] >> ((i % 2) * 4)) & 0xF;
+            if(!isInput || irqType == NO_INTERRUPT)
+                continue;
+
+            // unknown types keep their flag but never raise it
+            armedPins[i / 64] |= 1ull << (i % 64);
+            if(irqType <= NO_CHANGE)
+                pinsOfType[irqType][i / 64] |= 1ull << (i % 64);
+            anyArmed = true;
         }
     }
+    // rebuilds what is derived from the registers and back values after
+    // they were replaced wholesale
+    void registersChanged()
+    {
+        updateInterruptMasks();
 
-    uint8_t gpiopvFront[N];
-    uint8_t gpiopvBack[N];
-
-    uint8_t gpiodir[N / 8];
-    uint8_t gpioint[N / 2];
-    uint8_t gpioifl[N / 8];
+        memset(highBackPins, 0, sizeof(highBackPins));
+        for(size_t i = 0; i < N; i++)
+        {
+            if((gpiopvBack[i] & 0xF) != 0)
+                highBackPins[i / 64] |= 1ull << (i % 64);
+            markDirty(i);
+        }
+        memset(changedPins, 0, sizeof(changedPins));
+    }
 public:
+    constexpr static size_t REGISTER_PAGES = sizeof(Registers) / 256;
+
     void reset()
     {
-        memset(gpiopvFront, 0, N);
+        memset(&registers, 0, sizeof(Registers));
         memset(gpiopvBack, 0, N);
-        memset(gpiodir, 0, N / 8);
-        memset(gpioint, 0, N / 2);
-        memset(gpioifl, 0, N / 8);
+        registersChanged();
     }
 
     CNGPIO() { reset(); }
     CNGPIO(CNGPIO&& other) { *this = std::move(other); }
     CNGPIO& operator=(CNGPIO&& other)
     {
-        memcpy(gpiopvFront, other.gpiopvFront, N);
+        memcpy(&registers, &other.registers, sizeof(Registers));
         memcpy(gpiopvBack, other.gpiopvBack, N);
-        memcpy(gpiodir, other.gpiodir, N / 8);
-        memcpy(gpioint, other.gpioint, N / 2);
-        memcpy(gpioifl, other.gpioifl, N / 8);
+        memcpy(pinsOfType, other.pinsOfType, sizeof(pinsOfType));
+        memcpy(armedPins, other.armedPins, sizeof(armedPins));
+        anyArmed = other.anyArmed;
+        memcpy(dirtyPins, other.dirtyPins, sizeof(dirtyPins));
+        memcpy(changedPins, other.changedPins, sizeof(changedPins));
+        memcpy(highBackPins, other.highBackPins, sizeof(highBackPins));
         return *this;
     }
 
+    // Puts back size() register bytes and N back values saved from
+    // registerData() and pvBackData(), the only way to change them other
+    // than write() and setPin()
+    void restore(const uint8_t* registerBytes, const uint8_t* backValues)
+    {
+        memcpy(&registers, registerBytes, REGISTERS_SIZE);
+        memcpy(gpiopvBack, backValues, N);
+        registersChanged();
+    }
+
     size_t size() const
     {
-        return N + N / 8 + N / 2 + N / 8;
+        return REGISTERS_SIZE;
     }
 
-    uint8_t* pvFrontData() { return gpiopvFront; }
-    uint8_t* pvBackData() { return gpiopvBack; }
-    uint8_t* dirData() { return gpiodir; }
-    uint8_t* intData() { return gpioint; }
-    uint8_t* iflData() { return gpioifl; }
+    // REGISTER_PAGES pages laid out like the address space, see read()
+    const uint8_t* registerData() const { return reinterpret_cast<const uint8_t*>(&registers); }
+
+    const uint8_t* pvFrontData() const { return registers.pvFront; }
+    const uint8_t* pvBackData() const { return gpiopvBack; }
+    const uint8_t* dirData() const { return registers.dir; }
+    const uint8_t* intData() const { return registers.interrupt; }
+    const uint8_t* iflData() const { return registers.ifl; }
 
     uint8_t read(uint16_t address) const
     {
-        int buffer = mapAddress(&address);
-
-        switch(buffer)
-        {
-            case GPIOPV:
-                return gpiopvFront[address];
-            case GPIODIR:
-                return gpiodir[address];
-            case GPIOINT:
-                return gpioint[address];
-            case GPIOIFL:
-                return gpioifl[address];
-            default:
-                return 0;
-        }
+        return address < REGISTERS_SIZE
+            ? reinterpret_cast<const uint8_t*>(&registers)[address]
+            : 0;
     }
 
     void write(uint16_t address, uint8_t value)
@@ -142,23 +226,25 @@ public:
         switch(bufferID)
         {
             case GPIOPV:
-                isInput = (gpiodir[address / 8] & (1 << (address % 8))) == 0;
+                isInput = (registers.dir[address / 8] & (1 << (address % 8))) == 0;
                 if(isInput)
                     return;
-                gpiopvFront[address] = value;
+                setPin(address, value);
                 return;
             case GPIODIR:
-                gpiodir[address] = value;
+                registers.dir[address] = value;
+                updateInterruptMasks();
                 return;
             case GPIOINT:
-                gpioint[address] = value;
+                registers.interrupt[address] = value;
+                updateInterruptMasks();
                 return;
             case GPIOIFL:
-                for(int i = 0; i < 8; i++)
+                for(size_t i = 0; i < 8 && address * 8 + i < N; i++)
                 {
                     if((value & (1 << i)) == 0) continue;
 
-                    IRQType irqType = static_cast<IRQType>((gpioint[address * 4 + i / 2] >> ((i % 2) * 4)) & 0xF);
+                    IRQType irqType = static_cast<IRQType>((registers.interrupt[address * 4 + i / 2] >> ((i % 2) * 4)) & 0xF);
 
                     if(irqType == LOW || irqType == HIGH)
                     {
@@ -169,51 +255,141 @@ public:
                             continue;
                     }
 
-                    gpioifl[address] &= ~(1 << i);
+                    registers.ifl[address] &= ~(1 << i);
                 }
                 return;
         }
     }
 
+    // Drives a pin from outside, an input as the world sees it. Writing
+    // the value it already has costs the next tick nothing.
+    void setPin(size_t pin, uint8_t value)
+    {
+        if(registers.pvFront[pin] == value)
+            return;
+        registers.pvFront[pin] = value;
+        markDirty(pin);
+    }
+
+    // Whether the value of pin changed during the last tick, by the
+    // program or from outside
+    bool pinChanged(size_t pin) const
+    {
+        return (changedPins[pin / 64] >> (pin % 64)) & 1;
+    }
+
+    bool anyPinChanged() const
+    {
+        for(size_t w = 0; w < MASK_WORDS; w++)
+        {
+            if(changedPins[w] != 0)
+                return true;
+        }
+        return false;
+    }
+
     void tickInterrupts()
     {
         // Handle input interrupts
-        for(size_t i = 0; i < N; i++)
+        if(!anyArmed)
         {
-            bool isInput = (gpiodir[i / 8] & (1 << (i % 8))) == 0;
-            if(!isInput)
+            // nothing is armed, so no flag may stay set
+            memset(registers.ifl, 0, IFL_SIZE);
+            return;
+        }
+
+        for(size_t w = 0; w < MASK_WORDS; w++)
+        {
+            size_t base = w * 64;
+            size_t numPins = std::min<size_t>(N - base, 64);
+            size_t numFlagBytes = (numPins + 7) / 8;
+
+            // Clear interrupt flag when pin is not an input or has no interrupt
+            uint64_t flags = loadWord(registers.ifl + base / 8, numFlagBytes) & armedPins[w];
+            if(armedPins[w] == 0)
             {
-                gpioifl[i / 8] &= ~(1 << (i % 8)); // Clear interrupt flag when pin is not an input
+                storeWord(registers.ifl + base / 8, numFlagBytes, 0);
                 continue;
             }
-            IRQType irqType = static_cast<IRQType>((gpioint[i / 2] >> ((i % 2) * 4)) & 0xF);
-            if(irqType == NO_INTERRUPT)
+
+            // a bit per pin for each comparison of its value with the last
+            // tick's, eight pins at a time with their values in the bytes
+            // of a word. Pins that are not dirty kept their value.
+            uint64_t highOld = highBackPins[w];
+            uint64_t high = highOld, changed = 0, above = 0, below = 0;
+            for(size_t c = 0; c < numPins; c += 8)
             {
-                gpioifl[i / 8] &= ~(1 << (i % 8)); // Clear interrupt flag when pin is not an input
-                continue;
+                if(((dirtyPins[w] >> c) & 0xFF) == 0)
+                    continue;
+
+                size_t count = std::min<size_t>(numPins - c, 8);
+                uint64_t pv = loadValues(registers.pvFront + base + c, count);
+                uint64_t pvOld = loadValues(gpiopvBack + base + c, count);
+
+                // no borrow crosses a byte either
+                uint64_t differs = (pv ^ pvOld) + 0x7F7F7F7F7F7F7F7Full;
+                uint64_t atLeast = (pv | 0x8080808080808080ull) - pvOld;
+
+                high = (high & ~(0xFFull << c)) | nonZeroBytes(pv) << c;
+                changed |= gatherHighBits(differs) << c;
+                above |= gatherHighBits(atLeast & differs) << c;
+                below |= gatherHighBits(~atLeast) << c;
             }
 
-            uint8_t pv = gpiopvFront[i];
-            uint8_t pvOld = gpiopvBack[i];
-            bool triggers = triggersInterrupt(irqType, pv, pvOld);
-            if(triggers)
-                gpioifl[i / 8] |= (1 << (i % 8));
+            flags |=
+                (pinsOfType[LOW][w] & ~high) |
+                (pinsOfType[HIGH][w] & high) |
+                (pinsOfType[RISING][w] & high & ~highOld) |
+                (pinsOfType[FALLING][w] & ~high & highOld) |
+                (pinsOfType[CHANGE][w] & (high ^ highOld)) |
+                (pinsOfType[ANALOG_CHANGE][w] & changed) |
+                (pinsOfType[ANALOG_RISING][w] & above) |
+                (pinsOfType[ANALOG_FALLING][w] & below) |
+                (pinsOfType[NO_CHANGE][w] & ~changed);
+            storeWord(registers.ifl + base / 8, numFlagBytes, flags);
         }
-
-        // Trigger interrupt if any of the interrupt flags are set
     }
 
+    // Makes the front values the back ones and notes which pins changed,
+    // only dirty pins are looked at
     void swapBuffers()
     {
-        memcpy(gpiopvBack, gpiopvFront, N);
+        for(size_t w = 0; w < MASK_WORDS; w++)
+        {
+            changedPins[w] = 0;
+            if(dirtyPins[w] == 0)
+                continue;
+
+            size_t base = w * 64;
+            size_t numPins = std::min<size_t>(N - base, 64);
+            for(size_t c = 0; c < numPins; c += 8)
+            {
+                if(((dirtyPins[w] >> c) & 0xFF) == 0)
+                    continue;
+
+                size_t count = std::min<size_t>(numPins - c, 8);
+                uint64_t pv = loadWord(registers.pvFront + base + c, count);
+                uint64_t pvOld = loadWord(gpiopvBack + base + c, count);
+                uint64_t differs = pv ^ pvOld;
+
+                // a bit for every byte that differs anywhere, not just in
+                // its low nibble
+                differs |= (differs >> 4) & 0x0F0F0F0F0F0F0F0Full;
+                changedPins[w] |= nonZeroBytes(differs & 0x0F0F0F0F0F0F0F0Full) << c;
+
+                highBackPins[w] = (highBackPins[w] & ~(0xFFull << c)) | nonZeroBytes(pv & 0x0F0F0F0F0F0F0F0Full) << c;
+                memcpy(gpiopvBack + base + c, registers.pvFront + base + c, count);
+            }
+            dirtyPins[w] = 0;
+        }
     }
 
     bool shouldInterrupt() const
     {
         // Trigger interrupt if any of the interrupt flags are set
-        for(size_t i = 0; i < N / 8; i++)
+        for(size_t i = 0; i < IFL_SIZE; i++)
         {
-            if(gpioifl[i] != 0)
+            if(registers.ifl[i] != 0)
                 return true;
         }
 
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "CodeNodeNano.hpp"
+
+#include <vector>
+
+// Runs many CodeNodeNano-equivalent lanes that share one firmware image.
+// Registers, cycle counters, bus latches and RAM are kept as structure of
+// arrays (RAM interleaved as ram[address * size() + lane]) so lanes sitting
+// at the same PC can be stepped together in loops the compiler vectorizes.
+// Lanes left alone at their PC, code outside the ROM, BRK/RTI/JMP (ind),
+// 65C02 mode and parked or halted CPUs go through each lane's own mos6502
+// core instead.
+//
+// Each lane behaves exactly like a CodeNodeNano with the default settings
+// (bus tracing on, no JIT) loaded with the same image: saveSnapshot()
+// gives the bytes such a node would. The shared ROM is always
+// write-protected.
+class MCUBatch
+{
+public:
+    constexpr static size_t GPIO_NUM_PINS = CodeNodeNano::GPIO_NUM_PINS;
+    constexpr static size_t RAM_SIZE = CodeNodeNano::RAM_SIZE;
+    constexpr static size_t ROM_SIZE = CodeNodeNano::ROM_SIZE;
+    constexpr static size_t CLOCK_FREQUENCY = CodeNodeNano::CLOCK_FREQUENCY;
+    typedef CodeNodeNano::Snapshot Snapshot;
+
+    explicit MCUBatch(size_t numLanes);
+
+    size_t size() const { return numLanes; }
+
+    void tick();
+    void reset(size_t lane);
+
+    void powerOn(size_t lane);
+    void powerOff(size_t lane) { poweredOn[lane] = 0; }
+    bool isPoweredOn(size_t lane) const { return poweredOn[lane] != 0; }
+    void pauseClock(size_t lane) { clockPaused[lane] = 1; }
+    void resumeClock(size_t lane) { clockPaused[lane] = 0; }
+    bool isClockPaused(size_t lane) const { return clockPaused[lane] != 0; }
+    uint64_t numCycles(size_t lane) const { return cyclesCounter[lane]; }
+
+    uint16_t busAddress(size_t lane) const { return m_busAddress[lane]; }
+    uint8_t busData(size_t lane) const { return m_busData[lane]; }
+    bool busRw(size_t lane) const { return m_busRw[lane] != 0; }
+
+    // Same layout as CodeNodeNano's, a lane and a node running the same
+    // image can be saved into each other
+    void saveSnapshot(size_t lane, Snapshot& snapshot) const;
+    // false, leaving the lane untouched, if the snapshot is not one
+    bool loadSnapshot(size_t lane, const Snapshot& snapshot);
+
+    CNGPIO<GPIO_NUM_PINS>& GPIO(size_t lane) { return gpio[lane]; }
+    // Loads the image every lane runs and decodes it. Lanes keep running
+    // from where they are, reset or power them on to start over.
+    void loadROM(const uint8_t* data, size_t dataSize);
+    const CNROM<ROM_SIZE>& ROM() const { return rom; }
+
+    // lane-cycles retired by the vector and scalar paths so far
+    uint64_t numVectorCycles() const { return vectorCycles; }
+    uint64_t numScalarCycles() const { return scalarCycles; }
+private:
+    size_t numLanes;
+
+    // hot, touched by every lockstep step
+    std::vector<uint16_t> regPC;
+    std::vector<uint8_t> regA;
+    std::vector<uint8_t> regX;
+    std::vector<uint8_t> regY;
+    std::vector<uint8_t> regS;
+    std::vector<uint8_t> regP; // N and Z included
+    std::vector<uint8_t> irqLine;
+    // cycles left in the tick, cyclesTarget - cyclesCounter while a tick
+    // runs; the counter is only brought up to date from it before scalar
+    // runs and at the end of the tick
+    std::vector<int32_t> cyclesRemaining;
+    std::vector<uint16_t> m_busAddress;
+    std::vector<uint8_t> m_busData;
+    std::vector<uint8_t> m_busRw;
+    std::vector<uint8_t> ram;
+
+    // 0xFF for lanes on the lockstep path this tick, 0x00 for the rest
+    std::vector<uint8_t> active;
+    // 0xFF for the lanes at the PC being stepped
+    std::vector<uint8_t> groupMask;
+    std::vector<uint16_t> operandAddress;
+    std::vector<uint32_t> operandOffset;
+    std::vector<uint8_t> scratch;
+
+    // per lane, used once per tick or on the scalar path
+    std::vector<uint64_t> cyclesCounter;
+    std::vector<uint64_t> cyclesTarget;
+    std::vector<uint8_t> poweredOn;
+    std::vector<uint8_t> clockPaused;
+    // NMOS, not parked, halted or holding an NMI: may run in lockstep
+    std::vector<uint8_t> lockstep;
+    std::vector<CNGPIO<GPIO_NUM_PINS>> gpio;
+    // Each lane's own core. Registers live in the arrays above and are
+    // copied in and out around scalar runs, the rest (interrupt and
+    // parking state, instruction set, reset values, idle loop tracking)
+    // stays here.
+    std::vector<mos6502> cpus;
+
+    CNROM<ROM_SIZE> rom;
+    std::vector<mos6502::DecodedInstr> decoded;
+
+    uint64_t vectorCycles;
+    uint64_t scalarCycles;
+
+    typedef CodeNodePageMap<RAM_SIZE, CNGPIO<GPIO_NUM_PINS>::REGISTER_PAGES, ROM_SIZE> PageMap;
+    constexpr static PageMap pageMap = PageMap();
+    constexpr static uint16_t GPIO_BASE = 0x7000;
+    constexpr static uint16_t ROM_BASE = static_cast<uint16_t>(0x10000 - ROM_SIZE);
+
+    // A lane's memory map as CodeNodeNano's Bus has it, latch included
+    struct LaneBus
+    {
+        MCUBatch& batch;
+        size_t lane;
+        uint8_t Read(uint16_t address) { return batch.laneRead(lane, address); }
+        void Write(uint16_t address, uint8_t value) { batch.laneWrite(lane, address, value); }
+        const mos6502::DecodedInstr* Decoded(uint16_t address) { return batch.laneDecoded(lane, address); }
+        const mos6502::DecodedInstr* Inspect(uint16_t address) { return batch.decodedAt(address); }
+    };
+
+    uint8_t laneRead(size_t lane, uint16_t address);
+    void laneWrite(size_t lane, uint16_t address, uint8_t value);
+    const mos6502::DecodedInstr* laneDecoded(size_t lane, uint16_t address);
+    const mos6502::DecodedInstr* decodedAt(uint16_t address) const;
+    // what every lane reads at an address outside RAM, latches untouched
+    void readDevice(uint16_t address, uint8_t* row) const;
+
+    void loadLane(size_t lane);
+    void storeLane(size_t lane);
+    void runScalar(size_t lane, int32_t budget, mos6502::CycleMethod cycleMethod);
+    void finishScalar(size_t lane);
+    void splitGroups(size_t numLive);
+
+    enum AddressMode { IMP, IMM, ZER, ZEX, ZEY, ABS, ABX, ABY, INX, INY };
+    // A RAM row shared by the group, a RAM column per lane, one address
+    // outside RAM shared by the group, or anything else
+    enum OperandPlace { OPERAND_ROW, OPERAND_RAM, OPERAND_DEVICE, OPERAND_BUS };
+    // rowAddress is the group's one address for OPERAND_ROW and _DEVICE
+    OperandPlace resolveOperand(AddressMode mode, uint16_t operand, uint16_t& rowAddress);
+    bool stepVector(uint16_t pc, size_t groupSize);
+};
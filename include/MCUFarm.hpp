@@ -0,0 +1,41 @@
+#pragma once
+
+#include "CodeNodeNano.hpp"
+#include "ThreadPool.hpp"
+
+#include <memory>
+#include <vector>
+
+// Owns a world's worth of CodeNodeNano instances and advances all of them
+// by one game tick on a thread pool. Nodes share no state, so the result
+// of a tick does not depend on the number of threads.
+class MCUFarm
+{
+public:
+    struct TickStats
+    {
+        double wallTime; // seconds spent in tick()
+        size_t numTicked; // nodes that were powered on and not paused
+    };
+
+    explicit MCUFarm(size_t numThreads = ThreadPool::defaultThreadCount());
+
+    size_t add();
+    void remove(size_t index);
+    void clear();
+
+    size_t size() const { return nodes.size(); }
+    CodeNodeNano& node(size_t index) { return *nodes[index]; }
+
+    void tick();
+
+    const TickStats& lastTickStats() const { return stats; }
+    size_t numThreads() const { return pool.numThreads(); }
+    void setGrainSize(size_t grainSize) { this->grainSize = grainSize; }
+private:
+    std::vector<std::unique_ptr<CodeNodeNano>> nodes;
+    std::vector<CodeNodeNano*> runnable;
+    ThreadPool pool;
+    size_t grainSize;
+    TickStats stats;
+};
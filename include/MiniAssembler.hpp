@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Assembles the part of the vasm oldstyle syntax the examples use into a
+// ROM image: labels, symbol assignments, .org, .byte and .word, and every
+// NMOS 6502 and 65C02 addressing mode. Opcodes come from mos6502_opcodes.h.
+// Meant for benchmarks and tools that need fixed programs without the
+// toolchain, not as a replacement for it.
+class MiniAssembler
+{
+public:
+    MiniAssembler(uint16_t origin = 0xE000, size_t size = 0x2000);
+
+    bool assemble(const std::string& source);
+    bool assembleFile(const char* filename);
+
+    // origin..origin + size, unused bytes are 0
+    const std::vector<uint8_t>& image() const { return rom; }
+    const std::string& error() const { return errorMessage; }
+private:
+    uint16_t origin;
+    std::vector<uint8_t> rom;
+    std::string errorMessage;
+
+    struct Symbol
+    {
+        std::string name;
+        uint16_t value;
+    };
+    std::vector<Symbol> symbols;
+    // operand sizes picked in the first pass, one per instruction, so
+    // that forward references can't move labels in the second
+    std::vector<bool> wideOperands;
+
+    uint16_t pc;
+    int line;
+    bool finalPass;
+
+    bool assemblePass(const std::string& source);
+    bool assembleLine(std::string text, size_t* instruction);
+    bool emit(uint8_t value);
+
+    const Symbol* findSymbol(const std::string& name) const;
+    bool defineSymbol(const std::string& name, uint16_t value);
+
+    // false on syntax errors, *known false for symbols not seen yet
+    bool evaluate(const std::string& expression, uint16_t* value, bool* known);
+    bool fail(const std::string& message);
+};
@@ -40,6 +40,7 @@ public:
 
     size_t size() const { return N; }
     uint8_t* data() { return ram; }
+    const uint8_t* data() const { return ram; }
 
     uint8_t read(uint16_t address) const { return address < N ? ram[address] : 0; }
     void write(uint16_t address, uint8_t value) { if(address < N) ram[address] = value; }
@@ -2,60 +2,239 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
+// FNV-1a over 64-bit words of a ROM image, the key images are shared and
+// stored under. Matches are confirmed with memcmp.
+inline uint64_t hashROMImage(const uint8_t* bytes, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for(size_t i = size / sizeof(uint64_t) * sizeof(uint64_t); i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Process-wide set of ROM images, keyed by content. Every distinct image
+// is kept once, immutable, for as long as a CNROM refers to it.
 template <size_t N>
-class CNROM
+class CNROMStore
 {
 public:
-    CNROM()
+    struct Image
+    {
+        uint8_t bytes[N];
+        uint64_t hash;
+    };
+
+    CNROMStore() :
+        zeros(std::make_shared<Image>(Image()))
+    {
+        zeros->hash = hash(zeros->bytes);
+        images.emplace(zeros->hash, zeros);
+    }
+
+    static CNROMStore& shared()
+    {
+        static CNROMStore store;
+        return store;
+    }
+
+    // The image holding data, zero padded to N bytes, created if no live
+    // one matches
+    std::shared_ptr<const Image> intern(const uint8_t* data, size_t dataSize)
+    {
+        std::shared_ptr<Image> image;
+        const uint8_t* bytes = data;
+
+        // only short images are copied before they are known to be new
+        if(!data || dataSize < N)
+        {
+            image = std::make_shared<Image>();
+            size_t numBytesToRead = data ? dataSize : 0;
+            std::copy(data, data + numBytesToRead, image->bytes);
+            std::fill(image->bytes + numBytesToRead, image->bytes + N, 0);
+            bytes = image->bytes;
+        }
+
+        uint64_t imageHash = hash(bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto range = images.equal_range(imageHash);
+        for(auto it = range.first; it != range.second;)
+        {
+            std::shared_ptr<const Image> existing = it->second.lock();
+            if(!existing)
+            {
+                it = images.erase(it);
+                continue;
+            }
+            if(memcmp(existing->bytes, bytes, N) == 0)
+                return existing;
+            ++it;
+        }
+
+        if(!image)
+        {
+            image = std::make_shared<Image>();
+            memcpy(image->bytes, bytes, N);
+        }
+        image->hash = imageHash;
+
+        // images nobody uses are only noticed here, sweep them out once
+        // they could make up half of the table
+        if(images.size() >= 2 * liveAtLastSweep + 16)
+        {
+            for(auto it = images.begin(); it != images.end();)
+                it = it->second.expired() ? images.erase(it) : std::next(it);
+            liveAtLastSweep = images.size();
+        }
+
+        images.emplace(imageHash, image);
+        return image;
+    }
+
+    // All zeros, what a CNROM starts out with
+    std::shared_ptr<const Image> empty()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return zeros;
+    }
+
+    // Images still referred to, expired ones may be counted until swept
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return images.size();
+    }
+
+    static uint64_t hash(const uint8_t* bytes)
     {
-        for(size_t i = 0; i < N; i++)
-            rom[i] = 0;
+        return hashROMImage(bytes, N);
     }
+private:
+    std::mutex mutex;
+    std::shared_ptr<Image> zeros;
+    std::unordered_multimap<uint64_t, std::weak_ptr<const Image>> images;
+    size_t liveAtLastSweep = 0;
+};
 
-    CNROM(const uint8_t* data, size_t dataSize)
+// Read-only memory. The contents live in a CNROMStore image shared with
+// every other CNROM holding the same bytes, so loading an image another
+// node already runs costs a lookup instead of a copy. A private copy is
+// made the first time the contents may change: when write protection is
+// lifted or data() is asked for writable bytes. Both move data() to a new
+// address.
+template <size_t N>
+class CNROM
+{
+public:
+    typedef CNROMStore<N> Store;
+
+    CNROM() :
+        image(Store::shared().empty()),
+        writable(nullptr)
     {
-        for(size_t i = 0; i < N; i++)
-            rom[i] = 0;
+    }
 
-        size_t numBytesToRead = std::min(dataSize, N);
-        for(size_t i = 0; i < numBytesToRead; i++)
-            rom[i] = data[i];
+    CNROM(const uint8_t* data, size_t dataSize) :
+        image(Store::shared().intern(data, dataSize)),
+        writable(nullptr)
+    {
     }
 
-    CNROM(CNROM&& other)
+    CNROM(CNROM&& other) :
+        writable(nullptr)
     {
         *this = std::move(other);
     }
 
     CNROM& operator=(CNROM&& other)
     {
-        for(size_t i = 0; i < N; i++)
-            rom[i] = other.rom[i];
+        // other would be emptied after handing its image to itself
+        if(this == &other)
+            return *this;
+
+        image = other.image;
+        writable = other.writable;
+        writeProtect = other.writeProtect;
+
+        // a private copy stays with one owner, other starts over empty
+        // and protected
+        other.image = Store::shared().empty();
+        other.writable = nullptr;
+        other.writeProtect = true;
+
+        // unprotected contents are always a private copy
+        if(!writeProtect)
+            detach();
         return *this;
     }
 
-    size_t size() { return N; }
-    uint8_t* data() { return rom; }
+    // Shares the interned image holding data, zero padded to N bytes
+    void load(const uint8_t* data, size_t dataSize)
+    {
+        image = Store::shared().intern(data, dataSize);
+        writable = nullptr;
+        if(!writeProtect)
+            detach();
+    }
+
+    size_t size() const { return N; }
+    // Writable bytes, unshares the image first
+    uint8_t* data() { detach(); return writable->bytes; }
+    const uint8_t* data() const { return image->bytes; }
+    bool isShared() const { return writable == nullptr; }
+    // The store's image while shared, nullptr once this holds a private copy
+    std::shared_ptr<const typename Store::Image> sharedImage() const
+    {
+        return writable ? nullptr : image;
+    }
 
     uint8_t read(uint16_t address) const
     {
-        return address < N ? rom[address] : 0;
+        return address < N ? image->bytes[address] : 0;
     }
-    
+
     void write(uint16_t address, uint8_t value)
     {
         if(writeProtect)
             return;
 
         if(address < N)
-            rom[address] = value;
+            writable->bytes[address] = value;
     }
 
-    void setWriteProtect(bool writeProtect) { this->writeProtect = writeProtect; }
+    void setWriteProtect(bool writeProtect)
+    {
+        this->writeProtect = writeProtect;
+        if(!writeProtect)
+            detach();
+    }
     bool isWriteProtected() const { return writeProtect; }
 private:
-    uint8_t rom[N];
+    std::shared_ptr<const typename Store::Image> image;
+    // image, when it is a private copy
+    typename Store::Image* writable;
     bool writeProtect = true;
-};
\ No newline at end of file
+
+    void detach()
+    {
+        if(writable)
+            return;
+
+        std::shared_ptr<typename Store::Image> copy = std::make_shared<typename Store::Image>(*image);
+        writable = copy.get();
+        image = std::move(copy);
+    }
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "CodeNodeNano.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Keeps the state of many CodeNodeNano instances in one memory-mapped
+// file. Every node gets a fixed-size slot holding its Snapshot and the
+// index of its ROM image, and identical ROM images are stored once and
+// reference counted. Opening a file maps it, checks the indices every
+// slot holds against the reference counts and free lists and indexes the
+// ROM hashes. Snapshots are read and written in place through the
+// mapping, so bringing a region online copies no node state until one is
+// loaded.
+//
+// The capacity is fixed by create(). Space for one ROM image per slot is
+// reserved but left as a hole in the file, only images actually stored
+// take up disk. Fields are in host byte order like Snapshot, and nothing
+// is synchronized, one thread uses a RegionFile at a time.
+class RegionFile
+{
+public:
+    constexpr static uint32_t MAGIC = 0x47524E43; // "CNRG"
+    constexpr static uint16_t VERSION = 1;
+    constexpr static uint32_t NO_SLOT = 0xFFFFFFFF;
+
+    RegionFile();
+    ~RegionFile();
+
+    RegionFile(const RegionFile&) = delete;
+    RegionFile& operator=(const RegionFile&) = delete;
+
+    // Replaces whatever is at path with an empty region of numSlots slots
+    bool create(const char* path, uint32_t numSlots);
+    bool open(const char* path);
+    // Unmaps the file, changes made so far are kept
+    void close();
+    bool isOpen() const { return header != nullptr; }
+    // Writes dirty pages back to disk before returning
+    bool flush();
+    // Why the last create(), open() or flush() failed
+    const std::string& error() const { return errorMessage; }
+
+    uint32_t capacity() const;
+    uint32_t numUsed() const;
+    uint32_t numRoms() const { return static_cast<uint32_t>(romIndex.size()); }
+    bool isUsed(uint32_t slot) const;
+
+    // Stores node in a free slot, NO_SLOT if the region is full
+    uint32_t store(const CodeNodeNano& node);
+    // Overwrites a used slot with node
+    bool update(uint32_t slot, const CodeNodeNano& node);
+    // Puts the ROM image and state of a used slot into node. The image is
+    // only copied and predecoded if node runs a different one.
+    bool load(uint32_t slot, CodeNodeNano& node) const;
+    void release(uint32_t slot);
+
+    // Straight into the mapping, valid until close(). nullptr for slots
+    // that are not used.
+    const CodeNodeNano::Snapshot* snapshot(uint32_t slot) const;
+    const uint8_t* rom(uint32_t slot) const;
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t snapshotVersion;
+        uint32_t slotSize;
+        uint32_t romSize;
+        uint32_t numSlots;
+        uint32_t numUsed;
+        uint32_t firstFreeSlot;
+        uint32_t firstFreeRom;
+        uint64_t slotsOffset;
+        uint64_t romsOffset;
+        uint64_t romDataOffset;
+        uint64_t fileSize;
+    };
+
+    struct Slot
+    {
+        uint32_t rom; // NO_SLOT while free
+        uint32_t nextFree;
+        CodeNodeNano::Snapshot snapshot;
+    };
+
+    struct RomEntry
+    {
+        uint64_t hash;
+        uint32_t refCount; // 0 while free
+        uint32_t nextFree;
+    };
+
+    // Pointers into the mapping, fixed up from the header's offsets
+    Header* header;
+    Slot* slots;
+    RomEntry* roms;
+    uint8_t* romData;
+
+    uint8_t* mapping;
+    size_t mappingSize;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+
+    // ROM hash to the images with that hash, rebuilt by open()
+    std::unordered_multimap<uint64_t, uint32_t> romIndex;
+    std::string errorMessage;
+
+    bool mapFile(const char* path, size_t size, bool create);
+    void fixUp();
+    bool fail(const std::string& message);
+
+    uint32_t acquireRom(const uint8_t* image);
+    void releaseRom(uint32_t rom);
+    uint8_t* romImage(uint32_t rom) const;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that split index ranges between them.
+// Every thread owns a queue of chunks, pops from its back and, once it
+// runs dry, steals from the front of the others.
+class ThreadPool
+{
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeTask;
+
+    // numThreads counts the calling thread, so 1 runs everything inline
+    explicit ThreadPool(size_t numThreads = defaultThreadCount());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t numThreads() const { return workers.size() + 1; }
+
+    // Calls task over [0, count) in chunks of at most grainSize indices
+    // and returns once all of them are done. Not reentrant.
+    void parallelFor(size_t count, size_t grainSize, const RangeTask& task);
+
+    static size_t defaultThreadCount();
+private:
+    struct Chunk
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues; // queues[0] is the caller's
+
+    std::mutex jobMutex;
+    std::condition_variable jobStart;
+    std::condition_variable jobDone;
+    const RangeTask* currentTask;
+    uint64_t generation;
+    size_t busyWorkers;
+    bool stopping;
+
+    void workerMain(size_t index);
+    void drain(size_t index);
+    bool popLocal(size_t index, Chunk& chunk);
+    bool steal(size_t index, Chunk& chunk);
+};
@@ -8,16 +8,17 @@
 
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+class mos6502_jit;
 
 class mos6502
 {
 private:
-    // register reset values
-    uint8_t reset_A;
-    uint8_t reset_X;
-    uint8_t reset_Y;
-    uint8_t reset_sp;
-    uint8_t reset_status;
+	// Members are ordered by how often Run touches them: registers and
+	// the flags checked at every instruction boundary first, the
+	// callbacks and reset values, used on slow paths only, last.
 
 	// registers
 	uint8_t A; // accumulator
@@ -30,8 +31,22 @@ private:
 	// program counter
 	uint16_t pc;
 
-	// status register
+	// status register, N and Z excepted: those are derived from nz on
+	// demand so that most instructions only have to store their result.
+	// Z is set when the low byte is 0, N when bit 7 or bit 15 is set.
 	uint8_t status;
+	uint16_t nz;
+
+	bool illegalOpcode;
+
+	// set by WAI and STP
+	bool waiting;
+	bool stopped;
+
+	// interrupt input lines
+	bool irqLine;
+	bool nmiLine;
+	bool nmiPending;
 
 	typedef void (mos6502::*CodeExec)(uint16_t);
 	typedef uint16_t (mos6502::*AddrExec)();
@@ -43,12 +58,10 @@ private:
 		uint8_t cycles;
 	};
 
-	static Instr InstrTable[256];
+	static const std::array<Instr, 256> InstrTable;
 
 	void Exec(Instr i);
 
-	bool illegalOpcode;
-
 	// addressing modes
 	uint16_t Addr_ACC(); // ACCUMULATOR
 	uint16_t Addr_IMM(); // IMMEDIATE
@@ -134,6 +147,100 @@ private:
 
 	void Op_ILLEGAL(uint16_t src);
 
+	// value-level helpers shared by both dispatch methods
+	inline uint8_t SetNZ(uint8_t value);
+	static inline uint16_t MakeNZ(bool negative, bool zero);
+	// status with N and Z filled in, and its inverse
+	inline uint8_t Status() const;
+	inline void SetStatus(uint8_t value);
+	inline void Alu_ADC(uint8_t m);
+	inline void Alu_SBC(uint8_t m);
+	inline void Alu_AND(uint8_t m);
+	inline void Alu_ORA(uint8_t m);
+	inline void Alu_EOR(uint8_t m);
+	inline void Alu_BIT(uint8_t m);
+	inline void Alu_CMP(uint8_t reg, uint8_t m);
+	inline uint8_t Alu_ASL(uint8_t m);
+	inline uint8_t Alu_LSR(uint8_t m);
+	inline uint8_t Alu_ROL(uint8_t m);
+	inline uint8_t Alu_ROR(uint8_t m);
+	inline uint8_t Alu_INC(uint8_t m);
+	inline uint8_t Alu_DEC(uint8_t m);
+
+	// bus-bound counterparts of the addressing modes and of the opcodes
+	// that access memory on their own, defined in mos6502_core.h
+	template<class Bus> inline uint16_t EA_IMM(Bus& bus);
+	template<class Bus> inline uint16_t EA_ABS(Bus& bus);
+	template<class Bus> inline uint16_t EA_ZER(Bus& bus);
+	template<class Bus> inline uint16_t EA_ZEX(Bus& bus);
+	template<class Bus> inline uint16_t EA_ZEY(Bus& bus);
+	template<class Bus> inline uint16_t EA_ABX(Bus& bus);
+	template<class Bus> inline uint16_t EA_ABY(Bus& bus);
+	template<class Bus> inline uint16_t EA_REL(Bus& bus);
+	template<class Bus> inline uint16_t EA_INX(Bus& bus);
+	template<class Bus> inline uint16_t EA_INY(Bus& bus);
+	template<class Bus> inline uint16_t EA_ABI(Bus& bus);
+	template<class Bus> inline uint16_t EA_IZP(Bus& bus); // 65C02 (zp)
+	template<class Bus> inline uint16_t EA_IAX(Bus& bus); // 65C02 (abs,X)
+	// accesses below $0200, the address must be in range
+	template<class Bus> inline uint8_t ReadLow(Bus& bus, uint16_t address);
+	template<class Bus> inline void WriteLow(Bus& bus, uint16_t address, uint8_t value);
+	template<class Bus> inline void Push(Bus& bus, uint8_t byte);
+	template<class Bus> inline uint8_t Pop(Bus& bus);
+	template<class Bus> inline void Exec_BRK(Bus& bus);
+	template<class Bus> inline void Exec_JSR(Bus& bus, uint16_t src);
+	template<class Bus> inline void Exec_RTI(Bus& bus);
+	template<class Bus> inline void Exec_RTS(Bus& bus);
+	template<class Bus> inline void Exec_PHA(Bus& bus);
+	template<class Bus> inline void Exec_PHP(Bus& bus);
+	template<class Bus> inline void Exec_PLA(Bus& bus);
+	template<class Bus> inline void Exec_PLP(Bus& bus);
+	template<class Bus> inline uint16_t Indirect(Bus& bus, uint16_t abs);
+	template<class Bus> inline uint16_t IndexedIndirect(Bus& bus, uint8_t zero);
+	template<class Bus> inline uint16_t IndirectIndexed(Bus& bus, uint8_t zero);
+	template<class Bus> inline uint16_t IndirectZero(Bus& bus, uint8_t zero);
+	template<class Bus> inline uint16_t IndexedAbsIndirect(Bus& bus, uint16_t abs);
+	template<class Bus> inline void ServiceInterrupts(Bus& bus);
+	inline void Branch(uint16_t target, bool condition);
+
+	// fused dispatch: one switch case per opcode with the addressing
+	// mode inlined, no pointer-to-member calls. The operand bytes come
+	// from the instruction stream or from a predecoded ROM.
+	template<class Bus> struct StreamOperands;
+	template<class Bus> struct PredecodedOperands;
+	template<class Bus> inline void ExecFused(Bus& bus, uint8_t opcode);
+	template<class Bus, class Operands> inline void ExecFused(Bus& bus, Operands& operands, uint8_t opcode);
+	// opcodes the 65C02 adds, reached from ExecFused in CMOS_65C02 mode
+	template<class Bus, class Operands> inline void ExecCMOS(Bus& bus, Operands& operands, uint8_t opcode);
+
+	// hands ROM code to a translating bus, see mos6502_jit.h. Returns the
+	// cycles run natively, 0 when the next instruction is interpreted, and
+	// the jump back of a loop that may be idle in loopBranch, -1 if none.
+	int32_t RunNative(mos6502_jit& jit, int32_t cycles, int32_t& loopBranch);
+
+	// idle loop detection, see SkipIdleLoop in mos6502_core.h. One loop
+	// is tracked at a time, keyed by its start and the jump back to it.
+	enum LoopKind { LOOP_NONE, LOOP_IDLE, LOOP_COUNTER };
+	struct IdleLoop
+	{
+		uint16_t start;
+		uint16_t branch;
+		bool classified;
+		uint8_t kind;
+		uint8_t counter;     // DEX, DEY, INX or INY of a counting loop
+		int32_t cycles;      // of one pass
+		bool arrived;        // the registers below are from the last pass
+		uint64_t cycleCount;
+		uint8_t A;
+		uint8_t X;
+		uint8_t Y;
+		uint8_t sp;
+		uint8_t status;
+	};
+	template<class Bus> inline uint8_t ClassifyLoop(Bus& bus, uint16_t start, uint16_t branch, int32_t& cycles, uint8_t& counter);
+	template<class Bus> inline int32_t SkipIdleLoop(Bus& bus, uint16_t branch, uint64_t cycleCount, int32_t cyclesRemaining);
+	inline bool AtIdleLoop(uint64_t cycleCount) const;
+
 	// IRQ, reset, NMI vectors
 	static const uint16_t irqVectorH = 0xFFFF;
 	static const uint16_t irqVectorL = 0xFFFE;
@@ -142,13 +249,32 @@ private:
 	static const uint16_t nmiVectorH = 0xFFFB;
 	static const uint16_t nmiVectorL = 0xFFFA;
 
-	// read/write/clock-cycle callbacks
-	typedef void (*BusWrite)(uint16_t, uint8_t);
-	typedef uint8_t (*BusRead)(uint16_t);
-	typedef void (*ClockCycle)(mos6502*);
-	BusRead Read;
-	BusWrite Write;
-	ClockCycle Cycle;
+	// read/write/clock-cycle callbacks, each handed the context pointer
+	// given to the constructor so every instance can have its own bus
+	typedef void (*BusWrite)(void*, uint16_t, uint8_t);
+	typedef uint8_t (*BusRead)(void*, uint16_t);
+	typedef void (*ClockCycle)(void*, mos6502*);
+
+	uint8_t Read(uint16_t address) { return ReadCallback(context, address); }
+	void Write(uint16_t address, uint8_t value) { WriteCallback(context, address, value); }
+	void Cycle() { CycleCallback(context, this); }
+
+	// InstrTable and CmosInstrCycles are generated from mos6502_opcodes.h
+	static constexpr CodeExec CodeExecFor(uint8_t mnemonic, bool accumulator);
+	static constexpr AddrExec AddrExecFor(uint8_t mode);
+	static constexpr std::array<Instr, 256> BuildInstrTable();
+	static constexpr std::array<uint8_t, 256> BuildCmosInstrCycles();
+
+	// cycles per opcode in CMOS_65C02 mode, the NMOS ones included
+	static const std::array<uint8_t, 256> CmosInstrCycles;
+
+	// adapts the callbacks above to the bus interface of the core
+	struct CallbackBus
+	{
+		mos6502& cpu;
+		uint8_t Read(uint16_t address) { return cpu.Read(address); }
+		void Write(uint16_t address, uint8_t value) { cpu.Write(address, value); }
+	};
 
 	// stack operations
 	inline void StackPush(uint8_t byte);
@@ -159,7 +285,38 @@ public:
 		INST_COUNT,
 		CYCLE_COUNT,
 	};
-	mos6502(BusRead r, BusWrite w, ClockCycle c = nullptr);
+	enum DispatchMethod : uint8_t {
+		INSTR_TABLE,  // pointer-to-member InstrTable lookup
+		FUSED_SWITCH, // switch with addressing fused into each opcode
+	};
+	enum InstructionSet : uint8_t {
+		NMOS_6502,  // documented NMOS opcodes, anything else halts
+		CMOS_65C02, // adds the WDC 65C02 opcodes, WAI and STP included
+	};
+	// An instruction decoded ahead of time from memory that doesn't
+	// change under the CPU (write-protected ROM). A bus can hand these to
+	// Run, see mos6502_core.h.
+	struct DecodedInstr
+	{
+		uint16_t operand;   // immediate value, address or branch target
+		uint8_t opcode;
+		uint8_t cycles : 4;
+		uint8_t length : 4; // 0 when the bytes must be fetched instead
+	};
+	// Decodes the instructions starting at code[begin] up to code[end]
+	// into decoded[begin...], with code mapped at address base. Illegal
+	// opcodes and instructions running past the end of code are left
+	// undecoded.
+	static void Predecode(
+		const uint8_t* code,
+		size_t size,
+		uint16_t base,
+		size_t begin,
+		size_t end,
+		DecodedInstr* decoded);
+
+	mos6502(BusRead r, BusWrite w, ClockCycle c = nullptr, void* context = nullptr);
+	mos6502();
 	void NMI();
 	void IRQ();
 	void Reset();
@@ -167,16 +324,59 @@ public:
 		int32_t cycles,
 		uint64_t& cycleCount,
 		CycleMethod cycleMethod = CYCLE_COUNT);
+
+	// Same as above with every memory access resolved at compile time
+	// against bus.Read/bus.Write. Needs mos6502_core.h.
+	template<class Bus> void NMI(Bus& bus);
+	template<class Bus> void IRQ(Bus& bus);
+	template<class Bus> void Reset(Bus& bus);
+	template<class Bus> void Run(
+		Bus& bus,
+		int32_t cycles,
+		uint64_t& cycleCount,
+		CycleMethod cycleMethod = CYCLE_COUNT);
 	void RunEternally(); // until it encounters a illegal opcode
 						 // useful when running e.g. WOZ Monitor
 						 // no need to worry about cycle exhaus-
 						 // tion
+    void SetContext(void* context);
+
+    // Interrupt inputs, sampled once per instruction boundary by Run.
+    // IRQ is level-triggered and stays asserted until the peripheral
+    // releases it, NMI latches on the rising edge.
+    void SetIRQLine(bool asserted);
+    void SetNMILine(bool asserted);
+    bool GetIRQLine();
+    void SetDispatchMethod(DispatchMethod method);
+    DispatchMethod GetDispatchMethod();
+
+    // CMOS_65C02 adds BRA, PHX/PHY/PLX/PLY, STZ, TRB/TSB, INC/DEC A,
+    // (zp), BIT imm/zp,X/abs,X, JMP (abs,X), WAI and STP, fixes JMP (ind)
+    // across pages and clears D on interrupts. The Rockwell bit opcodes
+    // (RMB/SMB/BBR/BBS) are not implemented and still halt, as do the
+    // undefined opcodes. The table dispatch method covers NMOS only, the
+    // fused switch is used in CMOS_65C02 mode regardless.
+    void SetInstructionSet(InstructionSet set);
+    InstructionSet GetInstructionSet();
+    // WAI parks the CPU until IRQ or NMI is asserted, STP until reset.
+    // Run only advances the cycle count while either holds.
+    bool IsWaiting();
+    bool IsStopped();
     uint16_t GetPC();
     uint8_t GetS();
     uint8_t GetP();
     uint8_t GetA();
     uint8_t GetX();
     uint8_t GetY();
+    void SetPC(uint16_t value);
+    void SetS(uint8_t value);
+    void SetP(uint8_t value);
+    void SetA(uint8_t value);
+    void SetX(uint8_t value);
+    void SetY(uint8_t value);
+    bool GetIllegalOpcode();
+    void SetIllegalOpcode(bool value);
+    static uint8_t GetInstrCycles(uint8_t opcode);
     void SetResetS(uint8_t value);
     void SetResetP(uint8_t value);
     void SetResetA(uint8_t value);
@@ -187,4 +387,51 @@ public:
     uint8_t GetResetA();
     uint8_t GetResetX();
     uint8_t GetResetY();
+
+    // Registers, reset values, interrupt lines and internal flags as plain
+    // bytes, e.g. for snapshots. Idle loop tracking is not included and
+    // starts over after SetState.
+    struct State
+    {
+        uint16_t pc;
+        uint8_t A;
+        uint8_t X;
+        uint8_t Y;
+        uint8_t sp;
+        uint8_t status; // P, N and Z included
+        uint8_t flags;  // STATE_* below
+        uint8_t instructionSet;
+        uint8_t resetA;
+        uint8_t resetX;
+        uint8_t resetY;
+        uint8_t resetSp;
+        uint8_t resetStatus;
+    };
+    enum StateFlags : uint8_t {
+        STATE_ILLEGAL_OPCODE = 0x01,
+        STATE_WAITING        = 0x02,
+        STATE_STOPPED        = 0x04,
+        STATE_IRQ_LINE       = 0x08,
+        STATE_NMI_LINE       = 0x10,
+        STATE_NMI_PENDING    = 0x20,
+    };
+    void GetState(State& state) const;
+    void SetState(const State& state);
+private:
+	DispatchMethod dispatchMethod;
+	InstructionSet instructionSet;
+
+	IdleLoop idleLoop;
+
+	BusRead ReadCallback;
+	BusWrite WriteCallback;
+	ClockCycle CycleCallback;
+	void* context;
+
+    // register reset values
+    uint8_t reset_A;
+    uint8_t reset_X;
+    uint8_t reset_Y;
+    uint8_t reset_sp;
+    uint8_t reset_status;
 };
@@ -0,0 +1,1342 @@
+//============================================================================
+// Name        : mos6502_core
+// Description : Bus-templated execution core for mos6502. Every memory
+//               access goes through Bus::Read / Bus::Write, so including
+//               this header next to a concrete bus lets the compiler
+//               inline the memory map into the opcode handlers.
+//
+//               A bus is any type providing
+//                   uint8_t Read(uint16_t address);
+//                   void Write(uint16_t address, uint8_t value);
+//               and optionally
+//                   const mos6502::DecodedInstr* Decoded(uint16_t address);
+//               returning the predecoded instruction at address, or
+//               nullptr where it has to be fetched and decoded as usual.
+//               A bus can also offer
+//                   mos6502_jit* Jit();
+//               to have ROM code run as translated x86-64 where possible.
+//               Finally
+//                   const mos6502::DecodedInstr* Inspect(uint16_t address);
+//               looks up predecoded code without touching the bus. A bus
+//               providing it also vouches that reads have no side effects,
+//               which lets Run skip loops that only poll memory.
+//               A bus whose zero page and stack page are plain memory can
+//               hand them out with
+//                   uint8_t* LowMemory();
+//               returning the bytes at $0000-$01FF, or nullptr while it
+//               wants to see those accesses, e.g. to trace them.
+//============================================================================
+
+#pragma once
+#include "mos6502.h"
+#include "mos6502_jit.h"
+
+#define NEGATIVE  0x80
+#define OVERFLOW  0x40
+#define CONSTANT  0x20
+#define BREAK     0x10
+#define DECIMAL   0x08
+#define INTERRUPT 0x04
+#define ZERO      0x02
+#define CARRY     0x01
+
+// N and Z are kept lazily in nz, see mos6502.h
+#define SET_NEGATIVE(x) (nz = MakeNZ(x, IF_ZERO()))
+#define SET_OVERFLOW(x) (x ? (status |= OVERFLOW) : (status &= (~OVERFLOW)) )
+//#define SET_CONSTANT(x) (x ? (status |= CONSTANT) : (status &= (~CONSTANT)) )
+//#define SET_BREAK(x) (x ? (status |= BREAK) : (status &= (~BREAK)) )
+#define SET_DECIMAL(x) (x ? (status |= DECIMAL) : (status &= (~DECIMAL)) )
+#define SET_INTERRUPT(x) (x ? (status |= INTERRUPT) : (status &= (~INTERRUPT)) )
+#define SET_ZERO(x) (nz = MakeNZ(IF_NEGATIVE(), x))
+#define SET_CARRY(x) (x ? (status |= CARRY) : (status &= (~CARRY)) )
+
+#define IF_NEGATIVE() ((nz & 0x8080) ? true : false)
+#define IF_OVERFLOW() ((status & OVERFLOW) ? true : false)
+#define IF_CONSTANT() ((status & CONSTANT) ? true : false)
+#define IF_BREAK() ((status & BREAK) ? true : false)
+#define IF_DECIMAL() ((status & DECIMAL) ? true : false)
+#define IF_INTERRUPT() ((status & INTERRUPT) ? true : false)
+#define IF_ZERO() ((nz & 0x00FF) ? false : true)
+#define IF_CARRY() ((status & CARRY) ? true : false)
+
+inline uint16_t mos6502::MakeNZ(bool negative, bool zero)
+{
+	return (negative ? 0x8000 : 0) | (zero ? 0 : 1);
+}
+
+inline uint8_t mos6502::SetNZ(uint8_t value)
+{
+	nz = value;
+	return value;
+}
+
+inline uint8_t mos6502::Status() const
+{
+	return (status & ~(NEGATIVE | ZERO))
+		| (IF_NEGATIVE() ? NEGATIVE : 0)
+		| (IF_ZERO() ? ZERO : 0);
+}
+
+inline void mos6502::SetStatus(uint8_t value)
+{
+	status = value;
+	nz = MakeNZ(value & NEGATIVE, value & ZERO);
+}
+
+inline void mos6502::Alu_ADC(uint8_t m)
+{
+	unsigned int tmp = m + A + (IF_CARRY() ? 1 : 0);
+	if (IF_DECIMAL())
+	{
+		// Z follows the binary sum, N the adjusted one
+		bool zero = !(tmp & 0xFF);
+		if (((A & 0xF) + (m & 0xF) + (IF_CARRY() ? 1 : 0)) > 9) tmp += 6;
+		nz = MakeNZ(tmp & 0x80, zero);
+		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
+		if (tmp > 0x99)
+		{
+			tmp += 96;
+		}
+		SET_CARRY(tmp > 0x99);
+	}
+	else
+	{
+		nz = tmp & 0xFF;
+		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
+		SET_CARRY(tmp > 0xFF);
+	}
+
+	A = tmp & 0xFF;
+}
+
+inline void mos6502::Alu_SBC(uint8_t m)
+{
+	unsigned int tmp = A - m - (IF_CARRY() ? 0 : 1);
+	nz = tmp & 0xFF;
+	SET_OVERFLOW(((A ^ tmp) & 0x80) && ((A ^ m) & 0x80));
+
+	if (IF_DECIMAL())
+	{
+		if ( ((A & 0x0F) - (IF_CARRY() ? 0 : 1)) < (m & 0x0F)) tmp -= 6;
+		if (tmp > 0x99)
+		{
+			tmp -= 0x60;
+		}
+	}
+	SET_CARRY(tmp < 0x100);
+	A = (tmp & 0xFF);
+}
+
+inline void mos6502::Alu_AND(uint8_t m)
+{
+	A = SetNZ(m & A);
+}
+
+inline void mos6502::Alu_ORA(uint8_t m)
+{
+	A = SetNZ(A | m);
+}
+
+inline void mos6502::Alu_EOR(uint8_t m)
+{
+	A = SetNZ(A ^ m);
+}
+
+inline void mos6502::Alu_BIT(uint8_t m)
+{
+	status |= CONSTANT | BREAK;
+	SET_OVERFLOW(m & 0x40);
+	nz = MakeNZ(m & 0x80, !(m & A));
+}
+
+inline void mos6502::Alu_CMP(uint8_t reg, uint8_t m)
+{
+	unsigned int tmp = reg - m;
+	SET_CARRY(tmp < 0x100);
+	nz = tmp & 0xFF;
+}
+
+inline uint8_t mos6502::Alu_ASL(uint8_t m)
+{
+	SET_CARRY(m & 0x80);
+	m <<= 1;
+	return SetNZ(m);
+}
+
+inline uint8_t mos6502::Alu_LSR(uint8_t m)
+{
+	SET_CARRY(m & 0x01);
+	m >>= 1;
+	return SetNZ(m);
+}
+
+inline uint8_t mos6502::Alu_ROL(uint8_t m)
+{
+	uint16_t tmp = m << 1;
+	if (IF_CARRY()) tmp |= 0x01;
+	SET_CARRY(tmp > 0xFF);
+	return SetNZ(tmp & 0xFF);
+}
+
+inline uint8_t mos6502::Alu_ROR(uint8_t m)
+{
+	uint16_t tmp = m;
+	if (IF_CARRY()) tmp |= 0x100;
+	SET_CARRY(tmp & 0x01);
+	tmp >>= 1;
+	return SetNZ(tmp & 0xFF);
+}
+
+inline uint8_t mos6502::Alu_INC(uint8_t m)
+{
+	return SetNZ((m + 1) & 0xFF);
+}
+
+inline uint8_t mos6502::Alu_DEC(uint8_t m)
+{
+	return SetNZ((m - 1) & 0xFF);
+}
+
+// addressing modes
+
+template<class Bus>
+inline uint16_t mos6502::EA_IMM(Bus&)
+{
+	return pc++;
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_ABS(Bus& bus)
+{
+	uint16_t addrL;
+	uint16_t addrH;
+
+	addrL = bus.Read(pc++);
+	addrH = bus.Read(pc++);
+
+	return addrL + (addrH << 8);
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_ZER(Bus& bus)
+{
+	return bus.Read(pc++);
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_REL(Bus& bus)
+{
+	uint16_t offset;
+
+	offset = (uint16_t)bus.Read(pc++);
+	if (offset & 0x80) offset |= 0xFF00;
+	return pc + (int16_t)offset;
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_ABI(Bus& bus)
+{
+	uint16_t addrL;
+	uint16_t addrH;
+
+	addrL = bus.Read(pc++);
+	addrH = bus.Read(pc++);
+
+	return Indirect(bus, (addrH << 8) | addrL);
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_ZEX(Bus& bus)
+{
+	return (bus.Read(pc++) + X) & 0xFF;
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_ZEY(Bus& bus)
+{
+	return (bus.Read(pc++) + Y) & 0xFF;
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_ABX(Bus& bus)
+{
+	return EA_ABS(bus) + X;
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_ABY(Bus& bus)
+{
+	return EA_ABS(bus) + Y;
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_IZP(Bus& bus)
+{
+	return IndirectZero(bus, bus.Read(pc++));
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_IAX(Bus& bus)
+{
+	return IndexedAbsIndirect(bus, EA_ABS(bus));
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_INX(Bus& bus)
+{
+	return IndexedIndirect(bus, bus.Read(pc++));
+}
+
+template<class Bus>
+inline uint16_t mos6502::EA_INY(Bus& bus)
+{
+	return IndirectIndexed(bus, bus.Read(pc++));
+}
+
+// pointer lookups behind the indirect modes, given the operand byte(s)
+
+template<class Bus>
+inline uint16_t mos6502::Indirect(Bus& bus, uint16_t abs)
+{
+	uint16_t effL;
+	uint16_t effH;
+
+	effL = bus.Read(abs);
+
+#ifndef CMOS_INDIRECT_JMP_FIX
+	if(instructionSet == NMOS_6502)
+		effH = bus.Read((abs & 0xFF00) + ((abs + 1) & 0x00FF) );
+	else
+#endif
+		effH = bus.Read(abs + 1);
+
+	return effL + 0x100 * effH;
+}
+
+template<class Bus>
+inline uint16_t mos6502::IndexedIndirect(Bus& bus, uint8_t zero)
+{
+	uint16_t zeroL;
+	uint16_t zeroH;
+	uint16_t addrL;
+
+	zeroL = (zero + X) & 0xFF;
+	zeroH = (zeroL + 1) & 0xFF;
+	addrL = ReadLow(bus, zeroL);
+
+	return addrL + (ReadLow(bus, zeroH) << 8);
+}
+
+template<class Bus>
+inline uint16_t mos6502::IndirectIndexed(Bus& bus, uint8_t zero)
+{
+	uint16_t zeroL;
+	uint16_t zeroH;
+	uint16_t addrL;
+
+	zeroL = zero;
+	zeroH = (zeroL + 1) & 0xFF;
+	addrL = ReadLow(bus, zeroL);
+
+	return addrL + (ReadLow(bus, zeroH) << 8) + Y;
+}
+
+template<class Bus>
+inline uint16_t mos6502::IndirectZero(Bus& bus, uint8_t zero)
+{
+	uint16_t addrL;
+
+	addrL = ReadLow(bus, zero);
+
+	return addrL + (ReadLow(bus, (zero + 1) & 0xFF) << 8);
+}
+
+template<class Bus>
+inline uint16_t mos6502::IndexedAbsIndirect(Bus& bus, uint16_t abs)
+{
+	uint16_t addrL;
+
+	abs += X;
+	addrL = bus.Read(abs);
+
+	return addrL + (bus.Read(abs + 1) << 8);
+}
+
+// operand sources for ExecFused: StreamOperands fetches the bytes after
+// the opcode through the bus, PredecodedOperands takes them from a
+// DecodedInstr built ahead of time
+
+template<class Bus>
+struct mos6502::StreamOperands
+{
+	mos6502& cpu;
+	Bus& bus;
+
+	uint8_t Imm() { return bus.Read(cpu.EA_IMM(bus)); }
+	uint16_t Abs() { return cpu.EA_ABS(bus); }
+	uint16_t Zer() { return cpu.EA_ZER(bus); }
+	uint16_t Zex() { return cpu.EA_ZEX(bus); }
+	uint16_t Zey() { return cpu.EA_ZEY(bus); }
+	uint16_t Abx() { return cpu.EA_ABX(bus); }
+	uint16_t Aby() { return cpu.EA_ABY(bus); }
+	uint16_t Rel() { return cpu.EA_REL(bus); }
+	uint16_t Inx() { return cpu.EA_INX(bus); }
+	uint16_t Iny() { return cpu.EA_INY(bus); }
+	uint16_t Abi() { return cpu.EA_ABI(bus); }
+	uint16_t Izp() { return cpu.EA_IZP(bus); }
+	uint16_t Iax() { return cpu.EA_IAX(bus); }
+};
+
+template<class Bus>
+struct mos6502::PredecodedOperands
+{
+	mos6502& cpu;
+	Bus& bus;
+	uint16_t operand;
+
+	uint8_t Imm() { return operand & 0xFF; }
+	uint16_t Abs() { return operand; }
+	uint16_t Zer() { return operand; }
+	uint16_t Zex() { return (operand + cpu.X) & 0xFF; }
+	uint16_t Zey() { return (operand + cpu.Y) & 0xFF; }
+	uint16_t Abx() { return operand + cpu.X; }
+	uint16_t Aby() { return operand + cpu.Y; }
+	uint16_t Rel() { return operand; }
+	uint16_t Inx() { return cpu.IndexedIndirect(bus, operand); }
+	uint16_t Iny() { return cpu.IndirectIndexed(bus, operand); }
+	uint16_t Abi() { return cpu.Indirect(bus, operand); }
+	uint16_t Izp() { return cpu.IndirectZero(bus, operand); }
+	uint16_t Iax() { return cpu.IndexedAbsIndirect(bus, operand); }
+};
+
+// zero page and stack, straight from memory where the bus allows it
+
+namespace mos6502_detail
+{
+	template<class Bus>
+	inline auto LowMemory(Bus& bus, int) -> decltype(bus.LowMemory())
+	{
+		return bus.LowMemory();
+	}
+
+	// buses that see every access
+	template<class Bus>
+	inline uint8_t* LowMemory(Bus&, long)
+	{
+		return nullptr;
+	}
+}
+
+template<class Bus>
+inline uint8_t mos6502::ReadLow(Bus& bus, uint16_t address)
+{
+	uint8_t* low = mos6502_detail::LowMemory(bus, 0);
+	return low ? low[address] : bus.Read(address);
+}
+
+template<class Bus>
+inline void mos6502::WriteLow(Bus& bus, uint16_t address, uint8_t value)
+{
+	uint8_t* low = mos6502_detail::LowMemory(bus, 0);
+	if(low)
+		low[address] = value;
+	else
+		bus.Write(address, value);
+}
+
+// stack operations
+
+template<class Bus>
+inline void mos6502::Push(Bus& bus, uint8_t byte)
+{
+	WriteLow(bus, 0x0100 + sp, byte);
+	if(sp == 0x00) sp = 0xFF;
+	else sp--;
+}
+
+template<class Bus>
+inline uint8_t mos6502::Pop(Bus& bus)
+{
+	if(sp == 0xFF) sp = 0x00;
+	else sp++;
+	return ReadLow(bus, 0x0100 + sp);
+}
+
+// opcodes that touch the bus other than through their operand
+
+template<class Bus>
+inline void mos6502::Exec_BRK(Bus& bus)
+{
+	pc++;
+	Push(bus, (pc >> 8) & 0xFF);
+	Push(bus, pc & 0xFF);
+	Push(bus, Status() | CONSTANT | BREAK);
+	SET_INTERRUPT(1);
+	if(instructionSet == CMOS_65C02)
+		SET_DECIMAL(0);
+	pc = (bus.Read(irqVectorH) << 8) + bus.Read(irqVectorL);
+}
+
+template<class Bus>
+inline void mos6502::Exec_JSR(Bus& bus, uint16_t src)
+{
+	pc--;
+	Push(bus, (pc >> 8) & 0xFF);
+	Push(bus, pc & 0xFF);
+	pc = src;
+}
+
+template<class Bus>
+inline void mos6502::Exec_RTI(Bus& bus)
+{
+	uint8_t lo, hi;
+
+	SetStatus(Pop(bus) | CONSTANT | BREAK);
+
+	lo = Pop(bus);
+	hi = Pop(bus);
+
+	pc = (hi << 8) | lo;
+}
+
+template<class Bus>
+inline void mos6502::Exec_RTS(Bus& bus)
+{
+	uint8_t lo, hi;
+
+	lo = Pop(bus);
+	hi = Pop(bus);
+
+	pc = ((hi << 8) | lo) + 1;
+}
+
+template<class Bus>
+inline void mos6502::Exec_PHA(Bus& bus)
+{
+	Push(bus, A);
+}
+
+template<class Bus>
+inline void mos6502::Exec_PHP(Bus& bus)
+{
+	Push(bus, Status() | CONSTANT | BREAK);
+}
+
+template<class Bus>
+inline void mos6502::Exec_PLA(Bus& bus)
+{
+	A = SetNZ(Pop(bus));
+}
+
+template<class Bus>
+inline void mos6502::Exec_PLP(Bus& bus)
+{
+	SetStatus(Pop(bus) | CONSTANT | BREAK);
+}
+
+inline void mos6502::Branch(uint16_t target, bool condition)
+{
+	if (condition)
+	{
+		pc = target;
+	}
+}
+
+template<class Bus, class Operands>
+inline void mos6502::ExecFused(Bus& bus, Operands& operands, uint8_t opcode)
+{
+	switch(opcode)
+	{
+		// ADC
+		case 0x69: Alu_ADC(operands.Imm()); break;
+		case 0x6D: Alu_ADC(bus.Read(operands.Abs())); break;
+		case 0x65: Alu_ADC(ReadLow(bus, operands.Zer())); break;
+		case 0x61: Alu_ADC(bus.Read(operands.Inx())); break;
+		case 0x71: Alu_ADC(bus.Read(operands.Iny())); break;
+		case 0x75: Alu_ADC(ReadLow(bus, operands.Zex())); break;
+		case 0x7D: Alu_ADC(bus.Read(operands.Abx())); break;
+		case 0x79: Alu_ADC(bus.Read(operands.Aby())); break;
+
+		// AND
+		case 0x29: Alu_AND(operands.Imm()); break;
+		case 0x2D: Alu_AND(bus.Read(operands.Abs())); break;
+		case 0x25: Alu_AND(ReadLow(bus, operands.Zer())); break;
+		case 0x21: Alu_AND(bus.Read(operands.Inx())); break;
+		case 0x31: Alu_AND(bus.Read(operands.Iny())); break;
+		case 0x35: Alu_AND(ReadLow(bus, operands.Zex())); break;
+		case 0x3D: Alu_AND(bus.Read(operands.Abx())); break;
+		case 0x39: Alu_AND(bus.Read(operands.Aby())); break;
+
+		// ASL
+		case 0x0E: { uint16_t src = operands.Abs(); bus.Write(src, Alu_ASL(bus.Read(src))); } break;
+		case 0x06: { uint16_t src = operands.Zer(); WriteLow(bus, src, Alu_ASL(ReadLow(bus, src))); } break;
+		case 0x0A: A = Alu_ASL(A); break;
+		case 0x16: { uint16_t src = operands.Zex(); WriteLow(bus, src, Alu_ASL(ReadLow(bus, src))); } break;
+		case 0x1E: { uint16_t src = operands.Abx(); bus.Write(src, Alu_ASL(bus.Read(src))); } break;
+
+		// BCC
+		case 0x90: Branch(operands.Rel(), !IF_CARRY()); break;
+
+		// BCS
+		case 0xB0: Branch(operands.Rel(), IF_CARRY()); break;
+
+		// BEQ
+		case 0xF0: Branch(operands.Rel(), IF_ZERO()); break;
+
+		// BIT
+		case 0x2C: Alu_BIT(bus.Read(operands.Abs())); break;
+		case 0x24: Alu_BIT(ReadLow(bus, operands.Zer())); break;
+
+		// BMI
+		case 0x30: Branch(operands.Rel(), IF_NEGATIVE()); break;
+
+		// BNE
+		case 0xD0: Branch(operands.Rel(), !IF_ZERO()); break;
+
+		// BPL
+		case 0x10: Branch(operands.Rel(), !IF_NEGATIVE()); break;
+
+		// BRK
+		case 0x00: Exec_BRK(bus); break;
+
+		// BVC
+		case 0x50: Branch(operands.Rel(), !IF_OVERFLOW()); break;
+
+		// BVS
+		case 0x70: Branch(operands.Rel(), IF_OVERFLOW()); break;
+
+		// CLC
+		case 0x18: Op_CLC(0); break;
+
+		// CLD
+		case 0xD8: Op_CLD(0); break;
+
+		// CLI
+		case 0x58: Op_CLI(0); break;
+
+		// CLV
+		case 0xB8: Op_CLV(0); break;
+
+		// CMP
+		case 0xC9: Alu_CMP(A, operands.Imm()); break;
+		case 0xCD: Alu_CMP(A, bus.Read(operands.Abs())); break;
+		case 0xC5: Alu_CMP(A, ReadLow(bus, operands.Zer())); break;
+		case 0xC1: Alu_CMP(A, bus.Read(operands.Inx())); break;
+		case 0xD1: Alu_CMP(A, bus.Read(operands.Iny())); break;
+		case 0xD5: Alu_CMP(A, ReadLow(bus, operands.Zex())); break;
+		case 0xDD: Alu_CMP(A, bus.Read(operands.Abx())); break;
+		case 0xD9: Alu_CMP(A, bus.Read(operands.Aby())); break;
+
+		// CPX
+		case 0xE0: Alu_CMP(X, operands.Imm()); break;
+		case 0xEC: Alu_CMP(X, bus.Read(operands.Abs())); break;
+		case 0xE4: Alu_CMP(X, ReadLow(bus, operands.Zer())); break;
+
+		// CPY
+		case 0xC0: Alu_CMP(Y, operands.Imm()); break;
+		case 0xCC: Alu_CMP(Y, bus.Read(operands.Abs())); break;
+		case 0xC4: Alu_CMP(Y, ReadLow(bus, operands.Zer())); break;
+
+		// DEC
+		case 0xCE: { uint16_t src = operands.Abs(); bus.Write(src, Alu_DEC(bus.Read(src))); } break;
+		case 0xC6: { uint16_t src = operands.Zer(); WriteLow(bus, src, Alu_DEC(ReadLow(bus, src))); } break;
+		case 0xD6: { uint16_t src = operands.Zex(); WriteLow(bus, src, Alu_DEC(ReadLow(bus, src))); } break;
+		case 0xDE: { uint16_t src = operands.Abx(); bus.Write(src, Alu_DEC(bus.Read(src))); } break;
+
+		// DEX
+		case 0xCA: Op_DEX(0); break;
+
+		// DEY
+		case 0x88: Op_DEY(0); break;
+
+		// EOR
+		case 0x49: Alu_EOR(operands.Imm()); break;
+		case 0x4D: Alu_EOR(bus.Read(operands.Abs())); break;
+		case 0x45: Alu_EOR(ReadLow(bus, operands.Zer())); break;
+		case 0x41: Alu_EOR(bus.Read(operands.Inx())); break;
+		case 0x51: Alu_EOR(bus.Read(operands.Iny())); break;
+		case 0x55: Alu_EOR(ReadLow(bus, operands.Zex())); break;
+		case 0x5D: Alu_EOR(bus.Read(operands.Abx())); break;
+		case 0x59: Alu_EOR(bus.Read(operands.Aby())); break;
+
+		// INC
+		case 0xEE: { uint16_t src = operands.Abs(); bus.Write(src, Alu_INC(bus.Read(src))); } break;
+		case 0xE6: { uint16_t src = operands.Zer(); WriteLow(bus, src, Alu_INC(ReadLow(bus, src))); } break;
+		case 0xF6: { uint16_t src = operands.Zex(); WriteLow(bus, src, Alu_INC(ReadLow(bus, src))); } break;
+		case 0xFE: { uint16_t src = operands.Abx(); bus.Write(src, Alu_INC(bus.Read(src))); } break;
+
+		// INX
+		case 0xE8: Op_INX(0); break;
+
+		// INY
+		case 0xC8: Op_INY(0); break;
+
+		// JMP
+		case 0x4C: pc = operands.Abs(); break;
+		case 0x6C: pc = operands.Abi(); break;
+
+		// JSR
+		case 0x20: Exec_JSR(bus, operands.Abs()); break;
+
+		// LDA
+		case 0xA9: A = SetNZ(operands.Imm()); break;
+		case 0xAD: A = SetNZ(bus.Read(operands.Abs())); break;
+		case 0xA5: A = SetNZ(ReadLow(bus, operands.Zer())); break;
+		case 0xA1: A = SetNZ(bus.Read(operands.Inx())); break;
+		case 0xB1: A = SetNZ(bus.Read(operands.Iny())); break;
+		case 0xB5: A = SetNZ(ReadLow(bus, operands.Zex())); break;
+		case 0xBD: A = SetNZ(bus.Read(operands.Abx())); break;
+		case 0xB9: A = SetNZ(bus.Read(operands.Aby())); break;
+
+		// LDX
+		case 0xA2: X = SetNZ(operands.Imm()); break;
+		case 0xAE: X = SetNZ(bus.Read(operands.Abs())); break;
+		case 0xA6: X = SetNZ(ReadLow(bus, operands.Zer())); break;
+		case 0xBE: X = SetNZ(bus.Read(operands.Aby())); break;
+		case 0xB6: X = SetNZ(ReadLow(bus, operands.Zey())); break;
+
+		// LDY
+		case 0xA0: Y = SetNZ(operands.Imm()); break;
+		case 0xAC: Y = SetNZ(bus.Read(operands.Abs())); break;
+		case 0xA4: Y = SetNZ(ReadLow(bus, operands.Zer())); break;
+		case 0xB4: Y = SetNZ(ReadLow(bus, operands.Zex())); break;
+		case 0xBC: Y = SetNZ(bus.Read(operands.Abx())); break;
+
+		// LSR
+		case 0x4E: { uint16_t src = operands.Abs(); bus.Write(src, Alu_LSR(bus.Read(src))); } break;
+		case 0x46: { uint16_t src = operands.Zer(); WriteLow(bus, src, Alu_LSR(ReadLow(bus, src))); } break;
+		case 0x4A: A = Alu_LSR(A); break;
+		case 0x56: { uint16_t src = operands.Zex(); WriteLow(bus, src, Alu_LSR(ReadLow(bus, src))); } break;
+		case 0x5E: { uint16_t src = operands.Abx(); bus.Write(src, Alu_LSR(bus.Read(src))); } break;
+
+		// NOP
+		case 0xEA: Op_NOP(0); break;
+
+		// ORA
+		case 0x09: Alu_ORA(operands.Imm()); break;
+		case 0x0D: Alu_ORA(bus.Read(operands.Abs())); break;
+		case 0x05: Alu_ORA(ReadLow(bus, operands.Zer())); break;
+		case 0x01: Alu_ORA(bus.Read(operands.Inx())); break;
+		case 0x11: Alu_ORA(bus.Read(operands.Iny())); break;
+		case 0x15: Alu_ORA(ReadLow(bus, operands.Zex())); break;
+		case 0x1D: Alu_ORA(bus.Read(operands.Abx())); break;
+		case 0x19: Alu_ORA(bus.Read(operands.Aby())); break;
+
+		// PHA
+		case 0x48: Exec_PHA(bus); break;
+
+		// PHP
+		case 0x08: Exec_PHP(bus); break;
+
+		// PLA
+		case 0x68: Exec_PLA(bus); break;
+
+		// PLP
+		case 0x28: Exec_PLP(bus); break;
+
+		// ROL
+		case 0x2E: { uint16_t src = operands.Abs(); bus.Write(src, Alu_ROL(bus.Read(src))); } break;
+		case 0x26: { uint16_t src = operands.Zer(); WriteLow(bus, src, Alu_ROL(ReadLow(bus, src))); } break;
+		case 0x2A: A = Alu_ROL(A); break;
+		case 0x36: { uint16_t src = operands.Zex(); WriteLow(bus, src, Alu_ROL(ReadLow(bus, src))); } break;
+		case 0x3E: { uint16_t src = operands.Abx(); bus.Write(src, Alu_ROL(bus.Read(src))); } break;
+
+		// ROR
+		case 0x6E: { uint16_t src = operands.Abs(); bus.Write(src, Alu_ROR(bus.Read(src))); } break;
+		case 0x66: { uint16_t src = operands.Zer(); WriteLow(bus, src, Alu_ROR(ReadLow(bus, src))); } break;
+		case 0x6A: A = Alu_ROR(A); break;
+		case 0x76: { uint16_t src = operands.Zex(); WriteLow(bus, src, Alu_ROR(ReadLow(bus, src))); } break;
+		case 0x7E: { uint16_t src = operands.Abx(); bus.Write(src, Alu_ROR(bus.Read(src))); } break;
+
+		// RTI
+		case 0x40: Exec_RTI(bus); break;
+
+		// RTS
+		case 0x60: Exec_RTS(bus); break;
+
+		// SBC
+		case 0xE9: Alu_SBC(operands.Imm()); break;
+		case 0xED: Alu_SBC(bus.Read(operands.Abs())); break;
+		case 0xE5: Alu_SBC(ReadLow(bus, operands.Zer())); break;
+		case 0xE1: Alu_SBC(bus.Read(operands.Inx())); break;
+		case 0xF1: Alu_SBC(bus.Read(operands.Iny())); break;
+		case 0xF5: Alu_SBC(ReadLow(bus, operands.Zex())); break;
+		case 0xFD: Alu_SBC(bus.Read(operands.Abx())); break;
+		case 0xF9: Alu_SBC(bus.Read(operands.Aby())); break;
+
+		// SEC
+		case 0x38: Op_SEC(0); break;
+
+		// SED
+		case 0xF8: Op_SED(0); break;
+
+		// SEI
+		case 0x78: Op_SEI(0); break;
+
+		// STA
+		case 0x8D: bus.Write(operands.Abs(), A); break;
+		case 0x85: WriteLow(bus, operands.Zer(), A); break;
+		case 0x81: bus.Write(operands.Inx(), A); break;
+		case 0x91: bus.Write(operands.Iny(), A); break;
+		case 0x95: WriteLow(bus, operands.Zex(), A); break;
+		case 0x9D: bus.Write(operands.Abx(), A); break;
+		case 0x99: bus.Write(operands.Aby(), A); break;
+
+		// STX
+		case 0x8E: bus.Write(operands.Abs(), X); break;
+		case 0x86: WriteLow(bus, operands.Zer(), X); break;
+		case 0x96: WriteLow(bus, operands.Zey(), X); break;
+
+		// STY
+		case 0x8C: bus.Write(operands.Abs(), Y); break;
+		case 0x84: WriteLow(bus, operands.Zer(), Y); break;
+		case 0x94: WriteLow(bus, operands.Zex(), Y); break;
+
+		// TAX
+		case 0xAA: Op_TAX(0); break;
+
+		// TAY
+		case 0xA8: Op_TAY(0); break;
+
+		// TSX
+		case 0xBA: Op_TSX(0); break;
+
+		// TXA
+		case 0x8A: Op_TXA(0); break;
+
+		// TXS
+		case 0x9A: Op_TXS(0); break;
+
+		// TYA
+		case 0x98: Op_TYA(0); break;
+
+		default:
+			if(instructionSet == CMOS_65C02)
+				ExecCMOS(bus, operands, opcode);
+			else
+				Op_ILLEGAL(0);
+			break;
+	}
+}
+
+template<class Bus, class Operands>
+inline void mos6502::ExecCMOS(Bus& bus, Operands& operands, uint8_t opcode)
+{
+	switch(opcode)
+	{
+		// ADC, AND, CMP, EOR, LDA, ORA, SBC, STA (zp)
+		case 0x72: Alu_ADC(bus.Read(operands.Izp())); break;
+		case 0x32: Alu_AND(bus.Read(operands.Izp())); break;
+		case 0xD2: Alu_CMP(A, bus.Read(operands.Izp())); break;
+		case 0x52: Alu_EOR(bus.Read(operands.Izp())); break;
+		case 0xB2: A = SetNZ(bus.Read(operands.Izp())); break;
+		case 0x12: Alu_ORA(bus.Read(operands.Izp())); break;
+		case 0xF2: Alu_SBC(bus.Read(operands.Izp())); break;
+		case 0x92: bus.Write(operands.Izp(), A); break;
+
+		// BIT, the immediate form only sets Z
+		case 0x89: SET_ZERO((A & operands.Imm()) == 0); break;
+		case 0x34: Alu_BIT(ReadLow(bus, operands.Zex())); break;
+		case 0x3C: Alu_BIT(bus.Read(operands.Abx())); break;
+
+		// BRA
+		case 0x80: pc = operands.Rel(); break;
+
+		// DEC A
+		case 0x3A: A = Alu_DEC(A); break;
+
+		// INC A
+		case 0x1A: A = Alu_INC(A); break;
+
+		// JMP (abs,X)
+		case 0x7C: pc = operands.Iax(); break;
+
+		// PHX, PHY, PLX, PLY
+		case 0xDA: Push(bus, X); break;
+		case 0x5A: Push(bus, Y); break;
+		case 0xFA: X = SetNZ(Pop(bus)); break;
+		case 0x7A: Y = SetNZ(Pop(bus)); break;
+
+		// STZ
+		case 0x9C: bus.Write(operands.Abs(), 0); break;
+		case 0x64: WriteLow(bus, operands.Zer(), 0); break;
+		case 0x74: WriteLow(bus, operands.Zex(), 0); break;
+		case 0x9E: bus.Write(operands.Abx(), 0); break;
+
+		// TRB
+		case 0x1C: { uint16_t src = operands.Abs(); uint8_t m = bus.Read(src); SET_ZERO(!(m & A)); bus.Write(src, m & ~A); } break;
+		case 0x14: { uint16_t src = operands.Zer(); uint8_t m = ReadLow(bus, src); SET_ZERO(!(m & A)); WriteLow(bus, src, m & ~A); } break;
+
+		// TSB
+		case 0x0C: { uint16_t src = operands.Abs(); uint8_t m = bus.Read(src); SET_ZERO(!(m & A)); bus.Write(src, m | A); } break;
+		case 0x04: { uint16_t src = operands.Zer(); uint8_t m = ReadLow(bus, src); SET_ZERO(!(m & A)); WriteLow(bus, src, m | A); } break;
+
+		// WAI
+		case 0xCB: waiting = true; break;
+
+		// STP
+		case 0xDB: stopped = true; break;
+
+		default: Op_ILLEGAL(0); break;
+	}
+}
+
+template<class Bus>
+inline void mos6502::ExecFused(Bus& bus, uint8_t opcode)
+{
+	StreamOperands<Bus> operands{*this, bus};
+	ExecFused(bus, operands, opcode);
+}
+
+namespace mos6502_detail
+{
+	template<class Bus>
+	inline auto Decoded(Bus& bus, uint16_t address, int) -> decltype(bus.Decoded(address))
+	{
+		return bus.Decoded(address);
+	}
+
+	// buses without predecoded memory
+	template<class Bus>
+	inline const mos6502::DecodedInstr* Decoded(Bus&, uint16_t, long)
+	{
+		return nullptr;
+	}
+
+	template<class Bus>
+	inline auto Jit(Bus& bus, int) -> decltype(bus.Jit())
+	{
+		return bus.Jit();
+	}
+
+	// buses without a code translator
+	template<class Bus>
+	inline mos6502_jit* Jit(Bus&, long)
+	{
+		return nullptr;
+	}
+
+	template<class Bus>
+	inline auto Inspect(Bus& bus, uint16_t address, int) -> decltype(bus.Inspect(address))
+	{
+		return bus.Inspect(address);
+	}
+
+	// buses whose reads may have side effects
+	template<class Bus>
+	inline const mos6502::DecodedInstr* Inspect(Bus&, uint16_t, long)
+	{
+		return nullptr;
+	}
+
+	template<class Bus>
+	constexpr auto CanInspect(Bus& bus, int) -> decltype(bus.Inspect(0), bool())
+	{
+		return true;
+	}
+
+	template<class Bus>
+	constexpr bool CanInspect(Bus&, long)
+	{
+		return false;
+	}
+
+	// instructions that touch nothing but registers and flags besides
+	// reading memory
+	inline bool ReadsOnly(uint8_t opcode)
+	{
+		switch(opcode)
+		{
+			// LDA, LDX, LDY
+			case 0xA9: case 0xA5: case 0xB5: case 0xAD: case 0xBD: case 0xB9: case 0xA1: case 0xB1:
+			case 0xA2: case 0xA6: case 0xB6: case 0xAE: case 0xBE:
+			case 0xA0: case 0xA4: case 0xB4: case 0xAC: case 0xBC:
+			// AND, ORA, EOR
+			case 0x29: case 0x25: case 0x35: case 0x2D: case 0x3D: case 0x39: case 0x21: case 0x31:
+			case 0x09: case 0x05: case 0x15: case 0x0D: case 0x1D: case 0x19: case 0x01: case 0x11:
+			case 0x49: case 0x45: case 0x55: case 0x4D: case 0x5D: case 0x59: case 0x41: case 0x51:
+			// ADC, SBC
+			case 0x69: case 0x65: case 0x75: case 0x6D: case 0x7D: case 0x79: case 0x61: case 0x71:
+			case 0xE9: case 0xE5: case 0xF5: case 0xED: case 0xFD: case 0xF9: case 0xE1: case 0xF1:
+			// CMP, CPX, CPY, BIT
+			case 0xC9: case 0xC5: case 0xD5: case 0xCD: case 0xDD: case 0xD9: case 0xC1: case 0xD1:
+			case 0xE0: case 0xE4: case 0xEC:
+			case 0xC0: case 0xC4: case 0xCC:
+			case 0x24: case 0x2C:
+			// transfers, INX, INY, DEX, DEY
+			case 0xAA: case 0xA8: case 0x8A: case 0x98: case 0xBA: case 0x9A:
+			case 0xE8: case 0xC8: case 0xCA: case 0x88:
+			// CLC, SEC, CLV, CLD, SED, NOP
+			case 0x18: case 0x38: case 0xB8: case 0xD8: case 0xF8: case 0xEA:
+			// ASL, LSR, ROL, ROR on A
+			case 0x0A: case 0x4A: case 0x2A: case 0x6A:
+				return true;
+			default:
+				return false;
+		}
+	}
+}
+
+// Idle loops. A branch or JMP back over a short stretch of predecoded code
+// that only reads memory closes a loop whose passes can't change anything
+// but registers. Once a pass leaves every register as it found it, each
+// further pass does the same until the bus is written or an interrupt is
+// taken, so the passes left in the budget are counted instead of run. The
+// last, partial pass is still interpreted, leaving pc, the cycle count and
+// the bus exactly where stepping would. Delay loops that only count X or Y
+// down (or up) to zero are skipped the same way.
+
+template<class Bus>
+inline uint8_t mos6502::ClassifyLoop(
+	Bus& bus,
+	uint16_t start,
+	uint16_t branch,
+	int32_t& loopCycles,
+	uint8_t& counter
+) {
+	const int maxInstrs = 16;
+
+	loopCycles = 0;
+	counter = 0;
+
+	uint16_t address = start;
+	for(int count = 1; count <= maxInstrs; count++)
+	{
+		const DecodedInstr* decoded = mos6502_detail::Inspect(bus, address, 0);
+		if(!decoded)
+			return LOOP_NONE;
+		loopCycles += decoded->cycles;
+
+		if(address == branch)
+		{
+			// JMP abs or any conditional branch, back to the start
+			bool jumpsBack = (decoded->opcode == 0x4C || (decoded->opcode & 0x1F) == 0x10)
+				&& decoded->operand == start;
+			if(!jumpsBack)
+				return LOOP_NONE;
+
+			uint8_t first = mos6502_detail::Inspect(bus, start, 0)->opcode;
+			bool counting = first == 0xCA || first == 0x88 || first == 0xE8 || first == 0xC8;
+			if(count == 2 && decoded->opcode == 0xD0 && counting)
+			{
+				counter = first;
+				return LOOP_COUNTER;
+			}
+			return LOOP_IDLE;
+		}
+
+		if(!mos6502_detail::ReadsOnly(decoded->opcode))
+			return LOOP_NONE;
+
+		address += decoded->length;
+		if(address > branch || address < start)
+			return LOOP_NONE;
+	}
+
+	return LOOP_NONE;
+}
+
+inline bool mos6502::AtIdleLoop(uint64_t cycleCount) const
+{
+	return idleLoop.arrived
+		&& idleLoop.start == pc
+		&& idleLoop.cycleCount == cycleCount
+		&& idleLoop.A == A
+		&& idleLoop.X == X
+		&& idleLoop.Y == Y
+		&& idleLoop.sp == sp
+		&& idleLoop.status == Status();
+}
+
+// Called with pc just taken back by the instruction at branch and no
+// interrupt pending. Returns the cycles of the passes skipped.
+template<class Bus>
+inline int32_t mos6502::SkipIdleLoop(
+	Bus& bus,
+	uint16_t branch,
+	uint64_t cycleCount,
+	int32_t cyclesRemaining
+) {
+	IdleLoop& loop = idleLoop;
+
+	if(!loop.classified || loop.start != pc || loop.branch != branch)
+	{
+		loop.start = pc;
+		loop.branch = branch;
+		loop.kind = ClassifyLoop(bus, pc, branch, loop.cycles, loop.counter);
+		loop.classified = true;
+		loop.arrived = false;
+	}
+	if(loop.kind == LOOP_NONE)
+		return 0;
+
+	// whole passes that still leave a cycle to interpret
+	int32_t passes = (cyclesRemaining - 1) / loop.cycles;
+
+	if(loop.kind == LOOP_IDLE)
+	{
+		// a fixed point if exactly one pass ran since the last arrival
+		// and it left the registers alone
+		bool fixed = AtIdleLoop(cycleCount - loop.cycles);
+
+		loop.arrived = true;
+		loop.cycleCount = cycleCount;
+		loop.A = A;
+		loop.X = X;
+		loop.Y = Y;
+		loop.sp = sp;
+		loop.status = Status();
+
+		if(!fixed || passes <= 0)
+			return 0;
+	}
+	else
+	{
+		// passes to go before the BNE falls through, this one included
+		bool x = loop.counter == 0xCA || loop.counter == 0xE8;
+		bool down = loop.counter == 0xCA || loop.counter == 0x88;
+		uint8_t value = x ? X : Y;
+		int32_t left = down
+			? (value ? value : 256)
+			: 256 - value;
+		if(passes > left - 1)
+			passes = left - 1;
+		if(passes <= 0)
+			return 0;
+	}
+
+	// the code may have been rewritten since the loop was classified
+	int32_t loopCycles;
+	uint8_t counter;
+	if(ClassifyLoop(bus, loop.start, loop.branch, loopCycles, counter) != loop.kind)
+	{
+		loop.classified = false;
+		loop.arrived = false;
+		return 0;
+	}
+
+	int32_t skipped = passes * loop.cycles;
+	if(loop.kind == LOOP_IDLE)
+	{
+		loop.cycleCount += skipped;
+	}
+	else
+	{
+		uint8_t& value = loop.counter == 0xCA || loop.counter == 0xE8 ? X : Y;
+		bool down = loop.counter == 0xCA || loop.counter == 0x88;
+		value = down ? value - passes : value + passes;
+		SetNZ(value);
+	}
+	return skipped;
+}
+
+template<class Bus>
+void mos6502::Run(
+	Bus& bus,
+	int32_t cyclesRemaining,
+	uint64_t& cycleCount,
+	CycleMethod cycleMethod
+) {
+	// the table path is bound to the runtime callbacks
+	if(dispatchMethod == INSTR_TABLE && instructionSet == NMOS_6502 && ReadCallback && WriteCallback)
+	{
+		Run(cyclesRemaining, cycleCount, cycleMethod);
+		return;
+	}
+
+	uint8_t opcode;
+	uint8_t cycles;
+
+	mos6502_jit* jit = cycleMethod == CYCLE_COUNT && !CycleCallback
+		? mos6502_detail::Jit(bus, 0)
+		: nullptr;
+
+	const bool skipIdleLoops = cycleMethod == CYCLE_COUNT && !CycleCallback
+		&& mos6502_detail::CanInspect(bus, 0);
+
+	// a pass begun before this call may have read older inputs
+	if(!AtIdleLoop(cycleCount))
+		idleLoop.arrived = false;
+
+	// WAI ends on either interrupt line, taken or not
+	if(waiting && (irqLine || nmiPending))
+	{
+		waiting = false;
+		ServiceInterrupts(bus);
+	}
+
+	while(cyclesRemaining > 0 && !illegalOpcode && !waiting && !stopped)
+	{
+		// translated code runs while no interrupt can be taken at its
+		// instruction boundaries and ADC/SBC are binary
+		int32_t executed = 0;
+		int32_t loopBranch = -1;
+		if(jit && !nmiPending && !(irqLine && !IF_INTERRUPT()) && !IF_DECIMAL() && jit->MayExecute(pc))
+		{
+			executed = RunNative(*jit, cyclesRemaining, loopBranch);
+			cycleCount += executed;
+			cyclesRemaining -= executed;
+		}
+
+		if(executed == 0)
+		{
+			uint16_t address = pc;
+			const DecodedInstr* decoded = mos6502_detail::Decoded(bus, pc, 0);
+
+			if(decoded)
+			{
+				// predecoded, the operand bytes are skipped
+				pc += decoded->length;
+				cycles = decoded->cycles;
+
+				PredecodedOperands<Bus> operands{*this, bus, decoded->operand};
+				ExecFused(bus, operands, decoded->opcode);
+			}
+			else
+			{
+				// fetch
+				opcode = bus.Read(pc++);
+				cycles = instructionSet == NMOS_6502
+					? InstrTable[opcode].cycles
+					: CmosInstrCycles[opcode];
+
+				// decode and execute
+				ExecFused(bus, opcode);
+			}
+			cycleCount += cycles;
+			cyclesRemaining -=
+				cycleMethod == CYCLE_COUNT        ? cycles
+				/* cycleMethod == INST_COUNT */   : 1;
+
+			// run clock cycle callback
+			if (CycleCallback)
+				for(int i = 0; i < cycles; i++)
+					Cycle();
+
+			if(pc <= address)
+				loopBranch = address;
+		}
+
+		// a jump back may have closed an idle loop, translated code only
+		// reports the loops that may be
+		if(skipIdleLoops && loopBranch >= 0 && !nmiPending && !(irqLine && !IF_INTERRUPT()))
+		{
+			int32_t skipped = SkipIdleLoop(bus, (uint16_t)loopBranch, cycleCount, cyclesRemaining);
+			cycleCount += skipped;
+			cyclesRemaining -= skipped;
+		}
+
+		// sample the interrupt lines at the instruction boundary
+		if ((irqLine || nmiPending) && !illegalOpcode && !stopped)
+		{
+			waiting = false;
+			ServiceInterrupts(bus);
+		}
+	}
+
+	// time passes for a parked CPU all the same
+	if((waiting || stopped) && cyclesRemaining > 0 && cycleMethod == CYCLE_COUNT)
+		cycleCount += cyclesRemaining;
+}
+
+template<class Bus>
+void mos6502::ServiceInterrupts(Bus& bus)
+{
+	if(nmiPending)
+	{
+		nmiPending = false;
+		NMI(bus);
+	}
+	else if(irqLine)
+	{
+		IRQ(bus);
+	}
+}
+
+template<class Bus>
+void mos6502::Reset(Bus& bus)
+{
+	A = reset_A;
+	Y = reset_Y;
+	X = reset_X;
+
+	// load PC from reset vector
+	uint8_t pcl = bus.Read(rstVectorL);
+	uint8_t pch = bus.Read(rstVectorH);
+	pc = (pch << 8) + pcl;
+
+	sp = reset_sp;
+
+	SetStatus(reset_status | CONSTANT | BREAK);
+
+	illegalOpcode = false;
+	nmiPending = false;
+	waiting = false;
+	stopped = false;
+
+	idleLoop.classified = false;
+	idleLoop.arrived = false;
+}
+
+template<class Bus>
+void mos6502::IRQ(Bus& bus)
+{
+	if(!IF_INTERRUPT())
+	{
+		//SET_BREAK(0);
+		Push(bus, (pc >> 8) & 0xFF);
+		Push(bus, pc & 0xFF);
+		Push(bus, (Status() & ~BREAK) | CONSTANT);
+		SET_INTERRUPT(1);
+		if(instructionSet == CMOS_65C02)
+			SET_DECIMAL(0);
+
+		// load PC from interrupt request vector
+		uint8_t pcl = bus.Read(irqVectorL);
+		uint8_t pch = bus.Read(irqVectorH);
+		pc = (pch << 8) + pcl;
+	}
+}
+
+template<class Bus>
+void mos6502::NMI(Bus& bus)
+{
+	//SET_BREAK(0);
+	Push(bus, (pc >> 8) & 0xFF);
+	Push(bus, pc & 0xFF);
+	Push(bus, (Status() & ~BREAK) | CONSTANT);
+	SET_INTERRUPT(1);
+	if(instructionSet == CMOS_65C02)
+		SET_DECIMAL(0);
+
+	// load PC from non-maskable interrupt vector
+	uint8_t pcl = bus.Read(nmiVectorL);
+	uint8_t pch = bus.Read(nmiVectorH);
+	pc = (pch << 8) + pcl;
+}
+
+// the flag macros are private to the core unless the includer asks for them
+#ifndef MOS6502_CORE_KEEP_FLAG_MACROS
+#undef NEGATIVE
+#undef OVERFLOW
+#undef CONSTANT
+#undef BREAK
+#undef DECIMAL
+#undef INTERRUPT
+#undef ZERO
+#undef CARRY
+#undef SET_NEGATIVE
+#undef SET_OVERFLOW
+#undef SET_DECIMAL
+#undef SET_INTERRUPT
+#undef SET_ZERO
+#undef SET_CARRY
+#undef IF_NEGATIVE
+#undef IF_OVERFLOW
+#undef IF_CONSTANT
+#undef IF_BREAK
+#undef IF_DECIMAL
+#undef IF_INTERRUPT
+#undef IF_ZERO
+#undef IF_CARRY
+#endif
@@ -0,0 +1,137 @@
+//============================================================================
+// Name        : mos6502_jit
+// Description : Optional native code engine for mos6502. Basic blocks of
+//               ROM-resident code are translated to x86-64 and cached by
+//               entry PC. Translated code works on RAM, ROM and memory
+//               mapped I/O directly, jumps from block to block without
+//               returning, and hands control back to the interpreter for
+//               everything else: writes to ROM, interrupts, decimal mode,
+//               BRK, RTI, PLP, CLI, SED, JMP (ind) and illegal opcodes.
+//
+//               A bus opts in by providing
+//                   mos6502_jit* Jit();
+//               next to Read/Write, see mos6502_core.h. On hosts other
+//               than x86-64 nothing is ever translated and Run interprets
+//               as usual.
+//============================================================================
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(__EMSCRIPTEN__)
+#define MOS6502_JIT_X64
+#endif
+
+class mos6502_jit
+{
+public:
+	// How the bus maps memory. Addresses below ramSize are plain memory at
+	// ram, [romBase, romBase + romSize) is read-only memory at rom and
+	// [ioBase, ioBase + ioSize) is I/O read from io without side effects
+	// and written through ioWrite, which returns true when an interrupt
+	// may have to be taken after the write. Every other access is left to
+	// the interpreter. The bus latch is set to the last access, as the
+	// bus itself would.
+	struct MemoryMap
+	{
+		uint8_t* ram;
+		size_t ramSize;
+		const uint8_t* rom;
+		uint16_t romBase;
+		size_t romSize;
+		const uint8_t* io;
+		uint16_t ioBase;
+		size_t ioSize;
+		bool (*ioWrite)(void* context, uint16_t address, uint8_t value);
+		void* ioContext;
+		uint16_t* busAddress;
+		uint8_t* busData;
+		bool* busRw;
+	};
+
+	// registers handed in and out of Execute
+	struct State
+	{
+		uint16_t pc;
+		uint8_t A;
+		uint8_t X;
+		uint8_t Y;
+		uint8_t sp;
+		uint8_t status;
+	};
+
+	explicit mos6502_jit(const MemoryMap& map);
+	~mos6502_jit();
+	mos6502_jit(const mos6502_jit&) = delete;
+	mos6502_jit& operator=(const mos6502_jit&) = delete;
+
+	// whether translated code can run on this host at all
+	static bool IsSupported();
+
+	// Runs translated blocks from state.pc and returns the number of
+	// cycles they took. Like mos6502::Run it stops at the first
+	// instruction boundary where cycles are used up; 0 means the next
+	// instruction has to be interpreted. The caller makes sure no
+	// interrupt can be taken and decimal mode is off. While many cycles
+	// are left, a short loop that only reads memory stops after each pass
+	// with loopBranch set to the address of its jump back, so the caller
+	// can skip passes of an idle loop; loopBranch is -1 otherwise.
+	int32_t Execute(State& state, int32_t cycles, int32_t& loopBranch);
+
+	// false where Execute would return 0 right away, so the caller can
+	// skip handing it the registers
+	bool MayExecute(uint16_t pc) const
+	{
+		size_t index = (uint16_t)(pc - map.romBase);
+		return index < blocks.size() && (!blocks[index].translated || blocks[index].entry);
+	}
+
+	// drops the blocks translated from [address, address + size)
+	void Invalidate(uint16_t address, size_t size);
+	// drops every block, e.g. after a new image was loaded
+	void Flush();
+private:
+	// what translated code sees, pointed to by rbx
+	struct Frame
+	{
+		State state;
+		uint16_t busAddress;
+		uint8_t busData;
+		uint8_t busRw;
+		uint8_t* ram;
+		uintptr_t rom; // rom - romBase, indexed with the 6502 address
+		uintptr_t io;  // io - ioBase, likewise
+		const uint8_t* const* bodies;
+		bool (*ioWrite)(void* context, uint16_t address, uint8_t value);
+		void* ioContext;
+		int32_t cycles; // handed to the entry
+		int32_t loopBranch;
+	};
+
+	typedef int32_t (*BlockEntry)(Frame* frame, int32_t cycles);
+
+	struct Block
+	{
+		BlockEntry entry; // null if the first instruction isn't translatable
+		uint16_t size;    // bytes of ROM the block was translated from
+		bool translated;
+	};
+
+	MemoryMap map;
+	Frame frame;
+	std::vector<Block> blocks; // indexed by pc - romBase
+	// where a block continues when another one jumps to it, past the
+	// entry's prologue. Read by translated code, null until translated.
+	std::vector<const uint8_t*> bodies;
+
+	// executable arena, reset when full
+	uint8_t* code;
+	size_t codeCapacity;
+	size_t codeUsed;
+
+	BlockEntry Lookup(uint16_t pc);
+	void Translate(uint16_t pc, Block& block);
+	uint8_t* Install(const std::vector<uint8_t>& machineCode);
+};
@@ -0,0 +1,322 @@
+//============================================================================
+// Name        : mos6502_opcodes
+// Description : Opcode metadata for mos6502: mnemonic, addressing mode,
+//               length and base cycles of every NMOS 6502 and 65C02 opcode.
+//               Everything here is constexpr; the core builds its dispatch
+//               and cycle tables from it at compile time, and tools such
+//               as disassemblers or profilers can look opcodes up for free.
+//============================================================================
+
+#pragma once
+#include <stdint.h>
+#include <array>
+
+namespace mos6502_opcodes
+{
+	enum class Mnemonic : uint8_t
+	{
+		ILL, // undefined opcode
+		ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC,
+		CLD, CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP,
+		JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI,
+		RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+		// 65C02 only
+		BRA, PHX, PHY, PLX, PLY, STP, STZ, TRB, TSB, WAI,
+		COUNT
+	};
+
+	constexpr const char* MnemonicNames[(int)Mnemonic::COUNT] =
+	{
+		"???",
+		"ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRK", "BVC", "BVS", "CLC",
+		"CLD", "CLI", "CLV", "CMP", "CPX", "CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP",
+		"JSR", "LDA", "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL", "ROR", "RTI",
+		"RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA",
+		"BRA", "PHX", "PHY", "PLX", "PLY", "STP", "STZ", "TRB", "TSB", "WAI",
+	};
+
+	enum class Mode : uint8_t
+	{
+		IMP, // implied
+		ACC, // accumulator
+		IMM, // #imm
+		ZER, // zp
+		ZEX, // zp,X
+		ZEY, // zp,Y
+		ABS, // abs
+		ABX, // abs,X
+		ABY, // abs,Y
+		ABI, // (abs)
+		INX, // (zp,X)
+		INY, // (zp),Y
+		REL, // branch offset
+		IZP, // (zp), 65C02
+		IAX, // (abs,X), 65C02
+	};
+
+	// instruction sets an opcode exists in
+	enum Sets : uint8_t
+	{
+		NMOS = 0x01,
+		CMOS = 0x02,
+		BOTH = NMOS | CMOS
+	};
+
+	struct Opcode
+	{
+		Mnemonic mnemonic;
+		Mode mode;
+		uint8_t length; // in bytes, opcode included
+		uint8_t cycles; // base cycles, without page crossing or branch taken penalties
+		uint8_t sets;   // 0 for undefined opcodes
+	};
+
+	constexpr uint8_t Length(Mode mode)
+	{
+		switch(mode)
+		{
+			case Mode::IMP: case Mode::ACC:
+				return 1;
+			case Mode::ABS: case Mode::ABX: case Mode::ABY: case Mode::ABI: case Mode::IAX:
+				return 3;
+			default:
+				return 2;
+		}
+	}
+
+	namespace detail
+	{
+		struct Entry
+		{
+			uint8_t opcode;
+			Mnemonic mnemonic;
+			Mode mode;
+			uint8_t cycles;
+			uint8_t sets;
+		};
+
+#define MOS6502_OPCODE(opcode, mnemonic, mode, cycles, sets) \
+		Entry{ opcode, Mnemonic::mnemonic, Mode::mode, cycles, sets }
+
+		constexpr Entry entries[] =
+		{
+		MOS6502_OPCODE(0x00, BRK, IMP, 7, BOTH),
+		MOS6502_OPCODE(0x01, ORA, INX, 6, BOTH),
+		MOS6502_OPCODE(0x04, TSB, ZER, 5, CMOS),
+		MOS6502_OPCODE(0x05, ORA, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x06, ASL, ZER, 5, BOTH),
+		MOS6502_OPCODE(0x08, PHP, IMP, 3, BOTH),
+		MOS6502_OPCODE(0x09, ORA, IMM, 2, BOTH),
+		MOS6502_OPCODE(0x0A, ASL, ACC, 2, BOTH),
+		MOS6502_OPCODE(0x0C, TSB, ABS, 6, CMOS),
+		MOS6502_OPCODE(0x0D, ORA, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x0E, ASL, ABS, 6, BOTH),
+		MOS6502_OPCODE(0x10, BPL, REL, 2, BOTH),
+		MOS6502_OPCODE(0x11, ORA, INY, 5, BOTH),
+		MOS6502_OPCODE(0x12, ORA, IZP, 5, CMOS),
+		MOS6502_OPCODE(0x14, TRB, ZER, 5, CMOS),
+		MOS6502_OPCODE(0x15, ORA, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0x16, ASL, ZEX, 6, BOTH),
+		MOS6502_OPCODE(0x18, CLC, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x19, ORA, ABY, 4, BOTH),
+		MOS6502_OPCODE(0x1A, INC, ACC, 2, CMOS),
+		MOS6502_OPCODE(0x1C, TRB, ABS, 6, CMOS),
+		MOS6502_OPCODE(0x1D, ORA, ABX, 4, BOTH),
+		MOS6502_OPCODE(0x1E, ASL, ABX, 7, BOTH),
+		MOS6502_OPCODE(0x20, JSR, ABS, 6, BOTH),
+		MOS6502_OPCODE(0x21, AND, INX, 6, BOTH),
+		MOS6502_OPCODE(0x24, BIT, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x25, AND, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x26, ROL, ZER, 5, BOTH),
+		MOS6502_OPCODE(0x28, PLP, IMP, 4, BOTH),
+		MOS6502_OPCODE(0x29, AND, IMM, 2, BOTH),
+		MOS6502_OPCODE(0x2A, ROL, ACC, 2, BOTH),
+		MOS6502_OPCODE(0x2C, BIT, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x2D, AND, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x2E, ROL, ABS, 6, BOTH),
+		MOS6502_OPCODE(0x30, BMI, REL, 2, BOTH),
+		MOS6502_OPCODE(0x31, AND, INY, 5, BOTH),
+		MOS6502_OPCODE(0x32, AND, IZP, 5, CMOS),
+		MOS6502_OPCODE(0x34, BIT, ZEX, 4, CMOS),
+		MOS6502_OPCODE(0x35, AND, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0x36, ROL, ZEX, 6, BOTH),
+		MOS6502_OPCODE(0x38, SEC, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x39, AND, ABY, 4, BOTH),
+		MOS6502_OPCODE(0x3A, DEC, ACC, 2, CMOS),
+		MOS6502_OPCODE(0x3C, BIT, ABX, 4, CMOS),
+		MOS6502_OPCODE(0x3D, AND, ABX, 4, BOTH),
+		MOS6502_OPCODE(0x3E, ROL, ABX, 7, BOTH),
+		MOS6502_OPCODE(0x40, RTI, IMP, 6, BOTH),
+		MOS6502_OPCODE(0x41, EOR, INX, 6, BOTH),
+		MOS6502_OPCODE(0x45, EOR, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x46, LSR, ZER, 5, BOTH),
+		MOS6502_OPCODE(0x48, PHA, IMP, 3, BOTH),
+		MOS6502_OPCODE(0x49, EOR, IMM, 2, BOTH),
+		MOS6502_OPCODE(0x4A, LSR, ACC, 2, BOTH),
+		MOS6502_OPCODE(0x4C, JMP, ABS, 3, BOTH),
+		MOS6502_OPCODE(0x4D, EOR, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x4E, LSR, ABS, 6, BOTH),
+		MOS6502_OPCODE(0x50, BVC, REL, 2, BOTH),
+		MOS6502_OPCODE(0x51, EOR, INY, 5, BOTH),
+		MOS6502_OPCODE(0x52, EOR, IZP, 5, CMOS),
+		MOS6502_OPCODE(0x55, EOR, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0x56, LSR, ZEX, 6, BOTH),
+		MOS6502_OPCODE(0x58, CLI, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x59, EOR, ABY, 4, BOTH),
+		MOS6502_OPCODE(0x5A, PHY, IMP, 3, CMOS),
+		MOS6502_OPCODE(0x5D, EOR, ABX, 4, BOTH),
+		MOS6502_OPCODE(0x5E, LSR, ABX, 7, BOTH),
+		MOS6502_OPCODE(0x60, RTS, IMP, 6, BOTH),
+		MOS6502_OPCODE(0x61, ADC, INX, 6, BOTH),
+		MOS6502_OPCODE(0x64, STZ, ZER, 3, CMOS),
+		MOS6502_OPCODE(0x65, ADC, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x66, ROR, ZER, 5, BOTH),
+		MOS6502_OPCODE(0x68, PLA, IMP, 4, BOTH),
+		MOS6502_OPCODE(0x69, ADC, IMM, 2, BOTH),
+		MOS6502_OPCODE(0x6A, ROR, ACC, 2, BOTH),
+		MOS6502_OPCODE(0x6C, JMP, ABI, 5, BOTH),
+		MOS6502_OPCODE(0x6D, ADC, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x6E, ROR, ABS, 6, BOTH),
+		MOS6502_OPCODE(0x70, BVS, REL, 2, BOTH),
+		MOS6502_OPCODE(0x71, ADC, INY, 6, BOTH),
+		MOS6502_OPCODE(0x72, ADC, IZP, 5, CMOS),
+		MOS6502_OPCODE(0x74, STZ, ZEX, 4, CMOS),
+		MOS6502_OPCODE(0x75, ADC, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0x76, ROR, ZEX, 6, BOTH),
+		MOS6502_OPCODE(0x78, SEI, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x79, ADC, ABY, 4, BOTH),
+		MOS6502_OPCODE(0x7A, PLY, IMP, 4, CMOS),
+		MOS6502_OPCODE(0x7C, JMP, IAX, 6, CMOS),
+		MOS6502_OPCODE(0x7D, ADC, ABX, 4, BOTH),
+		MOS6502_OPCODE(0x7E, ROR, ABX, 7, BOTH),
+		MOS6502_OPCODE(0x80, BRA, REL, 3, CMOS),
+		MOS6502_OPCODE(0x81, STA, INX, 6, BOTH),
+		MOS6502_OPCODE(0x84, STY, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x85, STA, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x86, STX, ZER, 3, BOTH),
+		MOS6502_OPCODE(0x88, DEY, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x89, BIT, IMM, 2, CMOS),
+		MOS6502_OPCODE(0x8A, TXA, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x8C, STY, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x8D, STA, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x8E, STX, ABS, 4, BOTH),
+		MOS6502_OPCODE(0x90, BCC, REL, 2, BOTH),
+		MOS6502_OPCODE(0x91, STA, INY, 6, BOTH),
+		MOS6502_OPCODE(0x92, STA, IZP, 5, CMOS),
+		MOS6502_OPCODE(0x94, STY, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0x95, STA, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0x96, STX, ZEY, 4, BOTH),
+		MOS6502_OPCODE(0x98, TYA, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x99, STA, ABY, 5, BOTH),
+		MOS6502_OPCODE(0x9A, TXS, IMP, 2, BOTH),
+		MOS6502_OPCODE(0x9C, STZ, ABS, 4, CMOS),
+		MOS6502_OPCODE(0x9D, STA, ABX, 5, BOTH),
+		MOS6502_OPCODE(0x9E, STZ, ABX, 5, CMOS),
+		MOS6502_OPCODE(0xA0, LDY, IMM, 2, BOTH),
+		MOS6502_OPCODE(0xA1, LDA, INX, 6, BOTH),
+		MOS6502_OPCODE(0xA2, LDX, IMM, 2, BOTH),
+		MOS6502_OPCODE(0xA4, LDY, ZER, 3, BOTH),
+		MOS6502_OPCODE(0xA5, LDA, ZER, 3, BOTH),
+		MOS6502_OPCODE(0xA6, LDX, ZER, 3, BOTH),
+		MOS6502_OPCODE(0xA8, TAY, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xA9, LDA, IMM, 2, BOTH),
+		MOS6502_OPCODE(0xAA, TAX, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xAC, LDY, ABS, 4, BOTH),
+		MOS6502_OPCODE(0xAD, LDA, ABS, 4, BOTH),
+		MOS6502_OPCODE(0xAE, LDX, ABS, 4, BOTH),
+		MOS6502_OPCODE(0xB0, BCS, REL, 2, BOTH),
+		MOS6502_OPCODE(0xB1, LDA, INY, 5, BOTH),
+		MOS6502_OPCODE(0xB2, LDA, IZP, 5, CMOS),
+		MOS6502_OPCODE(0xB4, LDY, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0xB5, LDA, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0xB6, LDX, ZEY, 4, BOTH),
+		MOS6502_OPCODE(0xB8, CLV, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xB9, LDA, ABY, 4, BOTH),
+		MOS6502_OPCODE(0xBA, TSX, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xBC, LDY, ABX, 4, BOTH),
+		MOS6502_OPCODE(0xBD, LDA, ABX, 4, BOTH),
+		MOS6502_OPCODE(0xBE, LDX, ABY, 4, BOTH),
+		MOS6502_OPCODE(0xC0, CPY, IMM, 2, BOTH),
+		MOS6502_OPCODE(0xC1, CMP, INX, 6, BOTH),
+		MOS6502_OPCODE(0xC4, CPY, ZER, 3, BOTH),
+		MOS6502_OPCODE(0xC5, CMP, ZER, 3, BOTH),
+		MOS6502_OPCODE(0xC6, DEC, ZER, 5, BOTH),
+		MOS6502_OPCODE(0xC8, INY, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xC9, CMP, IMM, 2, BOTH),
+		MOS6502_OPCODE(0xCA, DEX, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xCB, WAI, IMP, 3, CMOS),
+		MOS6502_OPCODE(0xCC, CPY, ABS, 4, BOTH),
+		MOS6502_OPCODE(0xCD, CMP, ABS, 4, BOTH),
+		MOS6502_OPCODE(0xCE, DEC, ABS, 6, BOTH),
+		MOS6502_OPCODE(0xD0, BNE, REL, 2, BOTH),
+		MOS6502_OPCODE(0xD1, CMP, INY, 3, BOTH),
+		MOS6502_OPCODE(0xD2, CMP, IZP, 5, CMOS),
+		MOS6502_OPCODE(0xD5, CMP, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0xD6, DEC, ZEX, 6, BOTH),
+		MOS6502_OPCODE(0xD8, CLD, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xD9, CMP, ABY, 4, BOTH),
+		MOS6502_OPCODE(0xDA, PHX, IMP, 3, CMOS),
+		MOS6502_OPCODE(0xDB, STP, IMP, 3, CMOS),
+		MOS6502_OPCODE(0xDD, CMP, ABX, 4, BOTH),
+		MOS6502_OPCODE(0xDE, DEC, ABX, 7, BOTH),
+		MOS6502_OPCODE(0xE0, CPX, IMM, 2, BOTH),
+		MOS6502_OPCODE(0xE1, SBC, INX, 6, BOTH),
+		MOS6502_OPCODE(0xE4, CPX, ZER, 3, BOTH),
+		MOS6502_OPCODE(0xE5, SBC, ZER, 3, BOTH),
+		MOS6502_OPCODE(0xE6, INC, ZER, 5, BOTH),
+		MOS6502_OPCODE(0xE8, INX, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xE9, SBC, IMM, 2, BOTH),
+		MOS6502_OPCODE(0xEA, NOP, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xEC, CPX, ABS, 4, BOTH),
+		MOS6502_OPCODE(0xED, SBC, ABS, 4, BOTH),
+		MOS6502_OPCODE(0xEE, INC, ABS, 6, BOTH),
+		MOS6502_OPCODE(0xF0, BEQ, REL, 2, BOTH),
+		MOS6502_OPCODE(0xF1, SBC, INY, 5, BOTH),
+		MOS6502_OPCODE(0xF2, SBC, IZP, 5, CMOS),
+		MOS6502_OPCODE(0xF5, SBC, ZEX, 4, BOTH),
+		MOS6502_OPCODE(0xF6, INC, ZEX, 6, BOTH),
+		MOS6502_OPCODE(0xF8, SED, IMP, 2, BOTH),
+		MOS6502_OPCODE(0xF9, SBC, ABY, 4, BOTH),
+		MOS6502_OPCODE(0xFA, PLX, IMP, 4, CMOS),
+		MOS6502_OPCODE(0xFD, SBC, ABX, 4, BOTH),
+		MOS6502_OPCODE(0xFE, INC, ABX, 7, BOTH)
+		};
+
+#undef MOS6502_OPCODE
+
+		constexpr std::array<Opcode, 256> Build()
+		{
+			std::array<Opcode, 256> table{};
+			for(int i = 0; i < 256; i++)
+				table[i] = Opcode{ Mnemonic::ILL, Mode::IMP, 1, 0, 0 };
+			for(const Entry& e : entries)
+				table[e.opcode] = Opcode{ e.mnemonic, e.mode, Length(e.mode), e.cycles, e.sets };
+			return table;
+		}
+	}
+
+	// indexed by opcode, covering both instruction sets
+	constexpr std::array<Opcode, 256> Table = detail::Build();
+
+	// the opcode as the given instruction set sees it, undefined ones as ILL
+	constexpr Opcode Describe(uint8_t opcode, uint8_t set = NMOS)
+	{
+		return (Table[opcode].sets & set)
+			? Table[opcode]
+			: Opcode{ Mnemonic::ILL, Mode::IMP, 1, 0, 0 };
+	}
+
+	constexpr const char* Name(Mnemonic mnemonic)
+	{
+		return MnemonicNames[(int)mnemonic];
+	}
+
+	constexpr const char* Name(uint8_t opcode, uint8_t set = NMOS)
+	{
+		return Name(Describe(opcode, set).mnemonic);
+	}
+
+	static_assert(Table[0xA9].mnemonic == Mnemonic::LDA && Table[0xA9].length == 2, "");
+	static_assert(Table[0x6C].length == 3 && Table[0x6C].cycles == 5, "");
+	static_assert(Describe(0x80).mnemonic == Mnemonic::ILL && Describe(0x80, CMOS).cycles == 3, "");
+}
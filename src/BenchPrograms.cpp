@@ -0,0 +1,283 @@
+#include "BenchPrograms.hpp"
+#include "MiniAssembler.hpp"
+
+#include <stdio.h>
+
+namespace
+{
+    // Kernels end in an endless loop, the vectors at $FFFC point at start
+    // and irq. Addresses $7000-$706F are the GPIO registers on the node and
+    // plain memory on the flat bus.
+    const char* const aluKernel = R"(
+  .org $E000
+start:
+  ldx #0
+  ldy #0
+loop:
+  lda $10
+  clc
+  adc #$37
+  eor $11
+  sta $10
+  and #$F0
+  ora $12
+  asl a
+  rol $11
+  lsr a
+  ror $12
+  sec
+  sbc $10
+  sta $13
+  inx
+  dey
+  jmp loop
+irq:
+  rti
+  .org $FFFC
+  .word start
+  .word irq
+)";
+
+    const char* const branchKernel = R"(
+  .org $E000
+start:
+  ldy #0
+loop:
+  ldx #0
+inner:
+  txa
+  and #3
+  beq skip
+  cmp #2
+  bcc less
+  iny
+  bne next
+less:
+  dey
+  bpl next
+  nop
+skip:
+  nop
+next:
+  inx
+  bne inner
+  jmp loop
+irq:
+  rti
+  .org $FFFC
+  .word start
+  .word irq
+)";
+
+    const char* const indexedKernel = R"(
+src = $20
+ptrs = $30
+  .org $E000
+start:
+  lda #<table
+  sta src
+  lda #>table
+  sta src + 1
+loop:
+  ldx #0
+  ldy #0
+copy:
+  lda (src),y
+  clc
+  adc table,x
+  sta $80,x
+  lda $80,x
+  sta $0140,y
+  lda (ptrs,x)
+  ora $0140,x
+  inx
+  iny
+  cpy #64
+  bne copy
+  jmp loop
+irq:
+  rti
+table:
+  .byte $00, $03, $06, $09, $0C, $0F, $12, $15, $18, $1B, $1E, $21, $24, $27, $2A, $2D
+  .byte $30, $33, $36, $39, $3C, $3F, $42, $45, $48, $4B, $4E, $51, $54, $57, $5A, $5D
+  .byte $60, $63, $66, $69, $6C, $6F, $72, $75, $78, $7B, $7E, $81, $84, $87, $8A, $8D
+  .byte $90, $93, $96, $99, $9C, $9F, $A2, $A5, $A8, $AB, $AE, $B1, $B4, $B7, $BA, $BD
+  .org $FFFC
+  .word start
+  .word irq
+)";
+
+    const char* const stackKernel = R"(
+  .org $E000
+start:
+  ldx #0
+loop:
+  jsr outer
+  php
+  pha
+  pla
+  plp
+  jmp loop
+outer:
+  pha
+  txa
+  pha
+  jsr inner
+  pla
+  tax
+  pla
+  rts
+inner:
+  inx
+  tya
+  pha
+  pla
+  tay
+  rts
+irq:
+  rti
+  .org $FFFC
+  .word start
+  .word irq
+)";
+
+    const char* const decimalKernel = R"(
+  .org $E000
+start:
+  sed
+loop:
+  clc
+  lda $10
+  adc #$19
+  sta $10
+  lda $11
+  adc #$00
+  sta $11
+  sec
+  lda $12
+  sbc #$07
+  sta $12
+  lda $13
+  sbc #$00
+  sta $13
+  jmp loop
+irq:
+  rti
+  .org $FFFC
+  .word start
+  .word irq
+)";
+
+    // north and south out, east and west in with change interrupts
+    const char* const gpioKernel = R"(
+  .org $E000
+start:
+  lda #%0101
+  sta $7040
+  lda #$50
+  sta $7048
+  sta $7049
+  cli
+loop:
+  lda $7001
+  sta $7000
+  lda $7003
+  sta $7002
+  lda $7068
+  inc $7000
+  jmp loop
+irq:
+  pha
+  lda $7001
+  ora $7003
+  sta $7002
+  lda #%1010
+  sta $7068
+  pla
+  rti
+  .org $FFFC
+  .word start
+  .word irq
+)";
+
+    // Waits for the east pin the way most real firmware spends its time
+    const char* const idleKernel = R"(
+  .org $E000
+start:
+  lda #%0001
+  sta $7040
+wait:
+  lda $7001
+  beq wait
+  inc $7000
+release:
+  lda $7001
+  bne release
+  jmp wait
+irq:
+  rti
+  .org $FFFC
+  .word start
+  .word irq
+)";
+
+    bool addProgram(std::vector<BenchProgram>& programs, const char* name, const char* source)
+    {
+        MiniAssembler assembler(0x10000 - CodeNodeNano::ROM_SIZE, CodeNodeNano::ROM_SIZE);
+
+        if(!assembler.assemble(source))
+        {
+            fprintf(stderr, "Failed to assemble %s: %s\n", name, assembler.error().c_str());
+            return false;
+        }
+
+        programs.push_back({ name, assembler.image() });
+        return true;
+    }
+
+    bool addExample(std::vector<BenchProgram>& programs, const char* examplesDir, const char* name)
+    {
+        MiniAssembler assembler(0x10000 - CodeNodeNano::ROM_SIZE, CodeNodeNano::ROM_SIZE);
+        std::string filename = std::string(examplesDir) + "/" + name + ".s";
+
+        if(!assembler.assembleFile(filename.c_str()))
+        {
+            fprintf(stderr, "Failed to assemble example: %s\n", assembler.error().c_str());
+            return false;
+        }
+
+        programs.push_back({ name, assembler.image() });
+        return true;
+    }
+}
+
+bool loadBenchPrograms(const char* examplesDir, std::vector<BenchProgram>& programs)
+{
+    return
+        addExample(programs, examplesDir, "and-gate-counter") &&
+        addExample(programs, examplesDir, "rotating-signal") &&
+        addProgram(programs, "alu", aluKernel) &&
+        addProgram(programs, "branch", branchKernel) &&
+        addProgram(programs, "indexed", indexedKernel) &&
+        addProgram(programs, "stack", stackKernel) &&
+        addProgram(programs, "decimal", decimalKernel) &&
+        addProgram(programs, "gpio", gpioKernel) &&
+        addProgram(programs, "idle", idleKernel);
+}
+
+void printNodeLayout(FILE* out)
+{
+    constexpr size_t CACHE_LINE = 64;
+
+    fprintf(out, "sizeof(CodeNodeNano) %zu bytes, %zu cache lines, aligned to %zu\n",
+        sizeof(CodeNodeNano), (sizeof(CodeNodeNano) + CACHE_LINE - 1) / CACHE_LINE, alignof(CodeNodeNano));
+    fprintf(out, "sizeof(mos6502) %zu, per ROM image and shared: %zu image + %zu decoded\n",
+        sizeof(mos6502), CodeNodeNano::ROM_SIZE, CodeNodeNano::ROM_SIZE * sizeof(mos6502::DecodedInstr));
+    fprintf(out, "%-22s %6s %6s  %s\n", "part", "offset", "bytes", "cache lines");
+
+    for(const CodeNodeNano::LayoutEntry& entry : CodeNodeNano::memoryLayout())
+    {
+        fprintf(out, "%-22s %6zu %6zu  %zu-%zu\n", entry.name, entry.offset, entry.size,
+            entry.offset / CACHE_LINE, (entry.offset + entry.size - 1) / CACHE_LINE);
+    }
+}
@@ -1,148 +1,664 @@
 #include "CodeNodeNano.hpp"
+#include "mos6502_core.h"
 
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 
-CodeNodeNano::CodeNodeNano() :
-    cpu(read, write, cycle),
+namespace
+{
+    typedef std::vector<mos6502::DecodedInstr> DecodedROM;
+
+    // Decodings of shared ROM images, kept as long as a node uses them
+    template <size_t ROM_SIZE>
+    struct DecodingCache
+    {
+        typedef typename CNROMStore<ROM_SIZE>::Image ROMImage;
+
+        struct Entry
+        {
+            std::weak_ptr<const ROMImage> image;
+            std::weak_ptr<DecodedROM> decoded;
+        };
+
+        std::mutex mutex;
+        std::unordered_map<const ROMImage*, Entry> entries;
+        size_t liveAtLastSweep = 0;
+    };
+
+    template <size_t ROM_SIZE>
+    std::shared_ptr<DecodedROM> decodingOf(const std::shared_ptr<const typename CNROMStore<ROM_SIZE>::Image>& image)
+    {
+        static DecodingCache<ROM_SIZE> cache;
+        std::lock_guard<std::mutex> lock(cache.mutex);
+
+        // an image at the same address is only the same image while the
+        // entry's one is alive
+        auto found = cache.entries.find(image.get());
+        if(found != cache.entries.end() && found->second.image.lock() == image)
+        {
+            std::shared_ptr<DecodedROM> decoded = found->second.decoded.lock();
+            if(decoded)
+                return decoded;
+        }
+
+        if(cache.entries.size() >= 2 * cache.liveAtLastSweep + 16)
+        {
+            for(auto it = cache.entries.begin(); it != cache.entries.end();)
+                it = it->second.decoded.expired() ? cache.entries.erase(it) : std::next(it);
+            cache.liveAtLastSweep = cache.entries.size();
+        }
+
+        std::shared_ptr<DecodedROM> decoded = std::make_shared<DecodedROM>(ROM_SIZE);
+        mos6502::Predecode(image->bytes, ROM_SIZE, 0x10000 - ROM_SIZE, 0, ROM_SIZE, decoded->data());
+        cache.entries[image.get()] = { image, decoded };
+        return decoded;
+    }
+
+    // delta header: magic, version, reserved, base hash, result hash
+    constexpr size_t DELTA_HEADER_SIZE = 16;
+    // unchanged bytes shorter than this are sent along with the runs
+    // around them rather than splitting them
+    constexpr size_t DELTA_MIN_GAP = 4;
+
+    uint32_t hashBytes(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint32_t hash = 2166136261u; // FNV-1a
+        for(size_t i = 0; i < size; i++)
+            hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+
+    void putLittleEndian(std::vector<uint8_t>& out, uint32_t value, int bytes)
+    {
+        for(int i = 0; i < bytes; i++)
+            out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+
+    uint32_t getLittleEndian(const uint8_t* in, int bytes)
+    {
+        uint32_t value = 0;
+        for(int i = 0; i < bytes; i++)
+            value |= static_cast<uint32_t>(in[i]) << (i * 8);
+        return value;
+    }
+
+    void putVarint(std::vector<uint8_t>& out, size_t value)
+    {
+        while(value >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    bool getVarint(const uint8_t*& in, const uint8_t* end, size_t* value)
+    {
+        *value = 0;
+        for(int shift = 0; in < end && shift < 28; shift += 7)
+        {
+            uint8_t byte = *in++;
+            *value |= static_cast<size_t>(byte & 0x7F) << shift;
+            if((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::CodeNode() :
+    cpu(read, write, nullptr, this),
     cyclesCounter(0),
     cyclesTarget(0),
-    clockPaused(false)
+    busTracing(true),
+    clockPaused(false),
+    decoded(nullptr),
+    decodedShared(false)
 {
     poweredOn = false;
+    mappedROM = std::as_const(rom).data();
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::CodeNode(CodeNode&& other) :
+    cpu(other.cpu)
+{
+    *this = std::move(other);
 }
 
-void CodeNodeNano::tick()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+auto CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::operator=(CodeNode&& other) -> CodeNode&
+{
+    if(this == &other)
+        return *this;
+
+    cpu = other.cpu;
+    gpio = std::move(other.gpio);
+    ram = std::move(other.ram);
+    rom = std::move(other.rom);
+    cyclesCounter = other.cyclesCounter;
+    cyclesTarget = other.cyclesTarget;
+    m_busAddress = other.m_busAddress;
+    m_busData = other.m_busData;
+    m_busRw = other.m_busRw;
+    busTracing = other.busTracing;
+    poweredOn = other.poweredOn;
+    clockPaused = other.clockPaused;
+    decodedROM = std::move(other.decodedROM);
+    decodedShared = other.decodedShared;
+    decoded = decodedROM ? decodedROM->data() : nullptr;
+    other.decoded = nullptr;
+    lastCheckpoint = std::move(other.lastCheckpoint);
+    mappedROM = std::as_const(rom).data();
+
+    // translated code is bound to the memory of the node it came from
+    setJitEnabled(other.jit != nullptr);
+    other.jit.reset();
+
+    // the callbacks must keep pointing at this instance, not the source
+    cpu.SetContext(this);
+    return *this;
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::tick()
 {
     if(!poweredOn || clockPaused) return;
 
+    syncROM();
     cyclesTarget += CLOCK_FREQUENCY / GAME_TICK_RATE;
 
     gpio.tickInterrupts();
+    cpu.SetIRQLine(gpio.shouldInterrupt());
 
-    currentInstance = this;
-    cpu.Run(cyclesTarget - cyclesCounter, cyclesCounter);
+    // a CPU parked on WAI with no interrupt flag raised, or on STP, has
+    // nothing to run until the pins change
+    if((cpu.IsWaiting() && !cpu.GetIRQLine()) || cpu.IsStopped())
+    {
+        if(cyclesCounter < cyclesTarget)
+            cyclesCounter = cyclesTarget;
+    }
+    else
+    {
+        Bus bus{*this};
+        cpu.Run(bus, cyclesTarget - cyclesCounter, cyclesCounter);
+    }
 
     gpio.swapBuffers();
 }
 
-void CodeNodeNano::cycle()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::cycle()
 {
     if(!poweredOn) return;
 
+    syncROM();
     cyclesTarget += 1;
 
     if(cyclesTarget % (CLOCK_FREQUENCY / GAME_TICK_RATE) == 0)
         gpio.tickInterrupts();
+    cpu.SetIRQLine(gpio.shouldInterrupt());
 
-    currentInstance = this;
-    cpu.Run(cyclesTarget - cyclesCounter, cyclesCounter);
+    Bus bus{*this};
+    cpu.Run(bus, cyclesTarget - cyclesCounter, cyclesCounter);
     
     if(cyclesTarget % (CLOCK_FREQUENCY / GAME_TICK_RATE) == 0)
         gpio.swapBuffers();
 }
 
-void CodeNodeNano::reset()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::reset()
 {
-    currentInstance = this;
     ram.reset();
     // rom.reset();
     gpio.reset();
-    cpu.Reset();
+    syncROM();
+    predecodeROM();
+    if(jit)
+        jit->Flush();
+    cpu.SetIRQLine(false);
+    Bus bus{*this};
+    cpu.Reset(bus);
     cyclesCounter = 0;
     cyclesTarget = 0;
 }
 
-void CodeNodeNano::powerOn()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::powerOn()
 {
     poweredOn = true;
     reset();
 }
 
-void CodeNodeNano::powerOff()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::powerOff()
 {
     poweredOn = false;
 }
 
-bool CodeNodeNano::isPoweredOn() const
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+bool CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::isPoweredOn() const
 {
     return poweredOn;
 }
 
-mos6502& CodeNodeNano::CPU()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::setJitEnabled(bool enabled)
+{
+    if(!enabled || !mos6502_jit::IsSupported())
+    {
+        jit.reset();
+        return;
+    }
+
+    mos6502_jit::MemoryMap map;
+    map.ram = ram.data();
+    map.ramSize = RAM_SIZE;
+    map.rom = std::as_const(rom).data();
+    map.romBase = ROM_BASE;
+    map.romSize = ROM_SIZE;
+    map.io = gpio.registerData();
+    map.ioBase = GPIO_BASE;
+    map.ioSize = CNGPIO<GPIO_NUM_PINS>::REGISTER_PAGES * 256;
+    map.ioWrite = ioWrite;
+    map.ioContext = this;
+    map.busAddress = &m_busAddress;
+    map.busData = &m_busData;
+    map.busRw = &m_busRw;
+    jit.reset(new mos6502_jit(map));
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::saveSnapshot(Snapshot& snapshot) const
+{
+    // snapshots are copied and stored as raw bytes, so no padding may sneak in
+    static_assert(std::is_trivially_copyable<Snapshot>::value, "");
+    static_assert(sizeof(mos6502::State) == 14, "");
+    static_assert(sizeof(SnapshotHeader) == 8 + 16 + 2 + sizeof(mos6502::State), "");
+    static_assert(sizeof(Snapshot) == SNAPSHOT_GPIO_OFFSET + SNAPSHOT_GPIO_BACK_SIZE, "");
+
+    snapshot.magic = SNAPSHOT_MAGIC;
+    snapshot.version = SNAPSHOT_VERSION;
+    snapshot.flags =
+        (poweredOn ? SNAPSHOT_POWERED_ON : 0) |
+        (clockPaused ? SNAPSHOT_CLOCK_PAUSED : 0) |
+        (m_busRw ? SNAPSHOT_BUS_RW : 0);
+    snapshot.busData = m_busData;
+    snapshot.cyclesCounter = cyclesCounter;
+    snapshot.cyclesTarget = cyclesTarget;
+    snapshot.busAddress = m_busAddress;
+    cpu.GetState(snapshot.cpu);
+    memcpy(snapshot.ram, ram.data(), RAM_SIZE);
+    memcpy(snapshot.gpioRegisters, gpio.registerData(), sizeof(snapshot.gpioRegisters));
+    memcpy(snapshot.gpioBack, gpio.pvBackData(), GPIO_NUM_PINS);
+    memset(snapshot.gpioBack + GPIO_NUM_PINS, 0, SNAPSHOT_GPIO_BACK_SIZE - GPIO_NUM_PINS);
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+bool CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::loadSnapshot(const Snapshot& snapshot)
+{
+    if(snapshot.magic != SNAPSHOT_MAGIC || snapshot.version != SNAPSHOT_VERSION)
+        return false;
+
+    poweredOn = (snapshot.flags & SNAPSHOT_POWERED_ON) != 0;
+    clockPaused = (snapshot.flags & SNAPSHOT_CLOCK_PAUSED) != 0;
+    m_busRw = (snapshot.flags & SNAPSHOT_BUS_RW) != 0;
+    m_busData = snapshot.busData;
+    cyclesCounter = snapshot.cyclesCounter;
+    cyclesTarget = snapshot.cyclesTarget;
+    m_busAddress = snapshot.busAddress;
+    cpu.SetState(snapshot.cpu);
+    memcpy(ram.data(), snapshot.ram, RAM_SIZE);
+    gpio.restore(snapshot.gpioRegisters, snapshot.gpioBack);
+    return true;
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::encodeDelta(const Snapshot& base, const Snapshot& current, std::vector<uint8_t>& delta)
+{
+    const uint8_t* from = reinterpret_cast<const uint8_t*>(&base);
+    const uint8_t* to = reinterpret_cast<const uint8_t*>(&current);
+    const size_t size = sizeof(Snapshot);
+
+    putLittleEndian(delta, DELTA_MAGIC, 4);
+    putLittleEndian(delta, SNAPSHOT_VERSION, 2);
+    putLittleEndian(delta, 0, 2);
+    putLittleEndian(delta, hashBytes(from, size), 4);
+    putLittleEndian(delta, hashBytes(to, size), 4);
+
+    // runs of changed bytes, each as the number of unchanged bytes
+    // before it, its length and its new contents
+    size_t done = 0;
+    size_t i = 0;
+    while(i < size)
+    {
+        if(from[i] == to[i])
+        {
+            i++;
+            continue;
+        }
+
+        size_t end = i + 1;
+        while(end < size)
+        {
+            size_t gap = end;
+            while(gap < size && gap - end < DELTA_MIN_GAP && from[gap] == to[gap])
+                gap++;
+
+            if(gap == size || gap - end == DELTA_MIN_GAP)
+                break;
+            end = gap + 1;
+        }
+
+        putVarint(delta, i - done);
+        putVarint(delta, end - i);
+        delta.insert(delta.end(), to + i, to + end);
+        done = end;
+        i = end;
+    }
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+bool CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::applyDelta(Snapshot& snapshot, const uint8_t* delta, size_t size)
+{
+    if(size < DELTA_HEADER_SIZE ||
+        getLittleEndian(delta, 4) != DELTA_MAGIC ||
+        getLittleEndian(delta + 4, 2) != SNAPSHOT_VERSION ||
+        getLittleEndian(delta + 8, 4) != hashBytes(&snapshot, sizeof(Snapshot)))
+        return false;
+
+    Snapshot result = snapshot;
+    uint8_t* to = reinterpret_cast<uint8_t*>(&result);
+    const uint8_t* in = delta + DELTA_HEADER_SIZE;
+    const uint8_t* end = delta + size;
+    size_t offset = 0;
+
+    while(in < end)
+    {
+        size_t skip, length;
+        if(!getVarint(in, end, &skip) || !getVarint(in, end, &length))
+            return false;
+        if(skip > sizeof(Snapshot) - offset || length > sizeof(Snapshot) - offset - skip ||
+            length > static_cast<size_t>(end - in))
+            return false;
+
+        offset += skip;
+        memcpy(to + offset, in, length);
+        offset += length;
+        in += length;
+    }
+
+    if(getLittleEndian(delta + 12, 4) != hashBytes(&result, sizeof(Snapshot)))
+        return false;
+
+    snapshot = result;
+    return true;
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::checkpoint()
+{
+    if(!lastCheckpoint)
+        lastCheckpoint.reset(new Snapshot());
+    saveSnapshot(*lastCheckpoint);
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+uint32_t CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::dirtyRamPages() const
+{
+    static_assert(RAM_SIZE / RAM_PAGE_SIZE <= 32, "dirty pages must fit a uint32_t");
+    constexpr size_t numPages = RAM_SIZE / RAM_PAGE_SIZE;
+    uint32_t allPages = numPages == 32 ? ~0u : (1u << numPages) - 1;
+
+    if(!lastCheckpoint)
+        return allPages;
+
+    uint32_t dirty = 0;
+    for(size_t page = 0; page < numPages; page++)
+    {
+        size_t offset = page * RAM_PAGE_SIZE;
+        if(memcmp(ram.data() + offset, lastCheckpoint->ram + offset, RAM_PAGE_SIZE) != 0)
+            dirty |= 1u << page;
+    }
+    return dirty;
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+bool CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::isGpioDirty() const
+{
+    return !lastCheckpoint ||
+        memcmp(gpio.registerData(), lastCheckpoint->gpioRegisters, sizeof(lastCheckpoint->gpioRegisters)) != 0 ||
+        memcmp(gpio.pvBackData(), lastCheckpoint->gpioBack, GPIO_NUM_PINS) != 0;
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+bool CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::saveDelta(std::vector<uint8_t>& delta)
+{
+    if(!lastCheckpoint)
+        return false;
+
+    Snapshot current;
+    saveSnapshot(current);
+    encodeDelta(*lastCheckpoint, current, delta);
+    *lastCheckpoint = current;
+    return true;
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+bool CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::applyDelta(const uint8_t* delta, size_t size)
+{
+    Snapshot snapshot;
+    saveSnapshot(snapshot);
+    return applyDelta(snapshot, delta, size) && loadSnapshot(snapshot);
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+mos6502& CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::CPU()
 {
     return cpu;
 }
 
-CNGPIO<CodeNodeNano::GPIO_NUM_PINS>& CodeNodeNano::GPIO()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+auto CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::GPIO() -> CNGPIO<GPIO_NUM_PINS>&
 {
     return gpio;
 }
 
-CNRAM<CodeNodeNano::RAM_SIZE>& CodeNodeNano::RAM()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+auto CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::RAM() -> CNRAM<RAM_SIZE>&
 {
     return ram;
 }
 
-CNROM<CodeNodeNano::ROM_SIZE>& CodeNodeNano::ROM()
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+auto CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::ROM() -> CNROM<ROM_SIZE>&
 {
     return rom;
 }
 
-CodeNodeNano* CodeNodeNano::currentInstance = nullptr;
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+auto CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::memoryLayout() -> std::vector<LayoutEntry>
+{
+    std::unique_ptr<CodeNode> node(new CodeNode());
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(node.get());
+    auto offsetOf = [base](const void* member) {
+        return static_cast<size_t>(static_cast<const uint8_t*>(member) - base);
+    };
+
+    size_t clock = offsetOf(&node->cyclesCounter);
+    size_t gpioOffset = offsetOf(&node->gpio);
+    size_t ramOffset = offsetOf(&node->ram);
+    size_t coldOffset = offsetOf(&node->rom);
+
+    return {
+        { "cpu", offsetOf(&node->cpu), sizeof(mos6502) },
+        { "clock, bus and power", clock, gpioOffset - clock },
+        { "gpio", gpioOffset, ramOffset - gpioOffset },
+        { "zero page", ramOffset, 0x100 },
+        { "stack and up", ramOffset + 0x100, coldOffset - ramOffset - 0x100 },
+        { "cold", coldOffset, sizeof(CodeNode) - coldOffset },
+    };
+}
 
-uint8_t CodeNodeNano::read(uint16_t address)
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+uint8_t CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::busRead(uint16_t address)
 {
-    if(currentInstance == nullptr) return 0;
+    m_busAddress = address;
+    m_busRw = false;
 
-    currentInstance->m_busAddress = address;
-    currentInstance->m_busData = 0;
-    currentInstance->m_busRw = false;
+    switch(pageMap.device[address >> 8])
+    {
+        case PageMap::DEVICE_RAM:
+            return (m_busData = ram.data()[address]);
+        case PageMap::DEVICE_ROM:
+            return (m_busData = std::as_const(rom).data()[address - ROM_BASE]);
+        case PageMap::DEVICE_GPIO:
+            // the register pages are padded with zeros, see CNGPIO
+            return (m_busData = gpio.registerData()[address - GPIO_BASE]);
+        default:
+            return (m_busData = 0);
+    }
+}
 
-    if(0xFFFF - ROM_SIZE < address)
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::busWrite(uint16_t address, uint8_t value)
+{
+    m_busAddress = address;
+    m_busData = value;
+    m_busRw = true;
+
+    switch(pageMap.device[address >> 8])
     {
-        currentInstance->m_busData = currentInstance->rom.read(address - (0x10000 - ROM_SIZE));
-        return currentInstance->m_busData;
+        case PageMap::DEVICE_RAM:
+            ram.data()[address] = value;
+            break;
+        case PageMap::DEVICE_ROM:
+        {
+            uint16_t offset = address - ROM_BASE;
+            rom.write(offset, value);
+
+            // the byte may belong to any of the three instructions before it
+            if(!rom.isWriteProtected())
+            {
+                predecodeROM(offset < 2 ? 0 : offset - 2, offset + 1);
+                if(jit)
+                    jit->Invalidate(address, 1);
+            }
+            break;
+        }
+        case PageMap::DEVICE_GPIO:
+            gpio.write(address - GPIO_BASE, value);
+            // writes to GPIOIFL may release the interrupt line
+            cpu.SetIRQLine(gpio.shouldInterrupt());
+            break;
+        default:
+            break;
     }
-    else if(0x7000 <= address && address < (0x7000 + currentInstance->gpio.size()))
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+const mos6502::DecodedInstr* CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::busDecoded(uint16_t address)
+{
+    const mos6502::DecodedInstr* decoded = decodedAt(address);
+    if(decoded)
     {
-        currentInstance->m_busData = currentInstance->gpio.read(address - 0x7000);
-        return currentInstance->m_busData;
+        // leave the latch where the skipped fetches would have
+        m_busAddress = address + decoded->length - 1;
+        m_busData = rom.read(m_busAddress - ROM_BASE);
+        m_busRw = false;
     }
 
-    return (currentInstance->m_busData = currentInstance->ram.read(address));
+    return decoded;
 }
 
-void CodeNodeNano::write(uint16_t address, uint8_t value)
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+const mos6502::DecodedInstr* CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::decodedAt(uint16_t address) const
 {
-    if(currentInstance == nullptr) return;
+    if(0xFFFF - ROM_SIZE < address && decoded)
+    {
+        const mos6502::DecodedInstr& instr = decoded[address - ROM_BASE];
+        if(instr.length != 0)
+            return &instr;
+    }
 
-    currentInstance->m_busAddress = address;
-    currentInstance->m_busData = value;
-    currentInstance->m_busRw = true;
+    return nullptr;
+}
 
-    if(0xFFFF - ROM_SIZE < address)
-    {
-        currentInstance->rom.write(address - (0x10000 - ROM_SIZE), value);
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::syncROM()
+{
+    // loading an image or lifting write protection moves the ROM bytes
+    if(std::as_const(rom).data() == mappedROM)
         return;
+
+    mappedROM = std::as_const(rom).data();
+    if(jit)
+        setJitEnabled(true);
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::predecodeROM()
+{
+    auto image = rom.sharedImage();
+
+    if(image)
+    {
+        decodedROM = decodingOf<ROM_SIZE>(image);
+        decodedShared = true;
     }
-    else if(0x7000 <= address && address < (0x7000 + currentInstance->gpio.size()))
+    else
     {
-        currentInstance->gpio.write(address - 0x7000, value);
-        return;
+        decodedROM = std::make_shared<DecodedROM>(ROM_SIZE);
+        decodedShared = false;
+        predecodeROM(0, ROM_SIZE);
     }
 
+    decoded = decodedROM->data();
+}
+
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::predecodeROM(size_t begin, size_t end)
+{
+    if(!decodedROM)
+        return;
+
+    // the ROM has been written to, so it is a private copy by now
+    if(decodedShared)
+    {
+        decodedROM = std::make_shared<DecodedROM>(*decodedROM);
+        decodedShared = false;
+        decoded = decodedROM->data();
+    }
 
-    currentInstance->ram.write(address, value);
+    mos6502::Predecode(std::as_const(rom).data(), ROM_SIZE, ROM_BASE, begin, end, decodedROM->data());
 }
 
-void CodeNodeNano::cycle(mos6502* cpu)
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+uint8_t CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::read(void* context, uint16_t address)
 {
-    if(currentInstance == nullptr) return;
+    return static_cast<CodeNode*>(context)->busRead(address);
+}
 
-    bool shouldInterrupt = false;
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+void CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::write(void* context, uint16_t address, uint8_t value)
+{
+    static_cast<CodeNode*>(context)->busWrite(address, value);
+}
 
-    shouldInterrupt |= currentInstance->gpio.shouldInterrupt();
+template <size_t PINS, size_t RAM_BYTES, size_t ROM_BYTES, size_t CLOCK_HZ>
+bool CodeNode<PINS, RAM_BYTES, ROM_BYTES, CLOCK_HZ>::ioWrite(void* context, uint16_t address, uint8_t value)
+{
+    CodeNode* node = static_cast<CodeNode*>(context);
+    node->busWrite(address, value);
+    return node->cpu.GetIRQLine();
+}
 
-    if(shouldInterrupt)
-        cpu->IRQ();
-}
\ No newline at end of file
+template class CodeNode<64, 512, 8192, GAME_TICK_RATE * 40>;
+template class CodeNode<4, 512, 8192, GAME_TICK_RATE * 40>;
+template class CodeNode<64, 0x2000, 0x4000, GAME_TICK_RATE * 200>;
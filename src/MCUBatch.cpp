@@ -0,0 +1,1272 @@
+#include "MCUBatch.hpp"
+#include "mos6502_core.h"
+
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+    constexpr uint8_t FLAG_NEGATIVE = 0x80;
+    constexpr uint8_t FLAG_OVERFLOW = 0x40;
+    constexpr uint8_t FLAG_CONSTANT = 0x20;
+    constexpr uint8_t FLAG_BREAK = 0x10;
+    constexpr uint8_t FLAG_DECIMAL = 0x08;
+    constexpr uint8_t FLAG_INTERRUPT = 0x04;
+    constexpr uint8_t FLAG_ZERO = 0x02;
+    constexpr uint8_t FLAG_CARRY = 0x01;
+
+    // A PC shared by fewer than one in DIVERGED live lanes is not worth
+    // a pass over the whole batch per instruction
+    constexpr size_t DIVERGED = 4;
+
+    static_assert((MCUBatch::RAM_SIZE & (MCUBatch::RAM_SIZE - 1)) == 0,
+        "out-of-range lanes are folded back into RAM with a mask");
+
+    // Lane loops below store unconditionally and pick the old or new value
+    // with the group mask (0x00 or 0xFF), which keeps them vectorizable
+    inline uint8_t select(uint8_t mask, uint8_t value, uint8_t old)
+    {
+        return (value & mask) | (old & ~mask);
+    }
+
+    // the same for PCs and bus addresses, the mask sign-extended
+    inline uint16_t select16(uint8_t mask, uint16_t value, uint16_t old)
+    {
+        uint16_t wide = static_cast<uint16_t>(static_cast<int8_t>(mask));
+        return (value & wide) | (old & ~wide);
+    }
+
+    // true, with the value, if every lane of the group holds the same one
+    bool uniformIn(size_t n, const uint8_t* m, const uint8_t* reg, uint8_t& value)
+    {
+        uint8_t all = 0xFF;
+        uint8_t any = 0x00;
+        for(size_t l = 0; l < n; l++)
+        {
+            all &= reg[l] | ~m[l];
+            any |= reg[l] & m[l];
+        }
+        value = any;
+        return all == any;
+    }
+
+    inline uint8_t withNZ(uint8_t status, uint8_t value)
+    {
+        return (status & ~(FLAG_NEGATIVE | FLAG_ZERO)) | (value & FLAG_NEGATIVE) | (value ? 0 : FLAG_ZERO);
+    }
+
+    inline uint8_t withFlag(uint8_t status, uint8_t flag, bool set)
+    {
+        return (status & ~flag) | (set ? flag : 0);
+    }
+
+    enum LaneOp
+    {
+        LDA, LDX, LDY, STA, STX, STY,
+        AND, ORA, EOR, ADC, SBC, CMP, CPX, CPY, BIT,
+        ASL, LSR, ROL, ROR, INC, DEC,
+        ASL_ACC, LSR_ACC, ROL_ACC, ROR_ACC,
+        INC_X, INC_Y, DEC_X, DEC_Y, TAX, TAY, TXA, TYA, TSX, TXS,
+        CLC, SEC, CLI, SEI, CLV, CLD, SED, NOP,
+        BPL, BMI, BVC, BVS, BCC, BCS, BNE, BEQ,
+        JMP, JSR, RTS, PHA, PHP, PLA, PLP
+    };
+
+    // The batch's rows as one step sees them, group mask included. The
+    // lane loops take it by value: a byte store may alias anything whose
+    // address has been taken, so a loop reading its bound or rows through
+    // a pointer reloads them after every store and isn't vectorized.
+    struct Lanes
+    {
+        size_t n;
+        const uint8_t* m;
+        uint16_t* PC;
+        uint8_t* A;
+        uint8_t* X;
+        uint8_t* Y;
+        uint8_t* S;
+        uint8_t* P;
+        uint8_t* mem;
+        uint16_t* busAddress;
+        uint8_t* busData;
+        uint8_t* busRw;
+    };
+
+    inline auto rowOf(const uint8_t* row)
+    {
+        return [row](size_t l) { return row[l]; };
+    }
+
+    template<typename Value>
+    void setNZ(Lanes lanes, uint8_t* reg, Value value)
+    {
+        for(size_t l = 0; l < lanes.n; l++)
+        {
+            uint8_t v = value(l);
+            reg[l] = select(lanes.m[l], v, reg[l]);
+            lanes.P[l] = select(lanes.m[l], withNZ(lanes.P[l], v), lanes.P[l]);
+        }
+    }
+
+    void setFlag(Lanes lanes, uint8_t flag, bool set)
+    {
+        for(size_t l = 0; l < lanes.n; l++)
+            lanes.P[l] = select(lanes.m[l], withFlag(lanes.P[l], flag, set), lanes.P[l]);
+    }
+
+    void latch(Lanes lanes, uint16_t address, uint8_t data, uint8_t rw)
+    {
+        for(size_t l = 0; l < lanes.n; l++)
+        {
+            lanes.busAddress[l] = select16(lanes.m[l], address, lanes.busAddress[l]);
+            lanes.busData[l] = select(lanes.m[l], data, lanes.busData[l]);
+            lanes.busRw[l] = select(lanes.m[l], rw, lanes.busRw[l]);
+        }
+    }
+
+    // the latch as an access to a row leaves it, the row holding the data
+    void latchRow(Lanes lanes, uint16_t address, const uint8_t* row, uint8_t rw)
+    {
+        for(size_t l = 0; l < lanes.n; l++)
+        {
+            lanes.busAddress[l] = select16(lanes.m[l], address, lanes.busAddress[l]);
+            lanes.busData[l] = select(lanes.m[l], row[l], lanes.busData[l]);
+            lanes.busRw[l] = select(lanes.m[l], rw, lanes.busRw[l]);
+        }
+    }
+
+    void branch(Lanes lanes, uint8_t flag, bool set, uint16_t taken, uint16_t next)
+    {
+        for(size_t l = 0; l < lanes.n; l++)
+        {
+            bool take = ((lanes.P[l] & flag) != 0) == set;
+            lanes.PC[l] = select16(lanes.m[l], take ? taken : next, lanes.PC[l]);
+        }
+    }
+
+    void jump(Lanes lanes, uint16_t target)
+    {
+        for(size_t l = 0; l < lanes.n; l++)
+            lanes.PC[l] = select16(lanes.m[l], target, lanes.PC[l]);
+    }
+
+    // A group nearly always shares its stack pointer, the slot is then one
+    // row instead of a column per lane
+    template<typename Value>
+    void push(Lanes lanes, Value value)
+    {
+        const size_t n = lanes.n;
+        uint8_t sp;
+        if(uniformIn(n, lanes.m, lanes.S, sp))
+        {
+            uint16_t slot = 0x100 + sp;
+            uint8_t* row = lanes.mem + slot * n;
+            for(size_t l = 0; l < n; l++)
+            {
+                row[l] = select(lanes.m[l], value(l), row[l]);
+                lanes.S[l] = select(lanes.m[l], sp - 1, lanes.S[l]);
+            }
+            latchRow(lanes, slot, row, 1);
+            return;
+        }
+
+        for(size_t l = 0; l < n; l++)
+        {
+            uint16_t slot = 0x100 + lanes.S[l];
+            uint8_t v = value(l);
+            lanes.mem[slot * n + l] = select(lanes.m[l], v, lanes.mem[slot * n + l]);
+            lanes.busAddress[l] = select16(lanes.m[l], slot, lanes.busAddress[l]);
+            lanes.busData[l] = select(lanes.m[l], v, lanes.busData[l]);
+            lanes.busRw[l] = select(lanes.m[l], 1, lanes.busRw[l]);
+            lanes.S[l] = select(lanes.m[l], lanes.S[l] - 1, lanes.S[l]);
+        }
+    }
+
+    // pulls every lane into dst, only the group's stack pointers move
+    void pull(Lanes lanes, uint8_t* dst)
+    {
+        const size_t n = lanes.n;
+        uint8_t sp;
+        if(uniformIn(n, lanes.m, lanes.S, sp))
+        {
+            uint16_t slot = 0x100 + static_cast<uint8_t>(sp + 1);
+            const uint8_t* row = lanes.mem + slot * n;
+            for(size_t l = 0; l < n; l++)
+            {
+                dst[l] = row[l];
+                lanes.S[l] = select(lanes.m[l], sp + 1, lanes.S[l]);
+            }
+            latchRow(lanes, slot, row, 0);
+            return;
+        }
+
+        for(size_t l = 0; l < n; l++)
+        {
+            uint16_t slot = 0x100 + static_cast<uint8_t>(lanes.S[l] + 1);
+            dst[l] = lanes.mem[slot * n + l];
+            lanes.busAddress[l] = select16(lanes.m[l], slot, lanes.busAddress[l]);
+            lanes.busData[l] = select(lanes.m[l], dst[l], lanes.busData[l]);
+            lanes.busRw[l] = select(lanes.m[l], 0, lanes.busRw[l]);
+            lanes.S[l] = select(lanes.m[l], lanes.S[l] + 1, lanes.S[l]);
+        }
+    }
+
+    // Calls body with op's shift or step as a function of a value and the
+    // status it updates. The choice is made once, outside the lane loop
+    // body runs, so the loop itself has no branches.
+    template<typename Body>
+    void withShift(LaneOp op, Body body)
+    {
+        switch(op)
+        {
+            case ASL: case ASL_ACC:
+                body([](uint8_t v, uint8_t& status)
+                {
+                    status = withFlag(status, FLAG_CARRY, v & 0x80);
+                    return static_cast<uint8_t>(v << 1);
+                });
+                break;
+            case LSR: case LSR_ACC:
+                body([](uint8_t v, uint8_t& status)
+                {
+                    status = withFlag(status, FLAG_CARRY, v & 0x01);
+                    return static_cast<uint8_t>(v >> 1);
+                });
+                break;
+            case ROL: case ROL_ACC:
+                body([](uint8_t v, uint8_t& status)
+                {
+                    uint8_t carry = status & FLAG_CARRY;
+                    status = withFlag(status, FLAG_CARRY, v & 0x80);
+                    return static_cast<uint8_t>((v << 1) | carry);
+                });
+                break;
+            case ROR: case ROR_ACC:
+                body([](uint8_t v, uint8_t& status)
+                {
+                    uint8_t carry = status & FLAG_CARRY;
+                    status = withFlag(status, FLAG_CARRY, v & 0x01);
+                    return static_cast<uint8_t>((v >> 1) | (carry << 7));
+                });
+                break;
+            case INC:
+                body([](uint8_t v, uint8_t&) { return static_cast<uint8_t>(v + 1); });
+                break;
+            case DEC:
+                body([](uint8_t v, uint8_t&) { return static_cast<uint8_t>(v - 1); });
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Instructions with an operand, run with the operand accessors that
+    // fit the group: a RAM row shared by all lanes, each lane's own RAM
+    // column, or the full memory map when a lane touches GPIO, ROM or
+    // unmapped space. scratch takes a row of results.
+    template<typename Read, typename Write>
+    void execute(LaneOp op, Lanes lanes, uint8_t* scratch, Read read, Write write)
+    {
+        const size_t n = lanes.n;
+        const uint8_t* m = lanes.m;
+        uint8_t* A = lanes.A;
+        uint8_t* X = lanes.X;
+        uint8_t* Y = lanes.Y;
+        uint8_t* P = lanes.P;
+
+        switch(op)
+        {
+            case LDA: setNZ(lanes, A, read); break;
+            case LDX: setNZ(lanes, X, read); break;
+            case LDY: setNZ(lanes, Y, read); break;
+            case STA: write(rowOf(A)); break;
+            case STX: write(rowOf(X)); break;
+            case STY: write(rowOf(Y)); break;
+            case AND: setNZ(lanes, A, [=](size_t l) { return static_cast<uint8_t>(A[l] & read(l)); }); break;
+            case ORA: setNZ(lanes, A, [=](size_t l) { return static_cast<uint8_t>(A[l] | read(l)); }); break;
+            case EOR: setNZ(lanes, A, [=](size_t l) { return static_cast<uint8_t>(A[l] ^ read(l)); }); break;
+            // Decimal mode as mos6502::Alu_ADC and Alu_SBC have it, picked
+            // per lane: both results are computed and D selects one
+            case ADC:
+                for(size_t l = 0; l < n; l++)
+                {
+                    uint8_t value = read(l);
+                    uint8_t carry = P[l] & FLAG_CARRY;
+                    bool decimal = (P[l] & FLAG_DECIMAL) != 0;
+                    uint16_t sum = A[l] + value + carry;
+
+                    // Z follows the binary sum, N and V the low-adjusted one
+                    uint16_t adjusted = sum + (((A[l] & 0x0F) + (value & 0x0F) + carry) > 9 ? 6 : 0);
+                    uint16_t signs = decimal ? adjusted : sum;
+                    uint16_t result = decimal ? (adjusted > 0x99 ? adjusted + 96 : adjusted) : sum;
+
+                    uint8_t status = withNZ(P[l], static_cast<uint8_t>(sum)) & ~FLAG_NEGATIVE;
+                    status |= signs & FLAG_NEGATIVE;
+                    status = withFlag(status, FLAG_OVERFLOW, (~(A[l] ^ value) & (A[l] ^ signs) & 0x80) != 0);
+                    status = withFlag(status, FLAG_CARRY, result > (decimal ? 0x99 : 0xFF));
+                    A[l] = select(m[l], static_cast<uint8_t>(result), A[l]);
+                    P[l] = select(m[l], status, P[l]);
+                }
+                break;
+            case SBC:
+                for(size_t l = 0; l < n; l++)
+                {
+                    uint8_t value = read(l);
+                    uint8_t borrow = (P[l] & FLAG_CARRY) ? 0 : 1;
+                    bool decimal = (P[l] & FLAG_DECIMAL) != 0;
+                    uint16_t diff = A[l] - value - borrow;
+
+                    // flags other than C follow the binary difference
+                    uint16_t adjusted = diff - (((A[l] & 0x0F) - borrow) < (value & 0x0F) ? 6 : 0);
+                    adjusted = adjusted > 0x99 ? adjusted - 0x60 : adjusted;
+                    uint16_t result = decimal ? adjusted : diff;
+
+                    uint8_t status = withNZ(P[l], static_cast<uint8_t>(diff));
+                    status = withFlag(status, FLAG_OVERFLOW, ((A[l] ^ diff) & (A[l] ^ value) & 0x80) != 0);
+                    status = withFlag(status, FLAG_CARRY, result < 0x100);
+                    A[l] = select(m[l], static_cast<uint8_t>(result), A[l]);
+                    P[l] = select(m[l], status, P[l]);
+                }
+                break;
+            case CMP: case CPX: case CPY:
+            {
+                const uint8_t* reg = op == CMP ? A : op == CPX ? X : Y;
+                for(size_t l = 0; l < n; l++)
+                {
+                    uint8_t value = read(l);
+                    uint8_t result = reg[l] - value;
+                    uint8_t status = withFlag(withNZ(P[l], result), FLAG_CARRY, reg[l] >= value);
+                    P[l] = select(m[l], status, P[l]);
+                }
+                break;
+            }
+            case BIT:
+                for(size_t l = 0; l < n; l++)
+                {
+                    uint8_t value = read(l);
+                    uint8_t status = (P[l] & 0x3F) | (value & 0xC0) | FLAG_CONSTANT | FLAG_BREAK;
+                    status = withFlag(status, FLAG_ZERO, (value & A[l]) == 0);
+                    P[l] = select(m[l], status, P[l]);
+                }
+                break;
+            case ASL: case LSR: case ROL: case ROR: case INC: case DEC:
+            {
+                // results land in the scratch row first, the write below
+                // only keeps the group's
+                uint8_t* result = scratch;
+                withShift(op, [=](auto shift)
+                {
+                    for(size_t l = 0; l < n; l++)
+                    {
+                        uint8_t status = P[l];
+                        result[l] = shift(read(l), status);
+                        P[l] = select(m[l], withNZ(status, result[l]), P[l]);
+                    }
+                });
+                write(rowOf(result));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+MCUBatch::MCUBatch(size_t numLanes) :
+    numLanes(numLanes),
+    regPC(numLanes, 0),
+    regA(numLanes, 0),
+    regX(numLanes, 0),
+    regY(numLanes, 0),
+    regS(numLanes, 0),
+    regP(numLanes, 0),
+    irqLine(numLanes, 0),
+    cyclesCounter(numLanes, 0),
+    cyclesRemaining(numLanes, 0),
+    m_busAddress(numLanes, 0),
+    m_busData(numLanes, 0),
+    m_busRw(numLanes, 0),
+    ram(RAM_SIZE * numLanes, 0),
+    active(numLanes, 0),
+    groupMask(numLanes, 0),
+    operandAddress(numLanes, 0),
+    operandOffset(numLanes, 0),
+    scratch(numLanes * 2, 0),
+    cyclesTarget(numLanes, 0),
+    poweredOn(numLanes, 0),
+    clockPaused(numLanes, 0),
+    lockstep(numLanes, 0),
+    gpio(numLanes),
+    cpus(numLanes),
+    decoded(ROM_SIZE),
+    vectorCycles(0),
+    scalarCycles(0)
+{
+    mos6502::Predecode(std::as_const(rom).data(), ROM_SIZE, ROM_BASE, 0, ROM_SIZE, decoded.data());
+}
+
+void MCUBatch::loadROM(const uint8_t* data, size_t dataSize)
+{
+    rom.load(data, dataSize);
+    mos6502::Predecode(std::as_const(rom).data(), ROM_SIZE, ROM_BASE, 0, ROM_SIZE, decoded.data());
+}
+
+void MCUBatch::reset(size_t lane)
+{
+    for(size_t i = 0; i < RAM_SIZE; i++)
+        ram[i * numLanes + lane] = 0;
+    gpio[lane].reset();
+
+    LaneBus bus{*this, lane};
+    irqLine[lane] = 0;
+    cpus[lane].SetIRQLine(false);
+    cpus[lane].Reset(bus);
+    storeLane(lane);
+
+    cyclesCounter[lane] = 0;
+    cyclesTarget[lane] = 0;
+}
+
+void MCUBatch::powerOn(size_t lane)
+{
+    poweredOn[lane] = 1;
+    reset(lane);
+}
+
+void MCUBatch::saveSnapshot(size_t lane, Snapshot& snapshot) const
+{
+    snapshot.magic = CodeNodeNano::SNAPSHOT_MAGIC;
+    snapshot.version = CodeNodeNano::SNAPSHOT_VERSION;
+    snapshot.flags =
+        (poweredOn[lane] ? CodeNodeNano::SNAPSHOT_POWERED_ON : 0) |
+        (clockPaused[lane] ? CodeNodeNano::SNAPSHOT_CLOCK_PAUSED : 0) |
+        (m_busRw[lane] ? CodeNodeNano::SNAPSHOT_BUS_RW : 0);
+    snapshot.busData = m_busData[lane];
+    snapshot.cyclesCounter = cyclesCounter[lane];
+    snapshot.cyclesTarget = cyclesTarget[lane];
+    snapshot.busAddress = m_busAddress[lane];
+
+    // the core has everything but the registers and the IRQ line
+    cpus[lane].GetState(snapshot.cpu);
+    snapshot.cpu.pc = regPC[lane];
+    snapshot.cpu.A = regA[lane];
+    snapshot.cpu.X = regX[lane];
+    snapshot.cpu.Y = regY[lane];
+    snapshot.cpu.sp = regS[lane];
+    snapshot.cpu.status = regP[lane];
+    snapshot.cpu.flags = (snapshot.cpu.flags & ~mos6502::STATE_IRQ_LINE) |
+        (irqLine[lane] ? mos6502::STATE_IRQ_LINE : 0);
+
+    for(size_t i = 0; i < RAM_SIZE; i++)
+        snapshot.ram[i] = ram[i * numLanes + lane];
+    memcpy(snapshot.gpioRegisters, gpio[lane].registerData(), sizeof(snapshot.gpioRegisters));
+    memcpy(snapshot.gpioBack, gpio[lane].pvBackData(), GPIO_NUM_PINS);
+    memset(snapshot.gpioBack + GPIO_NUM_PINS, 0, sizeof(snapshot.gpioBack) - GPIO_NUM_PINS);
+}
+
+bool MCUBatch::loadSnapshot(size_t lane, const Snapshot& snapshot)
+{
+    if(snapshot.magic != CodeNodeNano::SNAPSHOT_MAGIC || snapshot.version != CodeNodeNano::SNAPSHOT_VERSION)
+        return false;
+
+    poweredOn[lane] = (snapshot.flags & CodeNodeNano::SNAPSHOT_POWERED_ON) != 0;
+    clockPaused[lane] = (snapshot.flags & CodeNodeNano::SNAPSHOT_CLOCK_PAUSED) != 0;
+    m_busRw[lane] = (snapshot.flags & CodeNodeNano::SNAPSHOT_BUS_RW) != 0;
+    m_busData[lane] = snapshot.busData;
+    cyclesCounter[lane] = snapshot.cyclesCounter;
+    cyclesTarget[lane] = snapshot.cyclesTarget;
+    m_busAddress[lane] = snapshot.busAddress;
+    cpus[lane].SetState(snapshot.cpu);
+    storeLane(lane);
+
+    for(size_t i = 0; i < RAM_SIZE; i++)
+        ram[i * numLanes + lane] = snapshot.ram[i];
+    gpio[lane].restore(snapshot.gpioRegisters, snapshot.gpioBack);
+    return true;
+}
+
+void MCUBatch::tick()
+{
+    const int32_t cyclesPerTick = CLOCK_FREQUENCY / GAME_TICK_RATE;
+
+    // same per-node preamble as CodeNodeNano::tick, lanes that can't run
+    // in lockstep run their whole tick on their own core
+    for(size_t l = 0; l < numLanes; l++)
+    {
+        active[l] = 0;
+        cyclesRemaining[l] = 0;
+        if(!poweredOn[l] || clockPaused[l])
+            continue;
+
+        cyclesTarget[l] += cyclesPerTick;
+        gpio[l].tickInterrupts();
+        irqLine[l] = gpio[l].shouldInterrupt();
+
+        cyclesRemaining[l] = static_cast<int32_t>(cyclesTarget[l] - cyclesCounter[l]);
+        if(lockstep[l])
+        {
+            active[l] = 0xFF;
+            continue;
+        }
+
+        mos6502& cpu = cpus[l];
+        if((cpu.IsWaiting() && !irqLine[l]) || cpu.IsStopped())
+        {
+            if(cyclesRemaining[l] > 0)
+                cyclesRemaining[l] = 0;
+        }
+        else
+            runScalar(l, cyclesRemaining[l], mos6502::CYCLE_COUNT);
+    }
+
+    // Lead with the lane furthest behind and take every lane at the same
+    // PC along with it. The leader is kept until its tick is done, which
+    // only changes the order lanes are stepped in, not their results.
+    size_t leader = numLanes;
+    while(true)
+    {
+        if(leader == numLanes || !active[leader] || cyclesRemaining[leader] <= 0)
+        {
+            leader = numLanes;
+            int32_t mostRemaining = 0;
+            for(size_t l = 0; l < numLanes; l++)
+            {
+                if(active[l] && cyclesRemaining[l] > mostRemaining)
+                {
+                    mostRemaining = cyclesRemaining[l];
+                    leader = l;
+                }
+            }
+
+            if(leader == numLanes)
+                break;
+        }
+
+        const uint16_t pc = regPC[leader];
+        const size_t n = numLanes;
+        const uint8_t* isActive = active.data();
+        const int32_t* remaining = cyclesRemaining.data();
+        const uint16_t* PC = regPC.data();
+        uint8_t* m = groupMask.data();
+        uint32_t groupSize = 0;
+        uint32_t numLive = 0;
+        for(size_t l = 0; l < n; l++)
+        {
+            uint8_t live = isActive[l] & (remaining[l] > 0 ? 0xFF : 0x00);
+            uint8_t inGroup = live & (PC[l] == pc ? 0xFF : 0x00);
+            m[l] = inGroup;
+            groupSize += inGroup & 1;
+            numLive += live & 1;
+        }
+
+        if(groupSize < 2 || groupSize * DIVERGED < numLive)
+        {
+            splitGroups(numLive);
+            continue;
+        }
+
+        if(!stepVector(pc, groupSize))
+        {
+            for(size_t l = 0; l < numLanes; l++)
+            {
+                if(!groupMask[l])
+                    continue;
+
+                runScalar(l, 1, mos6502::INST_COUNT);
+                if(!lockstep[l])
+                    finishScalar(l);
+            }
+        }
+    }
+
+    for(size_t l = 0; l < numLanes; l++)
+    {
+        if(!poweredOn[l] || clockPaused[l])
+            continue;
+
+        cyclesCounter[l] = cyclesTarget[l] - cyclesRemaining[l];
+        gpio[l].swapBuffers();
+    }
+}
+
+// Every live lane whose PC is shared by too few others finishes its tick
+// on its own core, the leader's group among them. One pass for all of
+// them keeps a batch that has come apart from costing a pass per lane.
+void MCUBatch::splitGroups(size_t numLive)
+{
+    std::unordered_map<uint16_t, size_t> lanesAt;
+    for(size_t l = 0; l < numLanes; l++)
+    {
+        if(active[l] && cyclesRemaining[l] > 0)
+            lanesAt[regPC[l]]++;
+    }
+
+    for(size_t l = 0; l < numLanes; l++)
+    {
+        if(!active[l] || cyclesRemaining[l] <= 0)
+            continue;
+
+        size_t count = lanesAt[regPC[l]];
+        if(count < 2 || count * DIVERGED < numLive)
+            finishScalar(l);
+    }
+}
+
+uint8_t MCUBatch::laneRead(size_t lane, uint16_t address)
+{
+    m_busAddress[lane] = address;
+    m_busRw[lane] = 0;
+
+    switch(pageMap.device[address >> 8])
+    {
+        case PageMap::DEVICE_RAM:
+            return (m_busData[lane] = ram[address * numLanes + lane]);
+        case PageMap::DEVICE_ROM:
+            return (m_busData[lane] = std::as_const(rom).data()[address - ROM_BASE]);
+        case PageMap::DEVICE_GPIO:
+            return (m_busData[lane] = gpio[lane].registerData()[address - GPIO_BASE]);
+        default:
+            return (m_busData[lane] = 0);
+    }
+}
+
+void MCUBatch::laneWrite(size_t lane, uint16_t address, uint8_t value)
+{
+    m_busAddress[lane] = address;
+    m_busData[lane] = value;
+    m_busRw[lane] = 1;
+
+    switch(pageMap.device[address >> 8])
+    {
+        case PageMap::DEVICE_RAM:
+            ram[address * numLanes + lane] = value;
+            break;
+        case PageMap::DEVICE_GPIO:
+            gpio[lane].write(address - GPIO_BASE, value);
+            // writes to GPIOIFL may release the interrupt line
+            irqLine[lane] = gpio[lane].shouldInterrupt();
+            cpus[lane].SetIRQLine(irqLine[lane] != 0);
+            break;
+        default:
+            // the firmware is shared by every lane, so ROM stays read-only
+            break;
+    }
+}
+
+const mos6502::DecodedInstr* MCUBatch::laneDecoded(size_t lane, uint16_t address)
+{
+    const mos6502::DecodedInstr* instr = decodedAt(address);
+    if(instr)
+    {
+        // leave the latch where the skipped fetches would have
+        m_busAddress[lane] = address + instr->length - 1;
+        m_busData[lane] = rom.read(m_busAddress[lane] - ROM_BASE);
+        m_busRw[lane] = 0;
+    }
+
+    return instr;
+}
+
+void MCUBatch::readDevice(uint16_t address, uint8_t* row) const
+{
+    switch(pageMap.device[address >> 8])
+    {
+        case PageMap::DEVICE_ROM:
+            memset(row, rom.read(address - ROM_BASE), numLanes);
+            break;
+        case PageMap::DEVICE_GPIO:
+            for(size_t l = 0; l < numLanes; l++)
+                row[l] = gpio[l].registerData()[address - GPIO_BASE];
+            break;
+        default:
+            memset(row, 0, numLanes);
+            break;
+    }
+}
+
+const mos6502::DecodedInstr* MCUBatch::decodedAt(uint16_t address) const
+{
+    if(0xFFFF - ROM_SIZE < address)
+    {
+        const mos6502::DecodedInstr& instr = decoded[address - ROM_BASE];
+        if(instr.length != 0)
+            return &instr;
+    }
+
+    return nullptr;
+}
+
+void MCUBatch::loadLane(size_t lane)
+{
+    mos6502& cpu = cpus[lane];
+    cpu.SetPC(regPC[lane]);
+    cpu.SetA(regA[lane]);
+    cpu.SetX(regX[lane]);
+    cpu.SetY(regY[lane]);
+    cpu.SetS(regS[lane]);
+    cpu.SetP(regP[lane]);
+    cpu.SetIRQLine(irqLine[lane] != 0);
+}
+
+void MCUBatch::storeLane(size_t lane)
+{
+    mos6502::State state;
+    cpus[lane].GetState(state);
+
+    regPC[lane] = state.pc;
+    regA[lane] = state.A;
+    regX[lane] = state.X;
+    regY[lane] = state.Y;
+    regS[lane] = state.sp;
+    regP[lane] = state.status;
+    irqLine[lane] = (state.flags & mos6502::STATE_IRQ_LINE) != 0;
+
+    const uint8_t offLockstep = mos6502::STATE_ILLEGAL_OPCODE | mos6502::STATE_WAITING |
+        mos6502::STATE_STOPPED | mos6502::STATE_NMI_PENDING;
+    lockstep[lane] = state.instructionSet == mos6502::NMOS_6502 && (state.flags & offLockstep) == 0
+        ? 0xFF : 0x00;
+}
+
+void MCUBatch::runScalar(size_t lane, int32_t budget, mos6502::CycleMethod cycleMethod)
+{
+    LaneBus bus{*this, lane};
+    cyclesCounter[lane] = cyclesTarget[lane] - cyclesRemaining[lane];
+    uint64_t cyclesBefore = cyclesCounter[lane];
+
+    loadLane(lane);
+    cpus[lane].Run(bus, budget, cyclesCounter[lane], cycleMethod);
+    storeLane(lane);
+
+    uint64_t cyclesRun = cyclesCounter[lane] - cyclesBefore;
+    cyclesRemaining[lane] -= static_cast<int32_t>(cyclesRun);
+    scalarCycles += cyclesRun;
+}
+
+void MCUBatch::finishScalar(size_t lane)
+{
+    active[lane] = 0;
+    if(cyclesRemaining[lane] > 0)
+        runScalar(lane, cyclesRemaining[lane], mos6502::CYCLE_COUNT);
+}
+
+MCUBatch::OperandPlace MCUBatch::resolveOperand(AddressMode mode, uint16_t operand, uint16_t& rowAddress)
+{
+    const size_t n = numLanes;
+    const uint8_t* m = groupMask.data();
+    const uint8_t* X = regX.data();
+    const uint8_t* Y = regY.data();
+    uint16_t* address = operandAddress.data();
+    uint32_t* offset = operandOffset.data();
+
+    // One address for the whole group, a row of the interleaved RAM. An
+    // indexed operand has one too when the group shares its index.
+    bool shared = mode == ZER || mode == ABS;
+    uint8_t index;
+    if((mode == ZEX || mode == ABX) && uniformIn(n, m, X, index))
+        shared = true;
+    else if((mode == ZEY || mode == ABY) && uniformIn(n, m, Y, index))
+        shared = true;
+    else
+        index = 0;
+
+    if(shared)
+    {
+        uint16_t ea = mode == ZEX || mode == ZEY ? (operand + index) & 0xFF : static_cast<uint16_t>(operand + index);
+        rowAddress = ea;
+        if(pageMap.device[ea >> 8] == PageMap::DEVICE_RAM)
+            return OPERAND_ROW;
+
+        for(size_t l = 0; l < n; l++)
+            address[l] = ea;
+        return OPERAND_DEVICE;
+    }
+
+    uint8_t outside = 0;
+    for(size_t l = 0; l < n; l++)
+    {
+        uint16_t ea = 0;
+
+        switch(mode)
+        {
+            case ZEX: ea = (operand + X[l]) & 0xFF; break;
+            case ZEY: ea = (operand + Y[l]) & 0xFF; break;
+            case ABX: ea = operand + X[l]; break;
+            case ABY: ea = operand + Y[l]; break;
+            case INX:
+            {
+                uint8_t zero = operand + X[l];
+                ea = ram[zero * n + l] | (ram[static_cast<uint8_t>(zero + 1) * n + l] << 8);
+                break;
+            }
+            case INY:
+            {
+                uint8_t zero = operand;
+                ea = ram[zero * n + l] | (ram[static_cast<uint8_t>(zero + 1) * n + l] << 8);
+                ea += Y[l];
+                break;
+            }
+            default:
+                break;
+        }
+
+        // lanes outside the group may point anywhere, fold them back into
+        // their own RAM column so the unconditional accesses stay in bounds
+        outside |= m[l] & (ea >= RAM_SIZE ? 0xFF : 0x00);
+        address[l] = ea;
+        offset[l] = (ea & (RAM_SIZE - 1)) * n + l;
+    }
+
+    return outside ? OPERAND_BUS : OPERAND_RAM;
+}
+
+bool MCUBatch::stepVector(uint16_t pc, size_t groupSize)
+{
+    // the group only shares an instruction when it comes from the ROM
+    const mos6502::DecodedInstr* instr = decodedAt(pc);
+    if(!instr)
+        return false;
+
+    const uint8_t opcode = instr->opcode;
+    const uint16_t operand = instr->operand;
+
+    LaneOp op;
+    AddressMode mode = IMP;
+
+    switch(opcode)
+    {
+        // LDA
+        case 0xA9: op = LDA; mode = IMM; break;
+        case 0xA5: op = LDA; mode = ZER; break;
+        case 0xB5: op = LDA; mode = ZEX; break;
+        case 0xAD: op = LDA; mode = ABS; break;
+        case 0xBD: op = LDA; mode = ABX; break;
+        case 0xB9: op = LDA; mode = ABY; break;
+        case 0xA1: op = LDA; mode = INX; break;
+        case 0xB1: op = LDA; mode = INY; break;
+
+        // LDX
+        case 0xA2: op = LDX; mode = IMM; break;
+        case 0xA6: op = LDX; mode = ZER; break;
+        case 0xB6: op = LDX; mode = ZEY; break;
+        case 0xAE: op = LDX; mode = ABS; break;
+        case 0xBE: op = LDX; mode = ABY; break;
+
+        // LDY
+        case 0xA0: op = LDY; mode = IMM; break;
+        case 0xA4: op = LDY; mode = ZER; break;
+        case 0xB4: op = LDY; mode = ZEX; break;
+        case 0xAC: op = LDY; mode = ABS; break;
+        case 0xBC: op = LDY; mode = ABX; break;
+
+        // STA
+        case 0x85: op = STA; mode = ZER; break;
+        case 0x95: op = STA; mode = ZEX; break;
+        case 0x8D: op = STA; mode = ABS; break;
+        case 0x9D: op = STA; mode = ABX; break;
+        case 0x99: op = STA; mode = ABY; break;
+        case 0x81: op = STA; mode = INX; break;
+        case 0x91: op = STA; mode = INY; break;
+
+        // STX
+        case 0x86: op = STX; mode = ZER; break;
+        case 0x96: op = STX; mode = ZEY; break;
+        case 0x8E: op = STX; mode = ABS; break;
+
+        // STY
+        case 0x84: op = STY; mode = ZER; break;
+        case 0x94: op = STY; mode = ZEX; break;
+        case 0x8C: op = STY; mode = ABS; break;
+
+        // AND
+        case 0x29: op = AND; mode = IMM; break;
+        case 0x25: op = AND; mode = ZER; break;
+        case 0x35: op = AND; mode = ZEX; break;
+        case 0x2D: op = AND; mode = ABS; break;
+        case 0x3D: op = AND; mode = ABX; break;
+        case 0x39: op = AND; mode = ABY; break;
+        case 0x21: op = AND; mode = INX; break;
+        case 0x31: op = AND; mode = INY; break;
+
+        // ORA
+        case 0x09: op = ORA; mode = IMM; break;
+        case 0x05: op = ORA; mode = ZER; break;
+        case 0x15: op = ORA; mode = ZEX; break;
+        case 0x0D: op = ORA; mode = ABS; break;
+        case 0x1D: op = ORA; mode = ABX; break;
+        case 0x19: op = ORA; mode = ABY; break;
+        case 0x01: op = ORA; mode = INX; break;
+        case 0x11: op = ORA; mode = INY; break;
+
+        // EOR
+        case 0x49: op = EOR; mode = IMM; break;
+        case 0x45: op = EOR; mode = ZER; break;
+        case 0x55: op = EOR; mode = ZEX; break;
+        case 0x4D: op = EOR; mode = ABS; break;
+        case 0x5D: op = EOR; mode = ABX; break;
+        case 0x59: op = EOR; mode = ABY; break;
+        case 0x41: op = EOR; mode = INX; break;
+        case 0x51: op = EOR; mode = INY; break;
+
+        // ADC
+        case 0x69: op = ADC; mode = IMM; break;
+        case 0x65: op = ADC; mode = ZER; break;
+        case 0x75: op = ADC; mode = ZEX; break;
+        case 0x6D: op = ADC; mode = ABS; break;
+        case 0x7D: op = ADC; mode = ABX; break;
+        case 0x79: op = ADC; mode = ABY; break;
+        case 0x61: op = ADC; mode = INX; break;
+        case 0x71: op = ADC; mode = INY; break;
+
+        // SBC
+        case 0xE9: op = SBC; mode = IMM; break;
+        case 0xE5: op = SBC; mode = ZER; break;
+        case 0xF5: op = SBC; mode = ZEX; break;
+        case 0xED: op = SBC; mode = ABS; break;
+        case 0xFD: op = SBC; mode = ABX; break;
+        case 0xF9: op = SBC; mode = ABY; break;
+        case 0xE1: op = SBC; mode = INX; break;
+        case 0xF1: op = SBC; mode = INY; break;
+
+        // CMP
+        case 0xC9: op = CMP; mode = IMM; break;
+        case 0xC5: op = CMP; mode = ZER; break;
+        case 0xD5: op = CMP; mode = ZEX; break;
+        case 0xCD: op = CMP; mode = ABS; break;
+        case 0xDD: op = CMP; mode = ABX; break;
+        case 0xD9: op = CMP; mode = ABY; break;
+        case 0xC1: op = CMP; mode = INX; break;
+        case 0xD1: op = CMP; mode = INY; break;
+
+        // CPX
+        case 0xE0: op = CPX; mode = IMM; break;
+        case 0xE4: op = CPX; mode = ZER; break;
+        case 0xEC: op = CPX; mode = ABS; break;
+
+        // CPY
+        case 0xC0: op = CPY; mode = IMM; break;
+        case 0xC4: op = CPY; mode = ZER; break;
+        case 0xCC: op = CPY; mode = ABS; break;
+
+        // BIT
+        case 0x24: op = BIT; mode = ZER; break;
+        case 0x2C: op = BIT; mode = ABS; break;
+
+        // ASL
+        case 0x0A: op = ASL_ACC; break;
+        case 0x06: op = ASL; mode = ZER; break;
+        case 0x16: op = ASL; mode = ZEX; break;
+        case 0x0E: op = ASL; mode = ABS; break;
+        case 0x1E: op = ASL; mode = ABX; break;
+
+        // LSR
+        case 0x4A: op = LSR_ACC; break;
+        case 0x46: op = LSR; mode = ZER; break;
+        case 0x56: op = LSR; mode = ZEX; break;
+        case 0x4E: op = LSR; mode = ABS; break;
+        case 0x5E: op = LSR; mode = ABX; break;
+
+        // ROL
+        case 0x2A: op = ROL_ACC; break;
+        case 0x26: op = ROL; mode = ZER; break;
+        case 0x36: op = ROL; mode = ZEX; break;
+        case 0x2E: op = ROL; mode = ABS; break;
+        case 0x3E: op = ROL; mode = ABX; break;
+
+        // ROR
+        case 0x6A: op = ROR_ACC; break;
+        case 0x66: op = ROR; mode = ZER; break;
+        case 0x76: op = ROR; mode = ZEX; break;
+        case 0x6E: op = ROR; mode = ABS; break;
+        case 0x7E: op = ROR; mode = ABX; break;
+
+        // INC
+        case 0xE6: op = INC; mode = ZER; break;
+        case 0xF6: op = INC; mode = ZEX; break;
+        case 0xEE: op = INC; mode = ABS; break;
+        case 0xFE: op = INC; mode = ABX; break;
+
+        // DEC
+        case 0xC6: op = DEC; mode = ZER; break;
+        case 0xD6: op = DEC; mode = ZEX; break;
+        case 0xCE: op = DEC; mode = ABS; break;
+        case 0xDE: op = DEC; mode = ABX; break;
+
+        // implied
+        case 0xE8: op = INC_X; break;
+        case 0xC8: op = INC_Y; break;
+        case 0xCA: op = DEC_X; break;
+        case 0x88: op = DEC_Y; break;
+        case 0xAA: op = TAX; break;
+        case 0xA8: op = TAY; break;
+        case 0x8A: op = TXA; break;
+        case 0x98: op = TYA; break;
+        case 0xBA: op = TSX; break;
+        case 0x9A: op = TXS; break;
+        case 0x18: op = CLC; break;
+        case 0x38: op = SEC; break;
+        case 0x58: op = CLI; break;
+        case 0x78: op = SEI; break;
+        case 0xB8: op = CLV; break;
+        case 0xD8: op = CLD; break;
+        case 0xF8: op = SED; break;
+        case 0xEA: op = NOP; break;
+
+        // branches
+        case 0x10: op = BPL; break;
+        case 0x30: op = BMI; break;
+        case 0x50: op = BVC; break;
+        case 0x70: op = BVS; break;
+        case 0x90: op = BCC; break;
+        case 0xB0: op = BCS; break;
+        case 0xD0: op = BNE; break;
+        case 0xF0: op = BEQ; break;
+
+        // jumps and stack
+        case 0x4C: op = JMP; break;
+        case 0x20: op = JSR; break;
+        case 0x60: op = RTS; break;
+        case 0x48: op = PHA; break;
+        case 0x08: op = PHP; break;
+        case 0x68: op = PLA; break;
+        case 0x28: op = PLP; break;
+
+        // BRK, RTI, JMP (ind) and illegal opcodes
+        default:
+            return false;
+    }
+
+    const size_t n = numLanes;
+    const uint8_t* m = groupMask.data();
+    const uint16_t* address = operandAddress.data();
+    const uint32_t* offset = operandOffset.data();
+
+    uint16_t* PC = regPC.data();
+    uint8_t* A = regA.data();
+    uint8_t* X = regX.data();
+    uint8_t* Y = regY.data();
+    uint8_t* S = regS.data();
+    uint8_t* P = regP.data();
+    uint8_t* mem = ram.data();
+    uint16_t* busAddress = m_busAddress.data();
+    uint8_t* busData = m_busData.data();
+    uint8_t* busRw = m_busRw.data();
+
+    OperandPlace place = OPERAND_ROW;
+    uint16_t rowAddress = operand;
+    if(mode != IMP && mode != IMM)
+        place = resolveOperand(mode, operand, rowAddress);
+
+    uint16_t length = instr->length;
+
+    const Lanes lanes = { n, m, PC, A, X, Y, S, P, mem, busAddress, busData, busRw };
+
+    // the latch as a fetch of the instruction's last byte leaves it
+    const uint16_t last = pc + length - 1;
+    const uint8_t lastByte = rom.read(last - ROM_BASE);
+    auto fetchLatch = [=]() { latch(lanes, last, lastByte, 0); };
+
+    auto branchOn = [=](uint8_t flag, bool set)
+    {
+        branch(lanes, flag, set, operand, pc + instr->length);
+        fetchLatch();
+    };
+
+    const uint8_t writes = op == STA || op == STX || op == STY ||
+        op == ASL || op == LSR || op == ROL || op == ROR || op == INC || op == DEC;
+
+    auto immediate = [=](size_t) { return static_cast<uint8_t>(operand); };
+    auto noWrite = [=](auto) {};
+
+    uint8_t* row = mem + (rowAddress & (RAM_SIZE - 1)) * n;
+    auto rowRead = [=](size_t l) { return row[l]; };
+    auto rowWrite = [=](auto value)
+    {
+        for(size_t l = 0; l < n; l++)
+            row[l] = select(m[l], value(l), row[l]);
+    };
+
+    auto ramRead = [=](size_t l) { return mem[offset[l]]; };
+    auto ramWrite = [=](auto value)
+    {
+        for(size_t l = 0; l < n; l++)
+            mem[offset[l]] = select(m[l], value(l), mem[offset[l]]);
+    };
+
+    // one access per group lane through its memory map, which sets its
+    // latch as CodeNodeNano's bus does
+    auto busRead = [=](size_t l) { return m[l] ? laneRead(l, address[l]) : static_cast<uint8_t>(0); };
+    auto busWrite = [=](auto value)
+    {
+        for(size_t l = 0; l < n; l++)
+        {
+            if(m[l])
+                laneWrite(l, address[l], value(l));
+        }
+    };
+
+    switch(op)
+    {
+        case ASL_ACC: case LSR_ACC: case ROL_ACC: case ROR_ACC:
+            withShift(op, [=](auto shift)
+            {
+                for(size_t l = 0; l < n; l++)
+                {
+                    uint8_t status = P[l];
+                    uint8_t value = shift(A[l], status);
+                    A[l] = select(m[l], value, A[l]);
+                    P[l] = select(m[l], withNZ(status, value), P[l]);
+                }
+            });
+            fetchLatch();
+            break;
+
+        case INC_X: setNZ(lanes, X, [=](size_t l) { return static_cast<uint8_t>(X[l] + 1); }); fetchLatch(); break;
+        case INC_Y: setNZ(lanes, Y, [=](size_t l) { return static_cast<uint8_t>(Y[l] + 1); }); fetchLatch(); break;
+        case DEC_X: setNZ(lanes, X, [=](size_t l) { return static_cast<uint8_t>(X[l] - 1); }); fetchLatch(); break;
+        case DEC_Y: setNZ(lanes, Y, [=](size_t l) { return static_cast<uint8_t>(Y[l] - 1); }); fetchLatch(); break;
+        case TAX: setNZ(lanes, X, rowOf(A)); fetchLatch(); break;
+        case TAY: setNZ(lanes, Y, rowOf(A)); fetchLatch(); break;
+        case TXA: setNZ(lanes, A, rowOf(X)); fetchLatch(); break;
+        case TYA: setNZ(lanes, A, rowOf(Y)); fetchLatch(); break;
+        case TSX: setNZ(lanes, X, rowOf(S)); fetchLatch(); break;
+        case TXS:
+            for(size_t l = 0; l < n; l++)
+                S[l] = select(m[l], X[l], S[l]);
+            fetchLatch();
+            break;
+
+        case CLC: setFlag(lanes, FLAG_CARRY, false); fetchLatch(); break;
+        case SEC: setFlag(lanes, FLAG_CARRY, true); fetchLatch(); break;
+        case CLI: setFlag(lanes, FLAG_INTERRUPT, false); fetchLatch(); break;
+        case SEI: setFlag(lanes, FLAG_INTERRUPT, true); fetchLatch(); break;
+        case CLV: setFlag(lanes, FLAG_OVERFLOW, false); fetchLatch(); break;
+        case CLD: setFlag(lanes, FLAG_DECIMAL, false); fetchLatch(); break;
+        case SED: setFlag(lanes, FLAG_DECIMAL, true); fetchLatch(); break;
+        case NOP: fetchLatch(); break;
+
+        case BPL: branchOn(FLAG_NEGATIVE, false); length = 0; break;
+        case BMI: branchOn(FLAG_NEGATIVE, true); length = 0; break;
+        case BVC: branchOn(FLAG_OVERFLOW, false); length = 0; break;
+        case BVS: branchOn(FLAG_OVERFLOW, true); length = 0; break;
+        case BCC: branchOn(FLAG_CARRY, false); length = 0; break;
+        case BCS: branchOn(FLAG_CARRY, true); length = 0; break;
+        case BNE: branchOn(FLAG_ZERO, false); length = 0; break;
+        case BEQ: branchOn(FLAG_ZERO, true); length = 0; break;
+
+        case JMP:
+            fetchLatch();
+            jump(lanes, operand);
+            length = 0;
+            break;
+
+        case JSR:
+        {
+            uint16_t ret = pc + length - 1;
+            push(lanes, [=](size_t) { return static_cast<uint8_t>(ret >> 8); });
+            push(lanes, [=](size_t) { return static_cast<uint8_t>(ret & 0xFF); });
+            jump(lanes, operand);
+            length = 0;
+            break;
+        }
+
+        case RTS:
+        {
+            uint8_t* lo = scratch.data();
+            uint8_t* hi = scratch.data() + n;
+            pull(lanes, lo);
+            pull(lanes, hi);
+            for(size_t l = 0; l < n; l++)
+                PC[l] = select16(m[l], ((hi[l] << 8) | lo[l]) + 1, PC[l]);
+            length = 0;
+            break;
+        }
+
+        case PHA: push(lanes, rowOf(A)); break;
+        case PHP: push(lanes, [=](size_t l) { return static_cast<uint8_t>(P[l] | FLAG_CONSTANT | FLAG_BREAK); }); break;
+        case PLA:
+        {
+            uint8_t* value = scratch.data();
+            pull(lanes, value);
+            setNZ(lanes, A, rowOf(value));
+            break;
+        }
+        case PLP:
+        {
+            uint8_t* value = scratch.data();
+            pull(lanes, value);
+            for(size_t l = 0; l < n; l++)
+                P[l] = select(m[l], value[l] | FLAG_CONSTANT | FLAG_BREAK, P[l]);
+            break;
+        }
+
+        default:
+            if(mode == IMM)
+            {
+                execute(op, lanes, scratch.data(), immediate, noWrite);
+                fetchLatch();
+            }
+            else if(place == OPERAND_ROW)
+            {
+                execute(op, lanes, scratch.data(), rowRead, rowWrite);
+                latchRow(lanes, rowAddress, row, writes);
+            }
+            else if(place == OPERAND_RAM)
+            {
+                execute(op, lanes, scratch.data(), ramRead, ramWrite);
+                for(size_t l = 0; l < n; l++)
+                {
+                    busAddress[l] = select16(m[l], address[l], busAddress[l]);
+                    busData[l] = select(m[l], mem[offset[l]], busData[l]);
+                    busRw[l] = select(m[l], writes, busRw[l]);
+                }
+            }
+            else if(place == OPERAND_DEVICE)
+            {
+                // GPIO registers have no side effects on a read, so they
+                // are gathered into a row up front; writes go to each lane
+                uint8_t* device = scratch.data() + n;
+                readDevice(rowAddress, device);
+                execute(op, lanes, scratch.data(), rowOf(device), busWrite);
+                if(!writes)
+                    latchRow(lanes, rowAddress, device, 0);
+            }
+            else
+                execute(op, lanes, scratch.data(), busRead, busWrite);
+            break;
+    }
+
+    if(length)
+        jump(lanes, pc + length);
+
+    // cyclesCounter catches up from this at the end of the tick
+    const uint8_t cycles = instr->cycles;
+    int32_t* remaining = cyclesRemaining.data();
+    for(size_t l = 0; l < n; l++)
+        remaining[l] -= cycles & m[l];
+    vectorCycles += static_cast<uint64_t>(cycles) * groupSize;
+
+    // same instruction boundary check as mos6502::Run, an IRQ is only
+    // taken with I clear. irqLine is 0 or 1, I is shifted down onto it.
+    static_assert(FLAG_INTERRUPT == 1 << 2, "I is bit 2");
+    const uint8_t* irq = irqLine.data();
+    uint8_t interrupted = 0;
+    for(size_t l = 0; l < n; l++)
+        interrupted |= m[l] & irq[l] & ~(P[l] >> 2);
+
+    if(interrupted)
+    {
+        for(size_t l = 0; l < n; l++)
+        {
+            if(m[l] && irqLine[l] && !(P[l] & FLAG_INTERRUPT))
+            {
+                LaneBus bus{*this, l};
+                loadLane(l);
+                cpus[l].IRQ(bus);
+                storeLane(l);
+            }
+        }
+    }
+
+    return true;
+}
@@ -1,6 +1,7 @@
 #include "MCUContext.hpp"
 
 #include <stdio.h>
+#include <vector>
 #include <glm/glm.hpp>
 
 #ifndef _WIN32
@@ -46,8 +47,7 @@ void MCUContext::update(float dt)
             return;
         }
 
-        uint8_t* pvFront = mcu.GPIO().pvFrontData();
-        uint8_t* pvBack = mcu.GPIO().pvBackData();
+        const uint8_t* pvFront = mcu.GPIO().pvFrontData();
         uint8_t dir = *mcu.GPIO().dirData();
         bool northPinIsInput = (dir & 0b0001) == 0;
         bool eastPinIsInput =  (dir & 0b0010) == 0;
@@ -59,10 +59,11 @@ void MCUContext::update(float dt)
         southOutput = southPinIsInput ? 0 : pvFront[2];
         westOutput =  westPinIsInput  ? 0 : pvFront[3];
 
-        pvFront[0] = northPinIsInput ? northPower() : pvFront[0];
-        pvFront[1] = eastPinIsInput  ? eastPower()  : pvFront[1];
-        pvFront[2] = southPinIsInput ? southPower() : pvFront[2];
-        pvFront[3] = westPinIsInput  ? westPower()  : pvFront[3];
+        // only inputs whose level changed are marked for the next tick
+        if(northPinIsInput) mcu.GPIO().setPin(0, northPower());
+        if(eastPinIsInput)  mcu.GPIO().setPin(1, eastPower());
+        if(southPinIsInput) mcu.GPIO().setPin(2, southPower());
+        if(westPinIsInput)  mcu.GPIO().setPin(3, westPower());
 
         mcu.tick();
         lastTickTime = time;
@@ -264,7 +265,9 @@ void MCUContext::uploadToMCU()
             return;
         }
 
-        file.read(reinterpret_cast<char*>(mcu.ROM().data()), size);
+        std::vector<uint8_t> image(size);
+        file.read(reinterpret_cast<char*>(image.data()), size);
+        mcu.ROM().load(image.data(), image.size());
     }
     else
     {
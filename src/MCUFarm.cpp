@@ -0,0 +1,51 @@
+#include "MCUFarm.hpp"
+
+#include <chrono>
+
+MCUFarm::MCUFarm(size_t numThreads) :
+    pool(numThreads),
+    grainSize(16)
+{
+    stats.wallTime = 0.0;
+    stats.numTicked = 0;
+}
+
+size_t MCUFarm::add()
+{
+    nodes.emplace_back(new CodeNodeNano());
+    return nodes.size() - 1;
+}
+
+void MCUFarm::remove(size_t index)
+{
+    nodes.erase(nodes.begin() + index);
+}
+
+void MCUFarm::clear()
+{
+    nodes.clear();
+}
+
+void MCUFarm::tick()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Only the state flags of idle nodes are read, their RAM, ROM and
+    // GPIO never get pulled into cache
+    runnable.clear();
+    for(std::unique_ptr<CodeNodeNano>& node : nodes)
+    {
+        if(node->isPoweredOn() && !node->isClockPaused())
+            runnable.push_back(node.get());
+    }
+
+    pool.parallelFor(runnable.size(), grainSize, [this](size_t begin, size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+            runnable[i]->tick();
+    });
+
+    auto end = std::chrono::steady_clock::now();
+    stats.wallTime = std::chrono::duration<double>(end - start).count();
+    stats.numTicked = runnable.size();
+}
@@ -0,0 +1,459 @@
+#include "MiniAssembler.hpp"
+#include "mos6502_opcodes.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+    using mos6502_opcodes::Mnemonic;
+    using mos6502_opcodes::Mode;
+
+    bool isIdentifierStart(char c)
+    {
+        return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool isIdentifierChar(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    std::string trim(const std::string& text)
+    {
+        size_t begin = text.find_first_not_of(" \t\r");
+        if(begin == std::string::npos)
+            return "";
+        size_t end = text.find_last_not_of(" \t\r");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    std::string toLower(std::string text)
+    {
+        for(char& c : text)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return text;
+    }
+
+    bool endsWith(const std::string& text, const char* suffix)
+    {
+        size_t length = strlen(suffix);
+        return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+    }
+
+    bool findMnemonic(const std::string& name, Mnemonic* mnemonic)
+    {
+        for(int i = 1; i < (int)Mnemonic::COUNT; i++)
+        {
+            if(name == mos6502_opcodes::MnemonicNames[i])
+            {
+                *mnemonic = static_cast<Mnemonic>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool findOpcode(Mnemonic mnemonic, Mode mode, uint8_t* opcode)
+    {
+        for(int i = 0; i < 256; i++)
+        {
+            const mos6502_opcodes::Opcode& op = mos6502_opcodes::Table[i];
+            if(op.sets != 0 && op.mnemonic == mnemonic && op.mode == mode)
+            {
+                *opcode = static_cast<uint8_t>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool hasMode(Mnemonic mnemonic, Mode mode)
+    {
+        uint8_t opcode;
+        return findOpcode(mnemonic, mode, &opcode);
+    }
+}
+
+MiniAssembler::MiniAssembler(uint16_t origin, size_t size) :
+    origin(origin),
+    rom(size, 0),
+    pc(origin),
+    line(0),
+    finalPass(false)
+{
+}
+
+bool MiniAssembler::assemble(const std::string& source)
+{
+    symbols.clear();
+    wideOperands.clear();
+    errorMessage.clear();
+
+    finalPass = false;
+    if(!assemblePass(source))
+        return false;
+
+    finalPass = true;
+    return assemblePass(source);
+}
+
+bool MiniAssembler::assembleFile(const char* filename)
+{
+    std::ifstream file(filename);
+
+    if(!file.good())
+    {
+        errorMessage = std::string("failed to open \"") + filename + "\"";
+        return false;
+    }
+
+    std::stringstream source;
+    source << file.rdbuf();
+
+    if(!assemble(source.str()))
+    {
+        errorMessage = std::string(filename) + ":" + errorMessage;
+        return false;
+    }
+
+    return true;
+}
+
+bool MiniAssembler::assemblePass(const std::string& source)
+{
+    std::istringstream lines(source);
+    std::string text;
+    size_t instruction = 0;
+
+    std::fill(rom.begin(), rom.end(), 0);
+    pc = origin;
+    line = 0;
+
+    while(std::getline(lines, text))
+    {
+        line++;
+        if(!assembleLine(text, &instruction))
+            return false;
+    }
+
+    return true;
+}
+
+bool MiniAssembler::assembleLine(std::string text, size_t* instruction)
+{
+    size_t comment = text.find(';');
+    if(comment != std::string::npos)
+        text.erase(comment);
+    text = trim(text);
+
+    // label: or name = value
+    size_t nameEnd = 0;
+    while(nameEnd < text.size() && isIdentifierChar(text[nameEnd]))
+        nameEnd++;
+
+    if(nameEnd > 0 && isIdentifierStart(text[0]))
+    {
+        std::string name = text.substr(0, nameEnd);
+        std::string rest = trim(text.substr(nameEnd));
+
+        if(!rest.empty() && rest[0] == ':')
+        {
+            if(!defineSymbol(name, pc))
+                return false;
+            text = trim(rest.substr(1));
+        }
+        else if(!rest.empty() && rest[0] == '=')
+        {
+            uint16_t value;
+            bool known;
+            if(!evaluate(rest.substr(1), &value, &known))
+                return false;
+            if(!known)
+                return fail("symbol " + name + " depends on an undefined symbol");
+            return defineSymbol(name, value);
+        }
+    }
+
+    if(text.empty())
+        return true;
+
+    size_t split = text.find_first_of(" \t");
+    std::string mnemonicName = toLower(text.substr(0, split));
+    std::string operand;
+
+    // operands never contain spaces that matter
+    if(split != std::string::npos)
+    {
+        for(char c : text.substr(split))
+        {
+            if(c != ' ' && c != '\t')
+                operand += c;
+        }
+    }
+
+    uint16_t value = 0;
+    bool known = true;
+
+    if(mnemonicName == ".org")
+    {
+        if(!evaluate(operand, &value, &known))
+            return false;
+        if(!known)
+            return fail(".org needs a defined address");
+        pc = value;
+        return true;
+    }
+
+    if(mnemonicName == ".byte" || mnemonicName == ".word")
+    {
+        std::stringstream values(operand);
+        std::string item;
+
+        while(std::getline(values, item, ','))
+        {
+            if(!evaluate(item, &value, &known))
+                return false;
+            if(!emit(value & 0xFF))
+                return false;
+            if(mnemonicName == ".word" && !emit(value >> 8))
+                return false;
+        }
+        return true;
+    }
+
+    Mnemonic mnemonic;
+    std::string upper = mnemonicName;
+    for(char& c : upper)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+    if(!findMnemonic(upper, &mnemonic))
+        return fail("unknown instruction " + mnemonicName);
+
+    std::string lower = toLower(operand);
+    std::string expression = operand;
+    Mode mode;
+    Mode wideMode = Mode::IMP;
+    bool sized = false; // zero page or absolute, decided below
+
+    if(lower.empty() || lower == "a")
+        mode = hasMode(mnemonic, Mode::ACC) ? Mode::ACC : Mode::IMP;
+    else if(lower[0] == '#')
+    {
+        mode = Mode::IMM;
+        expression = operand.substr(1);
+    }
+    else if(lower[0] == '(' && endsWith(lower, ",x)"))
+    {
+        mode = hasMode(mnemonic, Mode::IAX) ? Mode::IAX : Mode::INX;
+        expression = operand.substr(1, operand.size() - 4);
+    }
+    else if(lower[0] == '(' && endsWith(lower, "),y"))
+    {
+        mode = Mode::INY;
+        expression = operand.substr(1, operand.size() - 4);
+    }
+    else if(lower[0] == '(' && endsWith(lower, ")"))
+    {
+        mode = hasMode(mnemonic, Mode::ABI) ? Mode::ABI : Mode::IZP;
+        expression = operand.substr(1, operand.size() - 2);
+    }
+    else if(hasMode(mnemonic, Mode::REL))
+        mode = Mode::REL;
+    else if(endsWith(lower, ",x"))
+    {
+        mode = Mode::ZEX;
+        wideMode = Mode::ABX;
+        sized = true;
+        expression = operand.substr(0, operand.size() - 2);
+    }
+    else if(endsWith(lower, ",y"))
+    {
+        mode = Mode::ZEY;
+        wideMode = Mode::ABY;
+        sized = true;
+        expression = operand.substr(0, operand.size() - 2);
+    }
+    else
+    {
+        mode = Mode::ZER;
+        wideMode = Mode::ABS;
+        sized = true;
+    }
+
+    if(mode != Mode::IMP && mode != Mode::ACC && !evaluate(expression, &value, &known))
+        return false;
+
+    if(sized)
+    {
+        if(!finalPass)
+            wideOperands.push_back(!known || value > 0xFF);
+
+        bool wide = wideOperands[(*instruction)++];
+        if(!hasMode(mnemonic, mode))
+            wide = true;
+        else if(!hasMode(mnemonic, wideMode))
+            wide = false;
+
+        if(wide)
+            mode = wideMode;
+        else if(finalPass && value > 0xFF)
+            return fail("operand out of zero page range");
+    }
+
+    uint8_t opcode;
+    if(!findOpcode(mnemonic, mode, &opcode))
+        return fail("addressing mode not supported by " + mnemonicName);
+
+    uint8_t length = mos6502_opcodes::Length(mode);
+
+    if(mode == Mode::REL)
+    {
+        int offset = value - (pc + length);
+        if(finalPass && (offset < -128 || offset > 127))
+            return fail("branch out of range");
+        value = static_cast<uint16_t>(offset & 0xFF);
+    }
+    else if(finalPass && length == 2 && value > 0xFF)
+        return fail("operand does not fit in a byte");
+
+    if(!emit(opcode))
+        return false;
+    if(length >= 2 && !emit(value & 0xFF))
+        return false;
+    if(length == 3 && !emit(value >> 8))
+        return false;
+
+    return true;
+}
+
+bool MiniAssembler::emit(uint8_t value)
+{
+    size_t offset = static_cast<uint16_t>(pc - origin);
+
+    if(offset >= rom.size())
+        return fail("address outside of the image");
+
+    rom[offset] = value;
+    pc++;
+    return true;
+}
+
+const MiniAssembler::Symbol* MiniAssembler::findSymbol(const std::string& name) const
+{
+    for(const Symbol& symbol : symbols)
+    {
+        if(symbol.name == name)
+            return &symbol;
+    }
+    return nullptr;
+}
+
+bool MiniAssembler::defineSymbol(const std::string& name, uint16_t value)
+{
+    for(Symbol& symbol : symbols)
+    {
+        if(symbol.name != name)
+            continue;
+
+        // the final pass sees every definition a second time
+        if(!finalPass)
+            return fail("symbol " + name + " defined twice");
+
+        symbol.value = value;
+        return true;
+    }
+
+    symbols.push_back({ name, value });
+    return true;
+}
+
+bool MiniAssembler::evaluate(const std::string& expression, uint16_t* value, bool* known)
+{
+    std::string text = trim(expression);
+    *known = true;
+
+    if(text.empty())
+        return fail("missing operand");
+
+    // <expr and >expr take the low and high byte of everything after them
+    if(text[0] == '<' || text[0] == '>')
+    {
+        if(!evaluate(text.substr(1), value, known))
+            return false;
+        *value = text[0] == '<' ? (*value & 0xFF) : (*value >> 8);
+        return true;
+    }
+
+    int result = 0;
+    int sign = 1;
+    size_t i = 0;
+
+    while(i < text.size())
+    {
+        int term = 0;
+        size_t start = i;
+
+        if(text[i] == '$')
+        {
+            for(i++; i < text.size() && std::isxdigit(static_cast<unsigned char>(text[i])); i++)
+                term = term * 16 + (std::isdigit(static_cast<unsigned char>(text[i]))
+                    ? text[i] - '0' : std::tolower(static_cast<unsigned char>(text[i])) - 'a' + 10);
+        }
+        else if(text[i] == '%')
+        {
+            for(i++; i < text.size() && (text[i] == '0' || text[i] == '1'); i++)
+                term = term * 2 + (text[i] - '0');
+        }
+        else if(std::isdigit(static_cast<unsigned char>(text[i])))
+        {
+            for(; i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])); i++)
+                term = term * 10 + (text[i] - '0');
+        }
+        else if(text[i] == '*')
+        {
+            term = pc;
+            i++;
+        }
+        else if(isIdentifierStart(text[i]))
+        {
+            while(i < text.size() && isIdentifierChar(text[i]))
+                i++;
+
+            std::string name = text.substr(start, i - start);
+            const Symbol* symbol = findSymbol(name);
+
+            if(symbol)
+                term = symbol->value;
+            else if(finalPass)
+                return fail("undefined symbol " + name);
+            else
+                *known = false;
+        }
+
+        if(i == start || (i - start == 1 && (text[start] == '$' || text[start] == '%')))
+            return fail("invalid expression " + text);
+
+        result += sign * term;
+
+        if(i == text.size())
+            break;
+        if(text[i] != '+' && text[i] != '-')
+            return fail("invalid expression " + text);
+
+        sign = text[i] == '+' ? 1 : -1;
+        i++;
+    }
+
+    *value = static_cast<uint16_t>(result);
+    return true;
+}
+
+bool MiniAssembler::fail(const std::string& message)
+{
+    errorMessage = std::to_string(line) + ": " + message;
+    return false;
+}
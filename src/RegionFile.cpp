@@ -0,0 +1,475 @@
+#include "RegionFile.hpp"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr size_t ROM_SIZE = CodeNodeNano::ROM_SIZE;
+    // header and ROM images start on their own pages
+    constexpr uint64_t PAGE_ALIGNMENT = 4096;
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+RegionFile::RegionFile() :
+    header(nullptr),
+    slots(nullptr),
+    roms(nullptr),
+    romData(nullptr),
+    mapping(nullptr),
+    mappingSize(0),
+#ifdef _WIN32
+    fileHandle(INVALID_HANDLE_VALUE),
+    mappingHandle(nullptr)
+#else
+    fileDescriptor(-1)
+#endif
+{
+}
+
+RegionFile::~RegionFile()
+{
+    close();
+}
+
+bool RegionFile::create(const char* path, uint32_t numSlots)
+{
+    close();
+
+    if(numSlots == 0 || numSlots == NO_SLOT)
+        return fail("a region needs between 1 and 2^32 - 2 slots");
+
+    Header layout = {};
+    layout.magic = MAGIC;
+    layout.version = VERSION;
+    layout.snapshotVersion = CodeNodeNano::SNAPSHOT_VERSION;
+    layout.slotSize = sizeof(Slot);
+    layout.romSize = ROM_SIZE;
+    layout.numSlots = numSlots;
+    layout.numUsed = 0;
+    layout.firstFreeSlot = 0;
+    layout.firstFreeRom = 0;
+    layout.slotsOffset = PAGE_ALIGNMENT;
+    layout.romsOffset = alignUp(layout.slotsOffset + (uint64_t)numSlots * sizeof(Slot), alignof(RomEntry));
+    layout.romDataOffset = alignUp(layout.romsOffset + (uint64_t)numSlots * sizeof(RomEntry), PAGE_ALIGNMENT);
+    layout.fileSize = layout.romDataOffset + (uint64_t)numSlots * ROM_SIZE;
+
+    if(layout.fileSize != static_cast<size_t>(layout.fileSize))
+        return fail("region too large for the address space");
+
+    if(!mapFile(path, static_cast<size_t>(layout.fileSize), true))
+        return false;
+
+    // the file starts out zeroed, only the header and free lists need
+    // writing, the ROM images stay holes
+    *reinterpret_cast<Header*>(mapping) = layout;
+    fixUp();
+
+    for(uint32_t i = 0; i < numSlots; i++)
+    {
+        slots[i].rom = NO_SLOT;
+        slots[i].nextFree = i + 1 < numSlots ? i + 1 : NO_SLOT;
+        roms[i].nextFree = i + 1 < numSlots ? i + 1 : NO_SLOT;
+    }
+
+    return true;
+}
+
+bool RegionFile::open(const char* path)
+{
+    close();
+
+    if(!mapFile(path, 0, false))
+        return false;
+
+    const Header& stored = *reinterpret_cast<const Header*>(mapping);
+
+    if(mappingSize < sizeof(Header) || stored.magic != MAGIC || stored.version != VERSION)
+    {
+        close();
+        return fail(std::string(path) + " is not a region file");
+    }
+
+    if(stored.snapshotVersion != CodeNodeNano::SNAPSHOT_VERSION || stored.slotSize != sizeof(Slot) ||
+        stored.romSize != ROM_SIZE)
+    {
+        close();
+        return fail(std::string(path) + " was written by an incompatible version");
+    }
+
+    uint64_t numSlots = stored.numSlots;
+    if(stored.fileSize > mappingSize || stored.numUsed > numSlots ||
+        stored.slotsOffset < sizeof(Header) ||
+        stored.romsOffset < stored.slotsOffset + numSlots * sizeof(Slot) ||
+        stored.romDataOffset < stored.romsOffset + numSlots * sizeof(RomEntry) ||
+        stored.fileSize < stored.romDataOffset + numSlots * ROM_SIZE ||
+        stored.slotsOffset % alignof(Slot) != 0 || stored.romsOffset % alignof(RomEntry) != 0)
+    {
+        close();
+        return fail(std::string(path) + " is truncated or corrupt");
+    }
+
+    fixUp();
+
+    // every index the free lists and slots hold is used to address the
+    // mapping later on, so none may point past the tables
+    auto isIndex = [&](uint32_t index) { return index == NO_SLOT || index < header->numSlots; };
+    bool valid = isIndex(header->firstFreeSlot) && isIndex(header->firstFreeRom);
+
+    for(uint32_t i = 0; valid && i < header->numSlots; i++)
+    {
+        valid = isIndex(slots[i].nextFree) && isIndex(roms[i].nextFree) && isIndex(slots[i].rom) &&
+            (slots[i].rom == NO_SLOT || roms[slots[i].rom].refCount > 0);
+    }
+
+    // every image must be referenced by as many slots as it counts, and
+    // the free lists must hold each free entry once, without cycles
+    std::vector<uint32_t> references(valid ? header->numSlots : 0, 0);
+    uint32_t numUsed = 0;
+    uint32_t numRoms = 0;
+
+    for(uint32_t i = 0; valid && i < header->numSlots; i++)
+    {
+        if(slots[i].rom != NO_SLOT)
+        {
+            references[slots[i].rom]++;
+            numUsed++;
+        }
+    }
+
+    for(uint32_t i = 0; valid && i < header->numSlots; i++)
+    {
+        valid = roms[i].refCount == references[i];
+        numRoms += roms[i].refCount > 0;
+    }
+
+    valid = valid && numUsed == header->numUsed;
+
+    uint32_t numFree = 0;
+    for(uint32_t i = header->firstFreeSlot; valid && i != NO_SLOT; i = slots[i].nextFree)
+        valid = slots[i].rom == NO_SLOT && ++numFree <= header->numSlots - numUsed;
+    valid = valid && numFree == header->numSlots - numUsed;
+
+    numFree = 0;
+    for(uint32_t i = header->firstFreeRom; valid && i != NO_SLOT; i = roms[i].nextFree)
+        valid = roms[i].refCount == 0 && ++numFree <= header->numSlots - numRoms;
+    valid = valid && numFree == header->numSlots - numRoms;
+
+    if(!valid)
+    {
+        close();
+        return fail(std::string(path) + " is truncated or corrupt");
+    }
+
+    romIndex.reserve(header->numSlots);
+    for(uint32_t i = 0; i < header->numSlots; i++)
+    {
+        if(roms[i].refCount > 0)
+            romIndex.emplace(roms[i].hash, i);
+    }
+
+    return true;
+}
+
+void RegionFile::close()
+{
+    if(mapping)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(mapping, mappingSize);
+#endif
+    }
+
+#ifdef _WIN32
+    if(mappingHandle)
+        CloseHandle(mappingHandle);
+    if(fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if(fileDescriptor >= 0)
+        ::close(fileDescriptor);
+    fileDescriptor = -1;
+#endif
+
+    header = nullptr;
+    slots = nullptr;
+    roms = nullptr;
+    romData = nullptr;
+    mapping = nullptr;
+    mappingSize = 0;
+    romIndex.clear();
+}
+
+bool RegionFile::flush()
+{
+    if(!mapping)
+        return fail("no region open");
+
+#ifdef _WIN32
+    if(!FlushViewOfFile(mapping, 0) || !FlushFileBuffers(fileHandle))
+        return fail("failed to write the region back");
+#else
+    if(msync(mapping, mappingSize, MS_SYNC) != 0)
+        return fail("failed to write the region back");
+#endif
+
+    return true;
+}
+
+uint32_t RegionFile::capacity() const
+{
+    return header ? header->numSlots : 0;
+}
+
+uint32_t RegionFile::numUsed() const
+{
+    return header ? header->numUsed : 0;
+}
+
+bool RegionFile::isUsed(uint32_t slot) const
+{
+    return header && slot < header->numSlots && slots[slot].rom < header->numSlots;
+}
+
+uint32_t RegionFile::store(const CodeNodeNano& node)
+{
+    if(!header || header->firstFreeSlot == NO_SLOT)
+        return NO_SLOT;
+
+    uint32_t rom = acquireRom(node.ROM().data());
+    if(rom == NO_SLOT)
+        return NO_SLOT;
+
+    uint32_t index = header->firstFreeSlot;
+    Slot& slot = slots[index];
+
+    header->firstFreeSlot = slot.nextFree;
+    header->numUsed++;
+    slot.rom = rom;
+    slot.nextFree = NO_SLOT;
+    node.saveSnapshot(slot.snapshot);
+
+    return index;
+}
+
+bool RegionFile::update(uint32_t slot, const CodeNodeNano& node)
+{
+    if(!isUsed(slot))
+        return false;
+
+    Slot& stored = slots[slot];
+    const uint8_t* image = node.ROM().data();
+
+    if(memcmp(romImage(stored.rom), image, ROM_SIZE) != 0)
+    {
+        // released first so a slot that held the last reference to its
+        // image can always take a new one
+        releaseRom(stored.rom);
+        stored.rom = acquireRom(image);
+    }
+
+    node.saveSnapshot(stored.snapshot);
+    return true;
+}
+
+bool RegionFile::load(uint32_t slot, CodeNodeNano& node) const
+{
+    if(!isUsed(slot))
+        return false;
+
+    const Slot& stored = slots[slot];
+    const uint8_t* image = romImage(stored.rom);
+
+    if(memcmp(std::as_const(node).ROM().data(), image, ROM_SIZE) != 0)
+    {
+        node.ROM().load(image, ROM_SIZE);
+        node.reset();
+    }
+
+    return node.loadSnapshot(stored.snapshot);
+}
+
+void RegionFile::release(uint32_t slot)
+{
+    if(!isUsed(slot))
+        return;
+
+    Slot& stored = slots[slot];
+
+    releaseRom(stored.rom);
+    stored.rom = NO_SLOT;
+    stored.nextFree = header->firstFreeSlot;
+    header->firstFreeSlot = slot;
+    header->numUsed--;
+}
+
+const CodeNodeNano::Snapshot* RegionFile::snapshot(uint32_t slot) const
+{
+    return isUsed(slot) ? &slots[slot].snapshot : nullptr;
+}
+
+const uint8_t* RegionFile::rom(uint32_t slot) const
+{
+    return isUsed(slot) ? romImage(slots[slot].rom) : nullptr;
+}
+
+bool RegionFile::mapFile(const char* path, size_t size, bool create)
+{
+#ifdef _WIN32
+    fileHandle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+        create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(fileHandle == INVALID_HANDLE_VALUE)
+        return fail(std::string("failed to open \"") + path + "\"");
+
+    LARGE_INTEGER fileSize;
+    if(create)
+    {
+        DWORD returned;
+        DeviceIoControl(fileHandle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr);
+
+        fileSize.QuadPart = static_cast<LONGLONG>(size);
+        if(!SetFilePointerEx(fileHandle, fileSize, nullptr, FILE_BEGIN) || !SetEndOfFile(fileHandle))
+        {
+            close();
+            return fail(std::string("failed to resize \"") + path + "\"");
+        }
+    }
+    else if(!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return fail(std::string("\"") + path + "\" is empty");
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    void* view = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+    if(!view)
+    {
+        close();
+        return fail(std::string("failed to map \"") + path + "\"");
+    }
+#else
+    fileDescriptor = ::open(path, O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if(fileDescriptor < 0)
+        return fail(std::string("failed to open \"") + path + "\"");
+
+    struct stat status;
+    if(create)
+    {
+        if(ftruncate(fileDescriptor, static_cast<off_t>(size)) != 0)
+        {
+            close();
+            return fail(std::string("failed to resize \"") + path + "\"");
+        }
+    }
+    else if(fstat(fileDescriptor, &status) != 0 || status.st_size == 0)
+    {
+        close();
+        return fail(std::string("\"") + path + "\" is empty");
+    }
+    else
+        size = static_cast<size_t>(status.st_size);
+
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    if(view == MAP_FAILED)
+    {
+        close();
+        return fail(std::string("failed to map \"") + path + "\"");
+    }
+#endif
+
+    mapping = static_cast<uint8_t*>(view);
+    mappingSize = size;
+    return true;
+}
+
+void RegionFile::fixUp()
+{
+    header = reinterpret_cast<Header*>(mapping);
+    slots = reinterpret_cast<Slot*>(mapping + header->slotsOffset);
+    roms = reinterpret_cast<RomEntry*>(mapping + header->romsOffset);
+    romData = mapping + header->romDataOffset;
+}
+
+bool RegionFile::fail(const std::string& message)
+{
+    errorMessage = message;
+    return false;
+}
+
+uint32_t RegionFile::acquireRom(const uint8_t* image)
+{
+    uint64_t hash = hashROMImage(image, ROM_SIZE);
+    auto range = romIndex.equal_range(hash);
+
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        if(memcmp(romImage(it->second), image, ROM_SIZE) == 0)
+        {
+            roms[it->second].refCount++;
+            return it->second;
+        }
+    }
+
+    // never runs out while slots are left, there is an image per slot
+    uint32_t rom = header->firstFreeRom;
+    if(rom == NO_SLOT)
+        return NO_SLOT;
+
+    header->firstFreeRom = roms[rom].nextFree;
+    roms[rom].hash = hash;
+    roms[rom].refCount = 1;
+    roms[rom].nextFree = NO_SLOT;
+    memcpy(romImage(rom), image, ROM_SIZE);
+    romIndex.emplace(hash, rom);
+
+    return rom;
+}
+
+void RegionFile::releaseRom(uint32_t rom)
+{
+    RomEntry& entry = roms[rom];
+
+    if(--entry.refCount > 0)
+        return;
+
+    auto range = romIndex.equal_range(entry.hash);
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        if(it->second == rom)
+        {
+            romIndex.erase(it);
+            break;
+        }
+    }
+
+    entry.nextFree = header->firstFreeRom;
+    header->firstFreeRom = rom;
+}
+
+uint8_t* RegionFile::romImage(uint32_t rom) const
+{
+    return romData + (size_t)rom * ROM_SIZE;
+}
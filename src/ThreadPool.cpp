@@ -0,0 +1,144 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t numThreads) :
+    currentTask(nullptr),
+    generation(0),
+    busyWorkers(0),
+    stopping(false)
+{
+    numThreads = std::max<size_t>(numThreads, 1);
+
+    for(size_t i = 0; i < numThreads; i++)
+        queues.emplace_back(new WorkQueue());
+
+    for(size_t i = 1; i < numThreads; i++)
+        workers.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        stopping = true;
+    }
+    jobStart.notify_all();
+
+    for(std::thread& worker : workers)
+        worker.join();
+}
+
+size_t ThreadPool::defaultThreadCount()
+{
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    return 1;
+#else
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+#endif
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grainSize, const RangeTask& task)
+{
+    if(count == 0)
+        return;
+
+    grainSize = std::max<size_t>(grainSize, 1);
+
+    if(workers.empty() || count <= grainSize)
+    {
+        task(0, count);
+        return;
+    }
+
+    // Hand every thread a contiguous run of chunks so neighbouring
+    // indices stay on the same core unless someone has to steal them
+    size_t numChunks = (count + grainSize - 1) / grainSize;
+    size_t chunksPerQueue = (numChunks + queues.size() - 1) / queues.size();
+
+    for(size_t i = 0; i < numChunks; i++)
+    {
+        Chunk chunk;
+        chunk.begin = i * grainSize;
+        chunk.end = std::min(chunk.begin + grainSize, count);
+
+        WorkQueue& queue = *queues[i / chunksPerQueue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.chunks.push_front(chunk);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        currentTask = &task;
+        busyWorkers = workers.size();
+        generation++;
+    }
+    jobStart.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(jobMutex);
+    jobDone.wait(lock, [this] { return busyWorkers == 0; });
+    currentTask = nullptr;
+}
+
+void ThreadPool::workerMain(size_t index)
+{
+    uint64_t seenGeneration = 0;
+
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobStart.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if(stopping)
+                return;
+            seenGeneration = generation;
+        }
+
+        drain(index);
+
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if(--busyWorkers == 0)
+            jobDone.notify_one();
+    }
+}
+
+void ThreadPool::drain(size_t index)
+{
+    Chunk chunk;
+
+    while(popLocal(index, chunk) || steal(index, chunk))
+        (*currentTask)(chunk.begin, chunk.end);
+}
+
+bool ThreadPool::popLocal(size_t index, Chunk& chunk)
+{
+    WorkQueue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if(queue.chunks.empty())
+        return false;
+
+    chunk = queue.chunks.back();
+    queue.chunks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(size_t index, Chunk& chunk)
+{
+    for(size_t i = 1; i < queues.size(); i++)
+    {
+        WorkQueue& queue = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if(queue.chunks.empty())
+            continue;
+
+        chunk = queue.chunks.front();
+        queue.chunks.pop_front();
+        return true;
+    }
+
+    return false;
+}
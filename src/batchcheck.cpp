@@ -0,0 +1,253 @@
+// MCUBatch against CodeNodeNano. Every program of BenchPrograms.hpp, plus
+// a 65C02 program that sleeps in WAI, runs on the lanes of a batch and on
+// one node per lane. Lanes are fed their inputs at different phases so
+// some stay in lockstep, some drift apart and one runs alone; along the
+// way lanes are paused, powered off and on, and moved between a lane and
+// a node through snapshots. The snapshot of every lane must match its
+// node's after every tick. Exits non-zero if any lane diverges or a
+// program never ran in lockstep.
+
+#include "BenchPrograms.hpp"
+#include "MCUBatch.hpp"
+#include "MiniAssembler.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        uint64_t ticks = 1000;
+        size_t lanes = 16;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+    };
+
+    // sleeps in WAI, woken by changes on the east and west pins
+    const char* const waitProgram = R"(
+  .org $E000
+start:
+  lda #%0101
+  sta $7040
+  lda #$50
+  sta $7048
+  sta $7049
+  cli
+loop:
+  wai
+  inc $00
+  jmp loop
+irq:
+  pha
+  lda #%1010
+  sta $7068
+  inc $01
+  pla
+  rti
+  .org $FFFA
+  .word irq
+  .word start
+  .word irq
+)";
+
+    // A lane seen through driveBenchInputs
+    struct Lane
+    {
+        MCUBatch& batch;
+        size_t lane;
+        CNGPIO<MCUBatch::GPIO_NUM_PINS>& GPIO() { return batch.GPIO(lane); }
+    };
+
+    // Tick offset of each lane's inputs: a lockstep half, smaller groups
+    // further apart, the last lane on its own
+    uint64_t phaseOf(size_t lane, size_t numLanes)
+    {
+        if(lane + 1 == numLanes)
+            return 101;
+        if(lane < numLanes / 2)
+            return 0;
+        return lane < numLanes * 3 / 4 ? 3 : 50;
+    }
+
+    bool same(const CodeNodeNano::Snapshot& a, const CodeNodeNano::Snapshot& b)
+    {
+        return memcmp(&a, &b, sizeof(CodeNodeNano::Snapshot)) == 0;
+    }
+
+    bool check(const BenchProgram& program, bool cmos, const Options& options)
+    {
+        const size_t numLanes = options.lanes;
+        const uint64_t ticks = options.ticks;
+        const char* name = program.name.c_str();
+        std::unique_ptr<MCUBatch> batch(new MCUBatch(numLanes));
+        std::vector<std::unique_ptr<CodeNodeNano>> nodes;
+        std::unique_ptr<CodeNodeNano::Snapshot> expected(new CodeNodeNano::Snapshot());
+        std::unique_ptr<CodeNodeNano::Snapshot> actual(new CodeNodeNano::Snapshot());
+
+        batch->loadROM(program.rom.data(), program.rom.size());
+        for(size_t l = 0; l < numLanes; l++)
+        {
+            nodes.emplace_back(new CodeNodeNano());
+            CodeNodeNano& node = *nodes.back();
+            node.ROM().load(program.rom.data(), program.rom.size());
+            node.CPU().SetInstructionSet(cmos ? mos6502::CMOS_65C02 : mos6502::NMOS_6502);
+            node.powerOn();
+
+            // lanes only take another instruction set from a snapshot
+            batch->powerOn(l);
+            if(cmos)
+            {
+                node.saveSnapshot(*expected);
+                batch->loadSnapshot(l, *expected);
+            }
+        }
+
+        const size_t paused = numLanes / 2 - 1;
+        const size_t rebooted = 1;
+        const size_t restored = numLanes - 2;
+
+        for(uint64_t tick = 0; tick < ticks; tick++)
+        {
+            if(tick == ticks / 4)
+            {
+                batch->pauseClock(paused);
+                nodes[paused]->pauseClock();
+            }
+            else if(tick == ticks / 2)
+            {
+                batch->resumeClock(paused);
+                nodes[paused]->resumeClock();
+            }
+
+            if(tick == ticks / 3)
+            {
+                batch->powerOff(rebooted);
+                nodes[rebooted]->powerOff();
+            }
+            else if(tick == ticks / 3 + 10)
+            {
+                batch->powerOn(rebooted);
+                nodes[rebooted]->powerOn();
+            }
+
+            // node 0 goes into a lane and lane 0 into a node, both in step
+            // with lane 0 from here on
+            if(tick == ticks * 2 / 3)
+            {
+                nodes[0]->saveSnapshot(*expected);
+                batch->loadSnapshot(restored, *expected);
+                batch->saveSnapshot(0, *actual);
+                nodes[restored]->loadSnapshot(*actual);
+            }
+
+            for(size_t l = 0; l < numLanes; l++)
+            {
+                uint64_t phase = tick + phaseOf(l, numLanes);
+                Lane lane{*batch, l};
+                driveBenchInputs(lane, phase);
+                driveBenchInputs(*nodes[l], phase);
+                nodes[l]->tick();
+            }
+            batch->tick();
+
+            for(size_t l = 0; l < numLanes; l++)
+            {
+                nodes[l]->saveSnapshot(*expected);
+                batch->saveSnapshot(l, *actual);
+                if(same(*expected, *actual))
+                    continue;
+
+                printf("%s: lane %zu diverged at tick %llu: pc %04X vs %04X, %llu vs %llu cycles, bus %04X vs %04X\n",
+                    name, l, static_cast<unsigned long long>(tick), expected->cpu.pc, actual->cpu.pc,
+                    static_cast<unsigned long long>(expected->cyclesCounter),
+                    static_cast<unsigned long long>(actual->cyclesCounter),
+                    expected->busAddress, actual->busAddress);
+                return false;
+            }
+        }
+
+        uint64_t vectorCycles = batch->numVectorCycles();
+        uint64_t scalarCycles = batch->numScalarCycles();
+        printf("%s: %llu lane-cycles in lockstep, %llu on the scalar core\n", name,
+            static_cast<unsigned long long>(vectorCycles), static_cast<unsigned long long>(scalarCycles));
+
+        // a 65C02 lane never runs in lockstep
+        if(!cmos && vectorCycles == 0)
+        {
+            printf("%s: no lane ever ran in lockstep\n", name);
+            return false;
+        }
+        return true;
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -t, --ticks N        game ticks per program (default 1000)\n"
+            "  -n, --lanes N        lanes and nodes per program, at least 8 (default 16)\n"
+            "  -e, --examples DIR   where the example programs are (default %s)\n"
+            "  -h, --help           show this help\n",
+            program, CNMCU_EXAMPLES_DIR);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-t" || arg == "--ticks") && hasValue)
+            options.ticks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-n" || arg == "--lanes") && hasValue)
+            options.lanes = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+        else if((arg == "-e" || arg == "--examples") && hasValue)
+            options.examplesDir = argv[++i];
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(options.lanes < 8)
+    {
+        fprintf(stderr, "need at least 8 lanes\n");
+        return 2;
+    }
+
+    std::vector<BenchProgram> programs;
+    if(!loadBenchPrograms(options.examplesDir, programs))
+        return 2;
+
+    MiniAssembler assembler(0x10000 - CodeNodeNano::ROM_SIZE, CodeNodeNano::ROM_SIZE);
+    if(!assembler.assemble(waitProgram))
+    {
+        fprintf(stderr, "Failed to assemble wai: %s\n", assembler.error().c_str());
+        return 2;
+    }
+    BenchProgram wait = { "wai", assembler.image() };
+
+    size_t failed = 0;
+    for(const BenchProgram& program : programs)
+        failed += !check(program, false, options);
+    failed += !check(wait, true, options);
+
+    printf("%zu programs, %zu lanes, %llu ticks each: %zu failed\n", programs.size() + 1,
+        options.lanes, static_cast<unsigned long long>(options.ticks), failed);
+    return failed == 0 ? 0 : 1;
+}
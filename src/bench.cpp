@@ -0,0 +1,433 @@
+// Throughput benchmark for the emulator core. Runs the programs of
+// BenchPrograms.hpp through mos6502::Run on a flat memory bus and through
+// CodeNodeNano::tick, with both dispatch methods, and through MCUBatch
+// lanes, and prints one CSV (or JSON) row per program and mode so results
+// can be compared across versions.
+
+#include "CodeNodeNano.hpp"
+#include "BenchPrograms.hpp"
+#include "MCUBatch.hpp"
+#include "mos6502_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CNMCU_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CNMCU_HAS_TSC 1
+#else
+#define CNMCU_HAS_TSC 0
+#endif
+
+namespace
+{
+    constexpr uint64_t CYCLES_PER_TICK = CodeNodeNano::CLOCK_FREQUENCY / GAME_TICK_RATE;
+    // batch modes split the ticks of a run across this many lanes
+    constexpr size_t BATCH_LANES = 256;
+    // tick_batch_skew feeds lane l its inputs this many ticks late, l % BATCH_PHASES
+    constexpr uint64_t BATCH_PHASES = 8;
+
+    enum Mode
+    {
+        MODE_RUN,             // mos6502::Run on a flat 64 KB bus
+        MODE_RUN_TABLE,       // the same through mos6502::INSTR_TABLE
+        MODE_TICK,            // CodeNodeNano::tick, default settings
+        MODE_TICK_TABLE,      // CodeNodeNano::tick through mos6502::INSTR_TABLE
+        MODE_TICK_NOTRACE,    // CodeNodeNano::tick, bus tracing off
+        MODE_TICK_JIT,        // CodeNodeNano::tick with the JIT on
+        MODE_TICK_BATCH,      // MCUBatch::tick, every lane fed the same inputs
+        MODE_TICK_BATCH_SKEW, // MCUBatch::tick, lanes fed at BATCH_PHASES offsets
+    };
+
+    const char* const modeNames[] = { "run", "run_table", "tick", "tick_table", "tick_notrace", "tick_jit",
+        "tick_batch", "tick_batch_skew" };
+
+    bool isRunMode(Mode mode)
+    {
+        return mode == MODE_RUN || mode == MODE_RUN_TABLE;
+    }
+
+    bool isBatchMode(Mode mode)
+    {
+        return mode == MODE_TICK_BATCH || mode == MODE_TICK_BATCH_SKEW;
+    }
+
+    // ticks each lane runs in a batch mode, the run's ticks split evenly
+    uint64_t batchTicksOf(uint64_t ticks)
+    {
+        return std::max<uint64_t>(ticks / BATCH_LANES, 1);
+    }
+
+    uint64_t batchPhaseOf(Mode mode, size_t lane)
+    {
+        return mode == MODE_TICK_BATCH_SKEW ? lane % BATCH_PHASES : 0;
+    }
+
+    mos6502::DispatchMethod dispatchMethodOf(Mode mode)
+    {
+        return mode == MODE_RUN_TABLE || mode == MODE_TICK_TABLE
+            ? mos6502::INSTR_TABLE
+            : mos6502::FUSED_SWITCH;
+    }
+
+    struct Result
+    {
+        uint64_t ticks;
+        uint64_t cycles;
+        uint64_t instructions;
+        double seconds;
+        uint64_t hostCycles;
+    };
+
+    struct Options
+    {
+        uint64_t ticks = 100000;
+        int repeat = 3;
+        bool json = false;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+        const char* only = nullptr;
+        bool layout = false;
+    };
+
+    uint64_t hostCycleCounter()
+    {
+#if CNMCU_HAS_TSC
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    // The whole address space as memory, ROM image at the top
+    struct FlatBus
+    {
+        uint8_t memory[0x10000];
+
+        explicit FlatBus(const std::vector<uint8_t>& rom)
+        {
+            memset(memory, 0, sizeof(memory));
+            memcpy(memory + 0x10000 - rom.size(), rom.data(), rom.size());
+        }
+
+        uint8_t Read(uint16_t address) { return memory[address]; }
+        void Write(uint16_t address, uint8_t value) { memory[address] = value; }
+
+        // what INSTR_TABLE calls, it only runs on the callbacks
+        static uint8_t read(void* bus, uint16_t address)
+        {
+            return static_cast<FlatBus*>(bus)->memory[address];
+        }
+        static void write(void* bus, uint16_t address, uint8_t value)
+        {
+            static_cast<FlatBus*>(bus)->memory[address] = value;
+        }
+    };
+
+    void setUpNode(CodeNodeNano& node, const BenchProgram& benchmark, Mode mode)
+    {
+        node.ROM().load(benchmark.rom.data(), benchmark.rom.size());
+        node.setBusTracing(mode != MODE_TICK_NOTRACE);
+        node.setJitEnabled(mode == MODE_TICK_JIT);
+        node.CPU().SetDispatchMethod(dispatchMethodOf(mode));
+        node.powerOn();
+    }
+
+    // Instructions executed in the same span, counted by running one
+    // instruction per call. Only the timed runs skip idle loops or use
+    // the JIT, so this is the architectural instruction count, the same
+    // for every tick mode. phase delays the inputs as a batch lane's are.
+    uint64_t countInstructions(const BenchProgram& benchmark, Mode mode, uint64_t ticks, uint64_t phase = 0)
+    {
+        uint64_t instructions = 0;
+
+        if(isRunMode(mode))
+        {
+            std::unique_ptr<FlatBus> bus(new FlatBus(benchmark.rom));
+            mos6502 cpu(FlatBus::read, FlatBus::write, nullptr, bus.get());
+            uint64_t cycles = 0;
+
+            cpu.SetDispatchMethod(dispatchMethodOf(mode));
+            cpu.Reset(*bus);
+            while(cycles < ticks * CYCLES_PER_TICK)
+            {
+                cpu.Run(*bus, 1, cycles);
+                instructions++;
+            }
+            return instructions;
+        }
+
+        std::unique_ptr<CodeNodeNano> node(new CodeNodeNano());
+        setUpNode(*node, benchmark, MODE_TICK);
+
+        for(uint64_t tick = 0; tick < ticks; tick++)
+        {
+            driveBenchInputs(*node, tick + phase);
+            for(uint64_t i = 0; i < CYCLES_PER_TICK; i++)
+            {
+                uint64_t before = node->numCycles();
+                node->cycle();
+                if(node->numCycles() != before)
+                    instructions++;
+            }
+        }
+
+        return instructions;
+    }
+
+    // A batch lane seen through driveBenchInputs
+    struct BatchLane
+    {
+        MCUBatch& batch;
+        size_t lane;
+        CNGPIO<MCUBatch::GPIO_NUM_PINS>& GPIO() { return batch.GPIO(lane); }
+    };
+
+    // The same count summed over the lanes of a batch mode
+    uint64_t countBatchInstructions(const BenchProgram& benchmark, Mode mode, uint64_t ticks)
+    {
+        uint64_t perPhase[BATCH_PHASES] = {};
+        uint64_t instructions = 0;
+
+        for(uint64_t phase = 0; phase < BATCH_PHASES; phase++)
+            perPhase[phase] = countInstructions(benchmark, MODE_TICK, batchTicksOf(ticks), phase);
+        for(size_t lane = 0; lane < BATCH_LANES; lane++)
+            instructions += perPhase[batchPhaseOf(mode, lane)];
+        return instructions;
+    }
+
+    Result measureBatch(const BenchProgram& benchmark, Mode mode, uint64_t ticks)
+    {
+        Result result = {};
+        uint64_t batchTicks = batchTicksOf(ticks);
+        result.ticks = batchTicks * BATCH_LANES;
+
+        std::unique_ptr<MCUBatch> batch(new MCUBatch(BATCH_LANES));
+        batch->loadROM(benchmark.rom.data(), benchmark.rom.size());
+        for(size_t lane = 0; lane < BATCH_LANES; lane++)
+            batch->powerOn(lane);
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t hostStart = hostCycleCounter();
+
+        for(uint64_t tick = 0; tick < batchTicks; tick++)
+        {
+            for(size_t lane = 0; lane < BATCH_LANES; lane++)
+            {
+                BatchLane batchLane{*batch, lane};
+                driveBenchInputs(batchLane, tick + batchPhaseOf(mode, lane));
+            }
+            batch->tick();
+        }
+
+        result.hostCycles = hostCycleCounter() - hostStart;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for(size_t lane = 0; lane < BATCH_LANES; lane++)
+            result.cycles += batch->numCycles(lane);
+        return result;
+    }
+
+    Result measure(const BenchProgram& benchmark, Mode mode, uint64_t ticks)
+    {
+        Result result = {};
+        result.ticks = ticks;
+
+        if(isRunMode(mode))
+        {
+            std::unique_ptr<FlatBus> bus(new FlatBus(benchmark.rom));
+            mos6502 cpu(FlatBus::read, FlatBus::write, nullptr, bus.get());
+            uint64_t cycles = 0;
+            uint64_t target = ticks * CYCLES_PER_TICK;
+
+            cpu.SetDispatchMethod(dispatchMethodOf(mode));
+            cpu.Reset(*bus);
+
+            auto start = std::chrono::steady_clock::now();
+            uint64_t hostStart = hostCycleCounter();
+
+            while(cycles < target)
+                cpu.Run(*bus, static_cast<int32_t>(std::min<uint64_t>(target - cycles, 1 << 16)), cycles);
+
+            result.hostCycles = hostCycleCounter() - hostStart;
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            result.cycles = cycles;
+            return result;
+        }
+
+        if(isBatchMode(mode))
+            return measureBatch(benchmark, mode, ticks);
+
+        std::unique_ptr<CodeNodeNano> node(new CodeNodeNano());
+        setUpNode(*node, benchmark, mode);
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t hostStart = hostCycleCounter();
+
+        for(uint64_t tick = 0; tick < ticks; tick++)
+        {
+            driveBenchInputs(*node, tick);
+            node->tick();
+        }
+
+        result.hostCycles = hostCycleCounter() - hostStart;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.cycles = node->numCycles();
+        return result;
+    }
+
+    void printResult(const Options& options, const BenchProgram& benchmark, Mode mode, const Result& result)
+    {
+        double mhz = result.seconds > 0.0 ? result.cycles / result.seconds / 1e6 : 0.0;
+        double nsPerInstruction = result.instructions ? result.seconds * 1e9 / result.instructions : 0.0;
+        double perHostCycle = result.hostCycles ? (double)result.instructions / result.hostCycles : 0.0;
+
+        if(options.json)
+        {
+            printf("{\"version\":\"%s\",\"benchmark\":\"%s\",\"mode\":\"%s\",\"ticks\":%llu,"
+                "\"cycles\":%llu,\"instructions\":%llu,\"seconds\":%.6f,\"emulated_mhz\":%.3f,"
+                "\"ns_per_instruction\":%.3f,\"instructions_per_host_cycle\":%.4f}\n",
+                CNMCU_DEMO_VERSION, benchmark.name.c_str(), modeNames[mode],
+                (unsigned long long)result.ticks, (unsigned long long)result.cycles,
+                (unsigned long long)result.instructions, result.seconds, mhz,
+                nsPerInstruction, perHostCycle);
+        }
+        else
+        {
+            printf("%s,%s,%s,%llu,%llu,%llu,%.6f,%.3f,%.3f,%.4f\n",
+                CNMCU_DEMO_VERSION, benchmark.name.c_str(), modeNames[mode],
+                (unsigned long long)result.ticks, (unsigned long long)result.cycles,
+                (unsigned long long)result.instructions, result.seconds, mhz,
+                nsPerInstruction, perHostCycle);
+        }
+
+        fflush(stdout);
+    }
+
+    void printUsage(const char* program)
+    {
+        fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "Options:\n"
+            "  -t, --ticks N        game ticks per run (default 100000, %llu cycles each)\n"
+            "  -r, --repeat N       runs per benchmark, the fastest is reported (default 3)\n"
+            "  -e, --examples DIR   where and-gate-counter.s and rotating-signal.s are\n"
+            "  -o, --only NAME      only run benchmarks whose name contains NAME\n"
+            "      --json           print JSON lines instead of CSV\n"
+            "      --layout         print the memory layout of a node and exit\n",
+            program, (unsigned long long)CYCLES_PER_TICK);
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if(arg == "--json")
+            {
+                options.json = true;
+                continue;
+            }
+            if(arg == "--layout")
+            {
+                options.layout = true;
+                continue;
+            }
+
+            if(!value)
+                return false;
+            i++;
+
+            if(arg == "-t" || arg == "--ticks")
+                options.ticks = strtoull(value, nullptr, 10);
+            else if(arg == "-r" || arg == "--repeat")
+                options.repeat = atoi(value);
+            else if(arg == "-e" || arg == "--examples")
+                options.examplesDir = value;
+            else if(arg == "-o" || arg == "--only")
+                options.only = value;
+            else
+                return false;
+        }
+
+        return options.ticks > 0 && options.repeat > 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    if(!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if(options.layout)
+    {
+        printNodeLayout(stdout);
+        return 0;
+    }
+
+    std::vector<BenchProgram> benchmarks;
+    if(!loadBenchPrograms(options.examplesDir, benchmarks))
+        return 2;
+
+    std::vector<Mode> modes = { MODE_RUN, MODE_RUN_TABLE, MODE_TICK, MODE_TICK_TABLE, MODE_TICK_NOTRACE };
+    if(mos6502_jit::IsSupported())
+        modes.push_back(MODE_TICK_JIT);
+    modes.push_back(MODE_TICK_BATCH);
+    modes.push_back(MODE_TICK_BATCH_SKEW);
+
+    if(!options.json)
+    {
+        printf("version,benchmark,mode,ticks,cycles,instructions,seconds,"
+            "emulated_mhz,ns_per_instruction,instructions_per_host_cycle\n");
+    }
+
+    for(const BenchProgram& benchmark : benchmarks)
+    {
+        if(options.only && benchmark.name.find(options.only) == std::string::npos)
+            continue;
+
+        uint64_t runInstructions = countInstructions(benchmark, MODE_RUN, options.ticks);
+        uint64_t tickInstructions = countInstructions(benchmark, MODE_TICK, options.ticks);
+        uint64_t batchInstructions = countBatchInstructions(benchmark, MODE_TICK_BATCH, options.ticks);
+        uint64_t skewInstructions = countBatchInstructions(benchmark, MODE_TICK_BATCH_SKEW, options.ticks);
+
+        for(Mode mode : modes)
+        {
+            Result best = {};
+
+            for(int run = 0; run < options.repeat; run++)
+            {
+                Result result = measure(benchmark, mode, options.ticks);
+                if(run == 0 || result.seconds < best.seconds)
+                    best = result;
+            }
+
+            if(isRunMode(mode))
+                best.instructions = runInstructions;
+            else if(mode == MODE_TICK_BATCH)
+                best.instructions = batchInstructions;
+            else if(mode == MODE_TICK_BATCH_SKEW)
+                best.instructions = skewInstructions;
+            else
+                best.instructions = tickInstructions;
+            printResult(options, benchmark, mode, best);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+// Delta snapshot check. Every program of BenchPrograms.hpp runs on a
+// node that takes a checkpoint and then saves a delta every few ticks.
+// The deltas, applied in order on top of the checkpoint, must give the
+// node's own snapshot, both on a bare Snapshot and on a fresh node. Then
+// deltas that do not fit are fed in: one made for another base, every
+// truncation of a real one and runs that reach past the end of a
+// Snapshot. Each must be refused and leave the snapshot as it was.
+// Exits non-zero if any check fails.
+
+#include "BenchPrograms.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::vector<uint8_t> Delta;
+
+    struct Options
+    {
+        uint64_t ticks = 2000;
+        size_t deltas = 8;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+    };
+
+    bool same(const CodeNodeNano::Snapshot& a, const CodeNodeNano::Snapshot& b)
+    {
+        return memcmp(&a, &b, sizeof(CodeNodeNano::Snapshot)) == 0;
+    }
+
+    void putVarint(Delta& out, uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // Applies delta to a copy of snapshot, true if it was refused and
+    // the copy left alone
+    bool refused(const CodeNodeNano::Snapshot& snapshot, const Delta& delta)
+    {
+        std::unique_ptr<CodeNodeNano::Snapshot> copy(new CodeNodeNano::Snapshot(snapshot));
+        return !CodeNodeNano::applyDelta(*copy, delta.data(), delta.size()) && same(*copy, snapshot);
+    }
+
+    // Saves a chain of deltas while program runs and rebuilds the final
+    // state from them, then checks the malformed ones are refused
+    bool check(const BenchProgram& program, uint64_t ticks, size_t numDeltas)
+    {
+        std::unique_ptr<CodeNodeNano> node(new CodeNodeNano());
+        std::unique_ptr<CodeNodeNano::Snapshot> base(new CodeNodeNano::Snapshot());
+        std::unique_ptr<CodeNodeNano::Snapshot> live(new CodeNodeNano::Snapshot());
+        std::unique_ptr<CodeNodeNano::Snapshot> rebuilt(new CodeNodeNano::Snapshot());
+        std::vector<Delta> deltas(numDeltas);
+        const char* name = program.name.c_str();
+
+        node->ROM().load(program.rom.data(), program.rom.size());
+        node->powerOn();
+
+        uint64_t tick = 0;
+        for(; tick < ticks / 4; tick++)
+        {
+            driveBenchInputs(*node, tick);
+            node->tick();
+        }
+        node->checkpoint();
+        node->saveSnapshot(*base);
+
+        for(Delta& delta : deltas)
+        {
+            for(uint64_t end = tick + ticks / 2 / numDeltas + 1; tick < end; tick++)
+            {
+                driveBenchInputs(*node, tick);
+                node->tick();
+            }
+            if(!node->saveDelta(delta))
+            {
+                printf("%s: no delta saved after a checkpoint\n", name);
+                return false;
+            }
+        }
+        node->saveSnapshot(*live);
+
+        *rebuilt = *base;
+        for(size_t i = 0; i < deltas.size(); i++)
+        {
+            if(!CodeNodeNano::applyDelta(*rebuilt, deltas[i].data(), deltas[i].size()))
+            {
+                printf("%s: delta %zu of the chain refused\n", name, i);
+                return false;
+            }
+        }
+        if(!same(*rebuilt, *live))
+        {
+            printf("%s: chained deltas differ from the live snapshot\n", name);
+            return false;
+        }
+
+        // the same chain restored into a node that never ran
+        std::unique_ptr<CodeNodeNano> restored(new CodeNodeNano());
+        restored->ROM().load(program.rom.data(), program.rom.size());
+        restored->loadSnapshot(*base);
+        for(const Delta& delta : deltas)
+        {
+            if(!restored->applyDelta(delta.data(), delta.size()))
+            {
+                printf("%s: node refused a delta of the chain\n", name);
+                return false;
+            }
+        }
+        restored->saveSnapshot(*rebuilt);
+        if(!same(*rebuilt, *live))
+        {
+            printf("%s: node restored from deltas differs from the live one\n", name);
+            return false;
+        }
+
+        // made for the state after the first delta, not for base
+        if(!refused(*base, deltas[1]))
+        {
+            printf("%s: delta applied to the wrong base\n", name);
+            return false;
+        }
+
+        for(size_t size = 0; size < deltas[0].size(); size++)
+        {
+            Delta truncated(deltas[0].begin(), deltas[0].begin() + size);
+            if(!refused(*base, truncated))
+            {
+                printf("%s: delta truncated to %zu of %zu bytes applied\n", name, size, deltas[0].size());
+                return false;
+            }
+        }
+
+        // runs reaching past the end, behind a header naming base
+        const uint64_t size = sizeof(CodeNodeNano::Snapshot);
+        const uint64_t overflows[][4] = {
+            { size, 1 },
+            { size + 1, 0 },
+            { 0, size + 1 },
+            { size - 1, 2 },
+            { size / 2, size / 2, 1, 1 },
+            { 0, 1ull << 27 },
+            { 1ull << 27, 1 },
+        };
+        for(const uint64_t* runs : overflows)
+        {
+            Delta delta(deltas[0].begin(), deltas[0].begin() + 16); // the header
+            for(int i = 0; i < 4 && (i < 2 || runs[i] != 0); i += 2)
+            {
+                putVarint(delta, runs[i]);
+                putVarint(delta, runs[i + 1]);
+                delta.insert(delta.end(), runs[i + 1] < size ? runs[i + 1] : size, 0xA5);
+            }
+
+            if(!refused(*base, delta))
+            {
+                printf("%s: run of %llu bytes after %llu applied\n", name,
+                    static_cast<unsigned long long>(runs[1]), static_cast<unsigned long long>(runs[0]));
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -t, --ticks N        game ticks per program (default 2000)\n"
+            "  -d, --deltas N       deltas chained per program, at least 2 (default 8)\n"
+            "  -e, --examples DIR   where the example programs are (default %s)\n"
+            "  -h, --help           show this help\n",
+            program, CNMCU_EXAMPLES_DIR);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-t" || arg == "--ticks") && hasValue)
+            options.ticks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-d" || arg == "--deltas") && hasValue)
+            options.deltas = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-e" || arg == "--examples") && hasValue)
+            options.examplesDir = argv[++i];
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(options.deltas < 2)
+    {
+        fprintf(stderr, "need at least 2 deltas\n");
+        return 2;
+    }
+
+    std::vector<BenchProgram> programs;
+    if(!loadBenchPrograms(options.examplesDir, programs))
+        return 2;
+
+    size_t failed = 0;
+    for(const BenchProgram& program : programs)
+        failed += !check(program, options.ticks, options.deltas);
+
+    printf("%zu programs, %zu deltas each: %zu failed\n", programs.size(), options.deltas, failed);
+    return failed == 0 ? 0 : 1;
+}
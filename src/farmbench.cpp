@@ -0,0 +1,327 @@
+// Scaling benchmark for MCUFarm. Fills a farm with CodeNodeNano instances
+// running a round-robin mix of the BenchPrograms.hpp firmware, ticks it
+// for a fixed number of game ticks at every requested thread count and
+// prints one CSV row per instance and thread count. With --region, also
+// times storing every farm in a RegionFile and loading it back.
+
+#include "BenchPrograms.hpp"
+#include "MCUFarm.hpp"
+#include "RegionFile.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace
+{
+    struct Options
+    {
+        std::vector<size_t> instances = { 1, 10, 100, 1000, 10000, 100000 };
+        std::vector<size_t> threads;
+        uint64_t ticks = 100;
+        uint64_t warmupTicks = 5;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+        const char* regionPath = nullptr;
+        bool layout = false;
+    };
+
+    struct Result
+    {
+        double seconds;   // sum of the measured farm ticks
+        double p50;       // tick latency in seconds
+        double p99;
+        double max;
+        size_t residentBytes; // with the farm still populated
+    };
+
+    // Resident set size of the process in bytes, 0 where unknown
+    size_t residentBytes()
+    {
+#ifdef __linux__
+        FILE* file = fopen("/proc/self/statm", "r");
+        unsigned long pages = 0, resident = 0;
+
+        if(!file)
+            return 0;
+        if(fscanf(file, "%lu %lu", &pages, &resident) != 2)
+            resident = 0;
+        fclose(file);
+
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+        return 0;
+#endif
+    }
+
+    // What a powered-on node costs: the node itself and its slot in the
+    // farm. ROM images and their decoding are shared between the nodes
+    // running them.
+    size_t bytesPerInstance()
+    {
+        return sizeof(CodeNodeNano) +
+            sizeof(std::unique_ptr<CodeNodeNano>) + sizeof(CodeNodeNano*);
+    }
+
+    double percentile(std::vector<double>& sorted, double fraction)
+    {
+        size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    Result measure(const Options& options, const std::vector<BenchProgram>& programs,
+        size_t numInstances, size_t numThreads)
+    {
+        MCUFarm farm(numThreads);
+
+        for(size_t i = 0; i < numInstances; i++)
+        {
+            CodeNodeNano& node = farm.node(farm.add());
+            const BenchProgram& program = programs[i % programs.size()];
+
+            node.ROM().load(program.rom.data(), program.rom.size());
+            node.powerOn();
+        }
+
+        std::vector<double> latencies;
+        latencies.reserve(options.ticks);
+
+        for(uint64_t tick = 0; tick < options.warmupTicks + options.ticks; tick++)
+        {
+            for(size_t i = 0; i < farm.size(); i++)
+                driveBenchInputs(farm.node(i), tick);
+
+            farm.tick();
+
+            if(tick >= options.warmupTicks)
+                latencies.push_back(farm.lastTickStats().wallTime);
+        }
+
+        Result result;
+        result.seconds = 0.0;
+        for(double latency : latencies)
+            result.seconds += latency;
+
+        std::sort(latencies.begin(), latencies.end());
+        result.p50 = percentile(latencies, 0.50);
+        result.p99 = percentile(latencies, 0.99);
+        result.max = latencies.back();
+        result.residentBytes = residentBytes();
+        return result;
+    }
+
+    double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Stores numInstances nodes in a new region file, reopens it and loads
+    // every node back into a fresh farm. One line on stderr, so the CSV on
+    // stdout stays the same.
+    bool measureRegion(const Options& options, const std::vector<BenchProgram>& programs,
+        size_t numInstances)
+    {
+        MCUFarm farm(1);
+        RegionFile region;
+
+        for(size_t i = 0; i < numInstances; i++)
+        {
+            CodeNodeNano& node = farm.node(farm.add());
+            const BenchProgram& program = programs[i % programs.size()];
+
+            node.ROM().load(program.rom.data(), program.rom.size());
+            node.powerOn();
+        }
+
+        if(!region.create(options.regionPath, static_cast<uint32_t>(numInstances)))
+        {
+            fprintf(stderr, "%s\n", region.error().c_str());
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < farm.size(); i++)
+            region.store(farm.node(i));
+        if(!region.flush())
+        {
+            fprintf(stderr, "%s\n", region.error().c_str());
+            return false;
+        }
+        double storeSeconds = secondsSince(start);
+        region.close();
+        farm.clear();
+
+        start = std::chrono::steady_clock::now();
+        if(!region.open(options.regionPath))
+        {
+            fprintf(stderr, "%s\n", region.error().c_str());
+            return false;
+        }
+        double openSeconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        for(uint32_t slot = 0; slot < region.capacity(); slot++)
+            region.load(slot, farm.node(farm.add()));
+        double loadSeconds = secondsSince(start);
+
+        fprintf(stderr, "region: %zu nodes, %u ROM images, store %.2f ms, open %.3f ms, load %.2f ms\n",
+            numInstances, region.numRoms(), storeSeconds * 1e3, openSeconds * 1e3, loadSeconds * 1e3);
+        return true;
+    }
+
+    bool parseList(const char* text, std::vector<size_t>& list)
+    {
+        list.clear();
+
+        while(*text)
+        {
+            char* end;
+            unsigned long long value = strtoull(text, &end, 10);
+
+            if(end == text || value == 0 || (*end != ',' && *end != '\0'))
+                return false;
+
+            list.push_back(static_cast<size_t>(value));
+            text = *end == ',' ? end + 1 : end;
+        }
+
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+        return !list.empty();
+    }
+
+    void printUsage(const char* program)
+    {
+        fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "Options:\n"
+            "  -n, --instances LIST  comma separated node counts (default 1,10,100,1000,10000,100000)\n"
+            "  -j, --threads LIST    comma separated thread counts (default 1, 2, 4, ... up to\n"
+            "                        the hardware thread count)\n"
+            "  -t, --ticks N         measured game ticks per run (default 100)\n"
+            "  -w, --warmup N        unmeasured ticks before those (default 5)\n"
+            "  -e, --examples DIR    where and-gate-counter.s and rotating-signal.s are\n"
+            "  -r, --region FILE     also time saving and loading the nodes through a\n"
+            "                        region file at FILE (overwritten)\n"
+            "      --layout          print the memory layout of a node and exit\n"
+            "\n"
+            "Each node needs about %zu bytes, 100000 of them about %zu MB.\n",
+            program, bytesPerInstance(), bytesPerInstance() * 100000 / (1024 * 1024));
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if(arg == "--layout")
+            {
+                options.layout = true;
+                continue;
+            }
+
+            if(!value)
+                return false;
+            i++;
+
+            if(arg == "-n" || arg == "--instances")
+            {
+                if(!parseList(value, options.instances))
+                    return false;
+            }
+            else if(arg == "-j" || arg == "--threads")
+            {
+                if(!parseList(value, options.threads))
+                    return false;
+            }
+            else if(arg == "-t" || arg == "--ticks")
+                options.ticks = strtoull(value, nullptr, 10);
+            else if(arg == "-w" || arg == "--warmup")
+                options.warmupTicks = strtoull(value, nullptr, 10);
+            else if(arg == "-e" || arg == "--examples")
+                options.examplesDir = value;
+            else if(arg == "-r" || arg == "--region")
+                options.regionPath = value;
+            else
+                return false;
+        }
+
+        if(options.threads.empty())
+        {
+            size_t hardwareThreads = ThreadPool::defaultThreadCount();
+
+            for(size_t threads = 1; threads < hardwareThreads; threads *= 2)
+                options.threads.push_back(threads);
+            options.threads.push_back(hardwareThreads);
+        }
+
+        return options.ticks > 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    if(!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if(options.layout)
+    {
+        printNodeLayout(stdout);
+        return 0;
+    }
+
+    std::vector<BenchProgram> programs;
+    if(!loadBenchPrograms(options.examplesDir, programs))
+        return 2;
+
+    printf("instances,threads,ticks,node_ticks_per_s,tick_p50_ms,tick_p99_ms,tick_max_ms,"
+        "realtime_nodes,bytes_per_instance,rss_mb,scaling_efficiency\n");
+
+    for(size_t numInstances : options.instances)
+    {
+        if(options.regionPath && !measureRegion(options, programs, numInstances))
+            return 3;
+
+        double baseThroughput = 0.0;
+        size_t baseThreads = 0;
+
+        for(size_t numThreads : options.threads)
+        {
+            Result result = measure(options, programs, numInstances, numThreads);
+            double throughput = result.seconds > 0.0
+                ? numInstances * options.ticks / result.seconds : 0.0;
+
+            // relative to the fewest threads measured, 1.0 is linear
+            if(baseThreads == 0)
+            {
+                baseThroughput = throughput;
+                baseThreads = numThreads;
+            }
+            double efficiency = baseThroughput > 0.0
+                ? (throughput / baseThroughput) / ((double)numThreads / baseThreads) : 0.0;
+
+            printf("%zu,%zu,%llu,%.0f,%.4f,%.4f,%.4f,%.0f,%zu,%.1f,%.3f\n",
+                numInstances, numThreads, (unsigned long long)options.ticks, throughput,
+                result.p50 * 1e3, result.p99 * 1e3, result.max * 1e3,
+                throughput / GAME_TICK_RATE, bytesPerInstance(),
+                result.residentBytes / (1024.0 * 1024.0), efficiency);
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
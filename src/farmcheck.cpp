@@ -0,0 +1,180 @@
+// Determinism check for MCUFarm and ThreadPool. The same farm is built
+// and ticked on 1, 2 and N threads, with chunks of a few nodes so they are
+// spread and stolen between threads. Every few ticks a node is removed,
+// one is added and one has its clock paused or resumed, so the farm's
+// node and runnable lists change under the pool. Nodes cycle through the
+// BenchPrograms.hpp firmware, every other one with the JIT on. After each
+// round the snapshot of every node is compared with the run on one
+// thread. Exits non-zero if any run diverges.
+
+#include "BenchPrograms.hpp"
+#include "MCUFarm.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        size_t instances = 64;
+        size_t threads = 0; // hardware threads, 4 at least
+        uint64_t ticks = 400;
+        uint64_t roundTicks = 25;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+    };
+
+    // Ticks a farm through the schedule and appends the snapshot of every
+    // node at the end of each round to snapshots
+    void runFarm(const Options& options, const std::vector<BenchProgram>& programs,
+        size_t numThreads, size_t grainSize, std::vector<CodeNodeNano::Snapshot>& snapshots)
+    {
+        MCUFarm farm(numThreads);
+        size_t numAdded = 0;
+        farm.setGrainSize(grainSize);
+
+        auto addNode = [&]()
+        {
+            const BenchProgram& program = programs[numAdded % programs.size()];
+            CodeNodeNano& node = farm.node(farm.add());
+            node.ROM().load(program.rom.data(), program.rom.size());
+            node.setJitEnabled(numAdded % 2 == 1);
+            node.powerOn();
+            numAdded++;
+        };
+
+        for(size_t i = 0; i < options.instances; i++)
+            addNode();
+
+        for(uint64_t tick = 0; tick < options.ticks; tick++)
+        {
+            for(size_t i = 0; i < farm.size(); i++)
+                driveBenchInputs(farm.node(i), tick);
+            farm.tick();
+
+            if((tick + 1) % options.roundTicks != 0)
+                continue;
+
+            size_t round = static_cast<size_t>(tick / options.roundTicks);
+            size_t first = snapshots.size();
+            snapshots.resize(first + farm.size());
+            for(size_t i = 0; i < farm.size(); i++)
+                farm.node(i).saveSnapshot(snapshots[first + i]);
+
+            farm.remove(round * 7 % farm.size());
+            addNode();
+
+            CodeNodeNano& node = farm.node(round * 5 % farm.size());
+            if(node.isClockPaused())
+                node.resumeClock();
+            else
+                node.pauseClock();
+        }
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -n, --instances N    nodes in the farm (default 64)\n"
+            "  -j, --threads N      most threads to check (default: hardware threads, 4 at least)\n"
+            "  -t, --ticks N        game ticks per run (default 400)\n"
+            "  -r, --round N        ticks between changes to the farm (default 25)\n"
+            "  -e, --examples DIR   where the example programs are (default %s)\n"
+            "  -h, --help           show this help\n",
+            program, CNMCU_EXAMPLES_DIR);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-n" || arg == "--instances") && hasValue)
+            options.instances = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+        else if((arg == "-j" || arg == "--threads") && hasValue)
+            options.threads = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+        else if((arg == "-t" || arg == "--ticks") && hasValue)
+            options.ticks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-r" || arg == "--round") && hasValue)
+            options.roundTicks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-e" || arg == "--examples") && hasValue)
+            options.examplesDir = argv[++i];
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(options.instances == 0 || options.roundTicks == 0)
+    {
+        fprintf(stderr, "need at least one node and one tick per round\n");
+        return 2;
+    }
+
+    if(options.threads == 0)
+    {
+        options.threads = std::thread::hardware_concurrency();
+        if(options.threads < 4)
+            options.threads = 4;
+    }
+
+    std::vector<BenchProgram> programs;
+    if(!loadBenchPrograms(options.examplesDir, programs))
+        return 2;
+
+    std::vector<CodeNodeNano::Snapshot> reference;
+    runFarm(options, programs, 1, 16, reference);
+
+    struct Run
+    {
+        size_t threads;
+        size_t grainSize;
+    };
+    const Run runs[] = {
+        { 1, 1 },
+        { 2, 1 },
+        { 2, 3 },
+        { options.threads, 1 },
+        { options.threads, 2 },
+    };
+
+    size_t diverged = 0;
+    for(const Run& run : runs)
+    {
+        std::vector<CodeNodeNano::Snapshot> snapshots;
+        runFarm(options, programs, run.threads, run.grainSize, snapshots);
+
+        for(size_t i = 0; i < reference.size(); i++)
+        {
+            if(i < snapshots.size() && memcmp(&reference[i], &snapshots[i], sizeof(CodeNodeNano::Snapshot)) == 0)
+                continue;
+
+            printf("%zu threads, grain %zu: snapshot %zu of %zu diverged\n",
+                run.threads, run.grainSize, i, reference.size());
+            diverged++;
+            break;
+        }
+    }
+
+    printf("%zu nodes, %llu ticks, up to %zu threads: %zu of %zu runs diverged from one thread\n",
+        options.instances, static_cast<unsigned long long>(options.ticks), options.threads,
+        diverged, sizeof(runs) / sizeof(runs[0]));
+    return diverged == 0 ? 0 : 1;
+}
@@ -0,0 +1,391 @@
+// Differential check of the lazily kept N and Z flags. Runs every opcode
+// of both instruction sets and dispatch methods on random registers and
+// operands and compares P after each instruction, plus the result and the
+// branch taken where flags feed into them, against a plain eager
+// computation of the 6502 flags. Half the instructions start from the
+// flags the previous one left behind, so results have to survive from one
+// instruction to the next too. Prints the first mismatches and exits
+// non-zero if there were any.
+
+#include "mos6502.h"
+#include "mos6502_opcodes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using mos6502_opcodes::Mnemonic;
+    using mos6502_opcodes::Mode;
+
+    enum Flag : uint8_t
+    {
+        CARRY = 0x01,
+        ZERO = 0x02,
+        INTERRUPT = 0x04,
+        DECIMAL = 0x08,
+        BREAK = 0x10,
+        CONSTANT = 0x20,
+        OVERFLOW = 0x40,
+        NEGATIVE = 0x80,
+    };
+
+    // Every data read sees the same byte, so the operand, pointers,
+    // pulled values and vectors are all known up front. Only the opcode
+    // fetch at pc differs.
+    struct Memory
+    {
+        uint16_t pc;
+        uint8_t opcode;
+        uint8_t value;
+        bool fetched;
+        std::vector<uint8_t> writes;
+
+        static uint8_t read(void* context, uint16_t address)
+        {
+            Memory& memory = *static_cast<Memory*>(context);
+            if(address == memory.pc && !memory.fetched)
+            {
+                memory.fetched = true;
+                return memory.opcode;
+            }
+            return memory.value;
+        }
+
+        static void write(void* context, uint16_t, uint8_t value)
+        {
+            static_cast<Memory*>(context)->writes.push_back(value);
+        }
+    };
+
+    struct Registers
+    {
+        uint8_t a, x, y, s, p;
+        uint16_t pc;
+    };
+
+    // What an instruction leaves behind, -1 where the check doesn't care
+    struct Expected
+    {
+        uint8_t p;
+        int a = -1;
+        int x = -1;
+        int y = -1;
+        int written = -1; // last byte written
+        int pc = -1;
+    };
+
+    uint8_t setNZ(uint8_t p, uint8_t value)
+    {
+        return (p & ~(NEGATIVE | ZERO)) | (value & NEGATIVE) | (value == 0 ? ZERO : 0);
+    }
+
+    uint8_t setFlag(uint8_t p, uint8_t flag, bool set)
+    {
+        return set ? (p | flag) : (p & ~flag);
+    }
+
+    // The flags as the eager upstream core computed them, decimal mode
+    // quirks included
+    Expected reference(const mos6502_opcodes::Opcode& op, bool cmos, const Registers& in, uint8_t m)
+    {
+        Expected out;
+        uint8_t p = in.p;
+        bool carry = (p & CARRY) != 0;
+        bool accumulator = op.mode == Mode::ACC;
+        uint8_t operand = accumulator ? in.a : m;
+
+        auto result = [&](uint8_t value) {
+            p = setNZ(p, value);
+            if(accumulator)
+                out.a = value;
+            else
+                out.written = value;
+        };
+        auto compare = [&](uint8_t reg) {
+            unsigned int tmp = reg - m;
+            p = setFlag(setNZ(p, tmp & 0xFF), CARRY, tmp < 0x100);
+        };
+        auto branch = [&](bool taken) {
+            uint16_t next = in.pc + 2;
+            out.pc = taken ? static_cast<uint16_t>(next + static_cast<int8_t>(m)) : next;
+        };
+
+        switch(op.mnemonic)
+        {
+            case Mnemonic::ADC:
+            {
+                unsigned int tmp = m + in.a + (carry ? 1 : 0);
+                bool zero = (tmp & 0xFF) == 0;
+                if(p & DECIMAL)
+                {
+                    if(((in.a & 0xF) + (m & 0xF) + (carry ? 1 : 0)) > 9) tmp += 6;
+                    p = setFlag(p, NEGATIVE, tmp & 0x80);
+                    p = setFlag(p, OVERFLOW, !((in.a ^ m) & 0x80) && ((in.a ^ tmp) & 0x80));
+                    if(tmp > 0x99) tmp += 96;
+                    p = setFlag(p, CARRY, tmp > 0x99);
+                }
+                else
+                {
+                    p = setFlag(p, NEGATIVE, tmp & 0x80);
+                    p = setFlag(p, OVERFLOW, !((in.a ^ m) & 0x80) && ((in.a ^ tmp) & 0x80));
+                    p = setFlag(p, CARRY, tmp > 0xFF);
+                }
+                p = setFlag(p, ZERO, zero);
+                out.a = tmp & 0xFF;
+                break;
+            }
+            case Mnemonic::SBC:
+            {
+                unsigned int tmp = in.a - m - (carry ? 0 : 1);
+                p = setNZ(p, tmp & 0xFF);
+                p = setFlag(p, OVERFLOW, ((in.a ^ tmp) & 0x80) && ((in.a ^ m) & 0x80));
+                if(p & DECIMAL)
+                {
+                    if(((in.a & 0x0F) - (carry ? 0 : 1)) < (m & 0x0F)) tmp -= 6;
+                    if(tmp > 0x99) tmp -= 0x60;
+                }
+                p = setFlag(p, CARRY, tmp < 0x100);
+                out.a = tmp & 0xFF;
+                break;
+            }
+            case Mnemonic::AND: p = setNZ(p, in.a & m); out.a = in.a & m; break;
+            case Mnemonic::ORA: p = setNZ(p, in.a | m); out.a = in.a | m; break;
+            case Mnemonic::EOR: p = setNZ(p, in.a ^ m); out.a = in.a ^ m; break;
+            case Mnemonic::LDA: case Mnemonic::PLA: p = setNZ(p, m); out.a = m; break;
+            case Mnemonic::LDX: case Mnemonic::PLX: p = setNZ(p, m); out.x = m; break;
+            case Mnemonic::LDY: case Mnemonic::PLY: p = setNZ(p, m); out.y = m; break;
+            case Mnemonic::TAX: p = setNZ(p, in.a); out.x = in.a; break;
+            case Mnemonic::TAY: p = setNZ(p, in.a); out.y = in.a; break;
+            case Mnemonic::TXA: p = setNZ(p, in.x); out.a = in.x; break;
+            case Mnemonic::TYA: p = setNZ(p, in.y); out.a = in.y; break;
+            case Mnemonic::TSX: p = setNZ(p, in.s); out.x = in.s; break;
+            case Mnemonic::INX: p = setNZ(p, in.x + 1); out.x = (in.x + 1) & 0xFF; break;
+            case Mnemonic::DEX: p = setNZ(p, in.x - 1); out.x = (in.x - 1) & 0xFF; break;
+            case Mnemonic::INY: p = setNZ(p, in.y + 1); out.y = (in.y + 1) & 0xFF; break;
+            case Mnemonic::DEY: p = setNZ(p, in.y - 1); out.y = (in.y - 1) & 0xFF; break;
+            case Mnemonic::INC: result(operand + 1); break;
+            case Mnemonic::DEC: result(operand - 1); break;
+            case Mnemonic::ASL:
+                p = setFlag(p, CARRY, operand & 0x80);
+                result(operand << 1);
+                break;
+            case Mnemonic::LSR:
+                p = setFlag(p, CARRY, operand & 0x01);
+                result(operand >> 1);
+                break;
+            case Mnemonic::ROL:
+                p = setFlag(p, CARRY, operand & 0x80);
+                result((operand << 1) | (carry ? 0x01 : 0));
+                break;
+            case Mnemonic::ROR:
+                p = setFlag(p, CARRY, operand & 0x01);
+                result((operand >> 1) | (carry ? 0x80 : 0));
+                break;
+            case Mnemonic::CMP: compare(in.a); break;
+            case Mnemonic::CPX: compare(in.x); break;
+            case Mnemonic::CPY: compare(in.y); break;
+            case Mnemonic::BIT:
+                if(op.mode != Mode::IMM)
+                {
+                    p |= CONSTANT | BREAK;
+                    p = setFlag(p, OVERFLOW, m & 0x40);
+                    p = setFlag(p, NEGATIVE, m & 0x80);
+                }
+                p = setFlag(p, ZERO, (in.a & m) == 0);
+                break;
+            case Mnemonic::TRB:
+                p = setFlag(p, ZERO, (in.a & m) == 0);
+                out.written = m & ~in.a;
+                break;
+            case Mnemonic::TSB:
+                p = setFlag(p, ZERO, (in.a & m) == 0);
+                out.written = m | in.a;
+                break;
+            case Mnemonic::CLC: p &= ~CARRY; break;
+            case Mnemonic::SEC: p |= CARRY; break;
+            case Mnemonic::CLI: p &= ~INTERRUPT; break;
+            case Mnemonic::SEI: p |= INTERRUPT; break;
+            case Mnemonic::CLD: p &= ~DECIMAL; break;
+            case Mnemonic::SED: p |= DECIMAL; break;
+            case Mnemonic::CLV: p &= ~OVERFLOW; break;
+            case Mnemonic::PLP: case Mnemonic::RTI: p = m | CONSTANT | BREAK; break;
+            case Mnemonic::PHP:
+                out.written = in.p | CONSTANT | BREAK;
+                break;
+            case Mnemonic::BRK:
+                out.written = in.p | CONSTANT | BREAK;
+                p |= INTERRUPT;
+                if(cmos)
+                    p &= ~DECIMAL;
+                break;
+            case Mnemonic::BPL: branch(!(in.p & NEGATIVE)); break;
+            case Mnemonic::BMI: branch(in.p & NEGATIVE); break;
+            case Mnemonic::BNE: branch(!(in.p & ZERO)); break;
+            case Mnemonic::BEQ: branch(in.p & ZERO); break;
+            case Mnemonic::BCC: branch(!(in.p & CARRY)); break;
+            case Mnemonic::BCS: branch(in.p & CARRY); break;
+            case Mnemonic::BVC: branch(!(in.p & OVERFLOW)); break;
+            case Mnemonic::BVS: branch(in.p & OVERFLOW); break;
+            case Mnemonic::BRA: branch(true); break;
+            default:
+                // stores, jumps, pushes, TXS, NOP, WAI and STP leave P alone
+                break;
+        }
+
+        out.p = p;
+        return out;
+    }
+
+    struct Config
+    {
+        const char* name;
+        mos6502::InstructionSet instructionSet;
+        mos6502::DispatchMethod dispatchMethod;
+    };
+
+    // Runs every opcode of config trials times, returns the mismatches
+    uint64_t check(const Config& config, uint32_t trials, uint32_t seed, uint32_t maxReports)
+    {
+        bool cmos = config.instructionSet == mos6502::CMOS_65C02;
+        uint8_t set = cmos ? mos6502_opcodes::CMOS : mos6502_opcodes::NMOS;
+        std::mt19937 rng(seed);
+        Memory memory;
+        uint64_t mismatches = 0;
+
+        auto makeCPU = [&]() {
+            mos6502 cpu(Memory::read, Memory::write, nullptr, &memory);
+            cpu.SetInstructionSet(config.instructionSet);
+            cpu.SetDispatchMethod(config.dispatchMethod);
+            cpu.Reset();
+            return cpu;
+        };
+        mos6502 cpu = makeCPU();
+        bool fresh = true;
+
+        for(uint32_t trial = 0; trial < trials; trial++)
+        {
+            for(int opcode = 0; opcode < 256; opcode++)
+            {
+                mos6502_opcodes::Opcode op = mos6502_opcodes::Describe(opcode, set);
+                if(op.mnemonic == Mnemonic::ILL)
+                    continue;
+
+                Registers in;
+                in.pc = rng();
+                in.a = rng();
+                in.x = rng();
+                in.y = rng();
+                in.s = rng();
+                cpu.SetPC(in.pc);
+                cpu.SetA(in.a);
+                cpu.SetX(in.x);
+                cpu.SetY(in.y);
+                cpu.SetS(in.s);
+                // otherwise start from the flags the last instruction left
+                if(fresh || rng() % 2 == 0)
+                    cpu.SetP(rng());
+                in.p = cpu.GetP();
+                fresh = false;
+
+                memory.pc = in.pc;
+                memory.opcode = opcode;
+                memory.value = rng();
+                memory.fetched = false;
+                memory.writes.clear();
+
+                uint64_t cycles = 0;
+                cpu.Run(1, cycles, mos6502::INST_COUNT);
+
+                Expected expected = reference(op, cmos, in, memory.value);
+                bool ok = cpu.GetP() == expected.p &&
+                    (expected.a < 0 || cpu.GetA() == expected.a) &&
+                    (expected.x < 0 || cpu.GetX() == expected.x) &&
+                    (expected.y < 0 || cpu.GetY() == expected.y) &&
+                    (expected.pc < 0 || cpu.GetPC() == expected.pc) &&
+                    (expected.written < 0 || (!memory.writes.empty() && memory.writes.back() == expected.written));
+
+                if(!ok && mismatches++ < maxReports)
+                {
+                    printf("%s: %02X %s A=%02X X=%02X Y=%02X P=%02X M=%02X -> P=%02X A=%02X X=%02X Y=%02X, expected P=%02X",
+                        config.name, opcode, mos6502_opcodes::Name(op.mnemonic),
+                        in.a, in.x, in.y, in.p, memory.value,
+                        cpu.GetP(), cpu.GetA(), cpu.GetX(), cpu.GetY(), expected.p);
+                    if(expected.a >= 0) printf(" A=%02X", expected.a);
+                    if(expected.x >= 0) printf(" X=%02X", expected.x);
+                    if(expected.y >= 0) printf(" Y=%02X", expected.y);
+                    if(expected.pc >= 0) printf(" PC=%04X (got %04X)", expected.pc, cpu.GetPC());
+                    if(expected.written >= 0) printf(" written=%02X", expected.written);
+                    printf("\n");
+                }
+
+                // WAI and STP park the CPU for good here, start over
+                if(cpu.IsWaiting() || cpu.IsStopped() || cpu.GetIllegalOpcode())
+                {
+                    cpu = makeCPU();
+                    fresh = true;
+                }
+            }
+        }
+
+        return mismatches;
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -n, --trials N   runs of every opcode per configuration (default 2000)\n"
+            "  -s, --seed N     random seed (default 1)\n"
+            "  -h, --help       show this help\n",
+            program);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t trials = 2000;
+    uint32_t seed = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-n" || arg == "--trials") && hasValue)
+            trials = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        else if((arg == "-s" || arg == "--seed") && hasValue)
+            seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 0));
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    const Config configs[] = {
+        { "nmos/table", mos6502::NMOS_6502, mos6502::INSTR_TABLE },
+        { "nmos/switch", mos6502::NMOS_6502, mos6502::FUSED_SWITCH },
+        { "cmos/switch", mos6502::CMOS_65C02, mos6502::FUSED_SWITCH },
+    };
+
+    uint64_t total = 0;
+    for(const Config& config : configs)
+    {
+        uint64_t mismatches = check(config, trials, seed, 20);
+        printf("%s: %u runs of every opcode, %llu mismatches\n",
+            config.name, trials, static_cast<unsigned long long>(mismatches));
+        total += mismatches;
+    }
+
+    return total == 0 ? 0 : 1;
+}
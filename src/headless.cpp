@@ -0,0 +1,419 @@
+// Runs a CodeNodeNano without a window: loads a ROM image, drives the four
+// redstone pins from an input schedule, ticks the MCU and prints the final
+// state. Only needs the emulator core, see cnmcu-headless in CMakeLists.txt.
+
+#include "CodeNodeNano.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr int NUM_PINS = 4;
+    const char* const pinNames[NUM_PINS] = { "north", "east", "south", "west" };
+
+    // Sets the redstone level of an input pin from a tick on
+    struct InputEvent
+    {
+        uint64_t tick;
+        int pin;
+        uint8_t level;
+    };
+
+    struct Options
+    {
+        const char* romFile = nullptr;
+        uint64_t ticks = GAME_TICK_RATE;
+        std::vector<InputEvent> inputs;
+
+        bool untilHalt = false;
+        int untilPC = -1;
+        int untilPin = -1;
+        uint8_t untilPinLevel = 0;
+
+        bool jit = false;
+        bool busTracing = true;
+        bool cmos = false;
+        bool dumpRAM = true;
+    };
+
+    void printUsage(const char* program)
+    {
+        fprintf(stderr,
+            "Usage: %s [options] <rom.bin>\n"
+            "\n"
+            "Options:\n"
+            "  -t, --ticks N          game ticks to run at most (default %d, %d per second)\n"
+            "  -i, --input T:PIN=L    from tick T on, drive input PIN with redstone level L (0-15)\n"
+            "  -s, --script FILE      read input events from FILE, one \"T PIN L\" per line\n"
+            "      --until-pc ADDR    stop after the tick that leaves PC at ADDR (hex)\n"
+            "      --until-pin PIN=L  stop after the tick that leaves output PIN at level L\n"
+            "      --until-halt       stop once the CPU hits STP or an illegal opcode\n"
+            "      --jit              run ROM code as translated x86-64 where supported\n"
+            "      --no-bus-tracing   let zero page and stack accesses bypass the memory map\n"
+            "      --cmos             run the 65C02 instruction set\n"
+            "      --no-ram           leave the RAM dump out of the report\n"
+            "\n"
+            "PIN is north, east, south, west (or n, e, s, w, 0-3).\n",
+            program, GAME_TICK_RATE, GAME_TICK_RATE);
+    }
+
+    bool parseNumber(const char* text, int base, uint64_t* value)
+    {
+        char* end;
+
+        if(*text == '\0')
+            return false;
+
+        *value = strtoull(text, &end, base);
+        return *end == '\0';
+    }
+
+    int parsePin(const std::string& name)
+    {
+        for(int i = 0; i < NUM_PINS; i++)
+        {
+            if(name == pinNames[i] || (name.size() == 1 && name[0] == pinNames[i][0]))
+                return i;
+        }
+
+        if(name.size() == 1 && name[0] >= '0' && name[0] < '0' + NUM_PINS)
+            return name[0] - '0';
+
+        return -1;
+    }
+
+    bool parseLevel(const std::string& text, uint8_t* level)
+    {
+        uint64_t value;
+
+        if(!parseNumber(text.c_str(), 10, &value) || value > 15)
+            return false;
+
+        *level = static_cast<uint8_t>(value);
+        return true;
+    }
+
+    // PIN=L
+    bool parsePinLevel(const std::string& text, int* pin, uint8_t* level)
+    {
+        size_t equals = text.find('=');
+
+        if(equals == std::string::npos)
+            return false;
+
+        *pin = parsePin(text.substr(0, equals));
+        return *pin >= 0 && parseLevel(text.substr(equals + 1), level);
+    }
+
+    // T:PIN=L
+    bool parseInput(const std::string& text, InputEvent* event)
+    {
+        size_t colon = text.find(':');
+
+        if(colon == std::string::npos)
+            return false;
+
+        return parseNumber(text.substr(0, colon).c_str(), 10, &event->tick) &&
+            parsePinLevel(text.substr(colon + 1), &event->pin, &event->level);
+    }
+
+    bool loadScript(const char* filename, std::vector<InputEvent>& inputs)
+    {
+        std::ifstream file(filename);
+
+        if(!file.good())
+        {
+            fprintf(stderr, "Failed to open script \"%s\"\n", filename);
+            return false;
+        }
+
+        std::string line;
+        int lineNumber = 0;
+
+        while(std::getline(file, line))
+        {
+            lineNumber++;
+
+            size_t comment = line.find('#');
+            if(comment != std::string::npos)
+                line.erase(comment);
+
+            char tick[32], pin[32], level[32];
+            int fields = sscanf(line.c_str(), "%31s %31s %31s", tick, pin, level);
+
+            if(fields <= 0)
+                continue;
+
+            InputEvent event;
+            if(fields != 3 ||
+                !parseNumber(tick, 10, &event.tick) ||
+                (event.pin = parsePin(pin)) < 0 ||
+                !parseLevel(level, &event.level))
+            {
+                fprintf(stderr, "%s:%d: expected \"TICK PIN LEVEL\"\n", filename, lineNumber);
+                return false;
+            }
+
+            inputs.push_back(event);
+        }
+
+        return true;
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+            bool valid = true;
+
+            if(arg == "-h" || arg == "--help")
+                return false;
+            else if(arg == "--until-halt")
+                options.untilHalt = true;
+            else if(arg == "--jit")
+                options.jit = true;
+            else if(arg == "--no-bus-tracing")
+                options.busTracing = false;
+            else if(arg == "--cmos")
+                options.cmos = true;
+            else if(arg == "--no-ram")
+                options.dumpRAM = false;
+            else if(arg[0] == '-' && arg.size() > 1)
+            {
+                uint64_t number = 0;
+                InputEvent event;
+
+                if(!value)
+                {
+                    fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                    return false;
+                }
+                i++;
+
+                if(arg == "-t" || arg == "--ticks")
+                    valid = parseNumber(value, 10, &options.ticks);
+                else if(arg == "-i" || arg == "--input")
+                {
+                    valid = parseInput(value, &event);
+                    if(valid)
+                        options.inputs.push_back(event);
+                }
+                else if(arg == "-s" || arg == "--script")
+                {
+                    if(!loadScript(value, options.inputs))
+                        return false;
+                }
+                else if(arg == "--until-pc")
+                {
+                    valid = parseNumber(value, 16, &number) && number <= 0xFFFF;
+                    if(valid)
+                        options.untilPC = static_cast<int>(number);
+                }
+                else if(arg == "--until-pin")
+                    valid = parsePinLevel(value, &options.untilPin, &options.untilPinLevel);
+                else
+                {
+                    fprintf(stderr, "Unknown option %s\n", arg.c_str());
+                    return false;
+                }
+            }
+            else if(!options.romFile)
+                options.romFile = argv[i];
+            else
+            {
+                fprintf(stderr, "Unexpected argument %s\n", argv[i]);
+                return false;
+            }
+
+            if(!valid)
+            {
+                fprintf(stderr, "Invalid value for %s: %s\n", arg.c_str(), value);
+                return false;
+            }
+        }
+
+        if(!options.romFile)
+        {
+            fprintf(stderr, "No ROM image given\n");
+            return false;
+        }
+
+        // events for the same tick apply in the order given
+        std::stable_sort(options.inputs.begin(), options.inputs.end(),
+            [](const InputEvent& a, const InputEvent& b) { return a.tick < b.tick; });
+
+        return true;
+    }
+
+    bool loadROM(const char* filename, CodeNodeNano& mcu)
+    {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+
+        if(!file.good())
+        {
+            fprintf(stderr, "Failed to open ROM \"%s\"\n", filename);
+            return false;
+        }
+
+        size_t size = file.tellg();
+        file.seekg(0, std::ios::beg);
+
+        if(size != mcu.ROM().size())
+        {
+            fprintf(stderr, "ROM image must be %zu bytes, \"%s\" has %zu\n",
+                mcu.ROM().size(), filename, size);
+            return false;
+        }
+
+        std::vector<uint8_t> image(size);
+        file.read(reinterpret_cast<char*>(image.data()), size);
+        mcu.ROM().load(image.data(), image.size());
+        return true;
+    }
+
+    bool isInput(CodeNodeNano& mcu, int pin)
+    {
+        return (*mcu.GPIO().dirData() & (1 << pin)) == 0;
+    }
+
+    // what the pin puts out on its redstone wire, 0 for inputs
+    uint8_t outputLevel(CodeNodeNano& mcu, int pin)
+    {
+        return isInput(mcu, pin) ? 0 : mcu.GPIO().pvFrontData()[pin] & 0xF;
+    }
+
+    void printHex(const char* name, const uint8_t* data, size_t size)
+    {
+        printf("%s:", name);
+        for(size_t i = 0; i < size; i++)
+            printf(" %02x", data[i]);
+        printf("\n");
+    }
+
+    void printReport(CodeNodeNano& mcu, const Options& options, uint64_t ticks,
+        const char* stopReason, double seconds)
+    {
+        mos6502& cpu = mcu.CPU();
+        CNGPIO<CodeNodeNano::GPIO_NUM_PINS>& gpio = mcu.GPIO();
+
+        printf("rom: %s\n", options.romFile);
+        printf("ticks: %llu\n", (unsigned long long)ticks);
+        printf("cycles: %llu\n", (unsigned long long)mcu.numCycles());
+        printf("stop: %s\n", stopReason);
+        printf("time_s: %.6f\n", seconds);
+        printf("cycles_per_s: %.0f\n", seconds > 0.0 ? mcu.numCycles() / seconds : 0.0);
+        printf("realtime_factor: %.1f\n", seconds > 0.0
+            ? (double)ticks / GAME_TICK_RATE / seconds : 0.0);
+
+        printf("pc: %04x\n", cpu.GetPC());
+        printf("a: %02x\n", cpu.GetA());
+        printf("x: %02x\n", cpu.GetX());
+        printf("y: %02x\n", cpu.GetY());
+        printf("s: %02x\n", cpu.GetS());
+        printf("p: %02x\n", cpu.GetP());
+        printf("irq: %d\n", cpu.GetIRQLine() ? 1 : 0);
+        printf("waiting: %d\n", cpu.IsWaiting() ? 1 : 0);
+        printf("stopped: %d\n", cpu.IsStopped() ? 1 : 0);
+        printf("illegal_opcode: %d\n", cpu.GetIllegalOpcode() ? 1 : 0);
+
+        for(int pin = 0; pin < NUM_PINS; pin++)
+        {
+            printf("pin_%s: %s %u\n", pinNames[pin],
+                isInput(mcu, pin) ? "in" : "out",
+                gpio.pvFrontData()[pin] & 0xF);
+        }
+
+        printHex("gpio_pv", gpio.pvFrontData(), NUM_PINS);
+        printHex("gpio_dir", gpio.dirData(), CodeNodeNano::GPIO_NUM_PINS / 8);
+        printHex("gpio_int", gpio.intData(), CodeNodeNano::GPIO_NUM_PINS / 2);
+        printHex("gpio_ifl", gpio.iflData(), CodeNodeNano::GPIO_NUM_PINS / 8);
+
+        if(!options.dumpRAM)
+            return;
+
+        const uint8_t* ram = mcu.RAM().data();
+        for(size_t row = 0; row < mcu.RAM().size(); row += 16)
+        {
+            printf("ram_%04zx:", row);
+            for(size_t i = 0; i < 16; i++)
+                printf(" %02x", ram[row + i]);
+            printf("\n");
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    if(!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    CodeNodeNano mcu;
+
+    if(!loadROM(options.romFile, mcu))
+        return 2;
+
+    mcu.CPU().SetInstructionSet(options.cmos ? mos6502::CMOS_65C02 : mos6502::NMOS_6502);
+    mcu.setBusTracing(options.busTracing);
+    mcu.setJitEnabled(options.jit);
+    mcu.powerOn();
+
+    uint8_t inputLevels[NUM_PINS] = { 0 };
+    size_t nextInput = 0;
+    uint64_t tick = 0;
+    const char* stopReason = "ticks";
+
+    auto start = std::chrono::steady_clock::now();
+
+    while(tick < options.ticks)
+    {
+        for(; nextInput < options.inputs.size() && options.inputs[nextInput].tick <= tick; nextInput++)
+            inputLevels[options.inputs[nextInput].pin] = options.inputs[nextInput].level;
+
+        // inputs read their wire, outputs keep what the program wrote
+        for(int pin = 0; pin < NUM_PINS; pin++)
+        {
+            if(isInput(mcu, pin))
+                mcu.GPIO().setPin(pin, inputLevels[pin]);
+        }
+
+        mcu.tick();
+        tick++;
+
+        mos6502& cpu = mcu.CPU();
+        if(options.untilHalt && (cpu.IsStopped() || cpu.GetIllegalOpcode()))
+        {
+            stopReason = "halt";
+            break;
+        }
+        if(options.untilPC >= 0 && cpu.GetPC() == options.untilPC)
+        {
+            stopReason = "pc";
+            break;
+        }
+        if(options.untilPin >= 0 && outputLevel(mcu, options.untilPin) == options.untilPinLevel)
+        {
+            stopReason = "pin";
+            break;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printReport(mcu, options, tick, stopReason, elapsed.count());
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Differential check of the JIT against the interpreter. Every program of
+// BenchPrograms.hpp runs on two nodes fed the same inputs, one
+// interpreting and one with the JIT on, and their snapshots are compared
+// after every step. Three ways of stepping are checked: game ticks on a
+// CodeNodeNano, single cycles on one, so translated code is stopped at
+// every instruction boundary, and game ticks on a CodeNodeMicro, whose
+// longer ticks make idle loops leave translated code to be skipped.
+// Exits non-zero if any pair diverges.
+
+#include "BenchPrograms.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        uint64_t ticks = 5000;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+    };
+
+    // Runs program for the given game ticks, cycle by cycle if
+    // singleCycles, and returns whether both nodes stayed in step
+    template <class Node>
+    bool check(const char* variant, const BenchProgram& program, uint64_t ticks, bool singleCycles)
+    {
+        // images are built for the top 8 KB, larger ROMs get them there too
+        std::vector<uint8_t> image(Node::ROM_SIZE, 0);
+        size_t size = program.rom.size() < image.size() ? program.rom.size() : image.size();
+        memcpy(image.data() + image.size() - size, program.rom.data() + program.rom.size() - size, size);
+
+        std::unique_ptr<Node> nodes[2] = { std::unique_ptr<Node>(new Node()), std::unique_ptr<Node>(new Node()) };
+        for(int i = 0; i < 2; i++)
+        {
+            nodes[i]->ROM().load(image.data(), image.size());
+            nodes[i]->setJitEnabled(i == 1);
+            nodes[i]->powerOn();
+        }
+
+        const uint64_t cyclesPerTick = Node::CLOCK_FREQUENCY / GAME_TICK_RATE;
+        const uint64_t steps = singleCycles ? ticks * cyclesPerTick : ticks;
+        std::unique_ptr<typename Node::Snapshot> snapshots[2] = {
+            std::unique_ptr<typename Node::Snapshot>(new typename Node::Snapshot()),
+            std::unique_ptr<typename Node::Snapshot>(new typename Node::Snapshot()),
+        };
+
+        for(uint64_t step = 0; step < steps; step++)
+        {
+            for(int i = 0; i < 2; i++)
+            {
+                if(!singleCycles)
+                    driveBenchInputs(*nodes[i], step);
+                else if(step % cyclesPerTick == 0)
+                    driveBenchInputs(*nodes[i], step / cyclesPerTick);
+
+                if(singleCycles)
+                    nodes[i]->cycle();
+                else
+                    nodes[i]->tick();
+                nodes[i]->saveSnapshot(*snapshots[i]);
+            }
+
+            if(memcmp(snapshots[0].get(), snapshots[1].get(), sizeof(typename Node::Snapshot)) != 0)
+            {
+                const typename Node::Snapshot& a = *snapshots[0];
+                const typename Node::Snapshot& b = *snapshots[1];
+                printf("%s, %s: diverged at %s %llu: pc %04X vs %04X, A %02X vs %02X, X %02X vs %02X, Y %02X vs %02X, "
+                    "P %02X vs %02X, %llu vs %llu cycles, bus %04X=%02X vs %04X=%02X\n",
+                    program.name.c_str(), variant, singleCycles ? "cycle" : "tick",
+                    static_cast<unsigned long long>(step),
+                    a.cpu.pc, b.cpu.pc, a.cpu.A, b.cpu.A, a.cpu.X, b.cpu.X, a.cpu.Y, b.cpu.Y,
+                    a.cpu.status, b.cpu.status,
+                    static_cast<unsigned long long>(a.cyclesCounter), static_cast<unsigned long long>(b.cyclesCounter),
+                    a.busAddress, a.busData, b.busAddress, b.busData);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -t, --ticks N        game ticks per program and way of stepping (default 5000)\n"
+            "  -e, --examples DIR   where the example programs are (default %s)\n"
+            "  -h, --help           show this help\n",
+            program, CNMCU_EXAMPLES_DIR);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-t" || arg == "--ticks") && hasValue)
+            options.ticks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-e" || arg == "--examples") && hasValue)
+            options.examplesDir = argv[++i];
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(!mos6502_jit::IsSupported())
+    {
+        printf("no JIT on this host, nothing to check\n");
+        return 0;
+    }
+
+    std::vector<BenchProgram> programs;
+    if(!loadBenchPrograms(options.examplesDir, programs))
+        return 2;
+
+    size_t diverged = 0;
+    for(const BenchProgram& program : programs)
+    {
+        diverged += !check<CodeNodeNano>("nano", program, options.ticks, false);
+        diverged += !check<CodeNodeNano>("nano", program, options.ticks, true);
+        diverged += !check<CodeNodeMicro>("micro", program, options.ticks, false);
+    }
+
+    printf("%zu programs, %llu ticks each: %zu of %zu runs diverged from the interpreter\n",
+        programs.size(), static_cast<unsigned long long>(options.ticks), diverged, programs.size() * 3);
+    return diverged == 0 ? 0 : 1;
+}
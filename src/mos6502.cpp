@@ -1,721 +1,203 @@
-#include "mos6502.h"
-
-#define NEGATIVE  0x80
-#define OVERFLOW  0x40
-#define CONSTANT  0x20
-#define BREAK     0x10
-#define DECIMAL   0x08
-#define INTERRUPT 0x04
-#define ZERO      0x02
-#define CARRY     0x01
-
-#define SET_NEGATIVE(x) (x ? (status |= NEGATIVE) : (status &= (~NEGATIVE)) )
-#define SET_OVERFLOW(x) (x ? (status |= OVERFLOW) : (status &= (~OVERFLOW)) )
-//#define SET_CONSTANT(x) (x ? (status |= CONSTANT) : (status &= (~CONSTANT)) )
-//#define SET_BREAK(x) (x ? (status |= BREAK) : (status &= (~BREAK)) )
-#define SET_DECIMAL(x) (x ? (status |= DECIMAL) : (status &= (~DECIMAL)) )
-#define SET_INTERRUPT(x) (x ? (status |= INTERRUPT) : (status &= (~INTERRUPT)) )
-#define SET_ZERO(x) (x ? (status |= ZERO) : (status &= (~ZERO)) )
-#define SET_CARRY(x) (x ? (status |= CARRY) : (status &= (~CARRY)) )
-
-#define IF_NEGATIVE() ((status & NEGATIVE) ? true : false)
-#define IF_OVERFLOW() ((status & OVERFLOW) ? true : false)
-#define IF_CONSTANT() ((status & CONSTANT) ? true : false)
-#define IF_BREAK() ((status & BREAK) ? true : false)
-#define IF_DECIMAL() ((status & DECIMAL) ? true : false)
-#define IF_INTERRUPT() ((status & INTERRUPT) ? true : false)
-#define IF_ZERO() ((status & ZERO) ? true : false)
-#define IF_CARRY() ((status & CARRY) ? true : false)
-
-mos6502::Instr mos6502::InstrTable[256];
-
-mos6502::mos6502(BusRead r, BusWrite w, ClockCycle c)
-	: reset_A(0x00)
+#define MOS6502_CORE_KEEP_FLAG_MACROS
+#include "mos6502_core.h"
+#include "mos6502_jit.h"
+
+#include "mos6502_opcodes.h"
+
+constexpr mos6502::CodeExec mos6502::CodeExecFor(uint8_t mnemonic, bool accumulator)
+{
+	using mos6502_opcodes::Mnemonic;
+
+	switch((Mnemonic)mnemonic)
+	{
+		case Mnemonic::ADC: return &mos6502::Op_ADC;
+		case Mnemonic::AND: return &mos6502::Op_AND;
+		case Mnemonic::ASL: return accumulator ? &mos6502::Op_ASL_ACC : &mos6502::Op_ASL;
+		case Mnemonic::BCC: return &mos6502::Op_BCC;
+		case Mnemonic::BCS: return &mos6502::Op_BCS;
+		case Mnemonic::BEQ: return &mos6502::Op_BEQ;
+		case Mnemonic::BIT: return &mos6502::Op_BIT;
+		case Mnemonic::BMI: return &mos6502::Op_BMI;
+		case Mnemonic::BNE: return &mos6502::Op_BNE;
+		case Mnemonic::BPL: return &mos6502::Op_BPL;
+		case Mnemonic::BRK: return &mos6502::Op_BRK;
+		case Mnemonic::BVC: return &mos6502::Op_BVC;
+		case Mnemonic::BVS: return &mos6502::Op_BVS;
+		case Mnemonic::CLC: return &mos6502::Op_CLC;
+		case Mnemonic::CLD: return &mos6502::Op_CLD;
+		case Mnemonic::CLI: return &mos6502::Op_CLI;
+		case Mnemonic::CLV: return &mos6502::Op_CLV;
+		case Mnemonic::CMP: return &mos6502::Op_CMP;
+		case Mnemonic::CPX: return &mos6502::Op_CPX;
+		case Mnemonic::CPY: return &mos6502::Op_CPY;
+		case Mnemonic::DEC: return &mos6502::Op_DEC;
+		case Mnemonic::DEX: return &mos6502::Op_DEX;
+		case Mnemonic::DEY: return &mos6502::Op_DEY;
+		case Mnemonic::EOR: return &mos6502::Op_EOR;
+		case Mnemonic::INC: return &mos6502::Op_INC;
+		case Mnemonic::INX: return &mos6502::Op_INX;
+		case Mnemonic::INY: return &mos6502::Op_INY;
+		case Mnemonic::JMP: return &mos6502::Op_JMP;
+		case Mnemonic::JSR: return &mos6502::Op_JSR;
+		case Mnemonic::LDA: return &mos6502::Op_LDA;
+		case Mnemonic::LDX: return &mos6502::Op_LDX;
+		case Mnemonic::LDY: return &mos6502::Op_LDY;
+		case Mnemonic::LSR: return accumulator ? &mos6502::Op_LSR_ACC : &mos6502::Op_LSR;
+		case Mnemonic::NOP: return &mos6502::Op_NOP;
+		case Mnemonic::ORA: return &mos6502::Op_ORA;
+		case Mnemonic::PHA: return &mos6502::Op_PHA;
+		case Mnemonic::PHP: return &mos6502::Op_PHP;
+		case Mnemonic::PLA: return &mos6502::Op_PLA;
+		case Mnemonic::PLP: return &mos6502::Op_PLP;
+		case Mnemonic::ROL: return accumulator ? &mos6502::Op_ROL_ACC : &mos6502::Op_ROL;
+		case Mnemonic::ROR: return accumulator ? &mos6502::Op_ROR_ACC : &mos6502::Op_ROR;
+		case Mnemonic::RTI: return &mos6502::Op_RTI;
+		case Mnemonic::RTS: return &mos6502::Op_RTS;
+		case Mnemonic::SBC: return &mos6502::Op_SBC;
+		case Mnemonic::SEC: return &mos6502::Op_SEC;
+		case Mnemonic::SED: return &mos6502::Op_SED;
+		case Mnemonic::SEI: return &mos6502::Op_SEI;
+		case Mnemonic::STA: return &mos6502::Op_STA;
+		case Mnemonic::STX: return &mos6502::Op_STX;
+		case Mnemonic::STY: return &mos6502::Op_STY;
+		case Mnemonic::TAX: return &mos6502::Op_TAX;
+		case Mnemonic::TAY: return &mos6502::Op_TAY;
+		case Mnemonic::TSX: return &mos6502::Op_TSX;
+		case Mnemonic::TXA: return &mos6502::Op_TXA;
+		case Mnemonic::TXS: return &mos6502::Op_TXS;
+		case Mnemonic::TYA: return &mos6502::Op_TYA;
+		// the 65C02 additions only run through ExecCMOS
+		default: return &mos6502::Op_ILLEGAL;
+	}
+}
+
+constexpr mos6502::AddrExec mos6502::AddrExecFor(uint8_t mode)
+{
+	using mos6502_opcodes::Mode;
+
+	switch((Mode)mode)
+	{
+		case Mode::ACC: return &mos6502::Addr_ACC;
+		case Mode::IMM: return &mos6502::Addr_IMM;
+		case Mode::ZER: return &mos6502::Addr_ZER;
+		case Mode::ZEX: return &mos6502::Addr_ZEX;
+		case Mode::ZEY: return &mos6502::Addr_ZEY;
+		case Mode::ABS: return &mos6502::Addr_ABS;
+		case Mode::ABX: return &mos6502::Addr_ABX;
+		case Mode::ABY: return &mos6502::Addr_ABY;
+		case Mode::ABI: return &mos6502::Addr_ABI;
+		case Mode::INX: return &mos6502::Addr_INX;
+		case Mode::INY: return &mos6502::Addr_INY;
+		case Mode::REL: return &mos6502::Addr_REL;
+		default: return &mos6502::Addr_IMP;
+	}
+}
+
+// the NMOS opcodes of mos6502_opcodes::Table as handlers, the rest ILLEGAL
+constexpr std::array<mos6502::Instr, 256> mos6502::BuildInstrTable()
+{
+	std::array<Instr, 256> table{};
+
+	for(int i = 0; i < 256; i++)
+	{
+		const mos6502_opcodes::Opcode& op = mos6502_opcodes::Table[i];
+
+		if(op.sets & mos6502_opcodes::NMOS)
+		{
+			table[i].addr = AddrExecFor((uint8_t)op.mode);
+			table[i].code = CodeExecFor((uint8_t)op.mnemonic, op.mode == mos6502_opcodes::Mode::ACC);
+			table[i].cycles = op.cycles;
+		}
+		else
+		{
+			table[i].addr = &mos6502::Addr_IMP;
+			table[i].code = &mos6502::Op_ILLEGAL;
+			table[i].cycles = 0;
+		}
+	}
+
+	return table;
+}
+
+// cycles per opcode in CMOS_65C02 mode, 0 where undefined
+constexpr std::array<uint8_t, 256> mos6502::BuildCmosInstrCycles()
+{
+	std::array<uint8_t, 256> cycles{};
+
+	for(int i = 0; i < 256; i++)
+	{
+		const mos6502_opcodes::Opcode& op = mos6502_opcodes::Table[i];
+		cycles[i] = (op.sets & mos6502_opcodes::CMOS) ? op.cycles : 0;
+	}
+
+	return cycles;
+}
+
+const std::array<mos6502::Instr, 256> mos6502::InstrTable = mos6502::BuildInstrTable();
+const std::array<uint8_t, 256> mos6502::CmosInstrCycles = mos6502::BuildCmosInstrCycles();
+
+mos6502::mos6502(BusRead r, BusWrite w, ClockCycle c, void* context)
+	: waiting(false)
+    , stopped(false)
+    , irqLine(false)
+    , nmiLine(false)
+    , nmiPending(false)
+    , dispatchMethod(FUSED_SWITCH)
+    , instructionSet(NMOS_6502)
+    , idleLoop()
+    , reset_A(0x00)
     , reset_X(0x00)
     , reset_Y(0x00)
     , reset_sp(0xFD)
     , reset_status(CONSTANT)
 {
-	Write = (BusWrite)w;
-	Read = (BusRead)r;
-	Cycle = (ClockCycle)c;
-
-	static bool initialized = false;
-	if (initialized) return;
-	initialized = true;
+	WriteCallback = (BusWrite)w;
+	ReadCallback = (BusRead)r;
+	CycleCallback = (ClockCycle)c;
+	this->context = context;
+}
 
-	Instr instr;
-	// fill jump table with ILLEGALs
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_ILLEGAL;
-	for(int i = 0; i < 256; i++)
+void mos6502::Predecode(
+	const uint8_t* code,
+	size_t size,
+	uint16_t base,
+	size_t begin,
+	size_t end,
+	DecodedInstr* decoded
+) {
+	for(size_t offset = begin; offset < end && offset < size; offset++)
 	{
-		InstrTable[i] = instr;
-	}
+		const mos6502_opcodes::Opcode& op = mos6502_opcodes::Table[code[offset]];
+		DecodedInstr& out = decoded[offset];
+		uint8_t length = op.length;
 
-	// insert opcodes
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 2;
-	InstrTable[0x69] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x6D] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 3;
-	InstrTable[0x65] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 6;
-	InstrTable[0x61] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 6;
-	InstrTable[0x71] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x75] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x7D] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x79] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 2;
-	InstrTable[0x29] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x2D] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 3;
-	InstrTable[0x25] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 6;
-	InstrTable[0x21] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 5;
-	InstrTable[0x31] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x35] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x3D] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x39] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_ASL;
-	instr.cycles = 6;
-	InstrTable[0x0E] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_ASL;
-	instr.cycles = 5;
-	InstrTable[0x06] = instr;
-	instr.addr = &mos6502::Addr_ACC;
-	instr.code = &mos6502::Op_ASL_ACC;
-	instr.cycles = 2;
-	InstrTable[0x0A] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_ASL;
-	instr.cycles = 6;
-	InstrTable[0x16] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_ASL;
-	instr.cycles = 7;
-	InstrTable[0x1E] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BCC;
-	instr.cycles = 2;
-	InstrTable[0x90] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BCS;
-	instr.cycles = 2;
-	InstrTable[0xB0] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BEQ;
-	instr.cycles = 2;
-	InstrTable[0xF0] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_BIT;
-	instr.cycles = 4;
-	InstrTable[0x2C] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_BIT;
-	instr.cycles = 3;
-	InstrTable[0x24] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BMI;
-	instr.cycles = 2;
-	InstrTable[0x30] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BNE;
-	instr.cycles = 2;
-	InstrTable[0xD0] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BPL;
-	instr.cycles = 2;
-	InstrTable[0x10] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_BRK;
-	instr.cycles = 7;
-	InstrTable[0x00] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BVC;
-	instr.cycles = 2;
-	InstrTable[0x50] = instr;
-
-	instr.addr = &mos6502::Addr_REL;
-	instr.code = &mos6502::Op_BVS;
-	instr.cycles = 2;
-	InstrTable[0x70] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_CLC;
-	instr.cycles = 2;
-	InstrTable[0x18] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_CLD;
-	instr.cycles = 2;
-	InstrTable[0xD8] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_CLI;
-	instr.cycles = 2;
-	InstrTable[0x58] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_CLV;
-	instr.cycles = 2;
-	InstrTable[0xB8] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 2;
-	InstrTable[0xC9] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xCD] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 3;
-	InstrTable[0xC5] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 6;
-	InstrTable[0xC1] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 3;
-	InstrTable[0xD1] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xD5] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xDD] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xD9] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_CPX;
-	instr.cycles = 2;
-	InstrTable[0xE0] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_CPX;
-	instr.cycles = 4;
-	InstrTable[0xEC] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_CPX;
-	instr.cycles = 3;
-	InstrTable[0xE4] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_CPY;
-	instr.cycles = 2;
-	InstrTable[0xC0] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_CPY;
-	instr.cycles = 4;
-	InstrTable[0xCC] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_CPY;
-	instr.cycles = 3;
-	InstrTable[0xC4] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_DEC;
-	instr.cycles = 6;
-	InstrTable[0xCE] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_DEC;
-	instr.cycles = 5;
-	InstrTable[0xC6] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_DEC;
-	instr.cycles = 6;
-	InstrTable[0xD6] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_DEC;
-	instr.cycles = 7;
-	InstrTable[0xDE] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_DEX;
-	instr.cycles = 2;
-	InstrTable[0xCA] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_DEY;
-	instr.cycles = 2;
-	InstrTable[0x88] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 2;
-	InstrTable[0x49] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x4D] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 3;
-	InstrTable[0x45] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 6;
-	InstrTable[0x41] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 5;
-	InstrTable[0x51] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x55] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x5D] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x59] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_INC;
-	instr.cycles = 6;
-	InstrTable[0xEE] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_INC;
-	instr.cycles = 5;
-	InstrTable[0xE6] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_INC;
-	instr.cycles = 6;
-	InstrTable[0xF6] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_INC;
-	instr.cycles = 7;
-	InstrTable[0xFE] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_INX;
-	instr.cycles = 2;
-	InstrTable[0xE8] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_INY;
-	instr.cycles = 2;
-	InstrTable[0xC8] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_JMP;
-	instr.cycles = 3;
-	InstrTable[0x4C] = instr;
-	instr.addr = &mos6502::Addr_ABI;
-	instr.code = &mos6502::Op_JMP;
-	instr.cycles = 5;
-	InstrTable[0x6C] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_JSR;
-	instr.cycles = 6;
-	InstrTable[0x20] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 2;
-	InstrTable[0xA9] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xAD] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 3;
-	InstrTable[0xA5] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 6;
-	InstrTable[0xA1] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 5;
-	InstrTable[0xB1] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xB5] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xBD] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xB9] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_LDX;
-	instr.cycles = 2;
-	InstrTable[0xA2] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_LDX;
-	instr.cycles = 4;
-	InstrTable[0xAE] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_LDX;
-	instr.cycles = 3;
-	InstrTable[0xA6] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_LDX;
-	instr.cycles = 4;
-	InstrTable[0xBE] = instr;
-	instr.addr = &mos6502::Addr_ZEY;
-	instr.code = &mos6502::Op_LDX;
-	instr.cycles = 4;
-	InstrTable[0xB6] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_LDY;
-	instr.cycles = 2;
-	InstrTable[0xA0] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_LDY;
-	instr.cycles = 4;
-	InstrTable[0xAC] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_LDY;
-	instr.cycles = 3;
-	InstrTable[0xA4] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_LDY;
-	instr.cycles = 4;
-	InstrTable[0xB4] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_LDY;
-	instr.cycles = 4;
-	InstrTable[0xBC] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_LSR;
-	instr.cycles = 6;
-	InstrTable[0x4E] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_LSR;
-	instr.cycles = 5;
-	InstrTable[0x46] = instr;
-	instr.addr = &mos6502::Addr_ACC;
-	instr.code = &mos6502::Op_LSR_ACC;
-	instr.cycles = 2;
-	InstrTable[0x4A] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_LSR;
-	instr.cycles = 6;
-	InstrTable[0x56] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_LSR;
-	instr.cycles = 7;
-	InstrTable[0x5E] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_NOP;
-	instr.cycles = 2;
-	InstrTable[0xEA] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 2;
-	InstrTable[0x09] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x0D] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 3;
-	InstrTable[0x05] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 6;
-	InstrTable[0x01] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 5;
-	InstrTable[0x11] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x15] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x1D] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x19] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_PHA;
-	instr.cycles = 3;
-	InstrTable[0x48] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_PHP;
-	instr.cycles = 3;
-	InstrTable[0x08] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_PLA;
-	instr.cycles = 4;
-	InstrTable[0x68] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_PLP;
-	instr.cycles = 4;
-	InstrTable[0x28] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_ROL;
-	instr.cycles = 6;
-	InstrTable[0x2E] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_ROL;
-	instr.cycles = 5;
-	InstrTable[0x26] = instr;
-	instr.addr = &mos6502::Addr_ACC;
-	instr.code = &mos6502::Op_ROL_ACC;
-	instr.cycles = 2;
-	InstrTable[0x2A] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_ROL;
-	instr.cycles = 6;
-	InstrTable[0x36] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_ROL;
-	instr.cycles = 7;
-	InstrTable[0x3E] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_ROR;
-	instr.cycles = 6;
-	InstrTable[0x6E] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_ROR;
-	instr.cycles = 5;
-	InstrTable[0x66] = instr;
-	instr.addr = &mos6502::Addr_ACC;
-	instr.code = &mos6502::Op_ROR_ACC;
-	instr.cycles = 2;
-	InstrTable[0x6A] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_ROR;
-	instr.cycles = 6;
-	InstrTable[0x76] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_ROR;
-	instr.cycles = 7;
-	InstrTable[0x7E] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_RTI;
-	instr.cycles = 6;
-	InstrTable[0x40] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_RTS;
-	instr.cycles = 6;
-	InstrTable[0x60] = instr;
-
-	instr.addr = &mos6502::Addr_IMM;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 2;
-	InstrTable[0xE9] = instr;
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xED] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 3;
-	InstrTable[0xE5] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 6;
-	InstrTable[0xE1] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 5;
-	InstrTable[0xF1] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xF5] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xFD] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xF9] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_SEC;
-	instr.cycles = 2;
-	InstrTable[0x38] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_SED;
-	instr.cycles = 2;
-	InstrTable[0xF8] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_SEI;
-	instr.cycles = 2;
-	InstrTable[0x78] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_STA;
-	instr.cycles = 4;
-	InstrTable[0x8D] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_STA;
-	instr.cycles = 3;
-	InstrTable[0x85] = instr;
-	instr.addr = &mos6502::Addr_INX;
-	instr.code = &mos6502::Op_STA;
-	instr.cycles = 6;
-	InstrTable[0x81] = instr;
-	instr.addr = &mos6502::Addr_INY;
-	instr.code = &mos6502::Op_STA;
-	instr.cycles = 6;
-	InstrTable[0x91] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_STA;
-	instr.cycles = 4;
-	InstrTable[0x95] = instr;
-	instr.addr = &mos6502::Addr_ABX;
-	instr.code = &mos6502::Op_STA;
-	instr.cycles = 5;
-	InstrTable[0x9D] = instr;
-	instr.addr = &mos6502::Addr_ABY;
-	instr.code = &mos6502::Op_STA;
-	instr.cycles = 5;
-	InstrTable[0x99] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_STX;
-	instr.cycles = 4;
-	InstrTable[0x8E] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_STX;
-	instr.cycles = 3;
-	InstrTable[0x86] = instr;
-	instr.addr = &mos6502::Addr_ZEY;
-	instr.code = &mos6502::Op_STX;
-	instr.cycles = 4;
-	InstrTable[0x96] = instr;
-
-	instr.addr = &mos6502::Addr_ABS;
-	instr.code = &mos6502::Op_STY;
-	instr.cycles = 4;
-	InstrTable[0x8C] = instr;
-	instr.addr = &mos6502::Addr_ZER;
-	instr.code = &mos6502::Op_STY;
-	instr.cycles = 3;
-	InstrTable[0x84] = instr;
-	instr.addr = &mos6502::Addr_ZEX;
-	instr.code = &mos6502::Op_STY;
-	instr.cycles = 4;
-	InstrTable[0x94] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_TAX;
-	instr.cycles = 2;
-	InstrTable[0xAA] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_TAY;
-	instr.cycles = 2;
-	InstrTable[0xA8] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_TSX;
-	instr.cycles = 2;
-	InstrTable[0xBA] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_TXA;
-	instr.cycles = 2;
-	InstrTable[0x8A] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_TXS;
-	instr.cycles = 2;
-	InstrTable[0x9A] = instr;
-
-	instr.addr = &mos6502::Addr_IMP;
-	instr.code = &mos6502::Op_TYA;
-	instr.cycles = 2;
-	InstrTable[0x98] = instr;
+		out.operand = 0;
+		out.opcode = code[offset];
+		out.cycles = InstrTable[code[offset]].cycles;
+		out.length = 0;
 
-	return;
+		if(!(op.sets & mos6502_opcodes::NMOS))
+			continue;
+
+		if(offset + length > size)
+			continue;
+
+		if(length == 2)
+			out.operand = code[offset + 1];
+		else if(length == 3)
+			out.operand = code[offset + 1] | (code[offset + 2] << 8);
+
+		// branches keep their target rather than the offset
+		if(op.mode == mos6502_opcodes::Mode::REL)
+			out.operand = base + offset + 2 + (int8_t)code[offset + 1];
+
+		out.length = length;
+	}
+}
+
+mos6502::mos6502()
+	: mos6502(nullptr, nullptr, nullptr, nullptr)
+{
 }
 
 uint16_t mos6502::Addr_ACC()
@@ -725,26 +207,20 @@ uint16_t mos6502::Addr_ACC()
 
 uint16_t mos6502::Addr_IMM()
 {
-	return pc++;
+	CallbackBus bus{*this};
+	return EA_IMM(bus);
 }
 
 uint16_t mos6502::Addr_ABS()
 {
-	uint16_t addrL;
-	uint16_t addrH;
-	uint16_t addr;
-
-	addrL = Read(pc++);
-	addrH = Read(pc++);
-
-	addr = addrL + (addrH << 8);
-
-	return addr;
+	CallbackBus bus{*this};
+	return EA_ABS(bus);
 }
 
 uint16_t mos6502::Addr_ZER()
 {
-	return Read(pc++);
+	CallbackBus bus{*this};
+	return EA_ZER(bus);
 }
 
 uint16_t mos6502::Addr_IMP()
@@ -754,172 +230,81 @@ uint16_t mos6502::Addr_IMP()
 
 uint16_t mos6502::Addr_REL()
 {
-	uint16_t offset;
-	uint16_t addr;
-
-	offset = (uint16_t)Read(pc++);
-	if (offset & 0x80) offset |= 0xFF00;
-	addr = pc + (int16_t)offset;
-	return addr;
+	CallbackBus bus{*this};
+	return EA_REL(bus);
 }
 
 uint16_t mos6502::Addr_ABI()
 {
-	uint16_t addrL;
-	uint16_t addrH;
-	uint16_t effL;
-	uint16_t effH;
-	uint16_t abs;
-	uint16_t addr;
-
-	addrL = Read(pc++);
-	addrH = Read(pc++);
-
-	abs = (addrH << 8) | addrL;
-
-	effL = Read(abs);
-
-#ifndef CMOS_INDIRECT_JMP_FIX
-	effH = Read((abs & 0xFF00) + ((abs + 1) & 0x00FF) );
-#else
-	effH = Read(abs + 1);
-#endif
-
-	addr = effL + 0x100 * effH;
-
-	return addr;
+	CallbackBus bus{*this};
+	return EA_ABI(bus);
 }
 
 uint16_t mos6502::Addr_ZEX()
 {
-	uint16_t addr = (Read(pc++) + X) & 0xFF;
-	return addr;
+	CallbackBus bus{*this};
+	return EA_ZEX(bus);
 }
 
 uint16_t mos6502::Addr_ZEY()
 {
-	uint16_t addr = (Read(pc++) + Y) & 0xFF;
-	return addr;
+	CallbackBus bus{*this};
+	return EA_ZEY(bus);
 }
 
 uint16_t mos6502::Addr_ABX()
 {
-	uint16_t addr;
-	uint16_t addrL;
-	uint16_t addrH;
-
-	addrL = Read(pc++);
-	addrH = Read(pc++);
-
-	addr = addrL + (addrH << 8) + X;
-	return addr;
+	CallbackBus bus{*this};
+	return EA_ABX(bus);
 }
 
 uint16_t mos6502::Addr_ABY()
 {
-	uint16_t addr;
-	uint16_t addrL;
-	uint16_t addrH;
-
-	addrL = Read(pc++);
-	addrH = Read(pc++);
-
-	addr = addrL + (addrH << 8) + Y;
-	return addr;
+	CallbackBus bus{*this};
+	return EA_ABY(bus);
 }
 
 
 uint16_t mos6502::Addr_INX()
 {
-	uint16_t zeroL;
-	uint16_t zeroH;
-	uint16_t addr;
-
-	zeroL = (Read(pc++) + X) & 0xFF;
-	zeroH = (zeroL + 1) & 0xFF;
-	addr = Read(zeroL) + (Read(zeroH) << 8);
-
-	return addr;
+	CallbackBus bus{*this};
+	return EA_INX(bus);
 }
 
 uint16_t mos6502::Addr_INY()
 {
-	uint16_t zeroL;
-	uint16_t zeroH;
-	uint16_t addr;
-
-	zeroL = Read(pc++);
-	zeroH = (zeroL + 1) & 0xFF;
-	addr = Read(zeroL) + (Read(zeroH) << 8) + Y;
-
-	return addr;
+	CallbackBus bus{*this};
+	return EA_INY(bus);
 }
 
 void mos6502::Reset()
 {
-	A = reset_A;
-	Y = reset_Y;
-	X = reset_X;
-
-	// load PC from reset vector
-	uint8_t pcl = Read(rstVectorL);
-	uint8_t pch = Read(rstVectorH);
-	pc = (pch << 8) + pcl;
-
-	sp = reset_sp;
-
-	status = reset_status | CONSTANT | BREAK;
-
-	illegalOpcode = false;
-
-	return;
+	CallbackBus bus{*this};
+	Reset(bus);
 }
 
 void mos6502::StackPush(uint8_t byte)
 {
-	Write(0x0100 + sp, byte);
-	if(sp == 0x00) sp = 0xFF;
-	else sp--;
+	CallbackBus bus{*this};
+	Push(bus, byte);
 }
 
 uint8_t mos6502::StackPop()
 {
-	if(sp == 0xFF) sp = 0x00;
-	else sp++;
-	return Read(0x0100 + sp);
+	CallbackBus bus{*this};
+	return Pop(bus);
 }
 
 void mos6502::IRQ()
 {
-	if(!IF_INTERRUPT())
-	{
-		//SET_BREAK(0);
-		StackPush((pc >> 8) & 0xFF);
-		StackPush(pc & 0xFF);
-		StackPush((status & ~BREAK) | CONSTANT);
-		SET_INTERRUPT(1);
-
-		// load PC from interrupt request vector
-		uint8_t pcl = Read(irqVectorL);
-		uint8_t pch = Read(irqVectorH);
-		pc = (pch << 8) + pcl;
-	}
-	return;
+	CallbackBus bus{*this};
+	IRQ(bus);
 }
 
 void mos6502::NMI()
 {
-	//SET_BREAK(0);
-	StackPush((pc >> 8) & 0xFF);
-	StackPush(pc & 0xFF);
-	StackPush((status & ~BREAK) | CONSTANT);
-	SET_INTERRUPT(1);
-
-	// load PC from non-maskable interrupt vector
-	uint8_t pcl = Read(nmiVectorL);
-	uint8_t pch = Read(nmiVectorH);
-	pc = (pch << 8) + pcl;
-	return;
+	CallbackBus bus{*this};
+	NMI(bus);
 }
 
 void mos6502::Run(
@@ -927,6 +312,14 @@ void mos6502::Run(
 	uint64_t& cycleCount,
 	CycleMethod cycleMethod
 ) {
+	if(dispatchMethod == FUSED_SWITCH || instructionSet == CMOS_65C02)
+	{
+		CallbackBus bus{*this};
+		Run(bus, cyclesRemaining, cycleCount, cycleMethod);
+		return;
+	}
+
+	CallbackBus bus{*this};
 	uint8_t opcode;
 	Instr instr;
 
@@ -946,18 +339,24 @@ void mos6502::Run(
 			/* cycleMethod == INST_COUNT */   : 1;
 
 		// run clock cycle callback
-		if (Cycle)
+		if (CycleCallback)
 			for(int i = 0; i < instr.cycles; i++)
-				Cycle(this);
+				Cycle();
+
+		// sample the interrupt lines at the instruction boundary
+		if ((irqLine || nmiPending) && !illegalOpcode)
+			ServiceInterrupts(bus);
 	}
 }
 
 void mos6502::RunEternally()
 {
+	CallbackBus bus{*this};
 	uint8_t opcode;
 	Instr instr;
 
-	while(!illegalOpcode)
+	// nothing wakes a waiting CPU from in here
+	while(!illegalOpcode && !waiting && !stopped)
 	{
 		// fetch
 		opcode = Read(pc++);
@@ -966,12 +365,27 @@ void mos6502::RunEternally()
 		instr = InstrTable[opcode];
 
 		// execute
-		Exec(instr);
+		if(dispatchMethod == FUSED_SWITCH || instructionSet == CMOS_65C02)
+			ExecFused(bus, opcode);
+		else
+			Exec(instr);
 
 		// run clock cycle callback
-		if (Cycle)
-			for(int i = 0; i < instr.cycles; i++)
-				Cycle(this);
+		if (CycleCallback)
+		{
+			uint8_t cycles = instructionSet == NMOS_6502
+				? instr.cycles
+				: CmosInstrCycles[opcode];
+			for(int i = 0; i < cycles; i++)
+				Cycle();
+		}
+
+		// sample the interrupt lines at the instruction boundary
+		if ((irqLine || nmiPending) && !illegalOpcode && !stopped)
+		{
+			waiting = false;
+			ServiceInterrupts(bus);
+		}
 	}
 }
 
@@ -981,6 +395,82 @@ void mos6502::Exec(Instr i)
 	(this->*i.code)(src);
 }
 
+int32_t mos6502::RunNative(mos6502_jit& jit, int32_t cycles, int32_t& loopBranch)
+{
+	mos6502_jit::State state;
+	state.pc = pc;
+	state.A = A;
+	state.X = X;
+	state.Y = Y;
+	state.sp = sp;
+	state.status = Status();
+
+	int32_t executed = jit.Execute(state, cycles, loopBranch);
+	if(executed > 0)
+	{
+		pc = state.pc;
+		A = state.A;
+		X = state.X;
+		Y = state.Y;
+		sp = state.sp;
+		SetStatus(state.status);
+	}
+
+	return executed;
+}
+
+void mos6502::SetContext(void* context)
+{
+    this->context = context;
+}
+
+void mos6502::SetIRQLine(bool asserted)
+{
+    irqLine = asserted;
+}
+
+void mos6502::SetNMILine(bool asserted)
+{
+    if(asserted && !nmiLine)
+        nmiPending = true;
+    nmiLine = asserted;
+}
+
+bool mos6502::GetIRQLine()
+{
+    return irqLine;
+}
+
+void mos6502::SetDispatchMethod(DispatchMethod method)
+{
+    dispatchMethod = method;
+}
+
+mos6502::DispatchMethod mos6502::GetDispatchMethod()
+{
+    return dispatchMethod;
+}
+
+void mos6502::SetInstructionSet(InstructionSet set)
+{
+    instructionSet = set;
+}
+
+mos6502::InstructionSet mos6502::GetInstructionSet()
+{
+    return instructionSet;
+}
+
+bool mos6502::IsWaiting()
+{
+    return waiting;
+}
+
+bool mos6502::IsStopped()
+{
+    return stopped;
+}
+
 uint16_t mos6502::GetPC()
 {
     return pc;
@@ -993,7 +483,7 @@ uint8_t mos6502::GetS()
 
 uint8_t mos6502::GetP()
 {
-    return status;
+    return Status();
 }
 
 uint8_t mos6502::GetA()
@@ -1011,6 +501,51 @@ uint8_t mos6502::GetY()
     return Y;
 }
 
+void mos6502::SetPC(uint16_t value)
+{
+    pc = value;
+}
+
+void mos6502::SetS(uint8_t value)
+{
+    sp = value;
+}
+
+void mos6502::SetP(uint8_t value)
+{
+    SetStatus(value);
+}
+
+void mos6502::SetA(uint8_t value)
+{
+    A = value;
+}
+
+void mos6502::SetX(uint8_t value)
+{
+    X = value;
+}
+
+void mos6502::SetY(uint8_t value)
+{
+    Y = value;
+}
+
+bool mos6502::GetIllegalOpcode()
+{
+    return illegalOpcode;
+}
+
+void mos6502::SetIllegalOpcode(bool value)
+{
+    illegalOpcode = value;
+}
+
+uint8_t mos6502::GetInstrCycles(uint8_t opcode)
+{
+    return InstrTable[opcode].cycles;
+}
+
 void mos6502::SetResetS(uint8_t value)
 {
     reset_sp = value;
@@ -1061,6 +596,52 @@ uint8_t mos6502::GetResetY()
     return reset_Y;
 }
 
+void mos6502::GetState(State& state) const
+{
+    state.pc = pc;
+    state.A = A;
+    state.X = X;
+    state.Y = Y;
+    state.sp = sp;
+    state.status = Status();
+    state.flags =
+        (illegalOpcode ? STATE_ILLEGAL_OPCODE : 0) |
+        (waiting ? STATE_WAITING : 0) |
+        (stopped ? STATE_STOPPED : 0) |
+        (irqLine ? STATE_IRQ_LINE : 0) |
+        (nmiLine ? STATE_NMI_LINE : 0) |
+        (nmiPending ? STATE_NMI_PENDING : 0);
+    state.instructionSet = instructionSet;
+    state.resetA = reset_A;
+    state.resetX = reset_X;
+    state.resetY = reset_Y;
+    state.resetSp = reset_sp;
+    state.resetStatus = reset_status;
+}
+
+void mos6502::SetState(const State& state)
+{
+    pc = state.pc;
+    A = state.A;
+    X = state.X;
+    Y = state.Y;
+    sp = state.sp;
+    SetStatus(state.status);
+    illegalOpcode = (state.flags & STATE_ILLEGAL_OPCODE) != 0;
+    waiting = (state.flags & STATE_WAITING) != 0;
+    stopped = (state.flags & STATE_STOPPED) != 0;
+    irqLine = (state.flags & STATE_IRQ_LINE) != 0;
+    nmiLine = (state.flags & STATE_NMI_LINE) != 0;
+    nmiPending = (state.flags & STATE_NMI_PENDING) != 0;
+    instructionSet = state.instructionSet == CMOS_65C02 ? CMOS_65C02 : NMOS_6502;
+    reset_A = state.resetA;
+    reset_X = state.resetX;
+    reset_Y = state.resetY;
+    reset_sp = state.resetSp;
+    reset_status = state.resetStatus;
+    idleLoop = IdleLoop();
+}
+
 void mos6502::Op_ILLEGAL(uint16_t src)
 {
 	illegalOpcode = true;
@@ -1069,28 +650,7 @@ void mos6502::Op_ILLEGAL(uint16_t src)
 
 void mos6502::Op_ADC(uint16_t src)
 {
-	uint8_t m = Read(src);
-	unsigned int tmp = m + A + (IF_CARRY() ? 1 : 0);
-	SET_ZERO(!(tmp & 0xFF));
-	if (IF_DECIMAL())
-	{
-		if (((A & 0xF) + (m & 0xF) + (IF_CARRY() ? 1 : 0)) > 9) tmp += 6;
-		SET_NEGATIVE(tmp & 0x80);
-		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
-		if (tmp > 0x99)
-		{
-			tmp += 96;
-		}
-		SET_CARRY(tmp > 0x99);
-	}
-	else
-	{
-		SET_NEGATIVE(tmp & 0x80);
-		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
-		SET_CARRY(tmp > 0xFF);
-	}
-
-	A = tmp & 0xFF;
+	Alu_ADC(Read(src));
 	return;
 }
 
@@ -1098,36 +658,20 @@ void mos6502::Op_ADC(uint16_t src)
 
 void mos6502::Op_AND(uint16_t src)
 {
-	uint8_t m = Read(src);
-	uint8_t res = m & A;
-	SET_NEGATIVE(res & 0x80);
-	SET_ZERO(!res);
-	A = res;
+	Alu_AND(Read(src));
 	return;
 }
 
 
 void mos6502::Op_ASL(uint16_t src)
 {
-	uint8_t m = Read(src);
-	SET_CARRY(m & 0x80);
-	m <<= 1;
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	Write(src, Alu_ASL(Read(src)));
 	return;
 }
 
 void mos6502::Op_ASL_ACC(uint16_t src)
 {
-	uint8_t m = A;
-	SET_CARRY(m & 0x80);
-	m <<= 1;
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	A = m;
+	A = Alu_ASL(A);
 	return;
 }
 
@@ -1161,11 +705,7 @@ void mos6502::Op_BEQ(uint16_t src)
 
 void mos6502::Op_BIT(uint16_t src)
 {
-	uint8_t m = Read(src);
-	uint8_t res = m & A;
-	SET_NEGATIVE(res & 0x80);
-	status = (status & 0x3F) | (uint8_t)(m & 0xC0) | CONSTANT | BREAK;
-	SET_ZERO(!res);
+	Alu_BIT(Read(src));
 	return;
 }
 
@@ -1198,12 +738,8 @@ void mos6502::Op_BPL(uint16_t src)
 
 void mos6502::Op_BRK(uint16_t src)
 {
-	pc++;
-	StackPush((pc >> 8) & 0xFF);
-	StackPush(pc & 0xFF);
-	StackPush(status | CONSTANT | BREAK);
-	SET_INTERRUPT(1);
-	pc = (Read(irqVectorH) << 8) + Read(irqVectorL);
+	CallbackBus bus{*this};
+	Exec_BRK(bus);
 	return;
 }
 
@@ -1251,38 +787,25 @@ void mos6502::Op_CLV(uint16_t src)
 
 void mos6502::Op_CMP(uint16_t src)
 {
-	unsigned int tmp = A - Read(src);
-	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	Alu_CMP(A, Read(src));
 	return;
 }
 
 void mos6502::Op_CPX(uint16_t src)
 {
-	unsigned int tmp = X - Read(src);
-	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	Alu_CMP(X, Read(src));
 	return;
 }
 
 void mos6502::Op_CPY(uint16_t src)
 {
-	unsigned int tmp = Y - Read(src);
-	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	Alu_CMP(Y, Read(src));
 	return;
 }
 
 void mos6502::Op_DEC(uint16_t src)
 {
-	uint8_t m = Read(src);
-	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	Write(src, Alu_DEC(Read(src)));
 	return;
 }
 
@@ -1290,8 +813,7 @@ void mos6502::Op_DEX(uint16_t src)
 {
 	uint8_t m = X;
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	X = m;
 	return;
 }
@@ -1300,36 +822,26 @@ void mos6502::Op_DEY(uint16_t src)
 {
 	uint8_t m = Y;
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	Y = m;
 	return;
 }
 
 void mos6502::Op_EOR(uint16_t src)
 {
-	uint8_t m = Read(src);
-	m = A ^ m;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	A = m;
+	Alu_EOR(Read(src));
 }
 
 void mos6502::Op_INC(uint16_t src)
 {
-	uint8_t m = Read(src);
-	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	Write(src, Alu_INC(Read(src)));
 }
 
 void mos6502::Op_INX(uint16_t src)
 {
 	uint8_t m = X;
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	X = m;
 }
 
@@ -1337,8 +849,7 @@ void mos6502::Op_INY(uint16_t src)
 {
 	uint8_t m = Y;
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	Y = m;
 }
 
@@ -1349,54 +860,41 @@ void mos6502::Op_JMP(uint16_t src)
 
 void mos6502::Op_JSR(uint16_t src)
 {
-	pc--;
-	StackPush((pc >> 8) & 0xFF);
-	StackPush(pc & 0xFF);
-	pc = src;
+	CallbackBus bus{*this};
+	Exec_JSR(bus, src);
 }
 
 void mos6502::Op_LDA(uint16_t src)
 {
 	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	A = m;
 }
 
 void mos6502::Op_LDX(uint16_t src)
 {
 	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	X = m;
 }
 
 void mos6502::Op_LDY(uint16_t src)
 {
 	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	Y = m;
 }
 
 void mos6502::Op_LSR(uint16_t src)
 {
-	uint8_t m = Read(src);
-	SET_CARRY(m & 0x01);
-	m >>= 1;
-	SET_NEGATIVE(0);
-	SET_ZERO(!m);
-	Write(src, m);
+	Write(src, Alu_LSR(Read(src)));
+	return;
 }
 
 void mos6502::Op_LSR_ACC(uint16_t src)
 {
-	uint8_t m = A;
-	SET_CARRY(m & 0x01);
-	m >>= 1;
-	SET_NEGATIVE(0);
-	SET_ZERO(!m);
-	A = m;
+	A = Alu_LSR(A);
+	return;
 }
 
 void mos6502::Op_NOP(uint16_t src)
@@ -1406,134 +904,78 @@ void mos6502::Op_NOP(uint16_t src)
 
 void mos6502::Op_ORA(uint16_t src)
 {
-	uint8_t m = Read(src);
-	m = A | m;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	A = m;
+	Alu_ORA(Read(src));
 }
 
 void mos6502::Op_PHA(uint16_t src)
 {
-	StackPush(A);
+	CallbackBus bus{*this};
+	Exec_PHA(bus);
 	return;
 }
 
 void mos6502::Op_PHP(uint16_t src)
 {
-	StackPush(status | CONSTANT | BREAK);
+	CallbackBus bus{*this};
+	Exec_PHP(bus);
 	return;
 }
 
 void mos6502::Op_PLA(uint16_t src)
 {
-	A = StackPop();
-	SET_NEGATIVE(A & 0x80);
-	SET_ZERO(!A);
+	CallbackBus bus{*this};
+	Exec_PLA(bus);
 	return;
 }
 
 void mos6502::Op_PLP(uint16_t src)
 {
-	status = StackPop() | CONSTANT | BREAK;
-	//SET_CONSTANT(1);
+	CallbackBus bus{*this};
+	Exec_PLP(bus);
 	return;
 }
 
 void mos6502::Op_ROL(uint16_t src)
 {
-	uint16_t m = Read(src);
-	m <<= 1;
-	if (IF_CARRY()) m |= 0x01;
-	SET_CARRY(m > 0xFF);
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	Write(src, Alu_ROL(Read(src)));
 	return;
 }
 
 void mos6502::Op_ROL_ACC(uint16_t src)
 {
-	uint16_t m = A;
-	m <<= 1;
-	if (IF_CARRY()) m |= 0x01;
-	SET_CARRY(m > 0xFF);
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	A = m;
+	A = Alu_ROL(A);
 	return;
 }
 
 void mos6502::Op_ROR(uint16_t src)
 {
-	uint16_t m = Read(src);
-	if (IF_CARRY()) m |= 0x100;
-	SET_CARRY(m & 0x01);
-	m >>= 1;
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	Write(src, Alu_ROR(Read(src)));
 	return;
 }
 
 void mos6502::Op_ROR_ACC(uint16_t src)
 {
-	uint16_t m = A;
-	if (IF_CARRY()) m |= 0x100;
-	SET_CARRY(m & 0x01);
-	m >>= 1;
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	A = m;
+	A = Alu_ROR(A);
 	return;
 }
 
 void mos6502::Op_RTI(uint16_t src)
 {
-	uint8_t lo, hi;
-
-	status = StackPop() | CONSTANT | BREAK;
-
-	lo = StackPop();
-	hi = StackPop();
-
-	pc = (hi << 8) | lo;
+	CallbackBus bus{*this};
+	Exec_RTI(bus);
 	return;
 }
 
 void mos6502::Op_RTS(uint16_t src)
 {
-	uint8_t lo, hi;
-
-	lo = StackPop();
-	hi = StackPop();
-
-	pc = ((hi << 8) | lo) + 1;
+	CallbackBus bus{*this};
+	Exec_RTS(bus);
 	return;
 }
 
 void mos6502::Op_SBC(uint16_t src)
 {
-	uint8_t m = Read(src);
-	unsigned int tmp = A - m - (IF_CARRY() ? 0 : 1);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
-	SET_OVERFLOW(((A ^ tmp) & 0x80) && ((A ^ m) & 0x80));
-
-	if (IF_DECIMAL())
-	{
-		if ( ((A & 0x0F) - (IF_CARRY() ? 0 : 1)) < (m & 0x0F)) tmp -= 6;
-		if (tmp > 0x99)
-		{
-			tmp -= 0x60;
-		}
-	}
-	SET_CARRY(tmp < 0x100);
-	A = (tmp & 0xFF);
+	Alu_SBC(Read(src));
 	return;
 }
 
@@ -1576,8 +1018,7 @@ void mos6502::Op_STY(uint16_t src)
 void mos6502::Op_TAX(uint16_t src)
 {
 	uint8_t m = A;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	X = m;
 	return;
 }
@@ -1585,8 +1026,7 @@ void mos6502::Op_TAX(uint16_t src)
 void mos6502::Op_TAY(uint16_t src)
 {
 	uint8_t m = A;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	Y = m;
 	return;
 }
@@ -1594,8 +1034,7 @@ void mos6502::Op_TAY(uint16_t src)
 void mos6502::Op_TSX(uint16_t src)
 {
 	uint8_t m = sp;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	X = m;
 	return;
 }
@@ -1603,8 +1042,7 @@ void mos6502::Op_TSX(uint16_t src)
 void mos6502::Op_TXA(uint16_t src)
 {
 	uint8_t m = X;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	A = m;
 	return;
 }
@@ -1618,8 +1056,7 @@ void mos6502::Op_TXS(uint16_t src)
 void mos6502::Op_TYA(uint16_t src)
 {
 	uint8_t m = Y;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SetNZ(m);
 	A = m;
 	return;
 }
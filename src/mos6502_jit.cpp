@@ -0,0 +1,1300 @@
+//============================================================================
+// Name        : mos6502_jit
+// Description : Basic block translation of ROM code to x86-64, see
+//               mos6502_jit.h.
+//
+//               Inside a block the 6502 registers live in host registers:
+//                   r8b A, r9b X, r10b Y, r12b S, dl P
+//                   r13b last result byte, standing in for N and Z until
+//                        P has to be complete
+//                   rbx Frame*, rsi RAM, rdi ROM and r15 I/O (both
+//                   biased by their base), r14 the block bodies
+//                   ebp cycles left
+//               rax, rcx and r11 are scratch. Blocks are entered through
+//               BlockEntry(Frame*, cycles) and return the cycles they ran.
+//               Exits to another translated block jump straight to its
+//               body, so a run only returns for the interpreter, for
+//               blocks not translated yet or once the cycles are used up.
+//============================================================================
+
+#include "mos6502_jit.h"
+#include "mos6502.h"
+#include "mos6502_opcodes.h"
+
+#include <string.h>
+#include <initializer_list>
+
+#if defined(MOS6502_JIT_X64)
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace
+{
+	const size_t MAX_BLOCK_INSTRS = 64;
+	const size_t MAX_BLOCK_BYTES = MAX_BLOCK_INSTRS * 3;
+	// the longest loop mos6502::ClassifyLoop looks at
+	const size_t MAX_IDLE_LOOP_INSTRS = 16;
+	// Leaving the block to have a loop pass checked costs about as much
+	// as running a few passes, so loops only stop while the cycles left
+	// cover this many and skipping them would pay
+	const int32_t IDLE_LOOP_REPORT_PASSES = 8;
+	const size_t CODE_CAPACITY = 256 * 1024;
+}
+
+#if defined(MOS6502_JIT_X64)
+
+namespace
+{
+	// 6502 status bits
+	const uint8_t FLAG_N = 0x80;
+	const uint8_t FLAG_V = 0x40;
+	const uint8_t FLAG_Z = 0x02;
+	const uint8_t FLAG_C = 0x01;
+
+	//------------------------------------------------------------------------
+	// x86-64 encoder, only the forms the translator needs
+
+	enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15, NO_REG = -1 };
+	enum Width { BYTE, WORD, DWORD, QWORD };
+	enum AluOp { ALU_ADD, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP };
+	enum ShiftOp { SH_ROL, SH_ROR, SH_RCL, SH_RCR, SH_SHL, SH_SHR };
+	enum Cond { CC_O = 0x0, CC_C = 0x2, CC_NC = 0x3, CC_Z = 0x4, CC_NZ = 0x5, CC_S = 0x8, CC_NS = 0x9, CC_LE = 0xE, CC_G = 0xF };
+
+	// [base + index + disp]
+	struct Mem
+	{
+		int base;
+		int index;
+		int32_t disp;
+	};
+
+	Mem At(int base, int32_t disp = 0) { return Mem{ base, NO_REG, disp }; }
+	Mem At(int base, int index, int32_t disp) { return Mem{ base, index, disp }; }
+
+	class Emitter
+	{
+	public:
+		std::vector<uint8_t> bytes;
+
+		size_t Position() const { return bytes.size(); }
+
+		void Emit8(uint8_t value) { bytes.push_back(value); }
+		void Emit16(uint16_t value) { Emit8(value & 0xFF); Emit8(value >> 8); }
+		void Emit32(uint32_t value) { Emit16(value & 0xFFFF); Emit16(value >> 16); }
+
+		// rel32 fields are patched once the target is known
+		void Patch(size_t field, size_t target)
+		{
+			uint32_t rel = (uint32_t)((int64_t)target - (int64_t)(field + 4));
+			for(int i = 0; i < 4; i++)
+				bytes[field + i] = (rel >> (i * 8)) & 0xFF;
+		}
+		void Bind(size_t field) { Patch(field, Position()); }
+
+		void MovRR8(int dst, int src) { Reg(BYTE, { 0x88 }, src, dst); }
+		void MovRM8(int dst, const Mem& m) { Memory(BYTE, { 0x8A }, dst, m); }
+		void MovMR8(const Mem& m, int src) { Memory(BYTE, { 0x88 }, src, m); }
+		void MovMI8(const Mem& m, uint8_t imm) { Memory(BYTE, { 0xC6 }, 0, m); Emit8(imm); }
+		void MovMR16(const Mem& m, int src) { Memory(WORD, { 0x89 }, src, m); }
+		void MovMI16(const Mem& m, uint16_t imm) { Memory(WORD, { 0xC7 }, 0, m); Emit16(imm); }
+		void MovRR32(int dst, int src) { Reg(DWORD, { 0x89 }, src, dst); }
+		void MovRR64(int dst, int src) { Reg(QWORD, { 0x89 }, src, dst); }
+		void MovRI32(int dst, uint32_t imm) { if(dst >= 8) Emit8(0x41); Emit8(0xB8 + (dst & 7)); Emit32(imm); }
+		void MovMI32(const Mem& m, uint32_t imm) { Memory(DWORD, { 0xC7 }, 0, m); Emit32(imm); }
+		void MovRM32(int dst, const Mem& m) { Memory(DWORD, { 0x8B }, dst, m); }
+		void MovRM64(int dst, const Mem& m) { Memory(QWORD, { 0x8B }, dst, m); }
+		void MovzxRR8(int dst, int src) { Reg(BYTE, { 0x0F, 0xB6 }, dst, src); }
+		void MovzxRM8(int dst, const Mem& m) { Memory(BYTE, { 0x0F, 0xB6 }, dst, m); }
+		void Lea64(int dst, const Mem& m) { Memory(QWORD, { 0x8D }, dst, m); }
+
+		void AluRR8(AluOp op, int dst, int src) { Reg(BYTE, { (uint8_t)(op * 8) }, src, dst); }
+		void AluRI8(AluOp op, int dst, uint8_t imm) { Reg(BYTE, { 0x80 }, op, dst); Emit8(imm); }
+		void AluRR16(AluOp op, int dst, int src) { Reg(WORD, { (uint8_t)(op * 8 + 1) }, src, dst); }
+		void AluRI16(AluOp op, int dst, uint16_t imm) { Reg(WORD, { 0x81 }, op, dst); Emit16(imm); }
+		void AluRR32(AluOp op, int dst, int src) { Reg(DWORD, { (uint8_t)(op * 8 + 1) }, src, dst); }
+		void AluRI32(AluOp op, int dst, uint32_t imm) { Reg(DWORD, { 0x81 }, op, dst); Emit32(imm); }
+		void AluRI64(AluOp op, int dst, uint32_t imm) { Reg(QWORD, { 0x81 }, op, dst); Emit32(imm); }
+		void TestRR8(int a, int b) { Reg(BYTE, { 0x84 }, b, a); }
+		void TestRR64(int a, int b) { Reg(QWORD, { 0x85 }, b, a); }
+		void TestRI8(int a, uint8_t imm) { Reg(BYTE, { 0xF6 }, 0, a); Emit8(imm); }
+
+		void Shift1R8(ShiftOp op, int dst) { Reg(BYTE, { 0xD0 }, op, dst); }
+		void ShiftRI8(ShiftOp op, int dst, uint8_t n) { Reg(BYTE, { 0xC0 }, op, dst); Emit8(n); }
+		void ShiftRI32(ShiftOp op, int dst, uint8_t n) { Reg(DWORD, { 0xC1 }, op, dst); Emit8(n); }
+		void IncR8(int dst) { Reg(BYTE, { 0xFE }, 0, dst); }
+		void DecR8(int dst) { Reg(BYTE, { 0xFE }, 1, dst); }
+		void IncR32(int dst) { Reg(DWORD, { 0xFF }, 0, dst); }
+		void BtRI32(int dst, uint8_t bit) { Reg(DWORD, { 0x0F, 0xBA }, 4, dst); Emit8(bit); }
+		void Setcc(Cond cc, int dst) { Reg(BYTE, { 0x0F, (uint8_t)(0x90 + cc) }, 0, dst); }
+		void Cmc() { Emit8(0xF5); }
+
+		void Push(int reg) { if(reg >= 8) Emit8(0x41); Emit8(0x50 + (reg & 7)); }
+		void Pop(int reg) { if(reg >= 8) Emit8(0x41); Emit8(0x58 + (reg & 7)); }
+		void Ret() { Emit8(0xC3); }
+		void CallM(const Mem& m) { Memory(DWORD, { 0xFF }, 2, m); }
+		void JmpR(int reg) { Reg(DWORD, { 0xFF }, 4, reg); }
+
+		size_t Jcc(Cond cc) { Emit8(0x0F); Emit8(0x80 + cc); Emit32(0); return Position() - 4; }
+		size_t Jmp() { Emit8(0xE9); Emit32(0); return Position() - 4; }
+
+	private:
+		// byte forms get a REX prefix whenever a register from 4 to 7 is
+		// involved, so they name spl..dil rather than ah..bh
+		void Prefix(Width width, int reg, int index, int base, bool byteReg, bool byteBase)
+		{
+			if(width == WORD)
+				Emit8(0x66);
+
+			uint8_t rex = 0x40;
+			if(width == QWORD) rex |= 0x08;
+			if(reg >= 8) rex |= 0x04;
+			if(index >= 8) rex |= 0x02;
+			if(base >= 8) rex |= 0x01;
+
+			bool byteRex = (byteReg && reg >= 4 && reg < 8) || (byteBase && base >= 4 && base < 8);
+			if(rex != 0x40 || byteRex)
+				Emit8(rex);
+		}
+
+		void Reg(Width width, std::initializer_list<uint8_t> opcode, int reg, int rm)
+		{
+			Prefix(width, reg, NO_REG, rm, width == BYTE, width == BYTE);
+			for(uint8_t byte : opcode)
+				Emit8(byte);
+			Emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+		}
+
+		void Memory(Width width, std::initializer_list<uint8_t> opcode, int reg, const Mem& m)
+		{
+			Prefix(width, reg, m.index, m.base, width == BYTE, false);
+			for(uint8_t byte : opcode)
+				Emit8(byte);
+
+			int base = m.base & 7;
+			bool sib = m.index != NO_REG || base == 4;
+			int mod = 2;
+			if(m.disp == 0 && base != 5)
+				mod = 0;
+			else if(m.disp >= -128 && m.disp <= 127)
+				mod = 1;
+
+			Emit8((mod << 6) | ((reg & 7) << 3) | (sib ? 4 : base));
+			if(sib)
+				Emit8(((m.index == NO_REG ? 4 : (m.index & 7)) << 3) | base);
+			if(mod == 1)
+				Emit8((uint8_t)m.disp);
+			else if(mod == 2)
+				Emit32((uint32_t)m.disp);
+		}
+	};
+
+	//------------------------------------------------------------------------
+	// 6502 side
+
+	enum Op
+	{
+		OP_ADC, OP_SBC, OP_AND, OP_ORA, OP_EOR, OP_CMP, OP_CPX, OP_CPY, OP_BIT,
+		OP_LDA, OP_LDX, OP_LDY, OP_STA, OP_STX, OP_STY,
+		OP_ASL, OP_LSR, OP_ROL, OP_ROR, OP_INC, OP_DEC,
+		OP_INX, OP_INY, OP_DEX, OP_DEY,
+		OP_TAX, OP_TAY, OP_TXA, OP_TYA, OP_TSX, OP_TXS,
+		OP_CLC, OP_SEC, OP_CLV, OP_CLD, OP_SEI, OP_NOP,
+		OP_PHA, OP_PHP, OP_PLA,
+		OP_BRANCH, OP_JMP, OP_JSR, OP_RTS,
+	};
+
+	enum Mode { IMP, ACC, IMM, ZER, ZEX, ZEY, ABS, ABX, ABY, IDX, IDY, REL };
+
+	struct OpcodeInfo
+	{
+		uint8_t opcode;
+		Op op;
+		Mode mode;
+	};
+
+	// everything the translator handles, the rest ends a block
+	const OpcodeInfo opcodeInfo[] =
+	{
+		{ 0x69, OP_ADC, IMM }, { 0x65, OP_ADC, ZER }, { 0x75, OP_ADC, ZEX }, { 0x6D, OP_ADC, ABS },
+		{ 0x7D, OP_ADC, ABX }, { 0x79, OP_ADC, ABY }, { 0x61, OP_ADC, IDX }, { 0x71, OP_ADC, IDY },
+		{ 0xE9, OP_SBC, IMM }, { 0xE5, OP_SBC, ZER }, { 0xF5, OP_SBC, ZEX }, { 0xED, OP_SBC, ABS },
+		{ 0xFD, OP_SBC, ABX }, { 0xF9, OP_SBC, ABY }, { 0xE1, OP_SBC, IDX }, { 0xF1, OP_SBC, IDY },
+		{ 0x29, OP_AND, IMM }, { 0x25, OP_AND, ZER }, { 0x35, OP_AND, ZEX }, { 0x2D, OP_AND, ABS },
+		{ 0x3D, OP_AND, ABX }, { 0x39, OP_AND, ABY }, { 0x21, OP_AND, IDX }, { 0x31, OP_AND, IDY },
+		{ 0x09, OP_ORA, IMM }, { 0x05, OP_ORA, ZER }, { 0x15, OP_ORA, ZEX }, { 0x0D, OP_ORA, ABS },
+		{ 0x1D, OP_ORA, ABX }, { 0x19, OP_ORA, ABY }, { 0x01, OP_ORA, IDX }, { 0x11, OP_ORA, IDY },
+		{ 0x49, OP_EOR, IMM }, { 0x45, OP_EOR, ZER }, { 0x55, OP_EOR, ZEX }, { 0x4D, OP_EOR, ABS },
+		{ 0x5D, OP_EOR, ABX }, { 0x59, OP_EOR, ABY }, { 0x41, OP_EOR, IDX }, { 0x51, OP_EOR, IDY },
+		{ 0xC9, OP_CMP, IMM }, { 0xC5, OP_CMP, ZER }, { 0xD5, OP_CMP, ZEX }, { 0xCD, OP_CMP, ABS },
+		{ 0xDD, OP_CMP, ABX }, { 0xD9, OP_CMP, ABY }, { 0xC1, OP_CMP, IDX }, { 0xD1, OP_CMP, IDY },
+		{ 0xE0, OP_CPX, IMM }, { 0xE4, OP_CPX, ZER }, { 0xEC, OP_CPX, ABS },
+		{ 0xC0, OP_CPY, IMM }, { 0xC4, OP_CPY, ZER }, { 0xCC, OP_CPY, ABS },
+		{ 0x24, OP_BIT, ZER }, { 0x2C, OP_BIT, ABS },
+		{ 0xA9, OP_LDA, IMM }, { 0xA5, OP_LDA, ZER }, { 0xB5, OP_LDA, ZEX }, { 0xAD, OP_LDA, ABS },
+		{ 0xBD, OP_LDA, ABX }, { 0xB9, OP_LDA, ABY }, { 0xA1, OP_LDA, IDX }, { 0xB1, OP_LDA, IDY },
+		{ 0xA2, OP_LDX, IMM }, { 0xA6, OP_LDX, ZER }, { 0xB6, OP_LDX, ZEY }, { 0xAE, OP_LDX, ABS },
+		{ 0xBE, OP_LDX, ABY },
+		{ 0xA0, OP_LDY, IMM }, { 0xA4, OP_LDY, ZER }, { 0xB4, OP_LDY, ZEX }, { 0xAC, OP_LDY, ABS },
+		{ 0xBC, OP_LDY, ABX },
+		{ 0x85, OP_STA, ZER }, { 0x95, OP_STA, ZEX }, { 0x8D, OP_STA, ABS }, { 0x9D, OP_STA, ABX },
+		{ 0x99, OP_STA, ABY }, { 0x81, OP_STA, IDX }, { 0x91, OP_STA, IDY },
+		{ 0x86, OP_STX, ZER }, { 0x96, OP_STX, ZEY }, { 0x8E, OP_STX, ABS },
+		{ 0x84, OP_STY, ZER }, { 0x94, OP_STY, ZEX }, { 0x8C, OP_STY, ABS },
+		{ 0x0A, OP_ASL, ACC }, { 0x06, OP_ASL, ZER }, { 0x16, OP_ASL, ZEX }, { 0x0E, OP_ASL, ABS }, { 0x1E, OP_ASL, ABX },
+		{ 0x4A, OP_LSR, ACC }, { 0x46, OP_LSR, ZER }, { 0x56, OP_LSR, ZEX }, { 0x4E, OP_LSR, ABS }, { 0x5E, OP_LSR, ABX },
+		{ 0x2A, OP_ROL, ACC }, { 0x26, OP_ROL, ZER }, { 0x36, OP_ROL, ZEX }, { 0x2E, OP_ROL, ABS }, { 0x3E, OP_ROL, ABX },
+		{ 0x6A, OP_ROR, ACC }, { 0x66, OP_ROR, ZER }, { 0x76, OP_ROR, ZEX }, { 0x6E, OP_ROR, ABS }, { 0x7E, OP_ROR, ABX },
+		{ 0xE6, OP_INC, ZER }, { 0xF6, OP_INC, ZEX }, { 0xEE, OP_INC, ABS }, { 0xFE, OP_INC, ABX },
+		{ 0xC6, OP_DEC, ZER }, { 0xD6, OP_DEC, ZEX }, { 0xCE, OP_DEC, ABS }, { 0xDE, OP_DEC, ABX },
+		{ 0xE8, OP_INX, IMP }, { 0xC8, OP_INY, IMP }, { 0xCA, OP_DEX, IMP }, { 0x88, OP_DEY, IMP },
+		{ 0xAA, OP_TAX, IMP }, { 0xA8, OP_TAY, IMP }, { 0x8A, OP_TXA, IMP }, { 0x98, OP_TYA, IMP },
+		{ 0xBA, OP_TSX, IMP }, { 0x9A, OP_TXS, IMP },
+		{ 0x18, OP_CLC, IMP }, { 0x38, OP_SEC, IMP }, { 0xB8, OP_CLV, IMP }, { 0xD8, OP_CLD, IMP },
+		{ 0x78, OP_SEI, IMP }, { 0xEA, OP_NOP, IMP },
+		{ 0x48, OP_PHA, IMP }, { 0x08, OP_PHP, IMP }, { 0x68, OP_PLA, IMP },
+		{ 0x10, OP_BRANCH, REL }, { 0x30, OP_BRANCH, REL }, { 0x50, OP_BRANCH, REL }, { 0x70, OP_BRANCH, REL },
+		{ 0x90, OP_BRANCH, REL }, { 0xB0, OP_BRANCH, REL }, { 0xD0, OP_BRANCH, REL }, { 0xF0, OP_BRANCH, REL },
+		{ 0x4C, OP_JMP, ABS }, { 0x20, OP_JSR, ABS }, { 0x60, OP_RTS, IMP },
+	};
+
+	const OpcodeInfo* FindOpcode(uint8_t opcode)
+	{
+		for(const OpcodeInfo& info : opcodeInfo)
+			if(info.opcode == opcode)
+				return &info;
+		return nullptr;
+	}
+
+	bool IsTerminator(Op op)
+	{
+		return op == OP_BRANCH || op == OP_JMP || op == OP_JSR || op == OP_RTS;
+	}
+
+	bool UsesStack(Op op)
+	{
+		return op == OP_PHA || op == OP_PHP || op == OP_PLA || op == OP_JSR || op == OP_RTS;
+	}
+
+	bool WritesOperand(Op op)
+	{
+		switch(op)
+		{
+			case OP_STA: case OP_STX: case OP_STY:
+			case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+			case OP_INC: case OP_DEC:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	struct Instr
+	{
+		uint16_t address;
+		uint8_t opcode;
+		Op op;
+		Mode mode;
+		uint8_t length;
+		uint8_t cycles;
+		uint16_t operand; // immediate, address or branch target
+		int32_t cyclesBefore; // cycles of the block before this one
+	};
+
+	// touches nothing but registers and flags besides reading memory, as
+	// ReadsOnly in mos6502_core.h has it for idle loops
+	bool ReadsOnly(const Instr& in)
+	{
+		if(in.mode == ACC)
+			return true;
+		return !WritesOperand(in.op) && !UsesStack(in.op) && !IsTerminator(in.op) && in.op != OP_SEI;
+	}
+
+	// where Frame fields sit, relative to rbx
+	struct FrameLayout
+	{
+		int32_t pc, A, X, Y, sp, status;
+		int32_t busAddress, busData, busRw;
+		int32_t ram, rom, io, bodies, ioWrite, ioContext;
+		int32_t cycles, loopBranch;
+	};
+
+	class Translator
+	{
+	public:
+		Translator(const mos6502_jit::MemoryMap& map, const FrameLayout& layout, uint16_t start) :
+			map(map),
+			layout(layout),
+			start(start)
+		{
+		}
+
+		// collects the instructions of the block, false if there are none
+		bool Scan();
+		void Emit();
+
+		uint16_t Size() const { return instrs.back().address + instrs.back().length - start; }
+		const std::vector<uint8_t>& MachineCode() const { return out.bytes; }
+		// where blocks jumping here enter, past the prologue
+		size_t BodyOffset() const { return loopLabel; }
+	private:
+		const mos6502_jit::MemoryMap& map;
+		const FrameLayout& layout;
+		uint16_t start;
+		std::vector<Instr> instrs;
+		Emitter out;
+
+		bool nzLazy; // N and Z still have to be derived from r13b
+		int32_t total; // cycles of one pass through the block
+		bool reportsLoop; // may stop after a pass, see Execute
+		size_t loopLabel;
+		std::vector<size_t> toExitAtStart;
+		std::vector<size_t> toEpilogue;
+
+		// the bus latch as a static access left it, stored only when
+		// something can see it before the next access replaces it
+		bool latchPending;
+		uint32_t pendingLatch;
+
+		struct SideExit
+		{
+			size_t field;
+			size_t instr;
+			bool after; // leaves behind instrs[instr] rather than in front
+			bool nzLazy;
+			bool latchPending;
+			uint32_t pendingLatch;
+		};
+		std::vector<SideExit> sideExits;
+
+		bool InROM(uint32_t address) const
+		{
+			return map.romBase <= address && address < map.romBase + map.romSize;
+		}
+		bool InIO(uint32_t address) const
+		{
+			return map.ioSize && map.ioBase <= address && address < map.ioBase + map.ioSize;
+		}
+		uint8_t ROMByte(uint16_t address) const { return map.rom[address - map.romBase]; }
+		bool Fits(const Instr& in) const;
+
+		Mem FrameField(int32_t offset) const { return At(RBX, offset); }
+		Mem StaticOperand(uint16_t address) const
+		{
+			return At(address < map.ramSize ? RSI : InIO(address) ? R15 : RDI, address);
+		}
+		Mem DynamicOperand(const Instr& in, size_t index, bool write);
+		void SideExitAt(size_t field, size_t index, bool after);
+		void SideExitIf(Cond cc, size_t index) { SideExitAt(out.Jcc(cc), index, false); }
+		void CheckRange(size_t index, bool write);
+		void IoWrite(size_t index, int valueReg);
+
+		void Materialize();
+		void SetNZ(int reg) { out.MovRR8(R13, reg); nzLazy = true; }
+		void MergeCarry(int reg) { out.AluRI8(ALU_AND, RDX, (uint8_t)~FLAG_C); out.AluRR8(ALU_OR, RDX, reg); }
+
+		void LatchStatic(uint16_t address, uint8_t data, bool write);
+		void FlushLatch();
+		void Latch(const Instr& in, int dataReg, bool write);
+		void LatchStack(int dataReg, bool write);
+
+		void Chain(const Mem& body);
+		void ExitTo(uint16_t target);
+		void EmitInstr(size_t index, bool last);
+		void EmitBranch(const Instr& in);
+	};
+
+	bool Translator::Fits(const Instr& in) const
+	{
+		if(UsesStack(in.op) && map.ramSize < 0x200)
+			return false;
+
+		switch(in.mode)
+		{
+			case ZEX: case ZEY: case IDX: case IDY:
+				return map.ramSize >= 0x100;
+			case ZER: case ABS:
+				if(in.op == OP_JMP || in.op == OP_JSR)
+					return true;
+				if(in.operand < map.ramSize || InIO(in.operand))
+					return true;
+				return !WritesOperand(in.op) && InROM(in.operand);
+			default:
+				return true;
+		}
+	}
+
+	bool Translator::Scan()
+	{
+		uint32_t address = start;
+		int32_t cycles = 0;
+
+		while(instrs.size() < MAX_BLOCK_INSTRS && InROM(address))
+		{
+			const OpcodeInfo* info = FindOpcode(ROMByte(address));
+			if(!info)
+				break;
+
+			Instr in;
+			in.address = address;
+			in.opcode = info->opcode;
+			in.op = info->op;
+			in.mode = info->mode;
+			in.length = mos6502_opcodes::Table[info->opcode].length;
+			in.cycles = mos6502::GetInstrCycles(info->opcode);
+			in.cyclesBefore = cycles;
+
+			if(!InROM(address + in.length - 1))
+				break;
+
+			if(in.length == 2)
+				in.operand = ROMByte(address + 1);
+			else if(in.length == 3)
+				in.operand = ROMByte(address + 1) | (ROMByte(address + 2) << 8);
+			else
+				in.operand = 0;
+
+			if(in.mode == REL)
+				in.operand = (uint16_t)(address + 2 + (int8_t)in.operand);
+
+			if(!Fits(in))
+				break;
+
+			instrs.push_back(in);
+			cycles += in.cycles;
+			address += in.length;
+
+			if(IsTerminator(in.op))
+				break;
+		}
+
+		total = cycles;
+		if(instrs.empty())
+			return false;
+
+		// a polling or delay loop the interpreter may skip passes of,
+		// short enough for ClassifyLoop in mos6502_core.h to take
+		const Instr& last = instrs.back();
+		reportsLoop = (last.op == OP_BRANCH || last.op == OP_JMP) && last.operand == start
+			&& instrs.size() <= MAX_IDLE_LOOP_INSTRS;
+		for(size_t i = 0; i + 1 < instrs.size() && reportsLoop; i++)
+			reportsLoop = ReadsOnly(instrs[i]);
+		return true;
+	}
+
+	void Translator::Materialize()
+	{
+		if(!nzLazy)
+			return;
+
+		out.AluRI8(ALU_AND, RDX, (uint8_t)~(FLAG_N | FLAG_Z));
+		out.MovRR8(RAX, R13);
+		out.AluRI8(ALU_AND, RAX, FLAG_N);
+		out.AluRR8(ALU_OR, RDX, RAX);
+		out.TestRR8(R13, R13);
+		out.Setcc(CC_Z, RAX);
+		out.AluRR8(ALU_ADD, RAX, RAX);
+		out.AluRR8(ALU_OR, RDX, RAX);
+		nzLazy = false;
+	}
+
+	// leaves the block in front of instrs[index], which the interpreter
+	// then runs and nothing of which has happened yet, or right behind it
+	void Translator::SideExitAt(size_t field, size_t index, bool after)
+	{
+		sideExits.push_back(SideExit{ field, index, after, nzLazy, latchPending, pendingLatch });
+	}
+
+	// eax holds the 6502 address. Reads may come from RAM, ROM or I/O and
+	// get r11 pointed at the host byte, writes only go to RAM.
+	void Translator::CheckRange(size_t index, bool write)
+	{
+		out.AluRI32(ALU_CMP, RAX, (uint32_t)map.ramSize);
+
+		if(write)
+		{
+			SideExitIf(CC_NC, index);
+			return;
+		}
+
+		size_t toRAM = out.Jcc(CC_C);
+		std::vector<size_t> toIO;
+		out.AluRI32(ALU_CMP, RAX, map.romBase);
+		toIO.push_back(out.Jcc(CC_C));
+		if(map.romBase + map.romSize < 0x10000)
+		{
+			out.AluRI32(ALU_CMP, RAX, (uint32_t)(map.romBase + map.romSize));
+			toIO.push_back(out.Jcc(CC_NC));
+		}
+		out.Lea64(R11, At(RDI, RAX, 0));
+		std::vector<size_t> toDone;
+		toDone.push_back(out.Jmp());
+
+		for(size_t field : toIO)
+			out.Bind(field);
+		if(map.ioSize)
+		{
+			out.MovRR32(R11, RAX);
+			out.AluRI32(ALU_SUB, R11, map.ioBase);
+			out.AluRI32(ALU_CMP, R11, (uint32_t)map.ioSize);
+			SideExitIf(CC_NC, index);
+			out.Lea64(R11, At(R15, RAX, 0));
+			toDone.push_back(out.Jmp());
+		}
+		else
+		{
+			SideExitAt(out.Jmp(), index, false);
+		}
+
+		out.Bind(toRAM);
+		out.Lea64(R11, At(RSI, RAX, 0));
+		for(size_t field : toDone)
+			out.Bind(field);
+	}
+
+	// computes the effective address of an indexed or indirect operand
+	// into eax and returns where its byte lives on the host
+	Mem Translator::DynamicOperand(const Instr& in, size_t index, bool write)
+	{
+		switch(in.mode)
+		{
+			case ZEX:
+			case ZEY:
+				out.MovzxRR8(RAX, in.mode == ZEX ? R9 : R10);
+				out.AluRI8(ALU_ADD, RAX, in.operand & 0xFF);
+				return At(RSI, RAX, 0);
+
+			case ABX:
+			case ABY:
+				out.MovzxRR8(RAX, in.mode == ABX ? R9 : R10);
+				out.AluRI16(ALU_ADD, RAX, in.operand);
+				break;
+
+			case IDX:
+				out.MovzxRR8(RAX, R9);
+				out.AluRI8(ALU_ADD, RAX, in.operand & 0xFF);
+				out.MovzxRM8(RCX, At(RSI, RAX, 0));
+				out.IncR8(RAX);
+				out.MovzxRM8(RAX, At(RSI, RAX, 0));
+				out.ShiftRI32(SH_SHL, RAX, 8);
+				out.AluRR32(ALU_OR, RAX, RCX);
+				break;
+
+			case IDY:
+				out.MovzxRM8(RCX, At(RSI, in.operand & 0xFF));
+				out.MovzxRM8(RAX, At(RSI, (in.operand + 1) & 0xFF));
+				out.ShiftRI32(SH_SHL, RAX, 8);
+				out.AluRR32(ALU_OR, RAX, RCX);
+				out.MovzxRR8(RCX, R10);
+				out.AluRR16(ALU_ADD, RAX, RCX);
+				break;
+
+			default:
+				break;
+		}
+
+		CheckRange(index, write);
+		return write ? At(RSI, RAX, 0) : At(R11);
+	}
+
+	// writes valueReg to the static I/O operand of instrs[index] through
+	// the bus, leaving the block behind it if an interrupt may be due
+	void Translator::IoWrite(size_t index, int valueReg)
+	{
+		static const int kept[] = { RDX, RSI, RDI, R8, R9, R10 };
+		const Instr& in = instrs[index];
+
+		for(int reg : kept)
+			out.Push(reg);
+
+		// eight registers saved by the prologue and six here leave the
+		// stack 8 bytes off the alignment calls need
+#if defined(_WIN32)
+		out.MovzxRR8(R8, valueReg);
+		out.MovRI32(RDX, in.operand);
+		out.MovRM64(RCX, FrameField(layout.ioContext));
+		out.AluRI64(ALU_SUB, RSP, 40);
+		out.CallM(FrameField(layout.ioWrite));
+		out.AluRI64(ALU_ADD, RSP, 40);
+#else
+		out.MovzxRR8(RDX, valueReg);
+		out.MovRI32(RSI, in.operand);
+		out.MovRM64(RDI, FrameField(layout.ioContext));
+		out.AluRI64(ALU_SUB, RSP, 8);
+		out.CallM(FrameField(layout.ioWrite));
+		out.AluRI64(ALU_ADD, RSP, 8);
+#endif
+
+		for(int i = sizeof(kept) / sizeof(kept[0]) - 1; i >= 0; i--)
+			out.Pop(kept[i]);
+
+		out.TestRR8(RAX, RAX);
+		SideExitAt(out.Jcc(CC_NZ), index, true);
+	}
+
+	void Translator::LatchStatic(uint16_t address, uint8_t data, bool write)
+	{
+		latchPending = true;
+		pendingLatch = address | (data << 16) | ((write ? 1u : 0u) << 24);
+	}
+
+	void Translator::FlushLatch()
+	{
+		if(!latchPending)
+			return;
+
+		out.MovMI32(FrameField(layout.busAddress), pendingLatch);
+		latchPending = false;
+	}
+
+	// the address is the static operand or sits in eax
+	void Translator::Latch(const Instr& in, int dataReg, bool write)
+	{
+		if(in.mode == ZER || in.mode == ABS)
+		{
+			out.MovMI32(FrameField(layout.busAddress), in.operand | ((write ? 1u : 0u) << 24));
+		}
+		else
+		{
+			out.MovMR16(FrameField(layout.busAddress), RAX);
+			out.MovMI8(FrameField(layout.busRw), write ? 1 : 0);
+		}
+		out.MovMR8(FrameField(layout.busData), dataReg);
+		latchPending = false;
+	}
+
+	// eax holds the stack pointer the access went through
+	void Translator::LatchStack(int dataReg, bool write)
+	{
+		out.AluRI32(ALU_ADD, RAX, 0x100);
+		out.MovMR16(FrameField(layout.busAddress), RAX);
+		out.MovMR8(FrameField(layout.busData), dataReg);
+		out.MovMI8(FrameField(layout.busRw), write ? 1 : 0);
+		latchPending = false;
+	}
+
+	// continues in the block whose entry in the bodies is at body, or
+	// falls through if it isn't translated yet
+	void Translator::Chain(const Mem& body)
+	{
+		out.MovRM64(RAX, body);
+		out.TestRR64(RAX, RAX);
+		size_t untranslated = out.Jcc(CC_Z);
+		out.JmpR(RAX);
+		out.Bind(untranslated);
+	}
+
+	// ends the pass, ebp already has the cycles of the block taken off
+	void Translator::ExitTo(uint16_t target)
+	{
+		Materialize();
+		FlushLatch();
+
+		if(target == start)
+		{
+			if(reportsLoop)
+			{
+				out.AluRI32(ALU_CMP, RBP, IDLE_LOOP_REPORT_PASSES * total);
+				out.Patch(out.Jcc(CC_LE), loopLabel);
+				out.MovMI32(FrameField(layout.loopBranch), instrs.back().address);
+				toExitAtStart.push_back(out.Jmp());
+			}
+			else
+			{
+				out.Patch(out.Jmp(), loopLabel);
+			}
+			return;
+		}
+
+		if(InROM(target))
+		{
+			Chain(At(R14, (target - map.romBase) * 8));
+		}
+		out.MovMI16(FrameField(layout.pc), target);
+		toEpilogue.push_back(out.Jmp());
+	}
+
+	void Translator::EmitBranch(const Instr& in)
+	{
+		uint8_t flag;
+		switch(in.opcode >> 6)
+		{
+			case 0: flag = FLAG_N; break;
+			case 1: flag = FLAG_V; break;
+			case 2: flag = FLAG_C; break;
+			default: flag = FLAG_Z; break;
+		}
+		bool onSet = (in.opcode & 0x20) != 0;
+
+		LatchStatic(in.address + 1, ROMByte(in.address + 1), false);
+		FlushLatch();
+		out.AluRI32(ALU_SUB, RBP, total);
+
+		Cond taken;
+		if(nzLazy && (flag == FLAG_N || flag == FLAG_Z))
+		{
+			out.TestRR8(R13, R13);
+			if(flag == FLAG_Z)
+				taken = onSet ? CC_Z : CC_NZ;
+			else
+				taken = onSet ? CC_S : CC_NS;
+		}
+		else
+		{
+			out.TestRI8(RDX, flag);
+			taken = onSet ? CC_NZ : CC_Z;
+		}
+
+		size_t toTaken = out.Jcc(taken);
+		bool lazy = nzLazy;
+		ExitTo(in.address + 2);
+		out.Bind(toTaken);
+		nzLazy = lazy;
+		ExitTo(in.operand);
+	}
+
+	void Translator::EmitInstr(size_t index, bool last)
+	{
+		const Instr& in = instrs[index];
+
+		switch(in.op)
+		{
+			case OP_ADC: case OP_SBC: case OP_AND: case OP_ORA: case OP_EOR:
+			case OP_CMP: case OP_CPX: case OP_CPY: case OP_BIT:
+			case OP_LDA: case OP_LDX: case OP_LDY:
+			{
+				// operand into cl
+				if(in.mode == IMM)
+					out.MovRI32(RCX, in.operand & 0xFF);
+				else if(in.mode == ZER || in.mode == ABS)
+					out.MovzxRM8(RCX, StaticOperand(in.operand));
+				else
+					out.MovzxRM8(RCX, DynamicOperand(in, index, false));
+
+				if(in.mode == IMM)
+					LatchStatic(in.address + 1, in.operand & 0xFF, false);
+				else
+					Latch(in, RCX, false);
+
+				switch(in.op)
+				{
+					case OP_ADC:
+					case OP_SBC:
+						out.BtRI32(RDX, 0);
+						if(in.op == OP_ADC)
+						{
+							out.AluRR8(ALU_ADC, R8, RCX);
+							out.Setcc(CC_C, RAX);
+						}
+						else
+						{
+							out.Cmc();
+							out.AluRR8(ALU_SBB, R8, RCX);
+							out.Setcc(CC_NC, RAX);
+						}
+						out.Setcc(CC_O, R11);
+						out.AluRI8(ALU_AND, RDX, (uint8_t)~(FLAG_C | FLAG_V));
+						out.AluRR8(ALU_OR, RDX, RAX);
+						out.ShiftRI8(SH_SHL, R11, 6);
+						out.AluRR8(ALU_OR, RDX, R11);
+						SetNZ(R8);
+						break;
+					case OP_AND: out.AluRR8(ALU_AND, R8, RCX); SetNZ(R8); break;
+					case OP_ORA: out.AluRR8(ALU_OR, R8, RCX); SetNZ(R8); break;
+					case OP_EOR: out.AluRR8(ALU_XOR, R8, RCX); SetNZ(R8); break;
+					case OP_CMP:
+					case OP_CPX:
+					case OP_CPY:
+						out.MovRR8(R13, in.op == OP_CMP ? R8 : in.op == OP_CPX ? R9 : R10);
+						out.AluRR8(ALU_SUB, R13, RCX);
+						out.Setcc(CC_NC, RAX);
+						MergeCarry(RAX);
+						nzLazy = true;
+						break;
+					case OP_BIT:
+						out.MovRR8(RAX, R8);
+						out.AluRR8(ALU_AND, RAX, RCX);
+						out.Setcc(CC_Z, RAX);
+						out.AluRR8(ALU_ADD, RAX, RAX);
+						out.AluRI8(ALU_AND, RDX, (uint8_t)~(FLAG_N | FLAG_V | FLAG_Z));
+						out.AluRR8(ALU_OR, RDX, RAX);
+						out.AluRI8(ALU_AND, RCX, FLAG_N | FLAG_V);
+						out.AluRR8(ALU_OR, RDX, RCX);
+						out.AluRI8(ALU_OR, RDX, 0x30);
+						nzLazy = false;
+						break;
+					case OP_LDA: out.MovRR8(R8, RCX); SetNZ(R8); break;
+					case OP_LDX: out.MovRR8(R9, RCX); SetNZ(R9); break;
+					case OP_LDY: out.MovRR8(R10, RCX); SetNZ(R10); break;
+					default: break;
+				}
+				break;
+			}
+
+			case OP_STA: case OP_STX: case OP_STY:
+			{
+				int reg = in.op == OP_STA ? R8 : in.op == OP_STX ? R9 : R10;
+				bool io = (in.mode == ZER || in.mode == ABS) && InIO(in.operand);
+				if(!io)
+				{
+					Mem m = (in.mode == ZER || in.mode == ABS) ? StaticOperand(in.operand) : DynamicOperand(in, index, true);
+					out.MovMR8(m, reg);
+				}
+				Latch(in, reg, true);
+				if(io)
+					IoWrite(index, reg);
+				break;
+			}
+
+			case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+			case OP_INC: case OP_DEC:
+			{
+				int reg = R8;
+				Mem m = At(RCX);
+				if(in.mode != ACC)
+				{
+					m = (in.mode == ZER || in.mode == ABS) ? StaticOperand(in.operand) : DynamicOperand(in, index, true);
+					out.MovzxRM8(RCX, m);
+					reg = RCX;
+				}
+
+				if(in.op == OP_INC || in.op == OP_DEC)
+				{
+					if(in.op == OP_INC)
+						out.IncR8(reg);
+					else
+						out.DecR8(reg);
+				}
+				else
+				{
+					if(in.op == OP_ROL || in.op == OP_ROR)
+						out.BtRI32(RDX, 0);
+					ShiftOp shift =
+						in.op == OP_ASL ? SH_SHL :
+						in.op == OP_LSR ? SH_SHR :
+						in.op == OP_ROL ? SH_RCL : SH_RCR;
+					out.Shift1R8(shift, reg);
+					out.Setcc(CC_C, R11);
+					MergeCarry(R11);
+				}
+
+				SetNZ(reg);
+				if(in.mode == ACC)
+				{
+					LatchStatic(in.address, in.opcode, false);
+				}
+				else if((in.mode == ZER || in.mode == ABS) && InIO(in.operand))
+				{
+					Latch(in, reg, true);
+					IoWrite(index, reg);
+				}
+				else
+				{
+					out.MovMR8(m, reg);
+					Latch(in, reg, true);
+				}
+				break;
+			}
+
+			case OP_INX: out.IncR8(R9); SetNZ(R9); break;
+			case OP_INY: out.IncR8(R10); SetNZ(R10); break;
+			case OP_DEX: out.DecR8(R9); SetNZ(R9); break;
+			case OP_DEY: out.DecR8(R10); SetNZ(R10); break;
+			case OP_TAX: out.MovRR8(R9, R8); SetNZ(R9); break;
+			case OP_TAY: out.MovRR8(R10, R8); SetNZ(R10); break;
+			case OP_TXA: out.MovRR8(R8, R9); SetNZ(R8); break;
+			case OP_TYA: out.MovRR8(R8, R10); SetNZ(R8); break;
+			case OP_TSX: out.MovRR8(R9, R12); SetNZ(R9); break;
+			case OP_TXS: out.MovRR8(R12, R9); break;
+			case OP_CLC: out.AluRI8(ALU_AND, RDX, (uint8_t)~FLAG_C); break;
+			case OP_SEC: out.AluRI8(ALU_OR, RDX, FLAG_C); break;
+			case OP_CLV: out.AluRI8(ALU_AND, RDX, (uint8_t)~FLAG_V); break;
+			case OP_CLD: out.AluRI8(ALU_AND, RDX, (uint8_t)~0x08); break;
+			case OP_SEI: out.AluRI8(ALU_OR, RDX, 0x04); break;
+			case OP_NOP: break;
+
+			case OP_PHA:
+			case OP_PHP:
+			{
+				int reg = R8;
+				if(in.op == OP_PHP)
+				{
+					Materialize();
+					out.MovRR32(RCX, RDX);
+					out.AluRI8(ALU_OR, RCX, 0x30);
+					reg = RCX;
+				}
+				out.MovzxRR8(RAX, R12);
+				out.MovMR8(At(RSI, RAX, 0x100), reg);
+				out.DecR8(R12);
+				LatchStack(reg, true);
+				break;
+			}
+
+			case OP_PLA:
+				out.IncR8(R12);
+				out.MovzxRR8(RAX, R12);
+				out.MovRM8(R8, At(RSI, RAX, 0x100));
+				SetNZ(R8);
+				LatchStack(R8, false);
+				break;
+
+			case OP_BRANCH:
+				EmitBranch(in);
+				return;
+
+			case OP_JMP:
+				LatchStatic(in.address + 2, ROMByte(in.address + 2), false);
+				out.AluRI32(ALU_SUB, RBP, total);
+				ExitTo(in.operand);
+				return;
+
+			case OP_JSR:
+			{
+				uint16_t ret = in.address + 2;
+				out.MovzxRR8(RAX, R12);
+				out.MovMI8(At(RSI, RAX, 0x100), ret >> 8);
+				out.DecR8(R12);
+				out.MovzxRR8(RAX, R12);
+				out.MovMI8(At(RSI, RAX, 0x100), ret & 0xFF);
+				out.DecR8(R12);
+				out.AluRI32(ALU_ADD, RAX, 0x100);
+				out.MovMR16(FrameField(layout.busAddress), RAX);
+				out.MovMI8(FrameField(layout.busData), ret & 0xFF);
+				out.MovMI8(FrameField(layout.busRw), 1);
+				latchPending = false;
+				out.AluRI32(ALU_SUB, RBP, total);
+				ExitTo(in.operand);
+				return;
+			}
+
+			case OP_RTS:
+				out.IncR8(R12);
+				out.MovzxRR8(RAX, R12);
+				out.MovzxRM8(RCX, At(RSI, RAX, 0x100));
+				out.IncR8(R12);
+				out.MovzxRR8(RAX, R12);
+				out.MovzxRM8(R11, At(RSI, RAX, 0x100));
+				LatchStack(R11, false);
+				out.ShiftRI32(SH_SHL, R11, 8);
+				out.AluRR32(ALU_OR, R11, RCX);
+				out.IncR32(R11);
+				out.AluRI32(ALU_SUB, RBP, total);
+				Materialize();
+				// back into the caller's block if it is in ROM
+				out.MovRR32(RCX, R11);
+				out.AluRI32(ALU_SUB, RCX, map.romBase);
+				out.AluRI32(ALU_AND, RCX, 0xFFFF);
+				out.AluRI32(ALU_CMP, RCX, (uint32_t)map.romSize);
+				{
+					size_t outside = out.Jcc(CC_NC);
+					out.ShiftRI32(SH_SHL, RCX, 3);
+					Chain(At(R14, RCX, 0));
+					out.Bind(outside);
+				}
+				out.MovMR16(FrameField(layout.pc), R11);
+				toEpilogue.push_back(out.Jmp());
+				return;
+		}
+
+		if(in.mode == IMP && !UsesStack(in.op))
+			LatchStatic(in.address, in.opcode, false);
+
+		if(last)
+		{
+			// ran into something that isn't translated
+			out.AluRI32(ALU_SUB, RBP, total);
+			ExitTo(in.address + in.length);
+		}
+	}
+
+	void Translator::Emit()
+	{
+		static const int saved[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+
+		for(int reg : saved)
+			out.Push(reg);
+
+#if defined(_WIN32)
+		out.MovRR64(RBX, RCX);
+		out.MovRR32(RBP, RDX);
+#else
+		out.MovRR64(RBX, RDI);
+		out.MovRR32(RBP, RSI);
+#endif
+		out.MovRM64(RSI, FrameField(layout.ram));
+		out.MovRM64(RDI, FrameField(layout.rom));
+		out.MovRM64(R14, FrameField(layout.bodies));
+		out.MovRM64(R15, FrameField(layout.io));
+		out.MovzxRM8(R8, FrameField(layout.A));
+		out.MovzxRM8(R9, FrameField(layout.X));
+		out.MovzxRM8(R10, FrameField(layout.Y));
+		out.MovzxRM8(R12, FrameField(layout.sp));
+		out.MovzxRM8(RDX, FrameField(layout.status));
+
+		// every instruction starts with cycles left, as in the interpreter
+		loopLabel = out.Position();
+		out.AluRI32(ALU_CMP, RBP, 0);
+		toExitAtStart.push_back(out.Jcc(CC_LE));
+
+		nzLazy = false;
+		latchPending = false;
+		for(size_t i = 0; i < instrs.size(); i++)
+		{
+			if(i > 0)
+			{
+				out.AluRI32(ALU_CMP, RBP, instrs[i].cyclesBefore);
+				SideExitIf(CC_LE, i);
+			}
+			EmitInstr(i, i + 1 == instrs.size());
+		}
+
+		for(const SideExit& exit : sideExits)
+		{
+			const Instr& in = instrs[exit.instr];
+			out.Bind(exit.field);
+			nzLazy = exit.nzLazy;
+			Materialize();
+			latchPending = exit.latchPending;
+			pendingLatch = exit.pendingLatch;
+			FlushLatch();
+
+			int32_t cycles = in.cyclesBefore + (exit.after ? in.cycles : 0);
+			if(cycles)
+				out.AluRI32(ALU_SUB, RBP, cycles);
+			out.MovMI16(FrameField(layout.pc), in.address + (exit.after ? in.length : 0));
+			toEpilogue.push_back(out.Jmp());
+		}
+
+		for(size_t field : toExitAtStart)
+			out.Bind(field);
+		out.MovMI16(FrameField(layout.pc), start);
+
+		for(size_t field : toEpilogue)
+			out.Bind(field);
+		out.MovMR8(FrameField(layout.A), R8);
+		out.MovMR8(FrameField(layout.X), R9);
+		out.MovMR8(FrameField(layout.Y), R10);
+		out.MovMR8(FrameField(layout.sp), R12);
+		out.MovMR8(FrameField(layout.status), RDX);
+		out.MovRM32(RAX, FrameField(layout.cycles));
+		out.AluRR32(ALU_SUB, RAX, RBP);
+
+		for(int i = sizeof(saved) / sizeof(saved[0]) - 1; i >= 0; i--)
+			out.Pop(saved[i]);
+		out.Ret();
+	}
+}
+
+#endif
+
+mos6502_jit::mos6502_jit(const MemoryMap& map) :
+	map(map),
+	code(nullptr),
+	codeCapacity(0),
+	codeUsed(0)
+{
+	memset(&frame, 0, sizeof(frame));
+	frame.ram = map.ram;
+	frame.rom = reinterpret_cast<uintptr_t>(map.rom) - map.romBase;
+	frame.io = reinterpret_cast<uintptr_t>(map.io) - map.ioBase;
+	frame.ioWrite = map.ioWrite;
+	frame.ioContext = map.ioContext;
+	blocks.resize(map.romSize);
+	bodies.resize(map.romSize);
+	frame.bodies = bodies.data();
+	Flush();
+}
+
+mos6502_jit::~mos6502_jit()
+{
+#if defined(MOS6502_JIT_X64)
+	if(code)
+	{
+#if defined(_WIN32)
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, codeCapacity);
+#endif
+	}
+#endif
+}
+
+bool mos6502_jit::IsSupported()
+{
+#if defined(MOS6502_JIT_X64)
+	return true;
+#else
+	return false;
+#endif
+}
+
+int32_t mos6502_jit::Execute(State& state, int32_t cycles, int32_t& loopBranch)
+{
+	int32_t executed = 0;
+	frame.state = state;
+	frame.loopBranch = -1;
+
+	while(executed < cycles && frame.loopBranch < 0)
+	{
+		BlockEntry entry = Lookup(frame.state.pc);
+		if(!entry)
+			break;
+
+		frame.cycles = cycles - executed;
+		int32_t ran = entry(&frame, frame.cycles);
+		if(ran == 0)
+			break;
+		executed += ran;
+	}
+	loopBranch = frame.loopBranch;
+
+	if(executed > 0)
+	{
+		state = frame.state;
+		*map.busAddress = frame.busAddress;
+		*map.busData = frame.busData;
+		*map.busRw = frame.busRw != 0;
+	}
+
+	return executed;
+}
+
+void mos6502_jit::Invalidate(uint16_t address, size_t size)
+{
+	// a block reaching into the range starts at most MAX_BLOCK_BYTES before it
+	size_t end = address + size;
+	size_t first = address > map.romBase + MAX_BLOCK_BYTES ? address - MAX_BLOCK_BYTES : map.romBase;
+
+	for(size_t pc = first; pc < end; pc++)
+	{
+		if(pc < map.romBase || pc - map.romBase >= blocks.size())
+			continue;
+
+		Block& block = blocks[pc - map.romBase];
+		if(block.translated && pc + block.size > address)
+		{
+			block = Block{ nullptr, 0, false };
+			bodies[pc - map.romBase] = nullptr;
+		}
+	}
+}
+
+void mos6502_jit::Flush()
+{
+	for(Block& block : blocks)
+		block = Block{ nullptr, 0, false };
+	for(const uint8_t*& body : bodies)
+		body = nullptr;
+	codeUsed = 0;
+}
+
+mos6502_jit::BlockEntry mos6502_jit::Lookup(uint16_t pc)
+{
+	if(pc < map.romBase || (size_t)(pc - map.romBase) >= blocks.size())
+		return nullptr;
+
+	Block& block = blocks[pc - map.romBase];
+	if(!block.translated)
+		Translate(pc, block);
+	return block.entry;
+}
+
+void mos6502_jit::Translate(uint16_t pc, Block& block)
+{
+	// a failed attempt depends on the opcode and its operand
+	block = Block{ nullptr, 3, true };
+
+#if defined(MOS6502_JIT_X64)
+	FrameLayout layout;
+	layout.pc = offsetof(Frame, state) + offsetof(State, pc);
+	layout.A = offsetof(Frame, state) + offsetof(State, A);
+	layout.X = offsetof(Frame, state) + offsetof(State, X);
+	layout.Y = offsetof(Frame, state) + offsetof(State, Y);
+	layout.sp = offsetof(Frame, state) + offsetof(State, sp);
+	layout.status = offsetof(Frame, state) + offsetof(State, status);
+	layout.busAddress = offsetof(Frame, busAddress);
+	layout.busData = offsetof(Frame, busData);
+	layout.busRw = offsetof(Frame, busRw);
+	layout.ram = offsetof(Frame, ram);
+	layout.rom = offsetof(Frame, rom);
+	layout.io = offsetof(Frame, io);
+	layout.bodies = offsetof(Frame, bodies);
+	layout.ioWrite = offsetof(Frame, ioWrite);
+	layout.ioContext = offsetof(Frame, ioContext);
+	layout.cycles = offsetof(Frame, cycles);
+	layout.loopBranch = offsetof(Frame, loopBranch);
+
+	// the latch is stored as one dword
+	static_assert(offsetof(Frame, busData) == offsetof(Frame, busAddress) + 2
+		&& offsetof(Frame, busRw) == offsetof(Frame, busAddress) + 3, "bus latch fields must be packed");
+
+	Translator translator(map, layout, pc);
+	if(!translator.Scan())
+		return;
+	translator.Emit();
+
+	uint8_t* entry = Install(translator.MachineCode());
+	if(!entry)
+	{
+		// out of room, start over with an empty arena
+		Flush();
+		entry = Install(translator.MachineCode());
+	}
+
+	block = Block{ reinterpret_cast<BlockEntry>(entry), translator.Size(), true };
+	bodies[pc - map.romBase] = entry ? entry + translator.BodyOffset() : nullptr;
+#endif
+}
+
+uint8_t* mos6502_jit::Install(const std::vector<uint8_t>& machineCode)
+{
+#if defined(MOS6502_JIT_X64)
+	if(!code)
+	{
+#if defined(_WIN32)
+		code = static_cast<uint8_t*>(VirtualAlloc(nullptr, CODE_CAPACITY, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+		void* memory = mmap(nullptr, CODE_CAPACITY, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		code = memory == MAP_FAILED ? nullptr : static_cast<uint8_t*>(memory);
+#endif
+		if(!code)
+			return nullptr;
+		codeCapacity = CODE_CAPACITY;
+	}
+
+	if(codeCapacity - codeUsed < machineCode.size())
+		return nullptr;
+
+	// the arena is only ever writable or executable, never both
+	uint8_t* entry = code + codeUsed;
+#if defined(_WIN32)
+	DWORD oldProtect;
+	VirtualProtect(code, codeCapacity, PAGE_READWRITE, &oldProtect);
+	memcpy(entry, machineCode.data(), machineCode.size());
+	VirtualProtect(code, codeCapacity, PAGE_EXECUTE_READ, &oldProtect);
+	FlushInstructionCache(GetCurrentProcess(), entry, machineCode.size());
+#else
+	if(mprotect(code, codeCapacity, PROT_READ | PROT_WRITE) != 0)
+		return nullptr;
+	memcpy(entry, machineCode.data(), machineCode.size());
+	if(mprotect(code, codeCapacity, PROT_READ | PROT_EXEC) != 0)
+		return nullptr;
+#endif
+
+	// keep blocks 16-byte aligned
+	codeUsed += (machineCode.size() + 15) & ~(size_t)15;
+	return entry;
+#else
+	return nullptr;
+#endif
+}
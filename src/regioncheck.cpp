@@ -0,0 +1,345 @@
+// RegionFile check. Nodes running the programs of BenchPrograms.hpp, some
+// sharing an image, are stored in a region file, which is closed,
+// reopened and loaded back into fresh nodes that must match the stored
+// ones. Freed slots must be handed out again and an image must leave the
+// file once no slot uses it. Last, copies of the file with a corrupt
+// header field, slot ROM index or free list link must be refused by
+// open(). Exits non-zero if any check fails.
+
+#include "BenchPrograms.hpp"
+#include "RegionFile.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        uint64_t ticks = 500;
+        const char* path = "regioncheck.region";
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+    };
+
+    // where RegionFile::Header, Slot and RomEntry keep their fields
+    constexpr size_t HEADER_MAGIC = 0;
+    constexpr size_t HEADER_SLOT_SIZE = 8;
+    constexpr size_t HEADER_NUM_SLOTS = 16;
+    constexpr size_t HEADER_NUM_USED = 20;
+    constexpr size_t HEADER_FIRST_FREE_SLOT = 24;
+    constexpr size_t HEADER_FIRST_FREE_ROM = 28;
+    constexpr size_t HEADER_SLOTS_OFFSET = 32;
+    constexpr size_t HEADER_ROMS_OFFSET = 40;
+    constexpr size_t HEADER_FILE_SIZE = 56;
+    constexpr size_t SLOT_ROM = 0;
+    constexpr size_t SLOT_NEXT_FREE = 4;
+    constexpr size_t ROM_ENTRY_SIZE = 16;
+    constexpr size_t ROM_ENTRY_REF_COUNT = 8;
+    constexpr size_t ROM_ENTRY_NEXT_FREE = 12;
+
+    // more slots than programs, so the first few images are shared
+    constexpr uint32_t NUM_SLOTS = 12;
+
+    bool same(const CodeNodeNano::Snapshot& a, const CodeNodeNano::Snapshot& b)
+    {
+        return memcmp(&a, &b, sizeof(CodeNodeNano::Snapshot)) == 0;
+    }
+
+    bool readFile(const char* path, std::vector<uint8_t>& bytes)
+    {
+        FILE* file = fopen(path, "rb");
+        if(!file)
+            return false;
+
+        fseek(file, 0, SEEK_END);
+        bytes.resize(static_cast<size_t>(ftell(file)));
+        fseek(file, 0, SEEK_SET);
+        bool complete = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        fclose(file);
+        return complete;
+    }
+
+    bool writeFile(const char* path, const std::vector<uint8_t>& bytes)
+    {
+        FILE* file = fopen(path, "wb");
+        if(!file)
+            return false;
+
+        bool complete = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        fclose(file);
+        return complete;
+    }
+
+    template <class T>
+    T get(const std::vector<uint8_t>& bytes, size_t offset)
+    {
+        T value;
+        memcpy(&value, bytes.data() + offset, sizeof(T));
+        return value;
+    }
+
+    template <class T>
+    void put(std::vector<uint8_t>& bytes, size_t offset, T value)
+    {
+        memcpy(bytes.data() + offset, &value, sizeof(T));
+    }
+
+    std::unique_ptr<CodeNodeNano> runNode(const BenchProgram& program, uint64_t ticks)
+    {
+        std::unique_ptr<CodeNodeNano> node(new CodeNodeNano());
+        node->ROM().load(program.rom.data(), program.rom.size());
+        node->powerOn();
+
+        for(uint64_t tick = 0; tick < ticks; tick++)
+        {
+            driveBenchInputs(*node, tick);
+            node->tick();
+        }
+        return node;
+    }
+
+    // Stores, reopens and loads a node per slot, then frees and refills
+    // slots. Leaves slots 2 and 10 free and the file closed.
+    bool checkStoreAndLoad(const Options& options, const std::vector<BenchProgram>& programs)
+    {
+        RegionFile region;
+        std::vector<CodeNodeNano::Snapshot> stored(NUM_SLOTS);
+
+        if(!region.create(options.path, NUM_SLOTS))
+        {
+            printf("create: %s\n", region.error().c_str());
+            return false;
+        }
+
+        for(uint32_t i = 0; i < NUM_SLOTS; i++)
+        {
+            std::unique_ptr<CodeNodeNano> node = runNode(programs[i % programs.size()], options.ticks + i);
+            node->saveSnapshot(stored[i]);
+
+            uint32_t slot = region.store(*node);
+            if(slot != i)
+            {
+                printf("node %u went to slot %u of an empty region\n", i, slot);
+                return false;
+            }
+        }
+
+        if(region.store(*runNode(programs[0], 0)) != RegionFile::NO_SLOT)
+        {
+            printf("stored a node in a full region\n");
+            return false;
+        }
+
+        if(region.numRoms() != programs.size() || !region.flush())
+        {
+            printf("%u images stored for %zu programs\n", region.numRoms(), programs.size());
+            return false;
+        }
+
+        region.close();
+        if(!region.open(options.path))
+        {
+            printf("reopen: %s\n", region.error().c_str());
+            return false;
+        }
+
+        for(uint32_t slot = 0; slot < NUM_SLOTS; slot++)
+        {
+            const BenchProgram& program = programs[slot % programs.size()];
+            std::unique_ptr<CodeNodeNano> node(new CodeNodeNano());
+            std::unique_ptr<CodeNodeNano::Snapshot> loaded(new CodeNodeNano::Snapshot());
+
+            if(!region.snapshot(slot) || !same(*region.snapshot(slot), stored[slot]) ||
+                !region.load(slot, *node))
+            {
+                printf("slot %u: stored snapshot lost on reopen\n", slot);
+                return false;
+            }
+
+            node->saveSnapshot(*loaded);
+            if(!same(*loaded, stored[slot]) ||
+                memcmp(std::as_const(*node).ROM().data(), program.rom.data(), program.rom.size()) != 0)
+            {
+                printf("slot %u: loaded node differs from the stored one\n", slot);
+                return false;
+            }
+        }
+
+        // slot 5 holds the only node running its program
+        region.release(5);
+        if(region.numRoms() != programs.size() - 1 || region.numUsed() != NUM_SLOTS - 1)
+        {
+            printf("image still stored after its last slot was freed\n");
+            return false;
+        }
+
+        // slot 0 shares its image with slot 9
+        region.release(0);
+        if(region.numRoms() != programs.size() - 1)
+        {
+            printf("image dropped while another slot uses it\n");
+            return false;
+        }
+
+        uint32_t first = region.store(*runNode(programs[5], options.ticks));
+        uint32_t second = region.store(*runNode(programs[1], options.ticks));
+        if(first != 0 || second != 5 || region.numUsed() != NUM_SLOTS || region.numRoms() != programs.size())
+        {
+            printf("freed slots not reused: stored to %u and %u\n", first, second);
+            return false;
+        }
+
+        region.release(2);
+        region.release(10);
+        region.close();
+
+        if(!region.open(options.path) || region.numUsed() != NUM_SLOTS - 2)
+        {
+            printf("reopen after reuse: %s\n", region.error().c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Copies of the file left by checkStoreAndLoad with one field broken
+    bool checkCorruption(const Options& options)
+    {
+        std::vector<uint8_t> original;
+        if(!readFile(options.path, original))
+        {
+            printf("failed to read %s\n", options.path);
+            return false;
+        }
+
+        const uint32_t slotSize = get<uint32_t>(original, HEADER_SLOT_SIZE);
+        const uint64_t slotsOffset = get<uint64_t>(original, HEADER_SLOTS_OFFSET);
+        const uint64_t romsOffset = get<uint64_t>(original, HEADER_ROMS_OFFSET);
+        auto slot = [&](uint32_t index, size_t field) { return slotsOffset + index * slotSize + field; };
+        auto rom = [&](uint32_t index, size_t field) { return romsOffset + index * ROM_ENTRY_SIZE + field; };
+
+        // slot 10 heads the free list and links to 2, which ends it
+        const uint32_t usedRom = get<uint32_t>(original, slot(1, SLOT_ROM));
+        const uint32_t otherRom = get<uint32_t>(original, slot(3, SLOT_ROM));
+        const uint32_t freeRom = get<uint32_t>(original, HEADER_FIRST_FREE_ROM);
+
+        struct Corruption
+        {
+            const char* what;
+            size_t offset;
+            uint64_t value;
+            size_t size;
+        };
+        const Corruption corruptions[] = {
+            { "header magic", HEADER_MAGIC, 0, 4 },
+            { "header slot count", HEADER_NUM_SLOTS, NUM_SLOTS + 1, 4 },
+            { "header used count", HEADER_NUM_USED, NUM_SLOTS - 1, 4 },
+            { "header free slot", HEADER_FIRST_FREE_SLOT, NUM_SLOTS, 4 },
+            { "header free image", HEADER_FIRST_FREE_ROM, usedRom, 4 },
+            { "header file size", HEADER_FILE_SIZE, original.size() + 1, 8 },
+            { "slot image past the table", slot(1, SLOT_ROM), NUM_SLOTS, 4 },
+            { "slot image of another program", slot(1, SLOT_ROM), otherRom, 4 },
+            { "slot image that is free", slot(1, SLOT_ROM), freeRom, 4 },
+            { "image on a free slot", slot(2, SLOT_ROM), usedRom, 4 },
+            { "image reference count", rom(usedRom, ROM_ENTRY_REF_COUNT), 0, 4 },
+            { "free slot link past the table", slot(10, SLOT_NEXT_FREE), NUM_SLOTS, 4 },
+            { "free slot link to a used slot", slot(10, SLOT_NEXT_FREE), 1, 4 },
+            { "free slot link to itself", slot(10, SLOT_NEXT_FREE), 10, 4 },
+            { "free slot list cut short", slot(10, SLOT_NEXT_FREE), RegionFile::NO_SLOT, 4 },
+            { "free image link to a used image", rom(freeRom, ROM_ENTRY_NEXT_FREE), usedRom, 4 },
+            { "free image link to itself", rom(freeRom, ROM_ENTRY_NEXT_FREE), freeRom, 4 },
+        };
+
+        RegionFile region;
+        bool passed = true;
+        for(const Corruption& corruption : corruptions)
+        {
+            std::vector<uint8_t> bytes = original;
+            if(corruption.size == 8)
+                put<uint64_t>(bytes, corruption.offset, corruption.value);
+            else
+                put<uint32_t>(bytes, corruption.offset, static_cast<uint32_t>(corruption.value));
+
+            if(!writeFile(options.path, bytes))
+            {
+                printf("failed to write %s\n", options.path);
+                return false;
+            }
+            if(region.open(options.path))
+            {
+                printf("opened a file with a corrupt %s\n", corruption.what);
+                region.close();
+                passed = false;
+            }
+        }
+
+        // and the untouched file still opens
+        if(!writeFile(options.path, original) || !region.open(options.path))
+        {
+            printf("intact copy refused: %s\n", region.error().c_str());
+            return false;
+        }
+        return passed;
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -t, --ticks N        game ticks per node before storing it (default 500)\n"
+            "  -f, --file FILE      region file to use (default regioncheck.region,\n"
+            "                       overwritten and removed)\n"
+            "  -e, --examples DIR   where the example programs are (default %s)\n"
+            "  -h, --help           show this help\n",
+            program, CNMCU_EXAMPLES_DIR);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-t" || arg == "--ticks") && hasValue)
+            options.ticks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-f" || arg == "--file") && hasValue)
+            options.path = argv[++i];
+        else if((arg == "-e" || arg == "--examples") && hasValue)
+            options.examplesDir = argv[++i];
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<BenchProgram> programs;
+    if(!loadBenchPrograms(options.examplesDir, programs))
+        return 2;
+    // the slots sharing and owning images below depend on it
+    if(programs.size() != NUM_SLOTS - 3)
+    {
+        fprintf(stderr, "expected %u programs\n", NUM_SLOTS - 3);
+        return 2;
+    }
+
+    bool passed = checkStoreAndLoad(options, programs) && checkCorruption(options);
+    remove(options.path);
+
+    printf("%zu programs in %u slots: %s\n", programs.size(), NUM_SLOTS, passed ? "ok" : "failed");
+    return passed ? 0 : 1;
+}
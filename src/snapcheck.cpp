@@ -0,0 +1,298 @@
+// Save and restore check. Every program of BenchPrograms.hpp, plus a few
+// 65C02 programs that park the CPU in WAI or STP or leave an NMI pending,
+// runs on a node that is saved partway, restored into a fresh node with
+// the same ROM and ticked on next to the original, with and without the
+// JIT. Their snapshots are compared after every tick. Snapshots with the
+// wrong magic or version must be refused without touching the node.
+// Exits non-zero if any check fails.
+
+#include "BenchPrograms.hpp"
+#include "MiniAssembler.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        uint64_t ticks = 2000;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+    };
+
+    // A program and the state it has to be saved in
+    struct Case
+    {
+        const BenchProgram* program;
+        bool cmos;
+        bool raiseNmi;
+        uint8_t stateFlags; // mos6502::STATE_* the CPU must have when saved
+    };
+
+    // sleeps in WAI, woken by changes on the east and west pins or an NMI
+    const char* const waitProgram = R"(
+  .org $E000
+start:
+  lda #%0101
+  sta $7040
+  lda #$50
+  sta $7048
+  sta $7049
+  cli
+loop:
+  wai
+  inc $00
+  jmp loop
+irq:
+  pha
+  lda #%1010
+  sta $7068
+  inc $01
+  pla
+  rti
+nmi:
+  inc $02
+  rti
+  .org $FFFA
+  .word nmi
+  .word start
+  .word irq
+)";
+
+    // stops for good after a store
+    const char* const stopProgram = R"(
+  .org $E000
+start:
+  lda #$42
+  sta $00
+  stp
+  jmp start
+irq:
+  rti
+  .org $FFFA
+  .word irq
+  .word start
+  .word irq
+)";
+
+    bool assemble(const char* name, const char* source, BenchProgram& program)
+    {
+        MiniAssembler assembler(0x10000 - CodeNodeNano::ROM_SIZE, CodeNodeNano::ROM_SIZE);
+
+        if(!assembler.assemble(source))
+        {
+            fprintf(stderr, "Failed to assemble %s: %s\n", name, assembler.error().c_str());
+            return false;
+        }
+
+        program = { name, assembler.image() };
+        return true;
+    }
+
+    std::unique_ptr<CodeNodeNano> makeNode(const BenchProgram& program, bool jit, bool cmos)
+    {
+        std::unique_ptr<CodeNodeNano> node(new CodeNodeNano());
+        node->ROM().load(program.rom.data(), program.rom.size());
+        node->setJitEnabled(jit);
+        node->CPU().SetInstructionSet(cmos ? mos6502::CMOS_65C02 : mos6502::NMOS_6502);
+        return node;
+    }
+
+    bool same(const CodeNodeNano::Snapshot& a, const CodeNodeNano::Snapshot& b)
+    {
+        return memcmp(&a, &b, sizeof(CodeNodeNano::Snapshot)) == 0;
+    }
+
+    // Runs the case to about ticks / 2, saves it, restores it into a
+    // fresh node and ticks both to ticks. True if they stayed in step.
+    bool checkResume(const Case& test, bool jit, uint64_t ticks)
+    {
+        const char* mode = jit ? "jit" : "interpreter";
+        std::unique_ptr<CodeNodeNano> original = makeNode(*test.program, jit, test.cmos);
+        std::unique_ptr<CodeNodeNano::Snapshot> saved(new CodeNodeNano::Snapshot());
+        std::unique_ptr<CodeNodeNano::Snapshot> restored(new CodeNodeNano::Snapshot());
+        original->powerOn();
+
+        // keep going until the CPU is where the case wants it
+        uint64_t tick = 0;
+        for(;; tick++)
+        {
+            if(tick >= ticks)
+            {
+                printf("%s, %s: never reached state %02X\n", test.program->name.c_str(), mode, test.stateFlags);
+                return false;
+            }
+
+            driveBenchInputs(*original, tick);
+            original->tick();
+
+            if(tick < ticks / 2)
+                continue;
+            if(test.raiseNmi)
+                original->CPU().SetNMILine(true);
+            original->saveSnapshot(*saved);
+            if((saved->cpu.flags & test.stateFlags) == test.stateFlags)
+                break;
+            if(test.raiseNmi)
+                original->CPU().SetNMILine(false);
+        }
+
+        // NMOS on purpose, the snapshot has to bring the instruction set
+        std::unique_ptr<CodeNodeNano> resumed = makeNode(*test.program, jit, false);
+        if(!resumed->loadSnapshot(*saved))
+        {
+            printf("%s, %s: snapshot refused\n", test.program->name.c_str(), mode);
+            return false;
+        }
+
+        resumed->saveSnapshot(*restored);
+        if(!same(*saved, *restored))
+        {
+            printf("%s, %s: restored node differs from the saved one\n", test.program->name.c_str(), mode);
+            return false;
+        }
+
+        for(tick++; tick < ticks; tick++)
+        {
+            driveBenchInputs(*original, tick);
+            driveBenchInputs(*resumed, tick);
+            original->tick();
+            resumed->tick();
+            original->saveSnapshot(*saved);
+            resumed->saveSnapshot(*restored);
+
+            if(!same(*saved, *restored))
+            {
+                printf("%s, %s: diverged at tick %llu: pc %04X vs %04X, %llu vs %llu cycles\n",
+                    test.program->name.c_str(), mode, static_cast<unsigned long long>(tick),
+                    saved->cpu.pc, restored->cpu.pc,
+                    static_cast<unsigned long long>(saved->cyclesCounter),
+                    static_cast<unsigned long long>(restored->cyclesCounter));
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Snapshots with a wrong magic or version must be refused and leave
+    // the node as it was
+    bool checkRejected(const BenchProgram& program, uint64_t ticks)
+    {
+        std::unique_ptr<CodeNodeNano> node = makeNode(program, false, false);
+        std::unique_ptr<CodeNodeNano::Snapshot> before(new CodeNodeNano::Snapshot());
+        std::unique_ptr<CodeNodeNano::Snapshot> bad(new CodeNodeNano::Snapshot());
+        std::unique_ptr<CodeNodeNano::Snapshot> after(new CodeNodeNano::Snapshot());
+        node->powerOn();
+
+        // a snapshot of a different moment, so loading it would show
+        for(uint64_t tick = 0; tick < ticks; tick++)
+        {
+            driveBenchInputs(*node, tick);
+            node->tick();
+            if(tick == ticks / 2)
+                node->saveSnapshot(*bad);
+        }
+        node->saveSnapshot(*before);
+
+        for(int field = 0; field < 2; field++)
+        {
+            CodeNodeNano::Snapshot* corrupt = bad.get();
+            if(field == 0)
+                corrupt->magic ^= 1;
+            else
+            {
+                corrupt->magic = CodeNodeNano::SNAPSHOT_MAGIC;
+                corrupt->version++;
+            }
+
+            if(node->loadSnapshot(*corrupt))
+            {
+                printf("%s: snapshot with a wrong %s accepted\n", program.name.c_str(), field == 0 ? "magic" : "version");
+                return false;
+            }
+
+            node->saveSnapshot(*after);
+            if(!same(*before, *after))
+            {
+                printf("%s: refused snapshot with a wrong %s changed the node\n", program.name.c_str(), field == 0 ? "magic" : "version");
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -t, --ticks N        game ticks per program (default 2000)\n"
+            "  -e, --examples DIR   where the example programs are (default %s)\n"
+            "  -h, --help           show this help\n",
+            program, CNMCU_EXAMPLES_DIR);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-t" || arg == "--ticks") && hasValue)
+            options.ticks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-e" || arg == "--examples") && hasValue)
+            options.examplesDir = argv[++i];
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<BenchProgram> programs;
+    BenchProgram wait, stop;
+    if(!loadBenchPrograms(options.examplesDir, programs) ||
+        !assemble("wai", waitProgram, wait) ||
+        !assemble("stp", stopProgram, stop))
+        return 2;
+
+    std::vector<Case> cases;
+    for(const BenchProgram& program : programs)
+        cases.push_back({ &program, false, false, 0 });
+    cases.push_back({ &wait, true, false, mos6502::STATE_WAITING });
+    cases.push_back({ &stop, true, false, mos6502::STATE_STOPPED });
+    cases.push_back({ &wait, true, true, mos6502::STATE_WAITING | mos6502::STATE_NMI_PENDING });
+
+    size_t runs = 0;
+    size_t failed = 0;
+    for(const Case& test : cases)
+    {
+        for(int jit = 0; jit < (mos6502_jit::IsSupported() ? 2 : 1); jit++)
+        {
+            failed += !checkResume(test, jit != 0, options.ticks);
+            runs++;
+        }
+    }
+
+    failed += !checkRejected(programs.front(), options.ticks);
+    runs++;
+
+    printf("%zu programs, %llu ticks each: %zu of %zu checks failed\n",
+        cases.size(), static_cast<unsigned long long>(options.ticks), failed, runs);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+// Concurrency check for the emulator core. Runs N nodes on N threads at
+// once, each built, loaded and ticked on its own thread, and compares the
+// snapshot every node ends with against the same nodes ticked one after
+// another on the main thread. Nodes cycle through the BenchPrograms.hpp
+// firmware and every other one runs with the JIT on, so shared ROM images,
+// their decoding and the CPU tables are all used from many threads.
+// Exits non-zero if any node diverges.
+
+#include "BenchPrograms.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        size_t instances = 0; // one per hardware thread, 8 at least
+        uint64_t ticks = 1000;
+        const char* examplesDir = CNMCU_EXAMPLES_DIR;
+    };
+
+    void runNode(const BenchProgram& program, bool jit, uint64_t ticks, CodeNodeNano::Snapshot& result)
+    {
+        std::unique_ptr<CodeNodeNano> node(new CodeNodeNano());
+
+        node->ROM().load(program.rom.data(), program.rom.size());
+        node->setJitEnabled(jit);
+        node->powerOn();
+
+        for(uint64_t tick = 0; tick < ticks; tick++)
+        {
+            driveBenchInputs(*node, tick);
+            node->tick();
+        }
+
+        node->saveSnapshot(result);
+    }
+
+    void printUsage(const char* program)
+    {
+        printf(
+            "usage: %s [options]\n"
+            "  -n, --instances N    nodes, each on its own thread (default: hardware threads, 8 at least)\n"
+            "  -t, --ticks N        game ticks per node (default 1000)\n"
+            "  -e, --examples DIR   where the example programs are (default %s)\n"
+            "  -h, --help           show this help\n",
+            program, CNMCU_EXAMPLES_DIR);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if((arg == "-n" || arg == "--instances") && hasValue)
+            options.instances = static_cast<size_t>(strtoull(argv[++i], nullptr, 10));
+        else if((arg == "-t" || arg == "--ticks") && hasValue)
+            options.ticks = strtoull(argv[++i], nullptr, 10);
+        else if((arg == "-e" || arg == "--examples") && hasValue)
+            options.examplesDir = argv[++i];
+        else if(arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "unknown or incomplete option: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(options.instances == 0)
+    {
+        options.instances = std::thread::hardware_concurrency();
+        if(options.instances < 8)
+            options.instances = 8;
+    }
+
+    std::vector<BenchProgram> programs;
+    if(!loadBenchPrograms(options.examplesDir, programs))
+        return 2;
+
+    auto programOf = [&](size_t i) -> const BenchProgram& { return programs[i % programs.size()]; };
+    auto jitOf = [](size_t i) { return i % 2 == 1; };
+
+    std::vector<CodeNodeNano::Snapshot> serial(options.instances);
+    for(size_t i = 0; i < options.instances; i++)
+        runNode(programOf(i), jitOf(i), options.ticks, serial[i]);
+
+    // the threads wait for each other, so they build their nodes and start
+    // ticking at the same time
+    std::vector<CodeNodeNano::Snapshot> threaded(options.instances);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> ready(0);
+
+    for(size_t i = 0; i < options.instances; i++)
+    {
+        threads.emplace_back([&, i]() {
+            ready++;
+            while(ready.load() < options.instances)
+                std::this_thread::yield();
+            runNode(programOf(i), jitOf(i), options.ticks, threaded[i]);
+        });
+    }
+    for(std::thread& thread : threads)
+        thread.join();
+
+    size_t diverged = 0;
+    for(size_t i = 0; i < options.instances; i++)
+    {
+        if(memcmp(&serial[i], &threaded[i], sizeof(CodeNodeNano::Snapshot)) == 0)
+            continue;
+
+        diverged++;
+        printf("node %zu (%s%s) diverged: pc %04X vs %04X, %llu vs %llu cycles\n",
+            i, programOf(i).name.c_str(), jitOf(i) ? ", jit" : "",
+            serial[i].cpu.pc, threaded[i].cpu.pc,
+            static_cast<unsigned long long>(serial[i].cyclesCounter),
+            static_cast<unsigned long long>(threaded[i].cyclesCounter));
+    }
+
+    printf("%zu nodes on %zu threads, %llu ticks: %zu diverged from the serial run\n",
+        options.instances, options.instances, static_cast<unsigned long long>(options.ticks), diverged);
+    return diverged == 0 ? 0 : 1;
+}